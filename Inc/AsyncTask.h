@@ -0,0 +1,94 @@
+// Copyright (c) 2010-2018 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef ASYNCTASK_H
+#define ASYNCTASK_H
+
+#include <atomic>
+#include <functional>
+
+#include <glib.h>
+
+#include "Singleton.h"
+
+struct LSMessage;
+
+/**
+ * Runs blocking work (file copies, directory scans, spawned helpers, nyx
+ * calls) on a small pool of worker threads so that it doesn't hold up the
+ * main loop and with it every other client of the service.
+ *
+ * The work function runs on a worker thread and must not touch LS2 or any
+ * state owned by the main loop. The completion function runs afterwards on
+ * the main loop context and is where replies are sent and shared state is
+ * updated. If a message is given, it is referenced for the whole lifetime
+ * of the task so it can still be replied to from the completion.
+ */
+class AsyncTaskPool : public Singleton<AsyncTaskPool>
+{
+	friend class Singleton<AsyncTaskPool>;
+
+public:
+	typedef std::function<void()> Work;
+	typedef std::function<void()> Completion;
+
+	~AsyncTaskPool();
+
+	/**
+	 * Queue work on the pool.
+	 *
+	 * Returns false (and runs nothing) if the task can't be queued; callers
+	 * then usually fall back to doing the work synchronously.
+	 */
+	bool run(Work work, Completion done = Completion(), LSMessage* message = nullptr);
+
+	/**
+	 * Same as run() but falls back to running work and completion inline
+	 * if the pool is unavailable. Convenient for bus callbacks that just
+	 * want to offload their blocking part.
+	 */
+	void offload(LSMessage* message, Work work, Completion done);
+
+	/**
+	 * Run fn on the main loop context. Safe to call from worker threads,
+	 * e.g. to report progress of a running task.
+	 */
+	void post(Completion fn);
+
+	unsigned int pendingTasks() const { return m_pending; }
+	unsigned int workerThreads() const { return m_maxThreads; }
+
+private:
+	AsyncTaskPool();
+
+	struct Task;
+
+	static void workerFunc(gpointer data, gpointer userData);
+	static gboolean completeTask(gpointer data);
+	static gboolean runPosted(gpointer data);
+	static void freePosted(gpointer data);
+	static void releaseTask(Task* task);
+
+	void queue(GSourceFunc fn, gpointer data, GDestroyNotify destroy);
+
+private:
+	GThreadPool* m_pool;
+	GMainContext* m_context;
+	unsigned int m_maxThreads;
+	std::atomic<unsigned int> m_pending;
+};
+
+#endif // ASYNCTASK_H
@@ -23,16 +23,19 @@
 
 #include <map>
 #include <string>
+#include <glib.h>
 #include <pbnjson.hpp>
 #include "SignalSlot.h"
 
 struct LSHandle;
 struct LSMessage;
+class TimePrefsHandler;
 
 class ClockHandler : public Trackable
 {
 public:
 	ClockHandler();
+	~ClockHandler();
 
 	/**
 	 * Register/attach this handler to service
@@ -42,6 +45,12 @@ public:
 	 */
 	bool setServiceHandle(LSHandle* serviceHandle);
 
+	/**
+	 * Bind clocks to the time preferences: system time changes, manual
+	 * mode and the configured time sources (with their priorities)
+	 */
+	void attachTimePrefs(TimePrefsHandler* timePrefs);
+
 	/**
 	 * Notify about system-time moving forward/backward.
 	 *
@@ -161,6 +170,10 @@ private:
 	};
 
 	typedef std::map<std::string, ClockHandler::Clock> ClocksMap;
+
+	// changed on the main loop only, under m_mutex as getTime is served
+	// from the time thread (see TimeThread)
+	GMutex m_mutex;
 	ClocksMap m_clocks;
 	bool m_manualOverride;
 };
@@ -17,7 +17,9 @@
 #ifndef ERASE_HANDLER_H
 #define ERASE_HANDLER_H
 
+#include <glib.h>
 #include <nyx/nyx_client.h>
+#include <nyx/client/nyx_system.h>
 #include <luna-service2/lunaservice.h>
 
 #include "Singleton.h"
@@ -40,14 +42,39 @@ public:
     bool    init();
     void    setServiceHandle(LSHandle* serviceHandle);
     bool    Erase(LSHandle* pHandle, LSMessage* pMessage, EraseType_t type);
+    bool    Cancel(LSHandle* pHandle, LSMessage* pMessage);
 
     ~EraseHandler();
 
 private:
     EraseHandler();
 
+    // an erase request goes kPending (cancellable, waiting for its delay)
+    // -> kErasing (nyx call running on the worker pool) -> back to kIdle
+    typedef enum EraseState
+    {
+         kIdle
+        ,kPending
+        ,kErasing
+    } EraseState_t;
+
+    void    commit();
+    void    finish(const char* errorText);
+    void    replyStatus(const char* status);
+
+    static gboolean cbCommit(gpointer data);
+    static gboolean cbHeartbeat(gpointer data);
+
     static LSMethod    s_EraseServerMethods[];
     nyx_device_handle_t nyxSystem;
+
+    EraseState_t            m_state;
+    nyx_system_erase_type_t m_nyxType;
+    LSHandle*               m_handle;
+    LSMessage*              m_message;
+    bool                    m_subscribed;
+    guint                   m_timer;
+    gint64                  m_started;
 };
 
 
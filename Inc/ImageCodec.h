@@ -0,0 +1,85 @@
+// Copyright (c) 2010-2018 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef IMAGECODEC_H
+#define IMAGECODEC_H
+
+#include <cstddef>
+#include <string>
+
+/**
+ * Header-level details of an image file.
+ */
+struct ImageInfo
+{
+	int width = 0;
+	int height = 0;
+	int bpp = 0;
+	std::string format;     ///< e.g. "png", "jpeg"
+};
+
+/**
+ * Image operations of the service.
+ *
+ * Implemented by the image module (sysservice-image.so), which is the only
+ * part of the service that links QtGui. The service itself never sees a
+ * Qt image type; it gets at an instance through ImageModule, which loads
+ * the module on first use. Every call works on files and reports problems
+ * through errorText.
+ */
+class ImageCodec
+{
+public:
+	virtual ~ImageCodec() {}
+
+	/// Reads the image header only.
+	virtual bool info(const std::string& path, ImageInfo& info, std::string& errorText) = 0;
+
+	/// Stretches the image to exactly width x height.
+	virtual bool resize(const std::string& src, const std::string& dest, const char* format,
+	                    int width, int height, std::string& errorText) = 0;
+
+	/// Re-encodes the image in another format.
+	virtual bool convert(const std::string& src, const std::string& dest, const char* format,
+	                     std::string& errorText) = 0;
+
+	/**
+	 * Scales the image by scale. With clip, the result is then cut (or matted
+	 * black) to width x height so that the point (focusX, focusY), given as
+	 * fractions of the scaled image, ends up in its center.
+	 */
+	virtual bool scaleAndClip(const std::string& src, const std::string& dest, const char* format,
+	                          double scale, bool clip, double focusX, double focusY,
+	                          int width, int height, std::string& errorText) = 0;
+
+	/**
+	 * Draws the image scaled by scale onto a width x height canvas, moving
+	 * the point (focusX, focusY), given as fractions of the source size,
+	 * towards the middle of the canvas. Backs com.webos.service.image/convert.
+	 */
+	virtual bool focusScale(const std::string& src, const std::string& dest, const char* format,
+	                        double focusX, double focusY, double scale,
+	                        int width, int height, std::string& errorText) = 0;
+
+	/// Largest amount of pixel memory one operation held at a time, in bytes.
+	virtual size_t peakBufferBytes() const = 0;
+};
+
+/// Entry point exported by the image module.
+typedef ImageCodec* (*CreateImageCodecFunc)();
+#define IMAGE_CODEC_ENTRY "createImageCodec"
+
+#endif // IMAGECODEC_H
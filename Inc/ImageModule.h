@@ -0,0 +1,100 @@
+// Copyright (c) 2010-2018 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef IMAGEMODULE_H
+#define IMAGEMODULE_H
+
+#include <string>
+
+#include <glib.h>
+
+#include "ImageCodec.h"
+#include "Singleton.h"
+
+/**
+ * Loads the image module (and with it QtGui) on the first image or
+ * wallpaper request and unloads it again once it has been idle for
+ * Settings::m_imageModuleIdleUnload seconds.
+ *
+ * Only to be used from the main loop.
+ */
+class ImageModule : public Singleton<ImageModule>
+{
+	friend class Singleton<ImageModule>;
+
+public:
+	/**
+	 * Scoped access to the codec. The module stays loaded while a Ref is
+	 * alive; test it before use, the module may be missing.
+	 */
+	class Ref
+	{
+	public:
+		Ref() : m_codec(ImageModule::instance()->acquire()) {}
+		~Ref() { if (m_codec) ImageModule::instance()->release(); }
+
+		Ref(const Ref&) = delete;
+		Ref& operator=(const Ref&) = delete;
+
+		explicit operator bool() const { return m_codec != nullptr; }
+		ImageCodec* operator->() const { return m_codec; }
+
+	private:
+		ImageCodec* m_codec;
+	};
+
+	~ImageModule();
+
+	bool isLoaded() const { return m_codec != nullptr; }
+	unsigned int loadCount() const { return m_loadCount; }
+
+	/// peak pixel memory of a single operation since startup, across reloads
+	size_t peakBufferBytes() const;
+
+	/// unloads the module right away unless a request is using it
+	void trim();
+
+	/// error text for requests that found the module unavailable
+	static const char* unavailableError() { return "image support is not available"; }
+
+	/**
+	 * Recognizes the common image formats by their file signature without
+	 * loading the module. Meant for startup checks that only need to know
+	 * whether a file still looks like an image. Safe on any thread.
+	 */
+	static bool sniffFormat(const std::string& path, std::string* format = nullptr);
+
+private:
+	ImageModule();
+
+	ImageCodec* acquire();
+	void release();
+
+	bool load();
+	void unload();
+	static gboolean cbIdleUnload(gpointer userData);
+
+private:
+	void* m_handle;
+	ImageCodec* m_codec;
+	unsigned int m_users;
+	guint m_idleTimer;
+	bool m_loadFailed;
+	unsigned int m_loadCount;
+	size_t m_peakBufferBytes;
+};
+
+#endif // IMAGEMODULE_H
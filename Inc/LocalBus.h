@@ -0,0 +1,64 @@
+// Copyright (c) 2010-2018 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef LOCALBUS_H
+#define LOCALBUS_H
+
+#include <stdint.h>
+#include <functional>
+#include <string>
+
+/**
+ * In-process stand-in for the LS2 hub. LocalBus.cpp implements the LS2
+ * calls the service makes and is linked instead of libluna-service2 by
+ * sysservice-loadreplay.
+ *
+ * Categories registered on a handle are called on the main loop, the way
+ * the hub delivers messages. Replies (including later subscription updates)
+ * go to the caller's callback. Calls the service makes to itself are routed
+ * back to it; calls to other services are counted and never answered.
+ */
+namespace LocalBus {
+
+typedef std::function<void(const char* payload)> ReplyFunc;
+
+struct Counters {
+	uint64_t dispatched;
+	uint64_t replies;           //including subscription updates
+	uint64_t subscriptions;
+	uint64_t outgoingCalls;     //to other services, left unanswered
+};
+
+//the service the calls of call() go to
+extern const char* s_serviceName;
+
+/**
+ * Queue a call of method ("/category/method", or "/method" for the root
+ * category) on the main loop. Returns false if no such method is registered.
+ */
+bool call(const std::string& method, const std::string& payload,
+          const std::string& sender, ReplyFunc onReply);
+
+bool hasMethod(const std::string& method);
+
+const Counters& counters();
+
+//drop all subscriptions, and with them the callbacks of their callers
+void dropSubscriptions();
+
+}
+
+#endif // LOCALBUS_H
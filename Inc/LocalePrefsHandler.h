@@ -18,6 +18,9 @@
 #ifndef LOCALEPREFSHANDLER_H
 #define LOCALEPREFSHANDLER_H
 
+#include <unordered_map>
+#include <unordered_set>
+
 #include <pbnjson.hpp>
 
 #include "PrefsHandler.h"
@@ -33,6 +36,9 @@ public:
 	virtual bool validate(const std::string& key, const pbnjson::JValue &value);
 	virtual void valueChanged(const std::string& key, const pbnjson::JValue &value);
 	virtual pbnjson::JValue valuesForKey(const std::string& key);
+	virtual const std::string* valuesReplyForKey(const std::string& key);
+	virtual size_t memoryUsed() const;
+	virtual void releaseCaches();
 	
 	std::string currentLocale() const;
 	std::string currentRegion() const;
@@ -49,29 +55,22 @@ private:
 	bool validateRegion(const pbnjson::JValue &value);
 	void valueChangedLocale(const pbnjson::JValue &value);
 	void valueChangedRegion(const pbnjson::JValue &value);
-	pbnjson::JValue valuesForLocale();
-	pbnjson::JValue valuesForRegion();
 		
 private:
 
-	typedef std::pair<std::string, std::string> NameCodePair;
-	typedef std::string						NameCodeTriplet[3];
-	typedef std::list<NameCodePair> NameCodePairList;
+	typedef std::unordered_set<std::string> CodeSet;
 
-	struct LocaleEntry {
-		NameCodePair language;
-		NameCodePairList countries;
-	};
+	// language code -> country codes listed for it
+	std::unordered_map<std::string, CodeSet> m_localeIndex;
+	CodeSet m_regionIndex;
 
-	struct RegionEntry {
-		NameCodeTriplet region;
-	};
-	
-	typedef std::list<LocaleEntry> LocaleEntryList;
-	typedef std::list<RegionEntry> RegionEntryList;
-	
-	LocaleEntryList m_localeEntryList;
-	RegionEntryList m_regionEntryList;
+	// the catalog never changes at runtime, so the getPreferenceValues
+	// values and replies are built once when the files are read. The
+	// values DOMs can be released and are then reparsed from the replies
+	pbnjson::JValue m_localeValues;
+	pbnjson::JValue m_regionValues;
+	std::string m_localeReply;
+	std::string m_regionReply;
 	std::string m_languageCode;
 	std::string m_countryCode;
 	std::string m_regionCode;
@@ -0,0 +1,135 @@
+// Copyright (c) 2010-2018 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef LOGPREFSSTORE_H
+#define LOGPREFSSTORE_H
+
+#include <deque>
+#include <set>
+#include <unordered_map>
+#include <vector>
+
+#include "PrefsStore.h"
+
+/**
+ * Append-only preferences store: every put and journal entry is a
+ * checksummed record appended to an mmap'd file, and an in-memory hash
+ * index points at the latest value of each key. Reads copy straight out of
+ * the mapping, writes touch only the tail pages of the file. An ordered set
+ * over the index keys serves prefix reads.
+ *
+ * Records of a batch (begin/commit) only count once their commit record is
+ * in the file; a torn or uncommitted tail is dropped when the log is
+ * loaded, a damaged record further up is skipped together with its batch.
+ * Once more than half of the log is overwritten values the live records
+ * are rewritten to a new file that replaces the old one.
+ */
+class LogPrefsStore : public PrefsStore
+{
+public:
+	LogPrefsStore();
+	~LogPrefsStore();
+
+	const char* name() const override { return "log"; }
+
+	OpenResult open(const std::string& path) override;
+	void close() override;
+
+	bool get(const std::string& key, std::string& r_value) override;
+	bool put(const std::string& key, const std::string& value,
+	         uint64_t modified, const std::string& origin) override;
+	bool getAll(std::map<std::string, std::string>& r_prefs) override;
+	bool getRange(const std::string& prefix, std::map<std::string, std::string>& r_prefs) override;
+
+	bool begin() override;
+	bool commit() override;
+	void rollback() override;
+
+	bool openJournal(uint64_t& r_lastSeq) override;
+	bool appendJournal(const PrefsJournalEntry& entry) override;
+	void trimJournal(uint64_t seq) override;
+	bool readJournal(uint64_t seq, std::list<PrefsJournalEntry>& r_entries,
+	                 uint64_t& r_firstSeq) override;
+
+	void memoryStats(int& r_cacheUsed, int& r_schemaUsed, int& r_stmtUsed) const override;
+	void releaseMemory() override;
+
+	//size of the log and the part of it still in use, in bytes
+	size_t logBytes() const { return m_tail; }
+	size_t liveBytes() const { return m_liveBytes; }
+
+private:
+	struct Slot {
+		size_t offset;			//record start
+		size_t valueOffset;
+		uint32_t valueLen;
+		uint32_t recordSize;
+	};
+
+	struct KeyLess {
+		bool operator()(const std::string* a, const std::string* b) const { return *a < *b; }
+	};
+
+	struct JournalSlot {
+		PrefsJournalEntry entry;
+		uint32_t recordSize;
+	};
+
+	//what to put back if an open batch is rolled back
+	struct Undo {
+		bool journal;			//else a put of key
+		bool hadSlot;
+		std::string key;
+		Slot slot;
+	};
+
+	bool mapFile(size_t size);
+	void unmapFile();
+	bool reserve(size_t size);
+	bool sync(size_t from, size_t to);
+
+	bool load(bool& r_damaged);
+	size_t appendRecord(uint8_t type, const std::string& key, const std::string& value,
+	                    const std::string& origin, uint64_t seq, int64_t time);
+	void applyPut(const std::string& key, size_t offset, size_t keyLen, size_t valueLen, size_t recordSize);
+	void applyJournal(const PrefsJournalEntry& entry, size_t recordSize);
+	void applyTrim(uint64_t seq);
+	void undoBatch();
+
+	void maybeCompact();
+	bool compact();
+
+private:
+	std::string m_path;
+	int m_fd;
+	unsigned char* m_map;
+	size_t m_mapSize;
+	size_t m_tail;				//end of the last valid record
+	size_t m_liveBytes;			//records the index or journal still refer to
+	uint64_t m_maxSeq;
+
+	bool m_inBatch;
+	size_t m_batchStart;
+	uint64_t m_pendingTrim;		//trims are written after the commit record
+	std::vector<Undo> m_batchUndo;
+
+	std::unordered_map<std::string, Slot> m_index;
+	//the keys of m_index in order; map nodes do not move, so pointing at them is safe
+	std::set<const std::string*, KeyLess> m_orderedKeys;
+	std::deque<JournalSlot> m_journal;
+};
+
+#endif // LOGPREFSSTORE_H
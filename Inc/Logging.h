@@ -27,8 +27,41 @@ PmLogContext& sysServiceLogContext();
 void setLogLevel(const std::string& loglstr);
 
 void logInfo(const char* file, int line, const char* func, const char *fmt, ...);
+void logFormatted(PmLogLevel level, const char* file, int line, const char* func, const char *fmt, ...)
+	__attribute__((format(printf, 5, 6)));
 void outputQtMessages(QtMsgType type, const QMessageLogContext &context, const QString &msg);
 
+/**
+ * Returns the part of a path after the last '/'. Evaluated at compile time
+ * when used with __FILE__ (see SSLOG), so no basename work is done per call.
+ */
+constexpr const char* logFileBaseName(const char* path, const char* last)
+{
+	return *path == '\0' ? last : logFileBaseName(path + 1, *path == '/' ? path + 1 : last);
+}
+
 #define __qMessage(fmt, ...)  do { logInfo(__FILE__, __LINE__, __func__, fmt, __VA_ARGS__); } while(0)
 
+/*
+ * printf-style logging that checks the context level before doing any work.
+ * Disabled statements cost a level compare; enabled ones format into stack
+ * buffers (see logFormatted) instead of going through QString.
+ */
+#define SSLOG(level, fmt, ...) \
+	do { \
+		if (PmLogIsEnabled(sysServiceLogContext(), level)) { \
+			static constexpr const char* _sslogFile = logFileBaseName(__FILE__, __FILE__); \
+			logFormatted(level, _sslogFile, __LINE__, __func__, fmt, ##__VA_ARGS__); \
+		} \
+	} while (0)
+
+#ifndef NO_LOGGING
+#define SSLOG_DEBUG(fmt, ...)    SSLOG(kPmLogLevel_Debug, fmt, ##__VA_ARGS__)
+#else
+#define SSLOG_DEBUG(fmt, ...)    do {} while (0)
+#endif
+#define SSLOG_INFO(fmt, ...)     SSLOG(kPmLogLevel_Info, fmt, ##__VA_ARGS__)
+#define SSLOG_WARNING(fmt, ...)  SSLOG(kPmLogLevel_Warning, fmt, ##__VA_ARGS__)
+#define SSLOG_ERROR(fmt, ...)    SSLOG(kPmLogLevel_Error, fmt, ##__VA_ARGS__)
+
 #endif /* LOGGING_H */
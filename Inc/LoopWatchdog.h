@@ -0,0 +1,112 @@
+// Copyright (c) 2010-2018 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef LOOPWATCHDOG_H
+#define LOOPWATCHDOG_H
+
+#include <stdint.h>
+#include <string>
+
+#include <glib.h>
+
+#include <pbnjson.hpp>
+
+#include "Singleton.h"
+
+struct LSHandle;
+struct LSMessage;
+
+/**
+ * Watches the main loop, and the time loop when the service handle is
+ * dispatched from TimeThread, from a thread of its own. Every
+ * Settings::m_loopWatchdogInterval ms it posts a heartbeat to each watched
+ * context at the priority bus messages are dispatched with; the time the
+ * heartbeat waits is the loop lag, kept in a histogram. A heartbeat
+ * waiting longer than Settings::m_loopStallThreshold ms is logged as a
+ * stall together with the bus method the loop is stuck in.
+ */
+class LoopWatchdog : public Singleton<LoopWatchdog>
+{
+	friend class Singleton<LoopWatchdog>;
+
+public:
+	~LoopWatchdog();
+
+	// the time loop, before start(); it must not stop running before we are deleted
+	void watchTimeLoop(GMainContext* context);
+	void start();
+
+	static bool cbGetLoopLag(LSHandle* lsHandle, LSMessage *message, void *user_data);
+
+private:
+	static const unsigned int s_bucketCount = 13;
+
+	enum LoopId { LoopMain, LoopTime, LoopCount };
+
+	// state of one watched loop, guarded by m_mutex
+	struct Loop {
+		Loop();
+
+		GMainContext* context;      //null if not watched
+		const char* stallMsgId;
+		const char* stallEndedMsgId;
+		GSource* heartbeat;         //pending heartbeat
+		gint64 posted;
+		bool stallReported;
+		std::string stallMethod;
+
+		// stall records, written by the watchdog thread
+		uint64_t stalls;
+		gint64 lastStallAt;
+		gint64 lastStallLag;
+		std::string lastStallMethod;
+
+		// lag histogram, written by the loop's own thread
+		uint64_t buckets[s_bucketCount];
+		uint64_t samples;
+		gint64 lagSum;
+		gint64 lagMax;
+	};
+
+	// what a heartbeat source calls back with
+	struct Beat {
+		LoopWatchdog* watchdog;
+		LoopId loop;
+	};
+
+	LoopWatchdog();
+
+	static gpointer threadFunc(gpointer data);
+	static gboolean cbHeartbeat(gpointer data);
+
+	void post(LoopId id, gint64 now);
+	void checkStall(LoopId id, gint64 now);
+	static void addSample(Loop& loop, gint64 lag);
+	pbnjson::JValue loopReport(const Loop& loop) const;
+
+private:
+	unsigned int m_interval;        //ms
+	unsigned int m_threshold;       //ms
+	GThread* m_thread;
+
+	GMutex m_mutex;                 //guards the members below
+	GCond m_cond;
+	bool m_stop;
+	Loop m_loops[LoopCount];
+	Beat m_beats[LoopCount];
+};
+
+#endif // LOOPWATCHDOG_H
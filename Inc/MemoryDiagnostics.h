@@ -0,0 +1,52 @@
+// Copyright (c) 2010-2018 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef MEMORYDIAGNOSTICS_H
+#define MEMORYDIAGNOSTICS_H
+
+#include <pbnjson.hpp>
+
+#include "Singleton.h"
+
+struct LSHandle;
+struct LSMessage;
+
+/**
+ * Private /diagnostics category: reports where the memory of the service
+ * goes (allocator, SQLite, internal caches, image buffers) and releases
+ * what can be rebuilt on demand.
+ */
+class MemoryDiagnostics : public Singleton<MemoryDiagnostics>
+{
+	friend class Singleton<MemoryDiagnostics>;
+
+public:
+	void setServiceHandle(LSHandle* serviceHandle);
+
+	pbnjson::JValue memoryReport() const;
+
+	// drops rebuildable caches and returns free heap to the system,
+	// returns true if malloc_trim released anything
+	bool trim();
+
+	static bool cbGetMemoryInfo(LSHandle* lsHandle, LSMessage *message, void *user_data);
+	static bool cbTrimMemory(LSHandle* lsHandle, LSMessage *message, void *user_data);
+
+private:
+	MemoryDiagnostics() = default;
+};
+
+#endif //MEMORYDIAGNOSTICS_H
@@ -0,0 +1,35 @@
+// Copyright (c) 2010-2018 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef PLATFORM_H
+#define PLATFORM_H
+
+struct LSMessage;
+
+/**
+ * The few bus calls the core library (sysservice-core) makes. The service
+ * links PlatformLuna.cpp, which forwards to LS2; benchmarks and tests link
+ * sysservice-standin instead and hand the core messages they own.
+ */
+namespace Platform {
+
+// keep a message alive while a task that replies to it is pending
+void messageRef(LSMessage* message);
+void messageUnref(LSMessage* message);
+
+}
+
+#endif // PLATFORM_H
@@ -18,12 +18,14 @@
 #ifndef PREFSDB_H
 #define PREFSDB_H
 
+#include <cstdint>
 #include <string>
 #include <map>
 #include <list>
+#include <memory>
 
-#include <sqlite3.h>
-
+#include "PrefsStore.h"
+#include "SignalSlot.h"
 #include "Singleton.h"
 
 class BackupManager;
@@ -36,13 +38,19 @@ class PrefsDb : public Singleton<PrefsDb>
 public:
 	static PrefsDb* createStandalone(const std::string& dbFilename,bool deleteExisting=true);
 
-	bool setPref(const std::string& key, const std::string& value);
+	//origin is the app id of whoever made the change, recorded in the journal
+	bool setPref(const std::string& key, const std::string& value, const std::string& origin = std::string());
 
 	std::string getPref(const std::string& key);
 	bool getPref(const std::string& key,std::string& r_val);
 
 	std::map<std::string, std::string> getPrefs(const std::list<std::string>& keys);	
 	std::map<std::string,std::string> getAllPrefs();
+	//keys matching a glob (* and ?, as in g_pattern_match_simple). Only the keys
+	//starting with the part before the first wildcard are read from the store
+	std::map<std::string, std::string> getPrefsMatching(const std::string& pattern);
+	static bool isKeyPattern(const std::string& key)
+	{ return key.find_first_of("*?") != std::string::npos; }
 
 	int merge(PrefsDb * p_sourceDb,bool overwriteSameKeys=true);
 	int merge(const std::string& sourceDbFilename,bool overwriteSameKeys=true);
@@ -54,6 +62,38 @@ public:
 
 	void setDatabaseFileDeleteOnDestruction(bool deleteAtDestructor=true);
 
+	//keys rewritten on hot paths (time state). Reads are served from memory,
+	//writes reach the db through a write-behind timer, in one transaction
+	void setWriteBehind(const std::string& key);
+	//write out pending write-behind values now (timer, shutdown, ...)
+	void flushPrefs();
+
+	//memory held by the storage engine, in bytes
+	struct MemoryStats {
+		int cacheUsed;
+		int schemaUsed;
+		int stmtUsed;
+		size_t writeBehindKeys;
+		const char* engine;		//see PrefsStore::name()
+	};
+	MemoryStats memoryStats() const;
+	//hand the unused page cache of the connection back to the allocator
+	void releaseMemory();
+
+	//fired after the default prefs were (re)loaded into a recreated table
+	Signal<> defaultsReloaded;
+
+	//every setPref on the main db gets the next sequence number in a bounded journal
+	typedef PrefsJournalEntry JournalEntry;
+
+	uint64_t lastSeq() const
+	{ return m_lastSeq; }
+
+	//latest change of each key written after seq. Returns false if the journal
+	//doesn't reach back that far anymore (or seq is from the future), the caller
+	//has to do a full resync then
+	bool changesSince(uint64_t seq, std::map<std::string, JournalEntry>& r_changes);
+
 	//keeping all this in one place so that all of system service has one place to look it up in, rather than all over the other source files
 	static const char* s_defaultPrefsFile;
 	static const char* s_defaultPlatformPrefsFile;
@@ -76,6 +116,9 @@ public:
 	static const char* s_volumeIconFileAndPathDest;
 	static const char* s_sysDefaultWallpaperKey;
 	static const char* s_sysDefaultRingtoneKey;
+	static const char* s_schemaVersion;
+	static const unsigned int s_journalSize;
+	static const unsigned int s_writeBehindDelay;
 
 	~PrefsDb();
 private:
@@ -85,8 +128,6 @@ private:
 	void openPrefsDb();
 	void closePrefsDb();
 
-	bool checkTableConsistency();
-	bool integrityCheckDb();
 	void loadDefaultPrefs();
 	void loadDefaultPlatformPrefs();
 	void backupDefaultPrefs();
@@ -97,16 +138,38 @@ private:
 	
 	void updateWithCustomizationPrefOverrides();
 
-	// MUST RUN sqlite3_finalize(x);  on return value 'x' from runSqlQuery(..) unless x == 0
-	sqlite3_stmt* runSqlQuery(const std::string& queryStr);
-	// (___Command is the same except does an sql exec)
-	bool runSqlCommand(const std::string& cmdStr);
+	//journaled with origin when the value changes (and the journal is open)
+	bool putDefault(const std::string& key, const std::string& value, const char* origin = "default");
+	//copies the prefs of an sqlite prefs db into this one, except databaseVersion;
+	//r_keys gets the keys copied
+	bool importPrefs(const std::string& sqliteDbFilename, const char* origin,
+	                 std::list<std::string>* r_keys = nullptr);
+
+	void openJournal();
+	void journal(const std::string& key, const std::string& origin);
+
+	bool writePref(const std::string& key, const std::string& value, const std::string& origin);
+	bool readPref(const std::string& key, std::string& r_val);
+	void loadWriteBehind();
+	static int cbFlushPrefs(void* data);
 
 private:
-	sqlite3* m_prefsDb;
+	std::unique_ptr<PrefsStore> m_store;
 	bool m_standalone;
 	std::string m_dbFilename;
 	bool m_deleteOnDestroy;
+	bool m_journalOpen;
+	uint64_t m_lastSeq;
+
+	struct WriteBehindEntry {
+		WriteBehindEntry() : present(false), dirty(false) {}
+		std::string value;
+		std::string origin;
+		bool present;		//false if the key isn't set at all
+		bool dirty;			//not written to the db yet
+	};
+	std::map<std::string, WriteBehindEntry> m_writeBehind;
+	unsigned int m_flushTimer;
 };
 
 #endif /* PREFSDB_H */
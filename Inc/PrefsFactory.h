@@ -18,12 +18,14 @@
 #define PREFSFACTORY_H
 
 #include <map>
+#include <set>
 #include <string>
 #include <memory>
 
 #include "Singleton.h"
 
 struct LSHandle;
+struct LSMessage;
 
 class PrefsHandler;
 
@@ -40,31 +42,61 @@ public:
 		ErrorValuesDontExist, // values for key don't exist
 	};
 
-	typedef std::shared_ptr<PrefsHandler> PrefsHandlerPtr;
-	typedef std::map<std::string, PrefsHandlerPtr> PrefsHandlerMap;
+	//the handlers the factory owns; see s_handledKeys for the keys each one gets
+	enum HandlerId
+	{
+		HandlerLocale,
+		HandlerTime,
+		HandlerWallpaper,
+		HandlerBuildInfo,
+		HandlerRingtone,
+		HandlerCount
+	};
 
 	void setServiceHandle(LSHandle* serviceHandle);
 	LSHandle* getServiceHandle() const { return m_serviceHandle; }
 
-	std::shared_ptr<PrefsHandler> getPrefsHandler(const std::string& key) const;
+	//not owning, handlers live as long as the factory
+	PrefsHandler* getPrefsHandler(const std::string& key) const;
 	
 	void postPrefChange(const std::string& key,const std::string& value);
 	void postPrefChangeValueIsCompleteString(const std::string& key,const std::string& json_string);
+	//getPreferences subscriptions to a keyPrefix or a glob in keys
+	bool addKeyPatternSubscription(LSHandle* lsHandle, const std::string& pattern, LSMessage* message,
+	                               bool withSeq = false);
+	//json_string goes to the pattern subscriptions matching key; postPrefChange does this itself
+	void postPrefChangeToKeyPatterns(const std::string& key, const std::string& json_string);
 	void runConsistencyChecksOnAllHandlers();
+
+	//approximate cache/table bytes of each handler, keyed by its first key
+	std::map<std::string, size_t> handlersMemoryUsed() const;
+	void releaseHandlerCaches();
 	
 	void refreshAllKeys();		//useful for when the database is completely restored to another version
 								//at some point after sysservice startup (see BackupManager)
+
+	~PrefsFactory();
 private:
 	PrefsFactory();
 
 	void init();
-	void registerPrefHandler(const PrefsHandlerPtr &handler);
+	void registerPrefHandler(HandlerId id, PrefsHandler* handler);
+	//posts json_string with the current seq added, false without subscribers
+	bool postWithSeq(const std::string& subscriptionKey, const std::string& json_string);
 	
 private:
 
 	LSHandle* m_serviceHandle;
 		
-	PrefsHandlerMap m_handlersMaps;
+	std::unique_ptr<PrefsHandler> m_handlers[HandlerCount];
+
+	//patterns with subscribers, each under the subscription key s_keyPatternPrefix + pattern
+	std::set<std::string> m_keyPatterns;
+	static const char* s_keyPatternPrefix;
+
+public:
+	//getPreferences subscriptions with withSeq are kept under s_seqPrefix + their usual key
+	static const char* s_seqPrefix;
 };
 
 #endif /* PREFSFACTORY_H */
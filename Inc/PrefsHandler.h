@@ -21,12 +21,40 @@
 #include <string>
 #include <list>
 #include <map>
+#include <vector>
 
 #include <luna-service2/lunaservice.h>
 #include <pbnjson.hpp>
 
 #include "Logging.h"
 
+/**
+ * Window over the list returned by getPreferenceValues.
+ *
+ * Entries before offset are skipped, at most limit entries are returned
+ * (0 means no limit) and, if fields isn't empty, object entries keep only
+ * the listed properties.
+ */
+struct PrefsValuesWindow
+{
+	PrefsValuesWindow() : offset(0), limit(0) {}
+
+	bool isFull() const { return offset == 0 && limit == 0 && fields.empty(); }
+	bool contains(size_t index) const
+	{ return index >= offset && (limit == 0 || index - offset < limit); }
+	bool isPast(size_t index) const
+	{ return limit != 0 && index >= offset + limit; }
+
+	pbnjson::JValue project(const pbnjson::JValue &entry) const;
+	// returns a copy of values with the array values[key] sliced to the
+	// window, plus "total" and "offset" for paging
+	pbnjson::JValue apply(const std::string& key, const pbnjson::JValue &values) const;
+
+	size_t offset;
+	size_t limit;
+	std::vector<std::string> fields;
+};
+
 class PrefsHandler
 {
 public:
@@ -62,10 +90,22 @@ public:
 		valueChanged(key,jo);
 	}
 	virtual pbnjson::JValue valuesForKey(const std::string& key) = 0;
-	// FIXME: We very likely need a windowed version the above function
+	// Handlers with large value lists override this to build only the window
+	virtual pbnjson::JValue windowedValuesForKey(const std::string& key, const PrefsValuesWindow& window)
+	{
+		pbnjson::JValue values = valuesForKey(key);
+		return window.isFull() ? values : window.apply(key, values);
+	}
+	// Complete getPreferenceValues reply (incl. returnValue) for handlers
+	// whose values never change; nullptr means build it from valuesForKey
+	virtual const std::string* valuesReplyForKey(const std::string& key) { return nullptr; }
 	virtual bool isPrefConsistent() { return true; }
 	virtual void restoreToDefault() {}
 	virtual bool shouldRefreshKeys(std::map<std::string,std::string>& keyvalues) { return false;}
+	// Approximate bytes held in the handler's caches and tables (diagnostics)
+	virtual size_t memoryUsed() const { return 0; }
+	// Drop whatever can be rebuilt on demand
+	virtual void releaseCaches() {}
 
 	LSHandle * getServiceHandle() { return m_serviceHandle;}
 
@@ -0,0 +1,83 @@
+// Copyright (c) 2010-2018 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef PREFSSTORE_H
+#define PREFSSTORE_H
+
+#include <cstdint>
+#include <list>
+#include <map>
+#include <string>
+
+//one change in the bounded journal of the main db, see PrefsDb::changesSince
+struct PrefsJournalEntry {
+	uint64_t seq;
+	std::string key;
+	int64_t timestamp;
+	std::string origin;
+};
+
+/**
+ * Storage engine behind PrefsDb. PrefsDb keeps the defaults handling,
+ * write-behind and journal bookkeeping; a store only persists key/value
+ * rows and journal entries.
+ *
+ * Stores are used from the main loop only.
+ */
+class PrefsStore
+{
+public:
+	enum OpenResult {
+		OpenFailed,
+		OpenExisting,	//prefs from an earlier run are there
+		OpenCreated		//new or recreated empty store, defaults have to be loaded
+	};
+
+	virtual ~PrefsStore() {}
+
+	//"sqlite", "log"
+	virtual const char* name() const = 0;
+
+	virtual OpenResult open(const std::string& path) = 0;
+	virtual void close() = 0;
+
+	virtual bool get(const std::string& key, std::string& r_value) = 0;
+	//modified is the journal sequence of the change, 0 for defaults
+	virtual bool put(const std::string& key, const std::string& value,
+	                 uint64_t modified, const std::string& origin) = 0;
+	virtual bool getAll(std::map<std::string, std::string>& r_prefs) = 0;
+	//the keys starting with prefix, read from that range of the key order only
+	virtual bool getRange(const std::string& prefix, std::map<std::string, std::string>& r_prefs) = 0;
+
+	//groups puts so that they land all together or not at all
+	virtual bool begin() = 0;
+	virtual bool commit() = 0;
+	virtual void rollback() = 0;
+
+	virtual bool openJournal(uint64_t& r_lastSeq) = 0;
+	virtual bool appendJournal(const PrefsJournalEntry& entry) = 0;
+	//drops the entries up to and including seq
+	virtual void trimJournal(uint64_t seq) = 0;
+	//entries after seq in order; r_firstSeq is the oldest seq held, 0 if none
+	virtual bool readJournal(uint64_t seq, std::list<PrefsJournalEntry>& r_entries,
+	                         uint64_t& r_firstSeq) = 0;
+
+	//heap held by the engine, in bytes (see PrefsDb::MemoryStats)
+	virtual void memoryStats(int& r_cacheUsed, int& r_schemaUsed, int& r_stmtUsed) const = 0;
+	virtual void releaseMemory() {}
+};
+
+#endif // PREFSSTORE_H
@@ -0,0 +1,142 @@
+// Copyright (c) 2010-2018 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef REQUESTTRACE_H
+#define REQUESTTRACE_H
+
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <glib.h>
+#include <luna-service2/lunaservice.h>
+
+#include "Singleton.h"
+
+/**
+ * Opt-in recorder of the requests the service handles. Every method call
+ * gets an entry in a fixed-size ring: method, sender, payload size, when it
+ * was dispatched, how long it waited behind other work of the same
+ * main-loop iteration, how long the handler ran and when the first reply
+ * went out. The ring is appended to a JSONL file (Settings
+ * m_requestTraceFile) from a worker thread every few seconds; the format
+ * is the one sysservice-loadreplay replays.
+ *
+ * Requests are seen through linker-wrapped LS2 calls (see CMakeLists.txt):
+ * registered categories get a dispatching trampoline and replies are
+ * matched to the request they answer. With tracing off that costs one
+ * method lookup and a clock read per call; the trampoline also keeps
+ * track of the method being dispatched for LoopWatchdog.
+ *
+ * Only to be used from the main loop. When the service handle is
+ * dispatched by TimeThread the trampoline runs on that thread first: it
+ * serves the time queries there (their entries are handed to the main
+ * loop afterwards, with a queued time of 0) and forwards the rest.
+ */
+class RequestTrace : public Singleton<RequestTrace>
+{
+	friend class Singleton<RequestTrace>;
+
+public:
+	~RequestTrace();
+
+	bool isEnabled() const { return m_enabled; }
+	bool capturesPayloads() const { return m_payloads; }
+
+	/**
+	 * Start or stop recording. Starting truncates the trace file, stopping
+	 * writes out what is left in the ring. Payloads are captured redacted:
+	 * string values are replaced by x's of the same length, except for
+	 * those naming preference keys or time zones.
+	 */
+	void setEnabled(bool enabled, bool payloads);
+
+	/**
+	 * Method the main loop (or with timeThread, the time thread) is
+	 * dispatching right now ("/time/getSystemTime") and since when
+	 * (monotonic us). Safe on any thread; false if the loop isn't running a
+	 * bus method.
+	 */
+	static bool inFlight(std::string& r_method, gint64& r_since, bool timeThread = false);
+
+	static bool cbSetRequestTrace(LSHandle* lsHandle, LSMessage *message, void *user_data);
+
+	// used by the LS2 wrappers
+	struct Category;
+	static bool cbTraced(LSHandle* sh, LSMessage* message, void* categoryData);
+	static void noteReply(LSMessage* message);
+	void replied(LSMessage* message);
+
+private:
+	struct Entry {
+		const char* category;
+		const char* method;
+		char sender[64];
+		LSMessage* message;      //while awaiting a reply, not to be dereferenced
+		uint64_t seq;
+		gint64 dispatched;       //monotonic us
+		gint64 queued;           //us behind other work of the same loop iteration
+		gint64 handled;          //us in the handler
+		gint64 replied;          //us from dispatch to first reply, -1 if none
+		uint32_t payloadSize;
+		bool awaiting;
+		std::string payload;
+	};
+
+	RequestTrace();
+
+	static bool route(LSHandle* sh, LSMessage* message, Category* category, const LSMethod* method);
+	static bool dispatch(LSHandle* sh, LSMessage* message, Category* category, const LSMethod* method);
+
+	Entry& slot(uint64_t seq) { return m_ring[seq % m_ring.size()]; }
+	Entry* find(uint64_t seq);
+	Entry& record(const Category* category, const char* method, LSMessage* message, gint64 now);
+	void forget(Entry& entry);
+
+	// entries ready to be written; with all, also those still awaiting a reply
+	std::vector<Entry> takeEntries(bool all);
+	void flush(bool all);
+	static void writeFile(const std::string& path, const std::vector<Entry>& entries,
+	                      bool truncate, gint64 start);
+
+	void attachLoopProbe();
+	void detachLoopProbe();
+
+	static gboolean cbFlush(gpointer data);
+	static std::string methodPath(const char* category, const char* method);
+	static std::string redact(const char* payload);
+
+private:
+	bool m_enabled;
+	bool m_payloads;
+	std::string m_file;
+	std::vector<Entry> m_ring;
+	uint64_t m_first;            //oldest entry not written yet
+	uint64_t m_next;
+	uint64_t m_dropped;
+	gint64 m_start;
+	bool m_truncate;
+	bool m_writing;
+	bool m_flushAll;
+	guint m_flushTimer;
+	GSource* m_loopProbe;
+	LSMessage* m_currentMessage; //request whose handler is running right now
+	uint64_t m_currentSeq;
+	std::unordered_map<LSMessage*, uint64_t> m_awaiting;
+};
+
+#endif // REQUESTTRACE_H
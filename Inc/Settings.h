@@ -48,6 +48,12 @@ public:
 	bool	m_saveLastRestoredTempDb;
 	std::string m_logLevel;
 
+	// request recording, see RequestTrace
+	bool	m_requestTrace;
+	bool	m_requestTracePayloads;
+	std::string m_requestTraceFile;
+	unsigned int m_requestTraceEntries;
+
 	bool	m_useComPalmImage2;
 	bool	m_image2svcAvailable;
 	std::string m_comPalmImage2BinaryFile;
@@ -56,6 +62,27 @@ public:
 	bool	switchTimezoneOnManualTime;
 	bool	useLocalizedTZ;
 
+	unsigned int m_asyncWorkerThreads;
+
+	// time-change side effects are emitted once updates settle for this
+	// long, but never later than the max delay after the first one (ms)
+	unsigned int m_timeChangeSettleWindow;
+	unsigned int m_timeChangeMaxDelay;
+
+	// seconds the image module stays loaded after its last use, 0 keeps it
+	unsigned int m_imageModuleIdleUnload;
+
+	// main-loop heartbeat period and the lag logged as a stall (ms),
+	// an interval of 0 turns the watchdog off
+	unsigned int m_loopWatchdogInterval;
+	unsigned int m_loopStallThreshold;
+
+	// storage engine of the preferences db: "sqlite" or "log" (see LogPrefsStore)
+	std::string m_prefsStorage;
+
+	// serve the read-only time and clock queries from a thread of their own (see TimeThread)
+	bool m_timeThread;
+
 private:
 	Settings();
 
@@ -18,15 +18,19 @@
 #ifndef SIGNALSLOT_H
 #define SIGNALSLOT_H
 
-#include <set>
-#include <stdio.h>
+#include <algorithm>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+#include <stddef.h>
 
 class Trackable;
 
 class Sender
 {
 public:
-	
+
 	virtual void disconnectTrackable(Trackable* recv) = 0;
 };
 
@@ -34,424 +38,188 @@ class Trackable {
 public:
 
 	virtual ~Trackable() {
-		for (std::set<Sender*>::iterator it = m_senders.begin();
-			 it != m_senders.end(); ++it) {
-			(*it)->disconnectTrackable(this);
+		// disconnectTrackable() may come back to disconnected(), so walk a copy
+		std::vector<Sender*> senders;
+		senders.swap(m_senders);
+		for (Sender* sender : senders) {
+			sender->disconnectTrackable(this);
 		}
 	}
 
 	void connected(Sender* sender) {
-		m_senders.insert(sender);
+		if (std::find(m_senders.begin(), m_senders.end(), sender) == m_senders.end())
+			m_senders.push_back(sender);
 	}
 
 	void disconnected(Sender* sender) {
-		m_senders.erase(sender);
+		m_senders.erase(std::remove(m_senders.begin(), m_senders.end(), sender), m_senders.end());
 	}
 
 private:
 
-	std::set<Sender*> m_senders;
-};
-
-
-template <class Function>
-class FunctionWrapper
-{
-public:
-
-	inline Trackable* receiver() const {
-		return m_receiver;
-	}
-	
-protected:
-
-	Trackable* m_receiver;
-	Function m_function;
-};
-
-
-template <class Arg0=void, class Arg1=void, class Arg2=void, class Arg3=void, class Arg4=void>
-class SlotBase
-{
-public:
-
-	virtual void fire(Arg0 arg0, Arg1 arg1, Arg2 arg2, Arg3 arg3, Arg4 arg4) = 0;
-};
-
-template <>
-class SlotBase<void, void, void, void, void>
-{
-public:
-	
-	virtual void fire() = 0;
-	virtual ~SlotBase() {}
-};
-
-template <class Arg0>
-class SlotBase<Arg0, void, void, void, void>
-{
-public:
-	
-	virtual void fire(Arg0 arg0) = 0;
-	virtual ~SlotBase() {}
-};
-
-template <class Arg0, class Arg1>
-class SlotBase<Arg0, Arg1, void, void, void>
-{
-public:
-	
-	virtual void fire(Arg0 arg0, Arg1 arg1) = 0;
-	virtual ~SlotBase() {}
-};
-
-template <class Arg0, class Arg1, class Arg2>
-class SlotBase<Arg0, Arg1, Arg2, void, void>
-{
-public:
-	
-	virtual void fire(Arg0 arg0, Arg1 arg1, Arg2 arg2) = 0;
-	virtual ~SlotBase() {}
-};
-
-template <class Arg0, class Arg1, class Arg2, class Arg3>
-class SlotBase<Arg0, Arg1, Arg2, Arg3, void>
-{
-public:
-	
-	virtual void fire(Arg0 arg0, Arg1 arg1, Arg2 arg2, Arg3 arg3) = 0;
-	virtual ~SlotBase() {}
-};
-
-
-template <class Receiver,
-		  typename Result = void,
-		  typename Arg0 = void,
-		  typename Arg1 = void,
-		  typename Arg2 = void,
-		  typename Arg3 = void,
-		  typename Arg4 = void>
-class VoidSlot;
-
-template <class Receiver, class Arg0=void, class Arg1=void, class Arg2=void, class Arg3=void, class Arg4=void>
-class Slot : public SlotBase<Arg0, Arg1, Arg2, Arg3, Arg4>,
-			 public FunctionWrapper<void (*)()>
-{
-public:
-
-	typedef void (Receiver::*Function)(Arg0, Arg1, Arg2, Arg3, Arg4);
-	
-	Slot(Receiver* rec, Function func) {
-		this->m_receiver = rec;
-		this->m_function = func;
-	}
-
-	void fire(Arg0 arg0, Arg1 arg1, Arg2 arg2, Arg3 arg3, Arg4 arg4) {
-		(static_cast<Receiver*>(this->m_receiver)->*(this->m_function))(arg0, arg1, arg2, arg3, arg4);
-	}	
-};
-
-template <class Receiver>
-class Slot<Receiver, void, void, void, void, void> : public SlotBase<>,
-													 public FunctionWrapper<void (Receiver::*)()>
-{
-public:
-
-	typedef void (Receiver::*Function)();
-
-	Slot(Receiver* rec, Function func) {
-		this->m_receiver = rec;
-		this->m_function = func;
-	}
-
-	void fire() {
-		(static_cast<Receiver*>(this->m_receiver)->*(this->m_function))();
-	}
+	// a receiver is connected to a handful of signals at most, a flat
+	// vector beats a node based set both in lookups and in memory
+	std::vector<Sender*> m_senders;
 };
 
-template <class Receiver, class Arg0>
-class Slot<Receiver, Arg0, void, void, void, void> : public SlotBase<Arg0>,
-													 public FunctionWrapper<void (Receiver::*)(Arg0)>
-
-{
-public:
-
-	typedef void (Receiver::*Function)(Arg0);
-	
-	Slot(Receiver* rec, Function func) {
-		Trackable* t = rec;
-		this->m_receiver = t;
-		this->m_function = func;
-	}
-
-	void fire(Arg0 arg) {
-		(static_cast<Receiver*>(this->m_receiver)->*(this->m_function))(arg);
-	}
-};
-
-template <class Receiver, class Arg0, class Arg1>
-class Slot<Receiver, Arg0, Arg1, void, void, void> : public SlotBase<Arg0, Arg1>,
-													 public FunctionWrapper<void (Receiver::*)(Arg0,Arg1)>
+/*
+ * Sequence that keeps its first InlineCount elements inside the object and
+ * only spills to the heap past that. Elements must be trivially copyable.
+ */
+template <class Entry, size_t InlineCount>
+class InlineVector
 {
 public:
 
-	typedef void (Receiver::*Function)(Arg0, Arg1);
-	
-	Slot(Receiver* rec, Function func) {
-		this->m_receiver = rec;
-		this->m_function = func;
-	}
+	InlineVector() : m_size(0) {}
 
-	void fire(Arg0 arg0, Arg1 arg1) {
-		(static_cast<Receiver*>(this->m_receiver)->*(this->m_function))(arg0, arg1);
-	}	
-};
+	size_t size() const { return m_size; }
 
-template <class Receiver, typename Result, typename Arg0, typename Arg1>
-class VoidSlot<Receiver, Result, Arg0, Arg1, void, void, void> :
-	public SlotBase<Arg0, Arg1>,
-	public FunctionWrapper<Result (Receiver::*)(Arg0,Arg1)>
-{
-public:
-
-	typedef Result (Receiver::*Function)(Arg0, Arg1);
-
-	VoidSlot(Receiver* rec, Function func) {
-		this->m_receiver = rec;
-		this->m_function = func;
+	Entry& operator[](size_t i) {
+		return i < InlineCount ? m_inline[i] : m_overflow[i - InlineCount];
 	}
 
-	void fire(Arg0 arg0, Arg1 arg1) {
-		(void)(static_cast<Receiver*>(this->m_receiver)->*(this->m_function))(arg0, arg1);
+	void push_back(const Entry& entry) {
+		if (m_size < InlineCount)
+			m_inline[m_size] = entry;
+		else
+			m_overflow.push_back(entry);
+		++m_size;
 	}
-};
 
-template <class Receiver, typename Result, typename Arg0, typename Arg1, typename Arg2>
-class VoidSlot<Receiver, Result, Arg0, Arg1, Arg2, void, void> :
-	public SlotBase<Arg0, Arg1, Arg2>,
-	public FunctionWrapper<Result (Receiver::*)(Arg0,Arg1,Arg2)>
-{
-public:
-
-	typedef Result (Receiver::*Function)(Arg0, Arg1, Arg2);
-
-	VoidSlot(Receiver* rec, Function func) {
-		this->m_receiver = rec;
-		this->m_function = func;
+	void truncate(size_t size) {
+		if (size >= m_size)
+			return;
+		m_overflow.resize(size > InlineCount ? size - InlineCount : 0);
+		m_size = size;
 	}
 
-	void fire(Arg0 arg0, Arg1 arg1, Arg2 arg2) {
-		(void)(static_cast<Receiver*>(this->m_receiver)->*(this->m_function))(arg0, arg1, arg2);
-	}
-};
-
-template <class Receiver, class Arg0, class Arg1, class Arg2>
-class Slot<Receiver, Arg0, Arg1, Arg2, void, void> : public SlotBase<Arg0, Arg1, Arg2>,
-													 public FunctionWrapper<void (Receiver::*)(Arg0,Arg1,Arg2)>
-{
-public:
-
-	typedef void (Receiver::*Function)(Arg0, Arg1, Arg2);
-	
-	Slot(Receiver* rec, Function func) {
-		this->m_receiver = rec;
-		this->m_function = func;
-	}
+private:
 
-	void fire(Arg0 arg0, Arg1 arg1, Arg2 arg2) {
-		(static_cast<Receiver*>(this->m_receiver)->*(this->m_function))(arg0, arg1, arg2);
-	}	
+	size_t m_size;
+	Entry m_inline[InlineCount];
+	std::vector<Entry> m_overflow;
 };
 
-template <class Receiver, class Arg0, class Arg1, class Arg2, class Arg3>
-class Slot<Receiver, Arg0, Arg1, Arg2, Arg3, void> : public SlotBase<Arg0, Arg1, Arg2, Arg3>,
-													 public FunctionWrapper<void (Receiver::*)(Arg0,Arg1,Arg2,Arg3)>
+/*
+ * Signal<Args...> calls member functions of Trackable receivers.
+ *
+ * Slots are plain (receiver, member function, invoker) records kept by
+ * value in an InlineVector: connecting doesn't allocate for the first
+ * kInlineSlots receivers and firing is one indirect call per slot with no
+ * virtual dispatch. Receivers may disconnect (or be destroyed) from inside
+ * a slot; such slots are only marked dead while fire() is running and
+ * removed once the outermost fire() returns. Slots connected during fire()
+ * are first called by the next fire().
+ */
+template <class... Args>
+class Signal : public Sender
 {
 public:
 
-	typedef void (Receiver::*Function)(Arg0, Arg1, Arg2, Arg3);
-	
-	Slot(Receiver* rec, Function func) {
-		this->m_receiver = rec;
-		this->m_function = func;
-	}
-
-	void fire(Arg0 arg0, Arg1 arg1, Arg2 arg2, Arg3 arg3) {
-		(static_cast<Receiver*>(this->m_receiver)->*(this->m_function))(arg0, arg1, arg2, arg3);
-	}	
-};
-
-
-
+	Signal() : m_firing(0), m_dead(0) {}
 
-
-template <class Arg0=void, class Arg1=void, class Arg2=void, class Arg3=void, class Arg4=void>
-class SignalBase : public Sender
-{
-public:
-
-	typedef Slot<Trackable, Arg0, Arg1, Arg2, Arg3, Arg4> Sl;
-	
-	virtual ~SignalBase() {
-		for (typename SlotSet::const_iterator it = this->m_slots.begin();
-			 it != this->m_slots.end(); ++it) {
-			Sl* s = static_cast<Sl*>(*it);
-			s->receiver()->disconnected(this);
-			delete (*it);
+	virtual ~Signal() {
+		for (size_t i = 0; i < m_slots.size(); ++i) {
+			if (m_slots[i].receiver)
+				m_slots[i].receiver->disconnected(this);
 		}
 	}
 
-	void connect(SlotBase<Arg0, Arg1, Arg2, Arg3, Arg4>* slot) {
-		m_slots.insert(slot);
+	template <class Receiver>
+	void connect(Receiver* rec, void (Receiver::*func)(Args...)) {
+		add<Receiver>(rec, func);
 	}
 
-	void connect(Trackable* recv, SlotBase<Arg0, Arg1, Arg2, Arg3, Arg4>* slot) {
-		m_slots.insert(slot);
-		recv->connected(this);
+	// same as connect() for member functions with a (discarded) result
+	template <class Receiver, typename Result>
+	void connectVoid(Receiver* rec, Result (Receiver::*func)(Args...)) {
+		add<Receiver>(rec, func);
 	}
 
 	void disconnect(Trackable* recv) {
-		typename SlotSet::iterator it = this->m_slots.begin();
-		typename SlotSet::iterator itEnd = this->m_slots.end();
-		while (it != itEnd) {
-			Sl* s = static_cast<Sl*>(*it);
-			if (s->receiver() == recv) {
-				delete (*it);
-				this->m_slots.erase(it++);
-				continue;
-			}
-
-			++it;
-		}
+		removeSlots(recv);
+		recv->disconnected(this);
 	}
 
 	virtual void disconnectTrackable(Trackable* recv) {
-		disconnect(recv);
+		removeSlots(recv);
 	}
-	
-protected:
-
-	typedef std::set<SlotBase<Arg0, Arg1, Arg2, Arg3, Arg4>* > SlotSet;
-	SlotSet m_slots;
-};
-
-template <class Arg0=void, class Arg1=void, class Arg2=void, class Arg3=void, class Arg4=void>
-class Signal : public SignalBase<Arg0, Arg1, Arg2, Arg3, Arg4>
-{
-public:
 
-	template <class Receiver>
-	void connect(Receiver* rec, void (Receiver::*func)(Arg0, Arg1, Arg2, Arg3, Arg4)) {
-		SignalBase<Arg0>::connect(rec, new Slot<Receiver, Arg0, Arg1, Arg2, Arg3, Arg4>(rec, func));
-	}
-
-	void fire(Arg0 arg0, Arg1 arg1, Arg2 arg2, Arg3 arg3, Arg4 arg4) {
-		typename std::set<SlotBase<Arg0, Arg1, Arg2, Arg3, Arg4>* >::iterator it = this->m_slots.begin();
-		while (it != this->m_slots.end()) {
-			(*it++)->fire(arg0, arg1, arg2, arg3, arg4);
+	void fire(Args... args) {
+		++m_firing;
+		const size_t count = m_slots.size();
+		for (size_t i = 0; i < count; ++i) {
+			// re-read on each step, a slot may disconnect any of the others
+			const SlotEntry& slot = m_slots[i];
+			if (slot.receiver)
+				slot.invoke(slot, args...);
 		}
+		if (--m_firing == 0 && m_dead)
+			compact();
 	}
-};
-
-	
-template <>
-class Signal<void, void, void, void, void> : public SignalBase<>
-{
-public:
 
-	template <class Receiver>
-	void connect(Receiver* rec, void (Receiver::*func)()) {
-		SignalBase<>::connect(rec, new Slot<Receiver>(rec, func));
-	}
-		
-	void fire() {
-		std::set<SlotBase<>* >::iterator it = this->m_slots.begin();
-		while (it != this->m_slots.end()) {
-			(*it++)->fire();
-		}
-	}
-};
+private:
 
-template <class Arg0>
-class Signal<Arg0, void, void, void, void> : public SignalBase<Arg0>
-{
-public:
+	typedef void (Trackable::*AnyMemberFunction)();
 
-	template <class Receiver>
-	void connect(Receiver* rec, void (Receiver::*func)(Arg0)) {
-		SignalBase<Arg0>::connect(rec, new Slot<Receiver, Arg0>(rec, func));
-	}
+	struct SlotEntry;
+	typedef void (*Invoker)(const SlotEntry&, Args...);
 
-	void fire(Arg0 arg0) {
-		typename std::set<SlotBase<Arg0>* >::iterator it = this->m_slots.begin();
-		while (it != this->m_slots.end()) {
-			(*it++)->fire(arg0);
-		}
-	}
-};
-
-template <class Arg0, class Arg1>
-class Signal<Arg0, Arg1, void, void, void> : public SignalBase<Arg0, Arg1>
-{
-public:
-
-	template <class Receiver>
-	void connect(Receiver* rec, void (Receiver::*func)(Arg0, Arg1)) {
-		SignalBase<Arg0, Arg1>::connect(rec, new Slot<Receiver, Arg0, Arg1>(rec, func));
-	}
+	struct SlotEntry {
+		Trackable* receiver;
+		Invoker invoke;
+		typename std::aligned_storage<sizeof(AnyMemberFunction),
+		                              alignof(AnyMemberFunction)>::type function;
+	};
 
-	template <class Receiver, typename Result>
-	void connectVoid(Receiver* rec, Result (Receiver::*func)(Arg0, Arg1)) {
-		SignalBase<Arg0, Arg1>::connect(rec, new VoidSlot<Receiver, Result, Arg0, Arg1>(rec, func));
-	}
+	static const size_t kInlineSlots = 4;
 
-	void fire(Arg0 arg0, Arg1 arg1) {
-		typename std::set<SlotBase<Arg0, Arg1>* >::iterator it = this->m_slots.begin();
-		while (it != this->m_slots.end()) {
-			(*it++)->fire(arg0, arg1);
-		}
+	template <class Receiver, typename Function>
+	static void invokeSlot(const SlotEntry& slot, Args... args) {
+		Function func;
+		memcpy(&func, &slot.function, sizeof(func));
+		(void)(static_cast<Receiver*>(slot.receiver)->*func)(args...);
 	}
-};
 
-template <class Arg0, class Arg1, class Arg2>
-class Signal<Arg0, Arg1, Arg2, void, void> : public SignalBase<Arg0, Arg1, Arg2>
-{
-public:
+	template <class Receiver, typename Function>
+	void add(Receiver* rec, Function func) {
+		static_assert(sizeof(Function) <= sizeof(AnyMemberFunction),
+		              "member function pointer doesn't fit into slot storage");
 
-	template <class Receiver>
-	void connect(Receiver* rec, void (Receiver::*func)(Arg0, Arg1, Arg2)) {
-		SignalBase<Arg0, Arg1, Arg2>::connect(rec, new Slot<Receiver, Arg0, Arg1, Arg2>(rec, func));
-	}
+		SlotEntry slot;
+		slot.receiver = rec;
+		slot.invoke = &Signal::invokeSlot<Receiver, Function>;
+		memcpy(&slot.function, &func, sizeof(func));
+		m_slots.push_back(slot);
 
-	template <class Receiver, typename Result>
-	void connectVoid(Receiver* rec, Result (Receiver::*func)(Arg0, Arg1, Arg2)) {
-		SignalBase<Arg0, Arg1, Arg2>::connect(rec, new VoidSlot<Receiver, Result, Arg0, Arg1, Arg2>(rec, func));
+		slot.receiver->connected(this);
 	}
 
-	void fire(Arg0 arg0, Arg1 arg1, Arg2 arg2) {
-		typename std::set<SlotBase<Arg0, Arg1, Arg2>* >::iterator it = this->m_slots.begin();
-		while (it != this->m_slots.end()) {
-			(*it++)->fire(arg0, arg1, arg2);
+	void removeSlots(Trackable* recv) {
+		for (size_t i = 0; i < m_slots.size(); ++i) {
+			if (m_slots[i].receiver == recv) {
+				m_slots[i].receiver = nullptr;
+				++m_dead;
+			}
 		}
+		if (!m_firing && m_dead)
+			compact();
 	}
-};
-
-template <class Arg0, class Arg1, class Arg2, class Arg3>
-class Signal<Arg0, Arg1, Arg2, Arg3, void> : public SignalBase<Arg0, Arg1, Arg2, Arg3>
-{
-public:
 
-	template <class Receiver>
-	void connect(Receiver* rec, void (Receiver::*func)(Arg0, Arg1, Arg2, Arg3)) {
-		SignalBase<Arg0, Arg1, Arg2, Arg3>::connect(rec, new Slot<Receiver, Arg0, Arg1, Arg2, Arg3>(rec, func));
-	}
-
-	void fire(Arg0 arg0, Arg1 arg1, Arg2 arg2, Arg3 arg3) {
-		typename std::set<SlotBase<Arg0, Arg1, Arg2, Arg3>* >::iterator it = this->m_slots.begin();
-		while (it != this->m_slots.end()) {
-			(*it++)->fire(arg0, arg1, arg2, arg3);
+	void compact() {
+		size_t live = 0;
+		for (size_t i = 0; i < m_slots.size(); ++i) {
+			if (m_slots[i].receiver)
+				m_slots[live++] = m_slots[i];
 		}
+		m_slots.truncate(live);
+		m_dead = 0;
 	}
+
+	InlineVector<SlotEntry, kInlineSlots> m_slots;
+	unsigned m_firing;
+	size_t m_dead;
 };
 
 /*
@@ -480,6 +248,13 @@ public:
 	void memFun4(int a0, double a1, char a2, float a3) {
 		printf("%s: %d, %g, %d, %f\n", __PRETTY_FUNCTION__, a0, a1, a2, a3);
 	}
+
+	void selfDisconnect(int a0) {
+		printf("%s: %d\n", __PRETTY_FUNCTION__, a0);
+		sig->disconnect(this);
+	}
+
+	Signal<int>* sig;
 };
 
 int main() {
@@ -492,15 +267,18 @@ int main() {
 	
 	{
 		Rec r;
+		r.sig = &sig1;
 		
 		sig0.connect(&r, &Rec::memFun0);
+		sig1.connect(&r, &Rec::selfDisconnect);
 		sig1.connect(&r, &Rec::memFun1);
 		sig2.connect(&r, &Rec::memFun2);
 		sig3.connect(&r, &Rec::memFun3);
 		sig4.connect(&r, &Rec::memFun4);
 
 		sig0.fire();
-		sig1.fire(1);
+		sig1.fire(1);		// selfDisconnect only, it drops memFun1 too
+		sig1.fire(1);		// nothing
 		sig2.fire(1, 2.0);
 		sig3.fire(1, 2.0, 3);
 		sig4.fire(1, 2.0, 3, 4.0f);
@@ -516,5 +294,3 @@ int main() {
 */
 
 #endif // SIGNALSLOT_H
-
-
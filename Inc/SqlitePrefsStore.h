@@ -0,0 +1,86 @@
+// Copyright (c) 2010-2018 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef SQLITEPREFSSTORE_H
+#define SQLITEPREFSSTORE_H
+
+#include <sqlite3.h>
+
+#include "PrefsStore.h"
+
+/**
+ * The default store: a Preferences table and a PrefsJournal table in an
+ * SQLite db. Backups are always made in this format.
+ */
+class SqlitePrefsStore : public PrefsStore
+{
+public:
+	SqlitePrefsStore();
+	~SqlitePrefsStore();
+
+	const char* name() const override { return "sqlite"; }
+
+	OpenResult open(const std::string& path) override;
+	void close() override;
+
+	bool get(const std::string& key, std::string& r_value) override;
+	bool put(const std::string& key, const std::string& value,
+	         uint64_t modified, const std::string& origin) override;
+	bool getAll(std::map<std::string, std::string>& r_prefs) override;
+	bool getRange(const std::string& prefix, std::map<std::string, std::string>& r_prefs) override;
+
+	bool begin() override;
+	bool commit() override;
+	void rollback() override;
+
+	bool openJournal(uint64_t& r_lastSeq) override;
+	bool appendJournal(const PrefsJournalEntry& entry) override;
+	void trimJournal(uint64_t seq) override;
+	bool readJournal(uint64_t seq, std::list<PrefsJournalEntry>& r_entries,
+	                 uint64_t& r_firstSeq) override;
+
+	void memoryStats(int& r_cacheUsed, int& r_schemaUsed, int& r_stmtUsed) const override;
+	void releaseMemory() override;
+
+private:
+	OpenResult checkTableConsistency();
+	bool integrityCheckDb();
+	int createPrefsTable(const char* name, bool ifNotExists);
+
+	//brings the schema from version up to PrefsDb::s_schemaVersion, one transaction per step
+	bool migrateSchema(std::string version);
+	bool migrateToWithoutRowid();
+
+	struct SchemaMigration {
+		const char* fromVersion;
+		const char* toVersion;
+		bool (SqlitePrefsStore::*migrate)();
+	};
+	static const SchemaMigration s_schemaMigrations[];
+
+	bool runSqlCommand(const std::string& cmdStr);
+
+private:
+	sqlite3* m_db;
+	std::string m_path;
+	//kept prepared, these run on every read and write
+	sqlite3_stmt* m_getStatement;
+	sqlite3_stmt* m_putStatement;
+	//a migration failed and left a table without the modified/origin columns
+	bool m_legacySchema;
+};
+
+#endif // SQLITEPREFSSTORE_H
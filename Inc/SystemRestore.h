@@ -17,8 +17,13 @@
 #ifndef SYSTEMRESTORE_H
 #define SYSTEMRESTORE_H
 
+#include <map>
 #include <string>
+#include <vector>
 
+#include <sys/types.h>
+
+#include "SignalSlot.h"
 #include "Singleton.h"
 
 struct LSHandle;
@@ -29,6 +34,7 @@ struct LSMessage;
  * happens!
  */
 class SystemRestore : public Singleton<SystemRestore>
+                    , public Trackable
 {
 	friend class Singleton<SystemRestore>;
 
@@ -49,6 +55,12 @@ public:
 	bool isWallpaperSettingConsistent();
 	
 	void refreshDefaultSettings();
+
+	/*
+	 * startupConsistencyCheck() only queues the copies to the media partition,
+	 * this runs them (on the worker pool). Call once the service is registered.
+	 */
+	void runDeferredRestores();
 	
 	static bool msmAvailCallback(LSHandle* handle, LSMessage* message, void* ctxt);
 	static bool msmProgressCallback(LSHandle* handle, LSMessage* message, void* ctxt);
@@ -73,6 +85,27 @@ protected:
 
 	int restoreDefaultRingtoneToMediaPartition();
 	int restoreDefaultWallpaperToMediaPartition();
+	int mediaPartitionCopy(const std::string& source, const std::string& target);
+
+	//file checks behind the is__SettingConsistent functions; these touch nothing
+	//but the file so the startup check can run them on separate threads
+	typedef bool (*FileCheck)(const std::string& fileAndPath);
+	static bool isRingtoneFileConsistent(const std::string& fileAndPath);
+	static bool isWallpaperFileConsistent(const std::string& fileAndPath);
+	bool isFileConsistent(const char* name, const std::string& fileAndPath, FileCheck check);
+
+	//files that passed a check, remembered with size and mtime so the check
+	//can be skipped (also across reboots) as long as the file doesn't change
+	struct CheckCacheEntry {
+		std::string fileAndPath;
+		off_t size;
+		time_t mtime;
+	};
+	bool lookupCheckCache(const char* name, const std::string& fileAndPath, off_t size, time_t mtime) const;
+	void storeCheckCache(const char* name, const std::string& fileAndPath, off_t size, time_t mtime);
+	void loadCheckCache();
+	void saveCheckCache();
+	static void writeSystemToken();
 	
 	bool msmAvail(LSMessage* message);
 	bool msmProgress(LSMessage* message);
@@ -81,6 +114,13 @@ protected:
 	bool msmPartitionAvailable(LSMessage* message);
 	
 	MSMState m_msmState;
+
+	std::map<std::string, CheckCacheEntry> m_checkCache;
+	bool m_checkCacheDirty;
+
+	bool m_deferMediaCopies;
+	bool m_tokenPending;
+	std::vector<std::pair<std::string, std::string> > m_deferredCopies;
 };
 
 #endif //SYSTEMRESTORE_H
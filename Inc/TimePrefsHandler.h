@@ -18,6 +18,7 @@
 #ifndef TIMEPREFSHANDLER_H
 #define TIMEPREFSHANDLER_H
 
+#include <deque>
 #include <map>
 #include <list>
 #include <vector>
@@ -81,11 +82,13 @@ public:
     virtual bool validate(const std::string& key, const pbnjson::JValue &value);
     virtual void valueChanged(const std::string& key, const pbnjson::JValue &value);
     virtual pbnjson::JValue valuesForKey(const std::string& key);
+    virtual size_t memoryUsed() const;
 
     static TimePrefsHandler *instance() { return s_inst; }
     static bool cbLocaleHandler(LSHandle*, LSMessage*, void*);
     pbnjson::JValue timeZoneListAsJson();
-    pbnjson::JValue timeZoneListAsJson(const std::string& countryCode, const std::string& locale);
+    pbnjson::JValue timeZoneListAsJson(const std::string& countryCode, const std::string& locale,
+                                       const PrefsValuesWindow& window = PrefsValuesWindow());
     bool isValidTimeZoneName(const std::string& tzName);
 
     void postSystemTimeChange();
@@ -106,6 +109,18 @@ public:
     bool isNITZTZEnabled() { return (m_nitzSetting & NITZ_TZEnable) && m_nitzTimeZoneAvailable; }
     bool isNITZDisabled() { return ((!(m_nitzSetting & NITZ_TimeEnable)) && (!(m_nitzSetting & NITZ_TZEnable))); }
     const std::string &getSystemTimeSource() const { return m_systemTimeSourceTag; }
+
+    /**
+     * What getSystemTime reports besides the clock itself. Copied under a
+     * lock, so that TimeThread can read it while the main loop changes it.
+     */
+    struct SystemTimeState {
+        std::string timeZone;        // empty until a zone is set
+        std::string systemTimeSource;
+        std::string nitzValidity;
+    };
+    SystemTimeState systemTimeState() const;
+
     void manualTimeZoneChanged();
     bool setNITZTimeEnable(bool time_en);    //returns old value
     bool setNITZTZEnable(bool tz_en);    //returns old value
@@ -239,7 +254,7 @@ public:
 
 private:
     void init();
-    void scanTimeZoneJson();
+    void scanTimeZoneJson(const pbnjson::JValue &timeZonesJson);
 
     const TimeZoneInfo* timeZone_ZoneFromOffset(int offset,int dstValue=1,int mcc=0) const;
     const TimeZoneInfo* timeZone_GenericZoneFromOffset(int offset) const;
@@ -273,8 +288,6 @@ private:
      */
     void attachSystemTime(pbnjson::JValue &json);
 
-    static bool jsonUtil_ZoneFromJson(const pbnjson::JValue &json,TimeZoneInfo& r_zoneInfo);
-
     /// PIECEWISE NITZ HANDLING - (new , 11/2009)
 #define NITZHANDLER_FLAGBIT_NTPALLOW        (1)
 #define NITZHANDLER_FLAGBIT_MCCALLOW        (1 << 1)
@@ -332,35 +345,31 @@ private:
     void            tzTransTimerAnew(time_t timeout = -1);
     static gboolean tzTrans(gpointer userData);
     static void     tzTransCancel(gpointer userData);
+
+    /* Coalesced time-change side effects: clock steps are applied right
+     * away, notifications/launches/DST timer run once the updates settle */
+    void            scheduleTimeChangeEffects(bool postBroadcastEffective);
+    void            flushTimeChangeEffects();
+    static gboolean cbTimeChangeSettled(gpointer userData);
+
+    /* timeChangeLaunch list, kept as ready-to-send launch payloads and
+     * dispatched through a rate-limited queue */
+    void            setTimeChangeLaunchList(const pbnjson::JValue &stored);
+    void            queueTimeChangeLaunch(const std::string &appId, const std::string &payload);
+    bool            dispatchTimeChangeLaunch();
+    static gboolean cbDispatchTimeChangeLaunch(gpointer userData);
         int enableNetworkTimeSync(bool enable);
 
 private:
 
     static TimePrefsHandler * s_inst;            ///not a true instance handle. Just points to the first one created
 
-    typedef std::list<TimeZoneInfo*> TimeZoneInfoList;
-    typedef std::list<TimeZoneInfo*>::iterator TimeZoneInfoListIterator;
-    typedef std::list<TimeZoneInfo*>::const_iterator TimeZoneInfoListConstIterator;
-
-    typedef std::map<int,TimeZoneInfo*> TimeZoneMap;
-    typedef std::map<int,TimeZoneInfo*>::iterator TimeZoneMapIterator;
-    typedef std::map<int,TimeZoneInfo*>::const_iterator TimeZoneMapConstIterator;
-
-    typedef std::pair<int,TimeZoneInfo*> TimeZonePair;
-    typedef std::multimap<int,TimeZoneInfo*> TimeZoneMultiMap;
-    typedef std::multimap<int,TimeZoneInfo*>::iterator TimeZoneMultiMapIterator;
-    typedef std::multimap<int,TimeZoneInfo*>::const_iterator TimeZoneMultiMapConstIterator;
+    void publishTimeState();
+    mutable GMutex  m_timeStateMutex;            ///guards m_timeState
+    SystemTimeState m_timeState;
 
     std::list<std::string> m_keyList;
 
-    TimeZoneInfoList m_zoneList;
-    TimeZoneInfoList m_syszoneList;
-
-    TimeZoneMap m_mccZoneInfoMap;
-    TimeZoneMap m_preferredTimeZoneMapDST;
-    TimeZoneMap m_preferredTimeZoneMapNoDST;
-    TimeZoneMultiMap m_offsetZoneMultiMap;
-
     static const TimeZoneInfo s_failsafeDefaultZone;
     const TimeZoneInfo *     m_cpCurrentTimeZone;
     TimeZoneInfo *    m_pDefaultTimeZone;
@@ -373,8 +382,6 @@ private:
     NitzParameters    *    m_p_lastNitzParameter;
     int                    m_lastNitzFlags;
 
-    static pbnjson::JValue s_timeZonesJson;
-
     GSource *    m_gsource_periodic;
     guint        m_gsource_periodic_id;
     int            m_timeoutCycleCount;
@@ -404,6 +411,17 @@ private:
     guint    m_gsource_tzTrans_id;
     time_t   m_nextTzTrans;
 
+    guint    m_timeChangeSettleId;
+    gint64   m_timeChangeFirstPending;    // monotonic usecs, 0 if nothing pending
+    bool     m_timeChangePostBroadcast;
+
+    typedef std::vector<std::pair<std::string, std::string> > LaunchList;    // appId, payload
+    LaunchList                         m_timeChangeLaunches;
+    std::deque<std::string>            m_launchQueue;        // appIds in launch order
+    std::map<std::string, std::string> m_pendingLaunches;    // appId -> payload, one per app
+    guint                              m_launchDispatchId;
+    gint64                             m_lastLaunchDispatch;  // monotonic usecs
+
     bool m_micomAvailable;
     int m_altFactorySrcPriority;
     time_t m_altFactorySrcSystemOffset;
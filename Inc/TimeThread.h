@@ -0,0 +1,115 @@
+// Copyright (c) 2010-2018 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef TIMETHREAD_H
+#define TIMETHREAD_H
+
+#include <atomic>
+#include <functional>
+#include <set>
+#include <string>
+#include <utility>
+
+#include <glib.h>
+
+#include "Singleton.h"
+
+struct LSHandle;
+struct LSMessage;
+struct LSError;
+
+/**
+ * A GMainContext of its own, run by a dedicated thread, that answers the
+ * read-only time and clock queries. LS2 dispatches a handle from a single
+ * context, so the service handle as a whole is attached here: methods
+ * registered with serve() run right on this thread, every other method
+ * call, reply and server status callback is forwarded to the main loop in
+ * the order it came in. A slow preferences write or a backup on the main
+ * loop thus no longer holds up getSystemTime.
+ *
+ * Served methods only read state that is published to them under a lock
+ * (TimePrefsHandler::systemTimeState, ClockHandler's clocks) and never
+ * subscribe; subscription requests are forwarded like everything else.
+ * While a call of a method registered with orderAfter() is on its way
+ * through the main loop, served methods are forwarded too, so that a
+ * client reading the time right after setting it sees its change.
+ *
+ * serve(), orderAfter() and attach() are for the main loop, before start().
+ */
+class TimeThread : public Singleton<TimeThread>
+{
+	friend class Singleton<TimeThread>;
+
+public:
+	enum Route {
+		RouteForward,	//handled on the main loop
+		RouteBarrier,	//handled on the main loop, served methods wait for it
+		RouteServe		//handled on this thread
+	};
+
+	~TimeThread();
+
+	/**
+	 * Attach the service handle to the time context instead of the main
+	 * loop. Nothing is dispatched before start().
+	 */
+	bool attach(LSHandle* handle, LSError* lserror);
+
+	void start();
+	void stop();
+
+	bool isRunning() const { return m_thread != nullptr; }
+	GMainContext* context() const { return m_context; }
+
+	// for the memory diagnostics
+	size_t servedCount() const { return m_served.size(); }
+	unsigned int pendingBarriers() const { return m_pendingBarriers.load(std::memory_order_relaxed); }
+	static size_t relayCount();
+
+	// true on the time thread
+	static bool isCurrent();
+
+	void serve(const char* category, const char* method);
+	// a null method stands for every method of the category that isn't served
+	void orderAfter(const char* category, const char* method = nullptr);
+
+	// time thread only
+	Route route(const std::string& category, const char* method) const;
+	bool mayServe() const { return m_pendingBarriers.load(std::memory_order_acquire) == 0; }
+
+	/**
+	 * Run dispatch on the main loop. With barrier set, served methods are
+	 * forwarded as well until it has run.
+	 */
+	void forward(bool barrier, std::function<void()> dispatch);
+
+private:
+	TimeThread();
+
+	static gpointer threadFunc(gpointer data);
+	static gboolean cbQuit(gpointer data);
+
+private:
+	GMainContext* m_context;
+	GMainLoop* m_loop;
+	GThread* m_thread;
+
+	std::set<std::pair<std::string, std::string>> m_served;
+	std::set<std::pair<std::string, std::string>> m_barriers;
+	std::atomic<unsigned int> m_pendingBarriers;
+};
+
+#endif // TIMETHREAD_H
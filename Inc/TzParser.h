@@ -19,6 +19,7 @@
 #define TZPARSER_H
 
 #include <list>
+#include <stdint.h>
 #include <time.h>
 
 #define TZ_ABBR_MAX_LEN	16
@@ -36,4 +37,18 @@ typedef std::list<TzTransition> TzTransitionList;
 
 TzTransitionList parseTimeZone(const char* tzName);
 
+struct TzYearRule
+{
+	int     year;
+	bool    hasDstChange;
+	int64_t utcOffset;
+	int64_t dstOffset;
+	int64_t dstStart;
+	int64_t dstEnd;
+};
+
+// Standard offset and DST window of a year, derived from the transitions of
+// a zone. Returns false if no offset is known for that year.
+bool tzRuleForYear(const TzTransitionList& transitionList, int year, TzYearRule& rule);
+
 #endif /* TZPARSER_H */
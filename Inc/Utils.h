@@ -27,10 +27,10 @@
 #include <string>
 #include <vector>
 #include <memory>
+#include <functional>
 
 #include <glib.h>
 #include <pbnjson.hpp>
-#include <luna-service2/lunaservice.h>
 
 #define SS_DEBUG_INFO	100
 #define SS_DEBUG_WARN	50
@@ -85,8 +85,14 @@ int splitFileAndExtension(const std::string& srcFileAndExt,std::string& filePart
 int splitStringOnKey(std::vector<std::string>& returnSplitSubstrings,const std::string& baseStr,const std::string& delims);
 int splitStringOnKey(std::list<std::string>& returnSplitSubstrings,const std::string& baseStr,const std::string& delims);
 
+// (bytes copied so far, total bytes), called from the copying thread
+typedef std::function<void(uint64_t, uint64_t)> CopyProgress;
+
 bool doesExistOnFilesystem(const char * pathAndFile);
 int fileCopy(const char * srcFileAndPath,const char * dstFileAndPath);
+int fileCopy(const char * srcFileAndPath,const char * dstFileAndPath,const CopyProgress& progress);
+// hex SHA-256 of the file content
+bool fileChecksum(const char * pathAndFile,std::string& r_digest);
 
 int filesizeOnFilesystem(const char * pathAndFile);
 
@@ -20,8 +20,6 @@
 
 #include "PrefsHandler.h"
 
-#include <QtGui/QImage>
-
 class WallpaperPrefsHandler : public PrefsHandler {
 
 public:
@@ -34,6 +32,7 @@ public:
 	virtual void valueChanged(const std::string& key, const pbnjson::JValue &value);
 	virtual bool validate(const std::string& key, const pbnjson::JValue &value, const std::string& originId);
 	virtual pbnjson::JValue valuesForKey(const std::string& key);
+	virtual pbnjson::JValue windowedValuesForKey(const std::string& key, const PrefsValuesWindow& window);
 	virtual void init();
 
 	virtual bool isPrefConsistent();
@@ -77,8 +76,6 @@ public:
 	bool getWallpaperSpecFromFilename(std::string& wallpaperName,std::string& wallpaperFile,std::string& wallpaperThumbFile);
 
 private:
-	QImage clipImageToScreenSizeWithFocus(QImage& image, int focus_x,int focus_y);
-	QImage clipImageToScreenSize(QImage& image, bool center);
 	int resizeImage(const std::string& sourceFile, const std::string& destFile, int destImgW, int destImgH, const char* format);
 	void getScreenDimensions();
 
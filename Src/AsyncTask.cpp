@@ -0,0 +1,176 @@
+// Copyright (c) 2010-2018 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#include "AsyncTask.h"
+
+#include "Logging.h"
+#include "Mainloop.h"
+#include "Platform.h"
+#include "Settings.h"
+
+static const unsigned int s_maxWorkerThreads = 8;
+
+struct AsyncTaskPool::Task
+{
+	AsyncTaskPool* pool;
+	Work work;
+	Completion done;
+	LSMessage* message;
+};
+
+AsyncTaskPool::AsyncTaskPool()
+	: m_pool(nullptr)
+	, m_context(nullptr)
+	, m_maxThreads(Settings::instance()->m_asyncWorkerThreads)
+	, m_pending(0)
+{
+	// completions go to whatever context the service main loop runs on
+	m_context = g_mainloop ? g_main_loop_get_context(g_mainloop.get()) : g_main_context_default();
+	g_main_context_ref(m_context);
+
+	if (m_maxThreads == 0)
+		return;
+	if (m_maxThreads > s_maxWorkerThreads)
+		m_maxThreads = s_maxWorkerThreads;
+
+	GError* error = nullptr;
+	m_pool = g_thread_pool_new(&AsyncTaskPool::workerFunc, this, m_maxThreads, FALSE, &error);
+	if (!m_pool)
+	{
+		PmLogError(sysServiceLogContext(), "ASYNC_POOL_FAILURE", 1,
+		           PMLOGKS("REASON", error ? error->message : "unknown"),
+		           "Failed to create worker pool, blocking work will run on the main loop");
+		if (error)
+			g_error_free(error);
+	}
+}
+
+AsyncTaskPool::~AsyncTaskPool()
+{
+	if (m_pool)
+	{
+		// let already queued work finish, their completions are dropped
+		// together with the main loop
+		g_thread_pool_free(m_pool, FALSE, TRUE);
+		m_pool = nullptr;
+	}
+
+	g_main_context_unref(m_context);
+}
+
+bool AsyncTaskPool::run(Work work, Completion done, LSMessage* message)
+{
+	if (!m_pool || !work)
+		return false;
+
+	Task* task = new Task { this, std::move(work), std::move(done), message };
+	if (task->message)
+		Platform::messageRef(task->message);
+
+	++m_pending;
+
+	GError* error = nullptr;
+	if (!g_thread_pool_push(m_pool, task, &error))
+	{
+		PmLogError(sysServiceLogContext(), "ASYNC_PUSH_FAILURE", 1,
+		           PMLOGKS("REASON", error ? error->message : "unknown"), "");
+		if (error)
+			g_error_free(error);
+
+		--m_pending;
+		releaseTask(task);
+		return false;
+	}
+
+	return true;
+}
+
+void AsyncTaskPool::offload(LSMessage* message, Work work, Completion done)
+{
+	if (run(work, done, message))
+		return;
+
+	work();
+	if (done)
+		done();
+}
+
+void AsyncTaskPool::post(Completion fn)
+{
+	if (!fn)
+		return;
+
+	queue(&AsyncTaskPool::runPosted, new Completion(std::move(fn)), &AsyncTaskPool::freePosted);
+}
+
+// always through the loop: g_main_context_invoke() would run the function
+// right away on a thread that manages to acquire the context, e.g. a worker
+// while the main loop isn't running yet (startup) or anymore (shutdown)
+void AsyncTaskPool::queue(GSourceFunc fn, gpointer data, GDestroyNotify destroy)
+{
+	GSource* source = g_idle_source_new();
+	g_source_set_priority(source, G_PRIORITY_DEFAULT);
+	g_source_set_callback(source, fn, data, destroy);
+	g_source_attach(source, m_context);
+	g_source_unref(source);
+}
+
+gboolean AsyncTaskPool::runPosted(gpointer data)
+{
+	(*static_cast<Completion*>(data))();
+	return G_SOURCE_REMOVE;
+}
+
+void AsyncTaskPool::freePosted(gpointer data)
+{
+	delete static_cast<Completion*>(data);
+}
+
+void AsyncTaskPool::workerFunc(gpointer data, gpointer userData)
+{
+	Task* task = static_cast<Task*>(data);
+
+	try
+	{
+		task->work();
+	}
+	catch (...)
+	{
+		PmLogError(sysServiceLogContext(), "ASYNC_TASK_FAILURE", 0, "Worker task threw an exception");
+	}
+
+	task->pool->queue(&AsyncTaskPool::completeTask, task, nullptr);
+}
+
+gboolean AsyncTaskPool::completeTask(gpointer data)
+{
+	Task* task = static_cast<Task*>(data);
+
+	if (task->done)
+		task->done();
+
+	--task->pool->m_pending;
+
+	releaseTask(task);
+	return G_SOURCE_REMOVE;
+}
+
+void AsyncTaskPool::releaseTask(Task* task)
+{
+	if (task->message)
+		Platform::messageUnref(task->message);
+	delete task;
+}
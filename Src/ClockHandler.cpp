@@ -26,6 +26,7 @@
 
 #include "ClockHandler.h"
 #include "TimePrefsHandler.h"
+#include "TimeThread.h"
 
 #define SCHEMA_TIMESTAMP { \
 					"type": "object", \
@@ -86,11 +87,18 @@ const time_t ClockHandler::invalidOffset = (time_t)LONG_MIN;
 ClockHandler::ClockHandler() :
 	m_manualOverride( false )
 {
+	g_mutex_init(&m_mutex);
+
 	// we always have manual time-source
 	// assume priority 0 (the lowest non-negative)
 	setup(manual, 0);
 }
 
+ClockHandler::~ClockHandler()
+{
+	g_mutex_clear(&m_mutex);
+}
+
 bool ClockHandler::setServiceHandle(LSHandle* serviceHandle)
 {
 	LSError lsError;
@@ -112,11 +120,38 @@ bool ClockHandler::setServiceHandle(LSHandle* serviceHandle)
 		LSErrorFree(&lsError);
 		return false;
 	}
+
+	// getTime only looks at the clocks, setTime goes first
+	TimeThread::instance()->serve("/clock", "getTime");
+	TimeThread::instance()->orderAfter("/clock");
 	return true;
 }
 
+void ClockHandler::attachTimePrefs(TimePrefsHandler* timePrefs)
+{
+	manualOverride(timePrefs->isManualTimeUsed());
+
+	// setup properties bindings
+	timePrefs->systemTimeChanged.connect(this, &ClockHandler::adjust);
+	timePrefs->isManualTimeChanged.connect(this, &ClockHandler::manualOverride);
+	timePrefs->deprecatedClockChange.connectVoid(this, &ClockHandler::update);
+	timePrefs->compensateSuspendedTimeToClocks.connect(this, &ClockHandler::compensateSuspendedTimeToClocks);
+	clockChanged.connect(timePrefs, &TimePrefsHandler::clockChanged);
+	notAvailableSourceHandled.connect(timePrefs, &TimePrefsHandler::handleNotAvailableSource);
+
+	// setup time sources for clock handler
+	int basePriority = 1;
+	const TimePrefsHandler::TimeSources &sources = timePrefs->timeSources();
+	for (size_t i = 0; i < sources.size(); ++i)
+	{
+		int priority = sources.size()-1 - i + basePriority;
+		setup(sources[i], priority);
+	}
+}
+
 void ClockHandler::adjust(time_t offset)
 {
+	g_mutex_lock(&m_mutex);
 	for (ClocksMap::iterator it = m_clocks.begin();
 		 it != m_clocks.end(); ++it)
 	{
@@ -127,6 +162,7 @@ void ClockHandler::adjust(time_t offset)
 			it->second.lastUpdate += offset; // maintain same distance from current time
 		}
 	}
+	g_mutex_unlock(&m_mutex);
 }
 void ClockHandler::manualOverride(bool enabled)
 {
@@ -135,7 +171,9 @@ void ClockHandler::manualOverride(bool enabled)
 		return; // nothing to change
 	}
 
+	g_mutex_lock(&m_mutex);
 	m_manualOverride = enabled;
+	g_mutex_unlock(&m_mutex);
 
 	if (!enabled)
 	{
@@ -163,6 +201,7 @@ void ClockHandler::manualOverride(bool enabled)
 
 void ClockHandler::setup(const std::string &clockTag, int priority, time_t offset /* = invalidOffset */)
 {
+	g_mutex_lock(&m_mutex);
 	ClocksMap::iterator it = m_clocks.find(clockTag);
 	if (it != m_clocks.end())
 	{
@@ -186,6 +225,7 @@ void ClockHandler::setup(const std::string &clockTag, int priority, time_t offse
 	{
 		m_clocks.insert(ClocksMap::value_type(clockTag, (Clock){ priority, offset, invalidTime }));
 	}
+	g_mutex_unlock(&m_mutex);
 
 	PmLogDebug(sysServiceLogContext(), "Registered clock %s with priority %d", clockTag.c_str(), priority);
 }
@@ -225,8 +265,10 @@ bool ClockHandler::compensateSuspendedTime(time_t offset, const std::string &clo
 	}
 
 	Clock &clock = it->second;
+	g_mutex_lock(&m_mutex);
 	clock.lastUpdate = timeStamp;
 	clock.systemOffset += offset;
+	g_mutex_unlock(&m_mutex);
 
 	return true;
 }
@@ -277,8 +319,10 @@ bool ClockHandler::update(time_t offset, const std::string &clockTag /* = manual
 	}
 
 	Clock &clock = it->second;
+	g_mutex_lock(&m_mutex);
 	clock.lastUpdate = timeStamp;
 	clock.systemOffset = offset;
+	g_mutex_unlock(&m_mutex);
 
 	clockChanged.fire( it->first, clock.priority, offset, clock.lastUpdate );
 
@@ -398,6 +442,10 @@ bool ClockHandler::cbGetTime(LSHandle* lshandle, LSMessage *message, void *user_
 
 	ClockHandler &handler = *static_cast<ClockHandler*>(user_data);
 
+	// served from the time thread, see ClockHandler::m_mutex
+	std::string systemTimeSource = TimePrefsHandler::instance()->systemTimeState().systemTimeSource;
+	g_mutex_lock(&handler.m_mutex);
+
 	pbnjson::JValue reply;
 
 	bool isSystem = (source == system);
@@ -448,7 +496,7 @@ bool ClockHandler::cbGetTime(LSHandle* lshandle, LSMessage *message, void *user_
 		offset.put("source", system);
 		reply.put("offset", offset);
 		reply.put("utc", (int64_t)time(0));
-		reply.put("systemTimeSource", TimePrefsHandler::instance()->getSystemTimeSource());
+		reply.put("systemTimeSource", systemTimeSource);
 		reply.put("timestamp", timestampJson());
 	}
 	else if (it == handler.m_clocks.end())
@@ -479,6 +527,7 @@ bool ClockHandler::cbGetTime(LSHandle* lshandle, LSMessage *message, void *user_
 		reply.put("source", it->first);
 		reply.put("priority", it->second.priority);
 	}
+	g_mutex_unlock(&handler.m_mutex);
 
 	LSError lsError;
 	LSErrorInit(&lsError);
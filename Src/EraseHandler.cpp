@@ -16,9 +16,13 @@
 
 #include "EraseHandler.h"
 
+#include <memory>
+
 #include <nyx/client/nyx_system.h>
 #include <luna-service2++/error.hpp>
+#include <pbnjson.hpp>
 
+#include "AsyncTask.h"
 #include "Utils.h"
 #include "Logging.h"
 #include "JSONUtils.h"
@@ -28,6 +32,14 @@ static bool    cbEraseDeveloper(LSHandle* pHandle, LSMessage* pMessage, void* pU
 static bool    cbEraseMedia(LSHandle* pHandle, LSMessage* pMessage, void* pUserData);
 static bool    cbEraseVar(LSHandle* pHandle, LSMessage* pMessage, void* pUserData);
 static bool    cbSecureWipe(LSHandle* pHandle, LSMessage* pMessage, void* pUserData);
+static bool    cbCancel(LSHandle* pHandle, LSMessage* pMessage, void* pUserData);
+
+using namespace pbnjson;
+
+// longest pre-commit phase a caller can ask for
+static const int s_maxEraseDelay = 300;
+// interval of the status replies sent to subscribers while erasing
+static const guint s_heartbeatInterval = 5;
 
 #define ERASE(h,m,u) (EraseHandler::instance()->Erase(h,m,u))
 
@@ -41,6 +53,51 @@ static bool    cbSecureWipe(LSHandle* pHandle, LSMessage* pMessage, void* pUserD
  * - \ref com_palm_systemservice_EraseVar
  * - \ref com_palm_systemservice_EraseDeveloper
  * - \ref com_palm_systemservice_Wipe
+ * - \ref com_palm_systemservice_erase_cancel
+ *
+ * \section com_palm_systemservice_erase_params Common parameters
+ *
+ * All erase methods run the actual erase on a worker thread, the service
+ * stays responsive until the device reboots. Only one erase can be active.
+ *
+ * \code
+ * {
+ *     "delay": integer,
+ *     "subscribe": boolean
+ * }
+ * \endcode
+ *
+ * \param delay Optional. Seconds to wait before the erase starts, during which
+ *        it can still be called off with /erase/Cancel. Defaults to 0, at most 300.
+ * \param subscribe Optional. If true, status replies are sent as the request
+ *        goes through its phases.
+ *
+ * Status replies:
+ * \code
+ * {
+ *     "returnValue": true,
+ *     "subscribed": true,
+ *     "status": string,
+ *     "elapsed": integer
+ * }
+ * \endcode
+ *
+ * \param status "pending" while waiting for the delay, "erasing" once the
+ *        erase has started (repeated every few seconds).
+ * \param elapsed Seconds since the erase was started. Only while erasing.
+ *
+ * The final reply is {"returnValue": true} or {"returnValue": false, "errorText": string},
+ * with "subscribed": false for subscriptions. A cancelled request gets
+ * {"returnValue": false, "errorText": "Erase cancelled", "status": "cancelled"}.
+ *
+ * \section com_palm_systemservice_erase_cancel Cancel
+ *
+ * Calls off an erase that is still in its pre-commit phase. Fails once the
+ * erase has started.
+ *
+ * \code
+ * luna-send -n 1 -f luna://com.webos.service.systemservice/erase/Cancel '{}'
+ * \endcode
  */
 
 /**
@@ -52,11 +109,19 @@ static LSMethod s_methods[]  = {
 	,{ "EraseVar",       cbEraseVar }
 	,{ "EraseDeveloper", cbEraseDeveloper }
 	,{ "Wipe",           cbSecureWipe }
+	,{ "Cancel",         cbCancel }
 	,{ 0, 0 }
 };
 
 EraseHandler::EraseHandler()
 	: nyxSystem(nullptr)
+	, m_state(kIdle)
+	, m_nyxType(NYX_SYSTEM_TEST_ERASE)
+	, m_handle(nullptr)
+	, m_message(nullptr)
+	, m_subscribed(false)
+	, m_timer(0)
+	, m_started(0)
 {
 }
 
@@ -95,6 +160,10 @@ void EraseHandler::setServiceHandle(LSHandle* serviceHandle)
 
 EraseHandler::~EraseHandler()
 {
+	if (m_timer)
+		g_source_remove(m_timer);
+	if (m_message)
+		LSMessageUnref(m_message);
 }
 
 /**
@@ -105,6 +174,9 @@ EraseHandler::~EraseHandler()
  * mountall script that erases /var or both /var and the user
  * partition.
  *
+ * The request is only accepted here; the nyx call runs on the worker
+ * pool after the optional delay, see commit().
+ *
  * @param pHandle
  * @param pMessage
  * @param type
@@ -115,9 +187,15 @@ bool EraseHandler::Erase(LSHandle* pHandle, LSMessage* pMessage, EraseType_t typ
 		PmLogWarning(sysServiceLogContext(), "ERASE_BROKEN", 1, PMLOGKFV("ERASE_TYPE", "%d", type), "Call for erase when no working provider available");
 		return false;
 	}
-	LSError lserror;
-	char *error_text=NULL;
-	char* return_msg = NULL;
+
+	// {"delay": integer, "subscribe": boolean}
+	LSMessageJsonParser parser(pMessage, RELAXED_SCHEMA(PROPS_2(PROPERTY(delay, integer),
+	                                                            PROPERTY(subscribe, boolean))));
+
+	if (!parser.parse(__FUNCTION__, pHandle, Settings::instance()->schemaValidationOption))
+		return true;
+
+	std::string errorText;
 	nyx_system_erase_type_t nyx_type;
 
 	// write flag file used by mountall.sh
@@ -149,36 +227,174 @@ bool EraseHandler::Erase(LSHandle* pHandle, LSMessage* pMessage, EraseType_t typ
 			break;
 
 		default:
-			// initialize nyx_type with a value to suppress warning. It will not be used, because error_text is initialized
+			// initialize nyx_type with a value to suppress warning. It will not be used, because errorText is set
 			nyx_type = NYX_SYSTEM_TEST_ERASE;
-			error_text = g_strdup_printf("Invalid type %d", type);
+			errorText = "Invalid type " + std::to_string(type);
 			break;
 	}
 
-	if (!error_text) {
-		nyx_error_t ret = nyx_system_erase_partition(nyxSystem, nyx_type/*, error_text*/);
-		if (ret != NYX_ERROR_NONE) {
-			qCritical("Failed to execute nyx_system_erase_partition, ret : %d",ret);
-			error_text = g_strdup_printf("Failed to execute NYX erase API");
-		}
+	if (errorText.empty() && m_state != kIdle)
+		errorText = "Erase already in progress";
+
+	if (!errorText.empty()) {
+		qWarning() << errorText.c_str();
+
+		JObject reply {{"returnValue", false}, {"errorText", errorText}};
+		LS::Error error;
+		if (!LSMessageReply(pHandle, pMessage, reply.stringify().c_str(), error))
+			qWarning() << error.what();
+		return true;
 	}
 
-	if (error_text) {
-		qWarning() << error_text;
-		return_msg = g_strdup_printf("{\"returnValue\":false, \"errorText\":\"%s\"}", error_text);
-		g_free(error_text);
-	} else {
-		return_msg = g_strdup_printf("{\"returnValue\":true}");
+	JValue delayValue = parser.get()["delay"];
+	int delay = delayValue.isNumber() ? delayValue.asNumber<int>() : 0;
+	if (delay < 0)
+		delay = 0;
+	else if (delay > s_maxEraseDelay)
+		delay = s_maxEraseDelay;
+
+	LSMessageRef(pMessage);
+	m_handle = pHandle;
+	m_message = pMessage;
+	m_subscribed = LSMessageIsSubscription(pMessage);
+	m_nyxType = nyx_type;
+	m_state = kPending;
+
+	if (delay == 0) {
+		commit();
+		return true;
 	}
 
-	LSErrorInit(&lserror);
-	if (!LSMessageReply(pHandle, pMessage, return_msg, &lserror))
-		LSREPORT( lserror );
-	g_free(return_msg);
-	LSErrorFree(&lserror);
+	PmLogInfo(sysServiceLogContext(), "ERASE_PENDING", 2, PMLOGKFV("ERASE_TYPE", "%d", type),
+	          PMLOGKFV("DELAY", "%d", delay), "Erase scheduled");
+	replyStatus("pending");
+	m_timer = g_timeout_add_seconds(delay, &EraseHandler::cbCommit, this);
 	return true;
 }
 
+bool EraseHandler::Cancel(LSHandle* pHandle, LSMessage* pMessage)
+{
+	JObject reply;
+
+	if (m_state == kPending) {
+		g_source_remove(m_timer);
+		m_timer = 0;
+
+		JObject cancelled {{"returnValue", false}, {"errorText", "Erase cancelled"}, {"status", "cancelled"}};
+		if (m_subscribed)
+			cancelled.put("subscribed", false);
+
+		LS::Error error;
+		if (!LSMessageReply(m_handle, m_message, cancelled.stringify().c_str(), error))
+			qWarning() << error.what();
+
+		LSMessageUnref(m_message);
+		m_message = nullptr;
+		m_handle = nullptr;
+		m_state = kIdle;
+
+		PmLogInfo(sysServiceLogContext(), "ERASE_CANCELLED", 0, "Pending erase cancelled");
+		reply = JObject {{"returnValue", true}};
+	}
+	else if (m_state == kErasing) {
+		reply = JObject {{"returnValue", false}, {"errorText", "Erase already started"}};
+	}
+	else {
+		reply = JObject {{"returnValue", false}, {"errorText", "No erase pending"}};
+	}
+
+	LS::Error error;
+	if (!LSMessageReply(pHandle, pMessage, reply.stringify().c_str(), error))
+		qWarning() << error.what();
+	return true;
+}
+
+gboolean EraseHandler::cbCommit(gpointer data)
+{
+	EraseHandler* handler = static_cast<EraseHandler*>(data);
+	handler->m_timer = 0;
+	handler->commit();
+	return G_SOURCE_REMOVE;
+}
+
+gboolean EraseHandler::cbHeartbeat(gpointer data)
+{
+	static_cast<EraseHandler*>(data)->replyStatus("erasing");
+	return G_SOURCE_CONTINUE;
+}
+
+/**
+ * Past this point the erase can't be cancelled anymore. The nyx call
+ * blocks until the partition is flagged (or wiped, for kSecureWipe),
+ * so it goes to the worker pool and the reply is sent from the completion.
+ */
+void EraseHandler::commit()
+{
+	m_state = kErasing;
+	m_started = g_get_monotonic_time();
+
+	replyStatus("erasing");
+	if (m_subscribed)
+		m_timer = g_timeout_add_seconds(s_heartbeatInterval, &EraseHandler::cbHeartbeat, this);
+
+	nyx_device_handle_t device = nyxSystem;
+	nyx_system_erase_type_t nyx_type = m_nyxType;
+	auto ret = std::make_shared<nyx_error_t>(NYX_ERROR_NONE);
+
+	AsyncTaskPool::instance()->offload(m_message,
+		[device, nyx_type, ret]() {
+			*ret = nyx_system_erase_partition(device, nyx_type/*, error_text*/);
+		},
+		[this, ret]() {
+			if (*ret != NYX_ERROR_NONE) {
+				qCritical("Failed to execute nyx_system_erase_partition, ret : %d", *ret);
+				finish("Failed to execute NYX erase API");
+			}
+			else {
+				finish(nullptr);
+			}
+		});
+}
+
+void EraseHandler::finish(const char* errorText)
+{
+	if (m_timer) {
+		g_source_remove(m_timer);
+		m_timer = 0;
+	}
+
+	JObject reply {{"returnValue", errorText == nullptr}};
+	if (errorText) {
+		qWarning() << errorText;
+		reply.put("errorText", errorText);
+	}
+	if (m_subscribed)
+		reply.put("subscribed", false);
+
+	LS::Error error;
+	if (!LSMessageReply(m_handle, m_message, reply.stringify().c_str(), error))
+		qWarning() << error.what();
+
+	LSMessageUnref(m_message);
+	m_message = nullptr;
+	m_handle = nullptr;
+	m_state = kIdle;
+}
+
+void EraseHandler::replyStatus(const char* status)
+{
+	if (!m_subscribed)
+		return;
+
+	JObject reply {{"returnValue", true}, {"subscribed", true}, {"status", status}};
+	if (m_state == kErasing)
+		reply.put("elapsed", static_cast<int64_t>((g_get_monotonic_time() - m_started) / G_USEC_PER_SEC));
+
+	LS::Error error;
+	if (!LSMessageReply(m_handle, m_message, reply.stringify().c_str(), error))
+		qWarning() << error.what();
+}
+
 /**
  * @brief handle_erase_var
  *
@@ -274,3 +490,21 @@ bool cbSecureWipe(LSHandle* pHandle, LSMessage* pMessage, void* pUserData)
 	else return ERASE(pHandle, pMessage, EraseHandler::kSecureWipe);
 }
 
+/**
+ * @brief handle_erase_cancel
+ *
+ * @param pHandle
+ * @param pMessage
+ * @param pUserData
+ *
+ * @return
+ */
+bool cbCancel(LSHandle* pHandle, LSMessage* pMessage, void* pUserData)
+{
+	PMLOG_TRACE("%s:starting",__FUNCTION__);
+	if (LSMessageIsHubErrorMessage(pMessage)) {  // returns false if message is NULL
+		qWarning("The message received is an error message from the hub");
+		return true;
+	}
+	else return EraseHandler::instance()->Cancel(pHandle, pMessage);
+}
@@ -0,0 +1,291 @@
+// Copyright (c) 2010-2018 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+/*
+ * The image module (sysservice-image.so). This is the only code linked
+ * against QtGui; LunaSysService dlopens it through ImageModule. It must not
+ * use anything from the service binary itself, so logging goes through the
+ * Qt message macros, which the service routes to PmLog.
+ */
+
+#include <errno.h>
+#include <algorithm>
+#include <cstring>
+
+#include <QtCore/QDebug>
+#include <QtCore/QString>
+#include <QtGui/QImage>
+#include <QtGui/QImageReader>
+#include <QtGui/QPainter>
+
+#include "ImageCodec.h"
+#include "ImageHelpers.h"
+
+namespace {
+
+/*
+ *     Makes the image size == width x height, but the image center is now focus_x,focus_y
+ *
+ *     focus_x,focus_y determines the center point of the image. In other words, the final image has the src img's (focus_x,focus_y)
+ *     at its center, and extends +/- width/2 horizontally and +/- height/2 vertically
+ *
+ *     any region of the source image that is not within UL(focus_x-width/2,focus_y-height/2)
+ *                                                       LR(focus_x+width/2,focus_y+height/2)
+ *     ...is matted black
+ */
+QImage clipImageWithFocus(const QImage& image, int focus_x, int focus_y, int width, int height)
+{
+	if (focus_x < 0)
+		focus_x = 0;
+	if (focus_x > image.width())
+		focus_x = image.width();
+	if (focus_y < 0)
+		focus_y = 0;
+	if (focus_y >= image.height())
+		focus_y = image.height();
+
+	qDebug("clipImageWithFocus(): srcImg is ( %d , %d ), focus is ( %d , %d )", image.width(), image.height(), focus_x, focus_y);
+
+	QImage result(width, height, image.format());
+
+	result.fill(Qt::black);
+
+	QPainter p(&result);
+	p.setRenderHint(QPainter::SmoothPixmapTransform);
+	p.translate(-focus_x, -focus_y);
+	p.translate(width >> 1, height >> 1);
+	p.drawImage(QPoint(0,0), image);
+	p.end();
+	return result;
+}
+
+int bitsPerPixel(QImage::Format format)
+{
+	// QImageReader probably won't return all of these, but just to make sure we cover all cases
+	switch (format) {
+	case QImage::Format_ARGB32_Premultiplied:
+	case QImage::Format_ARGB32:
+	case QImage::Format_RGB32:
+		return 32;
+	case QImage::Format_RGB888:
+	case QImage::Format_RGB666:
+	case QImage::Format_ARGB8565_Premultiplied:
+	case QImage::Format_ARGB6666_Premultiplied:
+	case QImage::Format_ARGB8555_Premultiplied:
+		return 24;
+	case QImage::Format_RGB444:
+	case QImage::Format_ARGB4444_Premultiplied:
+	case QImage::Format_RGB16:
+	case QImage::Format_RGB555:
+		return 16;
+	case QImage::Format_Indexed8:
+		return 8;
+	case QImage::Format_Mono:
+	case QImage::Format_MonoLSB:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+size_t bufferBytes(const QImage& image)
+{
+	return image.isNull() ? 0 : size_t(image.bytesPerLine()) * image.height();
+}
+
+class QtImageCodec : public ImageCodec
+{
+public:
+	QtImageCodec() : m_peakBufferBytes(0) {}
+
+	size_t peakBufferBytes() const override { return m_peakBufferBytes; }
+
+	bool info(const std::string& path, ImageInfo& info, std::string& errorText) override
+	{
+		QImageReader reader(QString::fromStdString(path));
+		if (!reader.canRead()) {
+			errorText = reader.errorString().toStdString();
+			return false;
+		}
+
+		info.width = reader.size().width();
+		info.height = reader.size().height();
+		info.bpp = bitsPerPixel(reader.imageFormat());
+		info.format = reader.format().data(); // png/jpg etc
+		return true;
+	}
+
+	bool resize(const std::string& src, const std::string& dest, const char* format,
+	            int width, int height, std::string& errorText) override
+	{
+		QImageReader reader(QString::fromStdString(src));
+		if (!reader.canRead()) {
+			errorText = reader.errorString().toStdString();
+			return false;
+		}
+
+		QImage image;
+		if (!reader.read(&image)) {
+			errorText = reader.errorString().toStdString();
+			return false;
+		}
+		// cropped rescale, see http://qt-project.org/doc/qt-4.8/qt.html#AspectRatioMode-enum
+
+		QImage result(width, height, image.format());
+
+		if (result.isNull()) {
+			errorText = "resize: unable to allocate memory for QImage";
+			return false;
+		}
+
+		noteBuffers(image, result);
+
+		QPainter p(&result);
+		p.setRenderHint(QPainter::SmoothPixmapTransform);
+		p.drawImage(QRect(0,0,width, height), image);
+		p.end();
+
+		if (!result.save(QString::fromStdString(dest), format, 100)) {
+			errorText = "resize: failed to save destination file";
+			return false;
+		}
+
+		return true;
+	}
+
+	bool convert(const std::string& src, const std::string& dest, const char* format,
+	             std::string& errorText) override
+	{
+		QImageReader reader(QString::fromStdString(src));
+		if (!reader.canRead()) {
+			errorText = reader.errorString().toStdString();
+			return false;
+		}
+
+		QImage image;
+		if (!reader.read(&image)) {
+			errorText = reader.errorString().toStdString();
+			return false;
+		}
+		noteBuffers(image);
+
+		image.save(QString::fromStdString(dest), format, 100);
+		return true;
+	}
+
+	bool scaleAndClip(const std::string& src, const std::string& dest, const char* format,
+	                  double scale, bool clip, double focusX, double focusY,
+	                  int width, int height, std::string& errorText) override
+	{
+		QImageReader reader(QString::fromStdString(src));
+		if (!reader.canRead()) {
+			errorText = reader.errorString().toStdString();
+			return false;
+		}
+
+		// used to scale the file before it is actually read to memory
+		double prescale = 1.0;
+		QImage image;
+		if (!readImageWithPrescale(reader, image, prescale)) {
+			errorText = reader.errorString().toStdString();
+			return false;
+		}
+		//scale the image as requested...factor in whatever the prescale did
+		scale /= prescale;
+		qDebug("scaleAndClip(): scale after prescale adjustment: %f, prescale: %f", scale, prescale);
+
+		noteBuffers(image);
+
+		if (scale != 1.0) {
+			QImage scaled = image.scaled(scale * image.width(), scale * image.height());
+			noteBuffers(image, scaled);
+			image = scaled;
+			if (image.isNull()) {
+				errorText = std::strerror(errno);
+				qWarning("scaleAndClip(): cannot scale %s %g times: %s",
+				         src.c_str(), scale, errorText.c_str());
+				return false;
+			}
+		}
+
+		//now refocus as requested
+		if (clip) {
+			QImage clipped = clipImageWithFocus(image, image.width() * focusX, image.height() * focusY, width, height);
+			noteBuffers(image, clipped);
+			image = clipped;
+		}
+
+		//and write out the file
+		if (!image.save(QString::fromStdString(dest), format, 100)) {
+			errorText = std::strerror(errno);
+			qWarning("scaleAndClip(): cannot save %s to %s: %s",
+			         src.c_str(), dest.c_str(), errorText.c_str());
+			return false;
+		}
+		return true;
+	}
+
+	bool focusScale(const std::string& src, const std::string& dest, const char* format,
+	                double focusX, double focusY, double scale,
+	                int width, int height, std::string& errorText) override
+	{
+		QImageReader reader(QString::fromStdString(src));
+		if (!reader.canRead()) {
+			errorText = reader.errorString().toStdString();
+			return false;
+		}
+
+		QImage image;
+		double prescale;
+		if (!readImageWithPrescale(reader, image, prescale)) {
+			errorText = reader.errorString().toStdString();
+			return false;
+		}
+
+		//scale the image as requested...factor in whatever the prescaler did
+		scale /= prescale;
+		qDebug("focusScale(): scale after prescale adjustment: %f, prescale: %f", scale, prescale);
+
+		QImage result(width, height, image.format());
+		noteBuffers(image, result);
+
+		QPainter p(&result);
+		p.translate(height/2, width/2);
+		p.translate(-focusX * image.width(), -focusY * image.height());
+		p.scale(scale, scale);
+		p.drawImage(QPoint(0,0), image);
+		p.end();
+
+		result.save(QString::fromStdString(dest), format, 100);
+		return true;
+	}
+
+private:
+	// source and result of a step are alive at the same time
+	void noteBuffers(const QImage& first, const QImage& second = QImage())
+	{
+		m_peakBufferBytes = std::max(m_peakBufferBytes, bufferBytes(first) + bufferBytes(second));
+	}
+
+	size_t m_peakBufferBytes;
+};
+
+} // anonymous namespace
+
+extern "C" __attribute__((visibility("default"))) ImageCodec* createImageCodec()
+{
+	return new QtImageCodec;
+}
@@ -15,7 +15,8 @@
 // SPDX-License-Identifier: Apache-2.0
 
 #include "ImageHelpers.h"
-#include "Logging.h"
+
+#include <QtCore/QDebug>
 
 #define HALF_DECIMATION_THRESHOLD_H    1500
 #define QUARTER_DECIMATION_THRESHOLD_H 3000
@@ -0,0 +1,173 @@
+// Copyright (c) 2010-2018 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#include "ImageModule.h"
+
+#include <dlfcn.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "Logging.h"
+#include "Settings.h"
+
+static const char* s_modulePath = WEBOS_INSTALL_LIBDIR "/luna-sysservice/sysservice-image.so";
+
+ImageModule::ImageModule()
+	: m_handle(nullptr)
+	, m_codec(nullptr)
+	, m_users(0)
+	, m_idleTimer(0)
+	, m_loadFailed(false)
+	, m_loadCount(0)
+	, m_peakBufferBytes(0)
+{
+}
+
+ImageModule::~ImageModule()
+{
+	if (m_idleTimer)
+		g_source_remove(m_idleTimer);
+	unload();
+}
+
+ImageCodec* ImageModule::acquire()
+{
+	if (m_idleTimer) {
+		g_source_remove(m_idleTimer);
+		m_idleTimer = 0;
+	}
+
+	if (!m_codec && !load())
+		return nullptr;
+
+	++m_users;
+	return m_codec;
+}
+
+void ImageModule::release()
+{
+	if (m_users == 0 || --m_users > 0)
+		return;
+
+	unsigned int idle = Settings::instance()->m_imageModuleIdleUnload;
+	if (idle > 0 && !m_idleTimer)
+		m_idleTimer = g_timeout_add_seconds(idle, &ImageModule::cbIdleUnload, this);
+}
+
+bool ImageModule::load()
+{
+	// a missing or broken module won't get any better by retrying
+	if (m_loadFailed)
+		return false;
+
+	m_handle = dlopen(s_modulePath, RTLD_NOW | RTLD_LOCAL);
+	if (!m_handle) {
+		qCritical("Failed to load image module %s: %s", s_modulePath, dlerror());
+		m_loadFailed = true;
+		return false;
+	}
+
+	CreateImageCodecFunc create = reinterpret_cast<CreateImageCodecFunc>(dlsym(m_handle, IMAGE_CODEC_ENTRY));
+	m_codec = create ? create() : nullptr;
+	if (!m_codec) {
+		qCritical("Image module %s has no usable %s entry point", s_modulePath, IMAGE_CODEC_ENTRY);
+		dlclose(m_handle);
+		m_handle = nullptr;
+		m_loadFailed = true;
+		return false;
+	}
+
+	++m_loadCount;
+	PmLogInfo(sysServiceLogContext(), "IMAGE_MODULE_LOADED", 1,
+	          PMLOGKS("PATH", s_modulePath), "Image module loaded");
+	return true;
+}
+
+void ImageModule::unload()
+{
+	if (!m_handle)
+		return;
+
+	m_peakBufferBytes = peakBufferBytes();
+	delete m_codec;
+	m_codec = nullptr;
+
+	// QtGui may stay mapped if image format plugins it loaded still hold it
+	if (dlclose(m_handle) != 0)
+		qWarning("Failed to unload image module: %s", dlerror());
+	m_handle = nullptr;
+
+	PmLogInfo(sysServiceLogContext(), "IMAGE_MODULE_UNLOADED", 0, "Image module unloaded");
+}
+
+size_t ImageModule::peakBufferBytes() const
+{
+	if (m_codec && m_codec->peakBufferBytes() > m_peakBufferBytes)
+		return m_codec->peakBufferBytes();
+	return m_peakBufferBytes;
+}
+
+void ImageModule::trim()
+{
+	if (m_users > 0)
+		return;
+
+	if (m_idleTimer) {
+		g_source_remove(m_idleTimer);
+		m_idleTimer = 0;
+	}
+	unload();
+}
+
+gboolean ImageModule::cbIdleUnload(gpointer userData)
+{
+	ImageModule* module = static_cast<ImageModule*>(userData);
+	module->m_idleTimer = 0;
+	if (module->m_users == 0)
+		module->unload();
+	return G_SOURCE_REMOVE;
+}
+
+//static
+bool ImageModule::sniffFormat(const std::string& path, std::string* format)
+{
+	unsigned char magic[12] = {0};
+
+	FILE* file = fopen(path.c_str(), "rb");
+	if (!file)
+		return false;
+	size_t n = fread(magic, 1, sizeof(magic), file);
+	fclose(file);
+
+	const char* name = nullptr;
+	if (n >= 8 && memcmp(magic, "\x89PNG\r\n\x1a\n", 8) == 0)
+		name = "png";
+	else if (n >= 3 && magic[0] == 0xff && magic[1] == 0xd8 && magic[2] == 0xff)
+		name = "jpeg";
+	else if (n >= 6 && (memcmp(magic, "GIF87a", 6) == 0 || memcmp(magic, "GIF89a", 6) == 0))
+		name = "gif";
+	else if (n >= 2 && magic[0] == 'B' && magic[1] == 'M')
+		name = "bmp";
+	else if (n >= 12 && memcmp(magic, "RIFF", 4) == 0 && memcmp(magic + 8, "WEBP", 4) == 0)
+		name = "webp";
+
+	if (!name)
+		return false;
+
+	if (format)
+		*format = name;
+	return true;
+}
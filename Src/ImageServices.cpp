@@ -19,10 +19,7 @@
 #include <errno.h>
 #include <glib.h>
 
-#include <QtGui/QImage>
-#include <QtGui/QPainter>
 #include <QtCore/QtGlobal>
-#include <QtGui/QImageReader>
 
 #include <pbnjson.hpp>
 #include <luna-service2++/error.hpp>
@@ -30,7 +27,7 @@
 #include "Utils.h"
 #include "Logging.h"
 #include "JSONUtils.h"
-#include "ImageHelpers.h"
+#include "ImageModule.h"
 
 using namespace pbnjson;
 
@@ -446,40 +443,17 @@ bool ImageServices::lsImageInfo(LSHandle* lsHandle, LSMessage* message,void* use
 		return true;
 
 	std::string srcfile = parser.get()["src"].asString();
-	QImageReader reader(QString::fromStdString(srcfile));
-
-	if(reader.canRead()) {
-		srcWidth = reader.size().width();
-		srcHeight = reader.size().height();
-		// QImageReader probably won't return all of these, but just to make sure we cover all cases
-		switch(reader.imageFormat()) {
-		case QImage::Format_ARGB32_Premultiplied:
-		case QImage::Format_ARGB32:
-		case QImage::Format_RGB32:
-			srcBpp = 32; break;
-		case QImage::Format_RGB888:
-		case QImage::Format_RGB666:
-		case QImage::Format_ARGB8565_Premultiplied:
-		case QImage::Format_ARGB6666_Premultiplied:
-		case QImage::Format_ARGB8555_Premultiplied:
-			srcBpp = 24; break;
-		case QImage::Format_RGB444:
-		case QImage::Format_ARGB4444_Premultiplied:
-		case QImage::Format_RGB16:
-		case QImage::Format_RGB555:
-			srcBpp = 16; break;
-		case QImage::Format_Indexed8:
-			srcBpp = 8; break;
-		case QImage::Format_Mono:
-		case QImage::Format_MonoLSB:
-			srcBpp = 1; break;
-		default:
-			srcBpp = 0;
-		}
-		srcType = reader.format().data(); // png/jpg etc
+	ImageModule::Ref codec;
+	ImageInfo info;
+
+	if (!codec) {
+		errorText = ImageModule::unavailableError();
 	}
-	else {
-		errorText = reader.errorString().toStdString();
+	else if (codec->info(srcfile, info, errorText)) {
+		srcWidth = info.width;
+		srcHeight = info.height;
+		srcBpp = info.bpp;
+		srcType = info.format;
 	}
 
 	JObject reply {{"subscribed", false}};
@@ -551,41 +525,16 @@ bool ImageServices::ezResize(const std::string& pathToSourceFile,
 							 uint32_t widthFinal, uint32_t heightFinal,
 							 std::string& r_errorText)
 {
-	qDebug("From: [%s], To: [%s], target: {Type: [%s], w:%d, h:%d}",
+	SSLOG_DEBUG("From: [%s], To: [%s], target: {Type: [%s], w:%d, h:%d}",
 			pathToSourceFile.c_str(), pathToDestFile.c_str(), destType, widthFinal, heightFinal);
 
-	QImageReader reader(QString::fromStdString(pathToSourceFile));
-	if(!reader.canRead()) {
-		r_errorText = reader.errorString().toStdString();
-		return false;
-	}
-
-	QImage image;
-	if (!reader.read(&image)) {
-		r_errorText = reader.errorString().toStdString();
-		return false;
-	}
-	// cropped rescale, see http://qt-project.org/doc/qt-4.8/qt.html#AspectRatioMode-enum
-
-	QImage result(widthFinal, heightFinal, image.format());
-
-	if(result.isNull()) {
-		r_errorText = "ezResize: unable to allocate memory for QImage";
-		return false;
-	}
-
-	QPainter p(&result);
-	p.setRenderHint(QPainter::SmoothPixmapTransform);
-	p.drawImage(QRect(0,0,widthFinal, heightFinal), image);
-	p.end();
-//    image = image.scaled(widthFinal, heightFinal, Qt::KeepAspectRatioByExpanding);
-	PMLOG_TRACE("About to save image");
-	if(!result.save(QString::fromStdString(pathToDestFile), destType, 100)) {
-		r_errorText = "ezResize: failed to save destination file";
+	ImageModule::Ref codec;
+	if (!codec) {
+		r_errorText = ImageModule::unavailableError();
 		return false;
 	}
 
-	return true;
+	return codec->resize(pathToSourceFile, pathToDestFile, destType, widthFinal, heightFinal, r_errorText);
 }
 
 bool ImageServices::convertImage(const std::string& pathToSourceFile,
@@ -594,15 +543,9 @@ bool ImageServices::convertImage(const std::string& pathToSourceFile,
 								 uint32_t widthFinal,uint32_t heightFinal,
 								 std::string& r_errorText)
 {
-	qDebug("From: [%s], To: [%s], focus:{x:%f,y:%f}, target: {Type: [%s], w:%d, h:%d}, scale: %f",
+	SSLOG_DEBUG("From: [%s], To: [%s], focus:{x:%f,y:%f}, target: {Type: [%s], w:%d, h:%d}, scale: %f",
 			pathToSourceFile.c_str(), pathToDestFile.c_str(), focusX, focusY, destType, widthFinal, heightFinal, scale);
 
-	QImageReader reader(QString::fromStdString(pathToSourceFile));
-	if(!reader.canRead()) {
-		r_errorText = reader.errorString().toStdString();
-		return false;
-	}
-
 	if (focusX < 0)
 		focusX = 0.5;
 	if (focusY < 0)
@@ -615,52 +558,31 @@ bool ImageServices::convertImage(const std::string& pathToSourceFile,
 	//TODO: WARN: strict comparison of float to 0 might fail
 	if (qFuzzyCompare(scale, 0.0))
 		scale = 1.0;
-	qDebug("After adjustments: scale: %f, focus:{x:%f,y:%f}", scale, focusX, focusY);
+	SSLOG_DEBUG("After adjustments: scale: %f, focus:{x:%f,y:%f}", scale, focusX, focusY);
 
-	QImage image;
-	double prescale;
-	if(!readImageWithPrescale(reader, image, prescale)) {
-		r_errorText = reader.errorString().toStdString();
+	ImageModule::Ref codec;
+	if (!codec) {
+		r_errorText = ImageModule::unavailableError();
 		return false;
 	}
 
-	//scale the image as requested...factor in whatever the prescaler did
-	scale /= prescale;
-	qDebug("scale after prescale adjustment: %f, prescale: %f", scale, prescale);
-
-	QImage dest(widthFinal, heightFinal, image.format());
-	QPainter p (&dest);
-	p.translate(heightFinal/2, widthFinal/2);
-	p.translate(-focusX * image.width(), -focusY * image.height());
-	p.scale(scale, scale);
-	p.drawImage(QPoint(0,0), image);
-	p.end();
-
-	dest.save(QString::fromStdString(pathToDestFile), destType, 100);
-	return true;
-
+	return codec->focusScale(pathToSourceFile, pathToDestFile, destType,
+							 focusX, focusY, scale, widthFinal, heightFinal, r_errorText);
 }
 
 bool ImageServices::convertImage(const std::string& pathToSourceFile,
 								 const std::string& pathToDestFile, const char* destType,
 									   std::string& r_errorText)
 {
-	qDebug("From: [%s], To: [%s], target: {Type: [%s]}",
+	SSLOG_DEBUG("From: [%s], To: [%s], target: {Type: [%s]}",
 			pathToSourceFile.c_str(), pathToDestFile.c_str(), destType);
 
-	QImageReader reader(QString::fromStdString(pathToSourceFile));
-	if(!reader.canRead()) {
-		r_errorText = reader.errorString().toStdString();
-		return false;
-	}
-
-	QImage image;
-	if (!reader.read(&image)) {
-		r_errorText = reader.errorString().toStdString();
+	ImageModule::Ref codec;
+	if (!codec) {
+		r_errorText = ImageModule::unavailableError();
 		return false;
 	}
 
-	image.save(QString::fromStdString(pathToDestFile), destType, 100);
-	return true;
+	return codec->convert(pathToSourceFile, pathToDestFile, destType, r_errorText);
 }
 
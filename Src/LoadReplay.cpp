@@ -0,0 +1,440 @@
+// Copyright (c) 2010-2018 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+/*
+ * sysservice-loadreplay: runs the service's handlers on LocalBus, replays a
+ * recorded request mix (or a built-in one) against them and reports
+ * throughput and latency.
+ *
+ * A trace has one request per line:
+ *
+ *   {"method": "/time/getSystemTime", "payload": {}, "sender": "com.webos.app.settings", "at": 1532.5}
+ *
+ * "payload" may also be given as a string. "at" is the time of the request
+ * in ms since the start of the trace and is only used with --speed.
+ *
+ * Latency is measured from queueing a request on the main loop to its first
+ * reply, so it includes the time spent behind other requests.
+ */
+
+#include <stdio.h>
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <glib.h>
+#include <pbnjson.hpp>
+#include <luna-service2/lunaservice.h>
+#include <luna-service2++/error.hpp>
+
+#include "AsyncTask.h"
+#include "ClockHandler.h"
+#include "LocalBus.h"
+#include "Logging.h"
+#include "Mainloop.h"
+#include "PrefsDb.h"
+#include "PrefsFactory.h"
+#include "Settings.h"
+#include "SystemRestore.h"
+#include "TimePrefsHandler.h"
+#include "TimeZoneService.h"
+
+using namespace pbnjson;
+
+namespace {
+
+struct Request {
+	std::string method;
+	std::string payload;
+	std::string sender;
+	double at;
+};
+
+// used without --trace
+const Request s_builtinMix[] = {
+	{ "/getPreferences", R"({"keys":["timeZone","locale","wallpaper"]})", "com.webos.loadreplay", 0 },
+	{ "/setPreferences", R"({"loadReplay.value":"x"})", "com.webos.loadreplay", 0 },
+	{ "/getPreferenceValues", R"({"key":"timeZone"})", "com.webos.loadreplay", 0 },
+	{ "/time/getSystemTime", "{}", "com.webos.loadreplay", 0 },
+	{ "/clock/getTime", "{}", "com.webos.loadreplay", 0 },
+	{ "/timezone/getTimeZoneRules", R"([{"tz":"Europe/London","years":[2026]}])", "com.webos.loadreplay", 0 },
+};
+
+bool loadTrace(const char* path, std::vector<Request>& r_trace)
+{
+	std::ifstream file(path);
+	if (!file) {
+		fprintf(stderr, "Cannot open trace %s\n", path);
+		return false;
+	}
+
+	std::string line;
+	unsigned int lineNo = 0;
+	while (std::getline(file, line)) {
+		++lineNo;
+		if (line.find_first_not_of(" \t\r") == std::string::npos)
+			continue;
+
+		JValue entry = JDomParser::fromString(line);
+		if (!entry.isObject() || !entry["method"].isString()) {
+			fprintf(stderr, "%s:%u: not a request, skipped\n", path, lineNo);
+			continue;
+		}
+
+		Request request;
+		request.method = entry["method"].asString();
+
+		JValue payload = entry["payload"];
+		if (payload.isString())
+			request.payload = payload.asString();
+		else if (payload.isObject() || payload.isArray())
+			request.payload = payload.stringify();
+		else
+			request.payload = "{}";
+
+		request.sender = entry["sender"].isString() ? entry["sender"].asString() : std::string("com.webos.loadreplay");
+		request.at = entry["at"].isNumber() ? entry["at"].asNumber<double>() : 0;
+
+		r_trace.push_back(request);
+	}
+
+	return true;
+}
+
+// value at the given fraction of sorted latencies, in ms
+double percentile(const std::vector<gint64>& sorted, double fraction)
+{
+	if (sorted.empty())
+		return 0;
+	size_t index = std::min(sorted.size() - 1, size_t(fraction * sorted.size()));
+	return sorted[index] / 1000.0;
+}
+
+class Replay
+{
+public:
+	Replay(const std::vector<Request>& trace, unsigned int repeat, unsigned int concurrency,
+	       double speed, unsigned int timeoutMs)
+		: m_trace(trace)
+		, m_total(trace.size() * repeat)
+		, m_concurrency(std::max(1u, concurrency))
+		, m_speed(speed)
+		, m_timeout(gint64(timeoutMs) * 1000)
+		, m_span(0)
+		, m_next(0)
+		, m_done(0)
+		, m_updates(0)
+		, m_begin(0)
+		, m_end(0)
+		, m_paceTimer(0)
+		, m_timeoutTimer(0)
+	{
+		for (const Request& request : m_trace)
+			m_span = std::max(m_span, request.at);
+		m_results.resize(m_total);
+	}
+
+	void start()
+	{
+		m_begin = g_get_monotonic_time();
+		m_timeoutTimer = g_timeout_add(100, &Replay::cbCheckTimeouts, this);
+		fill();
+	}
+
+	void report() const;
+
+private:
+	struct Result {
+		gint64 started;
+		gint64 latency;     //-1 until answered
+		bool failed;
+		bool timedOut;
+	};
+
+	const Request& request(size_t index) const
+	{ return m_trace[index % m_trace.size()]; }
+
+	// due time of a request with --speed, repeats follow each other
+	gint64 dueTime(size_t index) const
+	{
+		double at = request(index).at + (index / m_trace.size()) * m_span;
+		return m_begin + gint64(at * 1000 / m_speed);
+	}
+
+	void fill()
+	{
+		while (m_pending.size() < m_concurrency && m_next < m_total) {
+			if (m_speed > 0) {
+				gint64 wait = dueTime(m_next) - g_get_monotonic_time();
+				if (wait > 0) {
+					if (!m_paceTimer)
+						m_paceTimer = g_timeout_add(std::max<gint64>(1, wait / 1000), &Replay::cbPace, this);
+					return;
+				}
+			}
+			startOne(m_next++);
+		}
+	}
+
+	void startOne(size_t index)
+	{
+		const Request& req = request(index);
+		Result& result = m_results[index];
+		result.started = g_get_monotonic_time();
+		result.latency = -1;
+		result.failed = false;
+		result.timedOut = false;
+
+		m_pending.insert(index);
+		if (!LocalBus::call(req.method, req.payload, req.sender,
+		                    [this, index](const char* payload) { replied(index, payload); })) {
+			// checked against the registered methods before the run, can't happen
+			result.latency = 0;
+			result.failed = true;
+			finish(index);
+		}
+	}
+
+	void replied(size_t index, const char* payload)
+	{
+		Result& result = m_results[index];
+		if (result.latency >= 0 || result.timedOut) {
+			++m_updates;
+			return;
+		}
+
+		result.latency = g_get_monotonic_time() - result.started;
+		JValue reply = JDomParser::fromString(payload ? payload : "");
+		result.failed = !reply.isObject() || !reply["returnValue"].isBoolean() || !reply["returnValue"].asBool();
+		finish(index);
+	}
+
+	void finish(size_t index)
+	{
+		m_pending.erase(index);
+		if (++m_done == m_total) {
+			m_end = g_get_monotonic_time();
+			g_source_remove(m_timeoutTimer);
+			m_timeoutTimer = 0;
+			g_main_loop_quit(g_mainloop.get());
+			return;
+		}
+		fill();
+	}
+
+	static gboolean cbPace(gpointer data)
+	{
+		Replay* replay = static_cast<Replay*>(data);
+		replay->m_paceTimer = 0;
+		replay->fill();
+		return G_SOURCE_REMOVE;
+	}
+
+	static gboolean cbCheckTimeouts(gpointer data)
+	{
+		Replay* replay = static_cast<Replay*>(data);
+		gint64 now = g_get_monotonic_time();
+
+		std::vector<size_t> expired;
+		for (size_t index : replay->m_pending) {
+			if (now - replay->m_results[index].started > replay->m_timeout)
+				expired.push_back(index);
+		}
+		for (size_t index : expired) {
+			replay->m_results[index].timedOut = true;
+			replay->finish(index);
+			if (!replay->m_timeoutTimer)
+				return G_SOURCE_REMOVE;
+		}
+		return G_SOURCE_CONTINUE;
+	}
+
+private:
+	const std::vector<Request>& m_trace;
+	std::vector<Result> m_results;
+	std::set<size_t> m_pending;
+	size_t m_total;
+	unsigned int m_concurrency;
+	double m_speed;
+	gint64 m_timeout;
+	double m_span;
+	size_t m_next;
+	size_t m_done;
+	uint64_t m_updates;
+	gint64 m_begin;
+	gint64 m_end;
+	guint m_paceTimer;
+	guint m_timeoutTimer;
+};
+
+void Replay::report() const
+{
+	std::vector<gint64> all;
+	std::map<std::string, std::vector<gint64>> byMethod;
+	size_t failed = 0, timedOut = 0;
+
+	for (size_t i = 0; i < m_results.size(); ++i) {
+		const Result& result = m_results[i];
+		if (result.timedOut) {
+			++timedOut;
+			continue;
+		}
+		if (result.failed)
+			++failed;
+		all.push_back(result.latency);
+		byMethod[request(i).method].push_back(result.latency);
+	}
+	std::sort(all.begin(), all.end());
+
+	double seconds = (m_end - m_begin) / 1000000.0;
+	printf("requests      %zu (failed %zu, timed out %zu, subscription updates %llu)\n",
+	       m_total, failed, timedOut, static_cast<unsigned long long>(m_updates));
+	printf("duration      %.3f s\n", seconds);
+	printf("throughput    %.1f req/s\n", seconds > 0 ? m_total / seconds : 0.0);
+	printf("latency (ms)  p50 %.3f  p90 %.3f  p99 %.3f  p99.9 %.3f  max %.3f\n\n",
+	       percentile(all, 0.5), percentile(all, 0.9), percentile(all, 0.99),
+	       percentile(all, 0.999), all.empty() ? 0.0 : all.back() / 1000.0);
+
+	printf("%-36s %8s %9s %9s %9s\n", "method", "count", "p50", "p99", "max");
+	for (auto& method : byMethod) {
+		std::vector<gint64>& latencies = method.second;
+		std::sort(latencies.begin(), latencies.end());
+		printf("%-36s %8zu %9.3f %9.3f %9.3f\n", method.first.c_str(), latencies.size(),
+		       percentile(latencies, 0.5), percentile(latencies, 0.99), latencies.back() / 1000.0);
+	}
+
+	const LocalBus::Counters& bus = LocalBus::counters();
+	printf("\nbus: %llu dispatched, %llu replies, %llu subscriptions, %llu calls to other services\n",
+	       static_cast<unsigned long long>(bus.dispatched), static_cast<unsigned long long>(bus.replies),
+	       static_cast<unsigned long long>(bus.subscriptions), static_cast<unsigned long long>(bus.outgoingCalls));
+}
+
+} // anonymous namespace
+
+int main(int argc, char** argv)
+{
+	gchar* tracePath = nullptr;
+	gchar* dbPath = nullptr;
+	gchar* storage = nullptr;
+	gchar* logLevel = nullptr;
+	gint concurrency = 1;
+	gint repeat = 1;
+	gint timeoutMs = 5000;
+	gdouble speed = 0;
+
+	static GOptionEntry entries[] = {
+		{ "trace", 't', 0, G_OPTION_ARG_FILENAME, &tracePath, "requests to replay, one JSON object per line (default: built-in mix)", "file" },
+		{ "concurrency", 'c', 0, G_OPTION_ARG_INT, &concurrency, "requests in flight at a time (default: 1)", "n" },
+		{ "repeat", 'r', 0, G_OPTION_ARG_INT, &repeat, "replay the trace n times (default: 1)", "n" },
+		{ "speed", 's', 0, G_OPTION_ARG_DOUBLE, &speed, "follow the recorded timing, sped up f times (default: as fast as possible)", "f" },
+		{ "timeout", 0, 0, G_OPTION_ARG_INT, &timeoutMs, "give up on a request after ms (default: 5000)", "ms" },
+		{ "db", 0, 0, G_OPTION_ARG_FILENAME, &dbPath, "preferences db to run against (default: /tmp/sysservice-loadreplay.db)", "file" },
+		{ "storage", 0, 0, G_OPTION_ARG_STRING, &storage, "preferences storage engine, sqlite or log (default: as in sysservice.conf)", "engine" },
+		{ "logger", 'l', 0, G_OPTION_ARG_STRING, &logLevel, "log level", "level" },
+		{ NULL }
+	};
+
+	GError* error = nullptr;
+	GOptionContext* context = g_option_context_new("- replay requests against the sysservice handlers");
+	g_option_context_add_main_entries(context, entries, nullptr);
+	bool parsed = g_option_context_parse(context, &argc, &argv, &error);
+	g_option_context_free(context);
+	if (!parsed) {
+		g_printerr("Error: %s\n", error->message);
+		g_error_free(error);
+		return 1;
+	}
+	if (repeat < 1 || concurrency < 1 || timeoutMs < 1 || speed < 0) {
+		g_printerr("Error: repeat, concurrency and timeout must be positive\n");
+		return 1;
+	}
+
+	std::vector<Request> trace;
+	if (tracePath) {
+		if (!loadTrace(tracePath, trace))
+			return 1;
+	}
+	else {
+		trace.assign(std::begin(s_builtinMix), std::end(s_builtinMix));
+	}
+
+	g_mainloop.reset(g_main_loop_new(nullptr, false));
+
+	qInstallMessageHandler(outputQtMessages);
+	setLogLevel(logLevel ? logLevel : "");
+
+	Settings* settings = Settings::instance();
+
+	// have to be set before the db is opened
+	PrefsDb::s_prefsDbPath = dbPath ? dbPath : "/tmp/sysservice-loadreplay.db";
+	if (storage)
+		settings->m_prefsStorage = storage;
+
+	AsyncTaskPool* async_pool = AsyncTaskPool::instance();
+	PrefsDb* prefs_db = PrefsDb::instance();
+	SystemRestore* system_restore = SystemRestore::instance();
+	system_restore->refreshDefaultSettings();
+
+	LS::Error lsError;
+	LSHandle* serviceHandle = nullptr;
+	LSRegister(LocalBus::s_serviceName, &serviceHandle, lsError);
+
+	PrefsFactory* prefs_factory = PrefsFactory::instance();
+	prefs_factory->setServiceHandle(serviceHandle);
+
+	ClockHandler clockHandler;
+	(void) clockHandler.setServiceHandle(serviceHandle);
+	clockHandler.attachTimePrefs(TimePrefsHandler::instance());
+
+	TimeZoneService* time_zone_srv = TimeZoneService::instance();
+	time_zone_srv->setServiceHandle(serviceHandle);
+
+	size_t unknown = trace.size();
+	trace.erase(std::remove_if(trace.begin(), trace.end(),
+	                           [](const Request& request) { return !LocalBus::hasMethod(request.method); }),
+	            trace.end());
+	unknown -= trace.size();
+	if (unknown)
+		fprintf(stderr, "%zu requests for methods the harness doesn't serve were skipped\n", unknown);
+
+	int result = 0;
+	if (trace.empty()) {
+		fprintf(stderr, "Nothing to replay\n");
+		result = 1;
+	}
+	else {
+		Replay replay(trace, repeat, concurrency, speed, timeoutMs);
+		replay.start();
+		g_main_loop_run(g_mainloop.get());
+		replay.report();
+	}
+
+	LocalBus::dropSubscriptions();
+	LSUnregister(serviceHandle, lsError);
+
+	delete async_pool;
+	delete time_zone_srv;
+	delete prefs_factory;
+	delete system_restore;
+	delete prefs_db;
+	delete settings;
+
+	return result;
+}
@@ -0,0 +1,472 @@
+// Copyright (c) 2010-2018 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+/*
+ * Stand-in for libluna-service2, see LocalBus.h. Only the part of the LS2
+ * API the service uses is implemented, and only as far as a single process
+ * talking to itself needs it.
+ */
+
+#include "LocalBus.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <map>
+#include <vector>
+
+#include <glib.h>
+#include <pbnjson.hpp>
+#include <luna-service2/lunaservice.h>
+
+struct LSHandle
+{
+	struct Category {
+		const LSMethod* methods;
+		void* data;
+	};
+
+	std::string name;
+	std::map<std::string, Category> categories;
+	std::map<std::string, std::vector<LSMessage*>> subscriptions;
+};
+
+struct LSMessage
+{
+	int refs;
+	LSHandle* handle;
+	std::string category;
+	std::string method;
+	std::string payload;
+	std::string sender;
+	LocalBus::ReplyFunc onReply;
+};
+
+struct LSSubscriptionIter
+{
+	std::vector<LSMessage*> messages;
+	size_t next;
+};
+
+namespace LocalBus {
+
+const char* s_serviceName = "com.webos.service.systemservice";
+
+}
+
+namespace {
+
+std::vector<LSHandle*> s_handles;
+LocalBus::Counters s_counters = { 0, 0, 0, 0 };
+LSMessageToken s_lastToken = 0;
+
+void setError(LSError* lserror, const char* func, const char* message)
+{
+	if (!lserror)
+		return;
+	g_free(lserror->message);
+	lserror->error_code = -1;
+	lserror->message = g_strdup(message);
+	lserror->func = func;
+}
+
+LSHandle* findHandle(const std::string& name)
+{
+	for (LSHandle* sh : s_handles) {
+		if (sh->name == name)
+			return sh;
+	}
+	return nullptr;
+}
+
+// "/time/getSystemTime" -> "/time", "getSystemTime"; "/getPreferences" -> "/", "getPreferences"
+bool splitMethod(const std::string& path, std::string& category, std::string& method)
+{
+	size_t slash = path.rfind('/');
+	if (slash == std::string::npos || slash + 1 == path.size())
+		return false;
+
+	category = slash == 0 ? std::string("/") : path.substr(0, slash);
+	method = path.substr(slash + 1);
+	return true;
+}
+
+const LSMethod* findMethod(LSHandle* sh, const std::string& category, const std::string& method, void** data)
+{
+	auto it = sh->categories.find(category);
+	if (it == sh->categories.end() || !it->second.methods)
+		return nullptr;
+
+	for (const LSMethod* m = it->second.methods; m->name; ++m) {
+		if (method == m->name) {
+			*data = it->second.data;
+			return m;
+		}
+	}
+	return nullptr;
+}
+
+gboolean cbDeliver(gpointer userData)
+{
+	LSMessage* message = static_cast<LSMessage*>(userData);
+
+	void* categoryData = nullptr;
+	const LSMethod* method = findMethod(message->handle, message->category, message->method, &categoryData);
+	if (method) {
+		(void) method->function(message->handle, message, categoryData);
+	}
+	else {
+		std::string reply = "{\"returnValue\":false,\"errorCode\":-1,\"errorText\":\"Unknown method \\\""
+		                    + message->method + "\\\" for category \\\"" + message->category + "\\\"\"}";
+		LSMessageReply(message->handle, message, reply.c_str(), nullptr);
+	}
+
+	LSMessageUnref(message);
+	return G_SOURCE_REMOVE;
+}
+
+// queued on the main loop at the priority the hub delivers messages with
+bool post(LSHandle* sh, const std::string& path, const std::string& payload,
+          const std::string& sender, LocalBus::ReplyFunc onReply)
+{
+	LSMessage* message = new LSMessage;
+	message->refs = 1;
+	message->handle = sh;
+	message->payload = payload;
+	message->sender = sender;
+	message->onReply = std::move(onReply);
+	if (!splitMethod(path, message->category, message->method)) {
+		delete message;
+		return false;
+	}
+
+	++s_counters.dispatched;
+	g_idle_add_full(G_PRIORITY_DEFAULT, cbDeliver, message, nullptr);
+	return true;
+}
+
+bool callService(LSHandle* sh, const char* uri, const char* payload, LSFilterFunc callback,
+                 void* ctx, bool oneReply, LSMessageToken* token, LSError* lserror)
+{
+	static const char s_scheme[] = "luna://";
+
+	std::string address = uri ? uri : "";
+	if (address.compare(0, sizeof(s_scheme) - 1, s_scheme) != 0) {
+		setError(lserror, __FUNCTION__, "Invalid uri");
+		return false;
+	}
+	address.erase(0, sizeof(s_scheme) - 1);
+
+	size_t slash = address.find('/');
+	if (slash == std::string::npos) {
+		setError(lserror, __FUNCTION__, "Invalid uri");
+		return false;
+	}
+
+	if (token)
+		*token = ++s_lastToken;
+
+	LSHandle* target = findHandle(address.substr(0, slash));
+	if (!target) {
+		++s_counters.outgoingCalls;
+		return true;
+	}
+
+	bool answered = false;
+	LocalBus::ReplyFunc onReply = [sh, callback, ctx, oneReply, answered](const char* reply) mutable {
+		if (!callback || (oneReply && answered))
+			return;
+		answered = true;
+
+		LSMessage* message = new LSMessage;
+		message->refs = 1;
+		message->handle = sh;
+		message->payload = reply;
+		message->sender = sh->name;
+		(void) callback(sh, message, ctx);
+		LSMessageUnref(message);
+	};
+
+	return post(target, address.substr(slash), payload ? payload : "{}", sh->name, std::move(onReply));
+}
+
+}
+
+namespace LocalBus {
+
+bool call(const std::string& method, const std::string& payload,
+          const std::string& sender, ReplyFunc onReply)
+{
+	LSHandle* sh = findHandle(s_serviceName);
+	if (!sh || !hasMethod(method))
+		return false;
+
+	return post(sh, method, payload, sender, std::move(onReply));
+}
+
+bool hasMethod(const std::string& method)
+{
+	LSHandle* sh = findHandle(s_serviceName);
+	std::string categoryName, methodName;
+	void* data;
+	return sh && splitMethod(method, categoryName, methodName) &&
+	       findMethod(sh, categoryName, methodName, &data);
+}
+
+const Counters& counters()
+{
+	return s_counters;
+}
+
+void dropSubscriptions()
+{
+	for (LSHandle* sh : s_handles) {
+		for (auto& subscription : sh->subscriptions) {
+			for (LSMessage* message : subscription.second)
+				LSMessageUnref(message);
+		}
+		sh->subscriptions.clear();
+	}
+}
+
+}
+
+bool LSErrorInit(LSError* lserror)
+{
+	memset(lserror, 0, sizeof(*lserror));
+	return true;
+}
+
+void LSErrorFree(LSError* lserror)
+{
+	if (!lserror)
+		return;
+	g_free(lserror->message);
+	LSErrorInit(lserror);
+}
+
+bool LSErrorIsSet(LSError* lserror)
+{
+	return lserror && lserror->message;
+}
+
+void LSErrorPrint(LSError* lserror, FILE* out)
+{
+	if (LSErrorIsSet(lserror))
+		fprintf(out, "LUNASERVICE ERROR %d: %s (%s)\n", lserror->error_code, lserror->message,
+		        lserror->func ? lserror->func : "");
+}
+
+bool LSRegister(const char* name, LSHandle** sh, LSError* lserror)
+{
+	*sh = new LSHandle;
+	(*sh)->name = name ? name : "";
+	s_handles.push_back(*sh);
+	return true;
+}
+
+bool LSUnregister(LSHandle* sh, LSError* lserror)
+{
+	for (auto it = s_handles.begin(); it != s_handles.end(); ++it) {
+		if (*it == sh) {
+			s_handles.erase(it);
+			break;
+		}
+	}
+
+	for (auto& subscription : sh->subscriptions) {
+		for (LSMessage* message : subscription.second)
+			LSMessageUnref(message);
+	}
+	delete sh;
+	return true;
+}
+
+bool LSGmainAttach(LSHandle* sh, GMainLoop* mainLoop, LSError* lserror)
+{
+	// messages are always delivered on the default context
+	return true;
+}
+
+bool LSGmainContextAttach(LSHandle* sh, GMainContext* context, LSError* lserror)
+{
+	// not thread-safe, the replay runs everything on the main loop
+	setError(lserror, __FUNCTION__, "Not supported by the local bus");
+	return false;
+}
+
+bool LSRegisterCategory(LSHandle* sh, const char* category, LSMethod* methods,
+                        LSSignal* langis, LSProperty* properties, LSError* lserror)
+{
+	LSHandle::Category& entry = sh->categories[category];
+	entry.methods = methods;
+	return true;
+}
+
+bool LSCategorySetData(LSHandle* sh, const char* category, void* userData, LSError* lserror)
+{
+	auto it = sh->categories.find(category);
+	if (it == sh->categories.end()) {
+		setError(lserror, __FUNCTION__, "Category not registered");
+		return false;
+	}
+	it->second.data = userData;
+	return true;
+}
+
+bool LSRegisterServerStatusEx(LSHandle* sh, const char* serviceName, LSServerStatusFunc func,
+                              void* ctxt, void** cookie, LSError* lserror)
+{
+	// nobody ever comes or goes on the local bus
+	if (cookie)
+		*cookie = sh;
+	return true;
+}
+
+bool LSCancelServerStatus(LSHandle* sh, void* cookie, LSError* lserror)
+{
+	return true;
+}
+
+bool LSCall(LSHandle* sh, const char* uri, const char* payload, LSFilterFunc callback,
+            void* ctx, LSMessageToken* ret_token, LSError* lserror)
+{
+	return callService(sh, uri, payload, callback, ctx, false, ret_token, lserror);
+}
+
+bool LSCallOneReply(LSHandle* sh, const char* uri, const char* payload, LSFilterFunc callback,
+                    void* ctx, LSMessageToken* ret_token, LSError* lserror)
+{
+	return callService(sh, uri, payload, callback, ctx, true, ret_token, lserror);
+}
+
+void LSMessageRef(LSMessage* message)
+{
+	++message->refs;
+}
+
+void LSMessageUnref(LSMessage* message)
+{
+	if (--message->refs == 0)
+		delete message;
+}
+
+const char* LSMessageGetPayload(LSMessage* message)
+{
+	return message->payload.c_str();
+}
+
+const char* LSMessageGetCategory(LSMessage* message)
+{
+	return message->category.c_str();
+}
+
+const char* LSMessageGetMethod(LSMessage* message)
+{
+	return message->method.c_str();
+}
+
+const char* LSMessageGetSender(LSMessage* message)
+{
+	return message->sender.c_str();
+}
+
+const char* LSMessageGetSenderServiceName(LSMessage* message)
+{
+	return message->sender.c_str();
+}
+
+const char* LSMessageGetApplicationID(LSMessage* message)
+{
+	return nullptr;
+}
+
+bool LSMessageIsHubErrorMessage(LSMessage* message)
+{
+	return false;
+}
+
+bool LSMessageIsSubscription(LSMessage* message)
+{
+	pbnjson::JValue root = pbnjson::JDomParser::fromString(message->payload);
+	return root.isObject() && root["subscribe"].isBoolean() && root["subscribe"].asBool();
+}
+
+bool LSMessageReply(LSHandle* sh, LSMessage* message, const char* replyPayload, LSError* lserror)
+{
+	++s_counters.replies;
+
+	// the callback may drop the last subscription holding the message
+	LSMessageRef(message);
+	if (message->onReply)
+		message->onReply(replyPayload);
+	LSMessageUnref(message);
+	return true;
+}
+
+bool LSMessageRespond(LSMessage* message, const char* replyPayload, LSError* lserror)
+{
+	return LSMessageReply(message->handle, message, replyPayload, lserror);
+}
+
+bool LSSubscriptionAdd(LSHandle* sh, const char* key, LSMessage* message, LSError* lserror)
+{
+	LSMessageRef(message);
+	sh->subscriptions[key].push_back(message);
+	++s_counters.subscriptions;
+	return true;
+}
+
+bool LSSubscriptionAcquire(LSHandle* sh, const char* key, LSSubscriptionIter** ret_iter, LSError* lserror)
+{
+	LSSubscriptionIter* iter = new LSSubscriptionIter;
+	iter->next = 0;
+
+	auto it = sh->subscriptions.find(key);
+	if (it != sh->subscriptions.end())
+		iter->messages = it->second;
+	for (LSMessage* message : iter->messages)
+		LSMessageRef(message);
+
+	*ret_iter = iter;
+	return true;
+}
+
+void LSSubscriptionRelease(LSSubscriptionIter* iter)
+{
+	for (LSMessage* message : iter->messages)
+		LSMessageUnref(message);
+	delete iter;
+}
+
+bool LSSubscriptionHasNext(LSSubscriptionIter* iter)
+{
+	return iter->next < iter->messages.size();
+}
+
+LSMessage* LSSubscriptionNext(LSSubscriptionIter* iter)
+{
+	return iter->messages[iter->next++];
+}
+
+bool LSSubscriptionReply(LSHandle* sh, const char* key, const char* payload, LSError* lserror)
+{
+	LSSubscriptionIter* iter = nullptr;
+	LSSubscriptionAcquire(sh, key, &iter, lserror);
+	while (LSSubscriptionHasNext(iter))
+		LSMessageReply(sh, LSSubscriptionNext(iter), payload, lserror);
+	LSSubscriptionRelease(iter);
+	return true;
+}
@@ -29,6 +29,22 @@ static const char* s_custLocaleFile = WEBOS_INSTALL_SYSMGR_DATADIR "/customizati
 static const char* s_defaultRegionFile = WEBOS_INSTALL_WEBOS_SYSCONFDIR "/region.json";
 static const char* s_custRegionFile = WEBOS_INSTALL_SYSMGR_DATADIR "/customization/region.json";
 
+static std::string valuesReply(const JValue &values)
+{
+	JValue reply = values.duplicate();
+	reply.put("returnValue", true);
+	return reply.stringify();
+}
+
+static const JValue& residentValues(JValue& values, const std::string& reply)
+{
+	if (values.isNull()) {
+		values = JDomParser::fromString(reply);
+		values.remove("returnValue");
+	}
+	return values;
+}
+
 LocalePrefsHandler::LocalePrefsHandler(LSHandle* serviceHandle)
 	: PrefsHandler(serviceHandle)
 {
@@ -74,28 +90,8 @@ bool LocalePrefsHandler::validateLocale(const JValue &value)
 	}
 
 	if (!languageCode.empty() && !countryCode.empty()) {
-		bool found = false;
-
-		for (LocaleEntryList::const_iterator it = m_localeEntryList.begin();
-		it != m_localeEntryList.end(); ++it) {
-
-			const LocaleEntry& locEntry = (*it);
-			if (locEntry.language.second == languageCode) {
-
-				for (NameCodePairList::const_iterator iter = locEntry.countries.begin();
-				iter != locEntry.countries.end(); ++iter) {
-
-					const NameCodePair& countryEntry = (*iter);
-					if (countryEntry.second == countryCode) {
-						found = true;
-						break;
-					}
-				}
-				if (found)
-					break;
-			}
-		}
-		if (!found)
+		auto it = m_localeIndex.find(languageCode);
+		if (it == m_localeIndex.end() || !it->second.count(countryCode))
 			return false;
 	}
 
@@ -119,21 +115,8 @@ bool LocalePrefsHandler::validateRegion(const JValue &value)
 		regionCode = label.asString();
 	}
 
-	if (!regionCode.empty()) {
-		bool found = false;
-
-		for (RegionEntryList::const_iterator it = m_regionEntryList.begin();
-		it != m_regionEntryList.end(); ++it) {
-
-			const RegionEntry& rEntry = (*it);
-			if (rEntry.region[2] == regionCode) {
-				found=true;
-				break;
-			}
-		}
-		if (!found)
-			return false;
-	}
+	if (!regionCode.empty() && !m_regionIndex.count(regionCode))
+		return false;
 
 	return true;
 
@@ -169,64 +152,48 @@ void LocalePrefsHandler::valueChanged(const std::string& key, const JValue &valu
 		valueChangedRegion(value);
 }
 
-JValue LocalePrefsHandler::valuesForLocale()
+JValue LocalePrefsHandler::valuesForKey(const std::string& key)
 {
-	JObject json;
-	JArray langArrayObj;
-
-	for (LocaleEntryList::const_iterator it = m_localeEntryList.begin();
-	it != m_localeEntryList.end(); ++it) {
-
-		const LocaleEntry& locEntry = (*it);
-		JObject langObj {{"languageName", locEntry.language.first},
-		                 {"languageCode", locEntry.language.second}};
-
-		JArray countryArrayObj;
-		for (NameCodePairList::const_iterator iter = locEntry.countries.begin();
-		iter != locEntry.countries.end(); ++iter) {
-			JObject countryObj {{"countryName", (*iter).first.c_str()},
-			                    {"countryCode", (*iter).second.c_str()}};
-			countryArrayObj.append(countryObj);
-		}
-
-		langObj.put("countries", countryArrayObj);
-		langArrayObj.append(langObj);
-	}
-
-	json.put("locale", langArrayObj);
-
-	return json;
+	// callers add returnValue & co, so hand out copies
+	if (key == "locale")
+		return residentValues(m_localeValues, m_localeReply).duplicate();
+	else if (key == "region")
+		return residentValues(m_regionValues, m_regionReply).duplicate();
+	else
+		return JObject();
 }
 
-JValue LocalePrefsHandler::valuesForRegion()
+const std::string* LocalePrefsHandler::valuesReplyForKey(const std::string& key)
 {
-	JObject json;
-	JArray regArrayObj;
+	if (key == "locale")
+		return &m_localeReply;
+	else if (key == "region")
+		return &m_regionReply;
+	else
+		return nullptr;
+}
 
-	for (RegionEntryList::const_iterator it = m_regionEntryList.begin();
-	it != m_regionEntryList.end(); ++it) {
+size_t LocalePrefsHandler::memoryUsed() const
+{
+	size_t used = m_localeReply.capacity() + m_regionReply.capacity();
 
-		const RegionEntry& regEntry = (*it);
-		JObject regObj = {{"shortCountryName", regEntry.region[0]},
-		                  {"countryName", regEntry.region[1]},
-		                  {"countryCode", regEntry.region[2]}};
+	// a resident DOM takes at least as much as its serialized form
+	if (!m_localeValues.isNull())
+		used += m_localeReply.size();
+	if (!m_regionValues.isNull())
+		used += m_regionReply.size();
 
-		regArrayObj.append(regObj);
-	}
+	for (const auto& language : m_localeIndex)
+		used += language.first.capacity() + language.second.size() * sizeof(std::string);
+	used += m_regionIndex.size() * sizeof(std::string);
 
-	json.put("region", regArrayObj);
-	
-	return json;
+	return used;
 }
-	
-JValue LocalePrefsHandler::valuesForKey(const std::string& key)
+
+void LocalePrefsHandler::releaseCaches()
 {
-	if (key == "locale")
-		return valuesForLocale();
-	else if (key == "region")
-		return valuesForRegion();
-	else
-		return JObject();
+	m_localeValues = JValue();
+	m_regionValues = JValue();
 }
 
 void LocalePrefsHandler::init()
@@ -284,91 +251,101 @@ void LocalePrefsHandler::readCurrentLocaleSetting()
 
 void LocalePrefsHandler::readLocaleFile()
 {
-	// Read the locale file
-	JValue root = JDomParser::fromFile(s_custLocaleFile);
-	if (!root.isObject())
-		root = JDomParser::fromFile(s_defaultLocaleFile);
-	if (!root.isObject()) {
-		qCritical() << "Failed to load locale files: [" << s_custLocaleFile << "] nor [" << s_defaultLocaleFile << "]";
-		return;
-	}
+	JArray langArrayObj;
 
-	JValue locale = root["locale"];
-	if (!locale.isArray()) {
-		qCritical() << "Failed to get locale array from locale file";
-		return;
-	}
+	do {
+		// Read the locale file
+		JValue root = JDomParser::fromFile(s_custLocaleFile);
+		if (!root.isObject())
+			root = JDomParser::fromFile(s_defaultLocaleFile);
+		if (!root.isObject()) {
+			qCritical() << "Failed to load locale files: [" << s_custLocaleFile << "] nor [" << s_defaultLocaleFile << "]";
+			break;
+		}
 
-	for (const JValue loc: locale.items()) {
+		JValue locale = root["locale"];
+		if (!locale.isArray()) {
+			qCritical() << "Failed to get locale array from locale file";
+			break;
+		}
+
+		for (const JValue loc: locale.items()) {
 
-		LocaleEntry localeEntry;
+			JValue languageName = loc["languageName"];
+			if (!languageName.isString()) continue;
 
-		JValue label = loc["languageName"];
-		if (!label.isString()) continue;
-		localeEntry.language.first = label.asString();
+			JValue languageCode = loc["languageCode"];
+			if (!languageCode.isString()) continue;
 
-		label = loc["languageCode"];
-		if (!label.isString()) continue;
-		localeEntry.language.second = label.asString();
+			JValue countries = loc["countries"];
+			if (!countries.isArray()) continue;
 
-		JValue countries = loc["countries"];
-		if (!countries.isArray()) continue;
+			CodeSet& countryCodes = m_localeIndex[languageCode.asString()];
+			JArray countryArrayObj;
 
-		for (const JValue cnt: countries.items()) {
-			NameCodePair country;
+			for (const JValue cnt: countries.items()) {
+				JValue countryName = cnt["countryName"];
+				if (!countryName.isString()) continue;
 
-			label = cnt["countryName"];
-			if (!label.isString()) continue;
-			country.first = label.asString();
+				JValue countryCode = cnt["countryCode"];
+				if (!countryCode.isString()) continue;
 
-			label = cnt["countryCode"];
-			if (!label.isString()) continue;
-			country.second = label.asString();
+				countryCodes.insert(countryCode.asString());
+				countryArrayObj.append(JObject {{"countryName", countryName.asString()},
+				                                {"countryCode", countryCode.asString()}});
+			}
 
-			localeEntry.countries.push_back(country);
+			langArrayObj.append(JObject {{"languageName", languageName.asString()},
+			                             {"languageCode", languageCode.asString()},
+			                             {"countries", countryArrayObj}});
 		}
+	} while (false);
 
-		m_localeEntryList.push_back(localeEntry);
-	}
+	m_localeValues = JObject {{"locale", langArrayObj}};
+	m_localeReply = valuesReply(m_localeValues);
 }
 
 void LocalePrefsHandler::readRegionFile() 
 {
-	// Read the locale file
-	JValue root = JDomParser::fromFile(s_custRegionFile);
-	if (!root.isObject())
-		root = JDomParser::fromFile(s_defaultRegionFile);
-	if (!root.isObject()) {
-		qCritical() << "Failed to load region files: [" << s_custRegionFile << "] nor [" << s_defaultRegionFile << "]";
-		return;
-	}
+	JArray regArrayObj;
 
-	JValue regionArray = root["region"];
-	if (!regionArray.isArray()) {
-		qCritical() << "Failed to get region array from region file";
-		return;
-	}
+	do {
+		// Read the locale file
+		JValue root = JDomParser::fromFile(s_custRegionFile);
+		if (!root.isObject())
+			root = JDomParser::fromFile(s_defaultRegionFile);
+		if (!root.isObject()) {
+			qCritical() << "Failed to load region files: [" << s_custRegionFile << "] nor [" << s_defaultRegionFile << "]";
+			break;
+		}
 
-	for (const JValue rgn: regionArray.items()) {
+		JValue regionArray = root["region"];
+		if (!regionArray.isArray()) {
+			qCritical() << "Failed to get region array from region file";
+			break;
+		}
 
-		RegionEntry regionEntry;
+		for (const JValue rgn: regionArray.items()) {
 
-		JValue label = rgn["countryName"];
-		if (!label.isString()) continue;
-		regionEntry.region[1] = label.asString();
+			JValue countryName = rgn["countryName"];
+			if (!countryName.isString()) continue;
 
-		label = rgn["shortCountryName"];
-		if (!label.isString())
-			regionEntry.region[0] = regionEntry.region[1];
-		else
-			regionEntry.region[0] = label.asString();
+			JValue shortCountryName = rgn["shortCountryName"];
+			if (!shortCountryName.isString())
+				shortCountryName = countryName;
 
-		label = rgn["countryCode"];
-		if (!label.isString()) continue;
-		regionEntry.region[2] = label.asString();
+			JValue countryCode = rgn["countryCode"];
+			if (!countryCode.isString()) continue;
 
-		m_regionEntryList.push_back(regionEntry);
-	}
+			m_regionIndex.insert(countryCode.asString());
+			regArrayObj.append(JObject {{"shortCountryName", shortCountryName.asString()},
+			                            {"countryName", countryName.asString()},
+			                            {"countryCode", countryCode.asString()}});
+		}
+	} while (false);
+
+	m_regionValues = JObject {{"region", regArrayObj}};
+	m_regionReply = valuesReply(m_regionValues);
 }
 
 std::string LocalePrefsHandler::currentLocale() const
@@ -0,0 +1,757 @@
+// Copyright (c) 2010-2018 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#include "LogPrefsStore.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <glib.h>
+
+#include "Logging.h"
+#include "PrefsDb.h"
+
+namespace {
+
+/*
+ * File layout: a 16 byte file header (magic, format version), then records
+ * aligned to 8 bytes. Each record is a RecordHeader followed by key, value
+ * and origin. The preallocated rest of the file is zero, which never
+ * passes the checksum, so an invalid record with no valid one behind it is
+ * the end of the log.
+ */
+const char s_logMagic[8] = { 'S', 'S', 'P', 'R', 'E', 'F', 'L', 'G' };
+const uint32_t s_logVersion = 1;
+const size_t s_fileHeaderSize = 16;
+const size_t s_growStep = 64 * 1024;
+//below this rewriting the log costs more than it frees
+const size_t s_compactMinBytes = 64 * 1024;
+
+enum RecordType {
+	RecordPut = 1,
+	RecordJournal,
+	RecordTrimJournal,
+	RecordCommit
+};
+
+const uint8_t s_flagInBatch = 1;
+
+struct RecordHeader {
+	uint32_t crc;			//crc32 of the rest of the record
+	uint32_t length;		//of key, value and origin
+	uint8_t type;
+	uint8_t flags;
+	uint16_t keyLen;
+	uint32_t valueLen;
+	uint64_t seq;			//put: modified, journal: seq, trim: last dropped seq
+	int64_t time;
+};
+static_assert(sizeof(RecordHeader) == 32, "record header layout changed");
+
+size_t alignRecord(size_t size)
+{
+	return (size + 7) & ~size_t(7);
+}
+
+uint32_t checksum(const unsigned char* record, size_t size)
+{
+	//only used from the main loop
+	static uint32_t table[256];
+	static bool tableReady = false;
+	if (!tableReady) {
+		for (uint32_t i = 0; i < 256; ++i) {
+			uint32_t c = i;
+			for (int k = 0; k < 8; ++k)
+				c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+			table[i] = c;
+		}
+		tableReady = true;
+	}
+
+	uint32_t crc = 0xffffffffu;
+	for (size_t i = sizeof(uint32_t); i < size; ++i)
+		crc = table[(crc ^ record[i]) & 0xff] ^ (crc >> 8);
+	return ~crc;
+}
+
+bool allZero(const unsigned char* data, size_t size)
+{
+	for (size_t i = 0; i < size; ++i) {
+		if (data[i])
+			return false;
+	}
+	return true;
+}
+
+//size of the valid record at offset, 0 if there is none
+size_t validRecord(const unsigned char* map, size_t mapSize, size_t offset)
+{
+	RecordHeader header;
+	if (offset + sizeof(header) > mapSize)
+		return 0;
+	memcpy(&header, map + offset, sizeof(header));
+
+	size_t size = sizeof(header) + header.length;
+	if (offset + alignRecord(size) > mapSize
+		|| (size_t) header.keyLen + header.valueLen > header.length
+		|| allZero(map + offset, sizeof(header))
+		|| checksum(map + offset, size) != header.crc)
+		return 0;
+	return alignRecord(size);
+}
+
+//writes a complete record to dest, which has room for recordSize() bytes
+size_t formatRecord(unsigned char* dest, uint8_t type, uint8_t flags,
+                    const std::string& key, const std::string& value,
+                    const std::string& origin, uint64_t seq, int64_t time)
+{
+	RecordHeader header;
+	header.crc = 0;
+	header.length = key.size() + value.size() + origin.size();
+	header.type = type;
+	header.flags = flags;
+	header.keyLen = key.size();
+	header.valueLen = value.size();
+	header.seq = seq;
+	header.time = time;
+
+	size_t size = sizeof(header) + header.length;
+	memcpy(dest, &header, sizeof(header));
+	memcpy(dest + sizeof(header), key.data(), key.size());
+	memcpy(dest + sizeof(header) + key.size(), value.data(), value.size());
+	memcpy(dest + sizeof(header) + key.size() + value.size(), origin.data(), origin.size());
+	memset(dest + size, 0, alignRecord(size) - size);
+
+	header.crc = checksum(dest, size);
+	memcpy(dest, &header.crc, sizeof(header.crc));
+	return alignRecord(size);
+}
+
+size_t recordSize(const std::string& key, const std::string& value, const std::string& origin)
+{
+	return alignRecord(sizeof(RecordHeader) + key.size() + value.size() + origin.size());
+}
+
+} // anonymous namespace
+
+LogPrefsStore::LogPrefsStore()
+	: m_fd(-1)
+	, m_map(nullptr)
+	, m_mapSize(0)
+	, m_tail(0)
+	, m_liveBytes(0)
+	, m_maxSeq(0)
+	, m_inBatch(false)
+	, m_batchStart(0)
+	, m_pendingTrim(0)
+{
+}
+
+LogPrefsStore::~LogPrefsStore()
+{
+	close();
+}
+
+PrefsStore::OpenResult LogPrefsStore::open(const std::string& path)
+{
+	if (m_map)
+		return OpenExisting;
+
+	m_path = path;
+	m_fd = ::open(m_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (m_fd < 0) {
+		qWarning("Failed to open prefs log %s: %s", m_path.c_str(), strerror(errno));
+		return OpenFailed;
+	}
+
+	struct stat st;
+	if (fstat(m_fd, &st) != 0) {
+		qWarning("Failed to stat prefs log %s: %s", m_path.c_str(), strerror(errno));
+		close();
+		return OpenFailed;
+	}
+
+	bool created = false;
+	bool damaged = false;
+	if (st.st_size >= (off_t) s_fileHeaderSize) {
+		if (!mapFile(st.st_size)) {
+			close();
+			return OpenFailed;
+		}
+		created = !load(damaged);
+		if (created) {
+			qCritical("prefs log %s has no valid header, recreating it", m_path.c_str());
+			unmapFile();
+		}
+	}
+	else {
+		created = true;
+	}
+
+	if (created) {
+		if (ftruncate(m_fd, 0) != 0 || ftruncate(m_fd, s_growStep) != 0 || !mapFile(s_growStep)) {
+			qWarning("Failed to create prefs log %s: %s", m_path.c_str(), strerror(errno));
+			close();
+			return OpenFailed;
+		}
+
+		uint32_t version = s_logVersion;
+		memcpy(m_map, s_logMagic, sizeof(s_logMagic));
+		memcpy(m_map + sizeof(s_logMagic), &version, sizeof(version));
+		m_tail = s_fileHeaderSize;
+		if (!sync(0, m_tail) || !put("databaseVersion", PrefsDb::s_schemaVersion, 0, std::string())) {
+			close();
+			return OpenFailed;
+		}
+	}
+
+	//rewrite a damaged log right away rather than skipping the damage on every load
+	if (damaged)
+		(void) compact();
+	else
+		maybeCompact();
+	return created ? OpenCreated : OpenExisting;
+}
+
+void LogPrefsStore::close()
+{
+	if (m_inBatch)
+		rollback();
+
+	unmapFile();
+	if (m_fd >= 0)
+		::close(m_fd);
+	m_fd = -1;
+	m_orderedKeys.clear();
+	m_index.clear();
+	m_journal.clear();
+	m_tail = m_liveBytes = 0;
+	m_maxSeq = 0;
+}
+
+bool LogPrefsStore::mapFile(size_t size)
+{
+	void* map = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+	if (map == MAP_FAILED) {
+		qWarning("Failed to map prefs log %s: %s", m_path.c_str(), strerror(errno));
+		return false;
+	}
+
+	m_map = static_cast<unsigned char*>(map);
+	m_mapSize = size;
+	return true;
+}
+
+void LogPrefsStore::unmapFile()
+{
+	if (m_map)
+		munmap(m_map, m_mapSize);
+	m_map = nullptr;
+	m_mapSize = 0;
+}
+
+bool LogPrefsStore::reserve(size_t size)
+{
+	if (size <= m_mapSize)
+		return true;
+
+	//the index holds offsets, not pointers, so the mapping may move
+	size_t newSize = std::max(m_mapSize * 2, (size + s_growStep - 1) / s_growStep * s_growStep);
+	if (ftruncate(m_fd, newSize) != 0) {
+		qWarning("Failed to grow prefs log %s: %s", m_path.c_str(), strerror(errno));
+		return false;
+	}
+
+	munmap(m_map, m_mapSize);
+	m_map = nullptr;
+	return mapFile(newSize);
+}
+
+bool LogPrefsStore::sync(size_t from, size_t to)
+{
+	size_t pageSize = sysconf(_SC_PAGESIZE);
+	size_t start = from / pageSize * pageSize;
+	if (msync(m_map + start, to - start, MS_SYNC) != 0) {
+		qWarning("Failed to sync prefs log %s: %s", m_path.c_str(), strerror(errno));
+		return false;
+	}
+	return true;
+}
+
+/*
+ * Rebuilds the index and journal from the mapping, false if it isn't a
+ * prefs log. An invalid record followed by valid ones is damage rather than
+ * the end of the log: it is skipped (r_damaged is set) and so is any batch
+ * it may have been part of, the records behind it still count.
+ */
+bool LogPrefsStore::load(bool& r_damaged)
+{
+	uint32_t version = 0;
+	memcpy(&version, m_map + sizeof(s_logMagic), sizeof(version));
+	if (memcmp(m_map, s_logMagic, sizeof(s_logMagic)) != 0 || version != s_logVersion)
+		return false;
+
+	r_damaged = false;
+	bool batchDamaged = false;	//the batch at hand may have lost records to damage
+	m_tail = s_fileHeaderSize;
+	while (m_tail + sizeof(RecordHeader) <= m_mapSize) {
+		size_t recordBytes = validRecord(m_map, m_mapSize, m_tail);
+		if (!recordBytes) {
+			size_t next = m_tail + 8;
+			while (next + sizeof(RecordHeader) <= m_mapSize && !validRecord(m_map, m_mapSize, next))
+				next += 8;
+			if (next + sizeof(RecordHeader) > m_mapSize)
+				break;
+
+			qCritical("Skipping %zu damaged bytes at offset %zu of prefs log %s",
+			          next - m_tail, m_tail, m_path.c_str());
+			r_damaged = true;
+			batchDamaged = true;
+			m_tail = next;
+			continue;
+		}
+
+		RecordHeader header;
+		memcpy(&header, m_map + m_tail, sizeof(header));
+
+		bool inBatch = header.flags & s_flagInBatch;
+		if (!inBatch && header.type != RecordCommit) {
+			//batches end with their commit record, this one's was lost
+			if (m_inBatch) {
+				qWarning("Dropping a batch without commit in prefs log %s", m_path.c_str());
+				undoBatch();
+				m_inBatch = false;
+			}
+			batchDamaged = false;
+		}
+		if (inBatch && !m_inBatch) {
+			m_inBatch = true;
+			m_batchStart = m_tail;
+		}
+
+		const char* body = (const char*) m_map + m_tail + sizeof(header);
+		std::string key(body, header.keyLen);
+		switch (header.type) {
+		case RecordPut:
+			applyPut(key, m_tail, header.keyLen, header.valueLen, recordBytes);
+			m_maxSeq = std::max(m_maxSeq, header.seq);
+			break;
+		case RecordJournal: {
+			PrefsJournalEntry entry;
+			entry.seq = header.seq;
+			entry.key = key;
+			entry.timestamp = header.time;
+			entry.origin.assign(body + header.keyLen + header.valueLen,
+			                    header.length - header.keyLen - header.valueLen);
+			applyJournal(entry, recordBytes);
+			break;
+		}
+		case RecordTrimJournal:
+			applyTrim(header.seq);
+			break;
+		case RecordCommit:
+			if (batchDamaged && m_inBatch) {
+				qWarning("Dropping a damaged batch in prefs log %s", m_path.c_str());
+				undoBatch();
+			}
+			m_inBatch = false;
+			batchDamaged = false;
+			m_batchUndo.clear();
+			break;
+		default:
+			//written by a newer format, can't tell what it changed
+			qWarning("Unknown record type %d in prefs log %s", header.type, m_path.c_str());
+			break;
+		}
+
+		m_tail += recordBytes;
+	}
+
+	//a batch without its commit record never happened
+	if (m_inBatch) {
+		qWarning("Dropping an uncommitted batch at the end of prefs log %s", m_path.c_str());
+		undoBatch();
+		m_tail = m_batchStart;
+		m_inBatch = false;
+	}
+
+	//clear a torn tail so that stale records can't show up behind new ones
+	if (m_tail < m_mapSize && !allZero(m_map + m_tail, std::min(sizeof(RecordHeader), m_mapSize - m_tail))) {
+		memset(m_map + m_tail, 0, m_mapSize - m_tail);
+		(void) sync(m_tail, m_mapSize);
+	}
+
+	return true;
+}
+
+size_t LogPrefsStore::appendRecord(uint8_t type, const std::string& key, const std::string& value,
+                                   const std::string& origin, uint64_t seq, int64_t time)
+{
+	if (!m_map || key.size() > 0xffff)
+		return std::string::npos;
+
+	size_t size = recordSize(key, value, origin);
+	if (!reserve(m_tail + size))
+		return std::string::npos;
+
+	uint8_t flags = (m_inBatch && type != RecordCommit) ? s_flagInBatch : 0;
+	size_t offset = m_tail;
+	formatRecord(m_map + offset, type, flags, key, value, origin, seq, time);
+	m_tail += size;
+
+	//a batch is synced as a whole on commit
+	if (!m_inBatch && !sync(offset, m_tail)) {
+		memset(m_map + offset, 0, size);
+		m_tail = offset;
+		return std::string::npos;
+	}
+	return offset;
+}
+
+void LogPrefsStore::applyPut(const std::string& key, size_t offset, size_t keyLen, size_t valueLen, size_t recordSize)
+{
+	Slot slot;
+	slot.offset = offset;
+	slot.valueOffset = offset + sizeof(RecordHeader) + keyLen;
+	slot.valueLen = valueLen;
+	slot.recordSize = recordSize;
+
+	auto it = m_index.find(key);
+	if (m_inBatch) {
+		Undo undo;
+		undo.journal = false;
+		undo.hadSlot = it != m_index.end();
+		undo.key = key;
+		if (undo.hadSlot)
+			undo.slot = it->second;
+		m_batchUndo.push_back(undo);
+	}
+
+	if (it != m_index.end()) {
+		m_liveBytes -= it->second.recordSize;
+		it->second = slot;
+	}
+	else {
+		it = m_index.emplace(key, slot).first;
+		m_orderedKeys.insert(&it->first);
+	}
+	m_liveBytes += recordSize;
+}
+
+void LogPrefsStore::applyJournal(const PrefsJournalEntry& entry, size_t recordSize)
+{
+	if (m_inBatch) {
+		Undo undo;
+		undo.journal = true;
+		undo.hadSlot = false;
+		m_batchUndo.push_back(undo);
+	}
+
+	JournalSlot slot;
+	slot.entry = entry;
+	slot.recordSize = recordSize;
+	m_journal.push_back(slot);
+	m_liveBytes += recordSize;
+	m_maxSeq = std::max(m_maxSeq, entry.seq);
+}
+
+void LogPrefsStore::applyTrim(uint64_t seq)
+{
+	while (!m_journal.empty() && m_journal.front().entry.seq <= seq) {
+		m_liveBytes -= m_journal.front().recordSize;
+		m_journal.pop_front();
+	}
+}
+
+void LogPrefsStore::undoBatch()
+{
+	for (auto undo = m_batchUndo.rbegin(); undo != m_batchUndo.rend(); ++undo) {
+		if (undo->journal) {
+			m_liveBytes -= m_journal.back().recordSize;
+			m_journal.pop_back();
+			continue;
+		}
+
+		auto it = m_index.find(undo->key);
+		m_liveBytes -= it->second.recordSize;
+		if (undo->hadSlot) {
+			it->second = undo->slot;
+			m_liveBytes += undo->slot.recordSize;
+		}
+		else {
+			m_orderedKeys.erase(&it->first);
+			m_index.erase(it);
+		}
+	}
+	m_batchUndo.clear();
+}
+
+bool LogPrefsStore::get(const std::string& key, std::string& r_value)
+{
+	auto it = m_index.find(key);
+	if (it == m_index.end() || !m_map)
+		return false;
+
+	r_value.assign((const char*) m_map + it->second.valueOffset, it->second.valueLen);
+	return true;
+}
+
+bool LogPrefsStore::put(const std::string& key, const std::string& value,
+                        uint64_t modified, const std::string& origin)
+{
+	size_t offset = appendRecord(RecordPut, key, value, origin, modified, 0);
+	if (offset == std::string::npos) {
+		qWarning("Failed to write key %s to prefs log", key.c_str());
+		return false;
+	}
+
+	applyPut(key, offset, key.size(), value.size(), recordSize(key, value, origin));
+	m_maxSeq = std::max(m_maxSeq, modified);
+	if (!m_inBatch)
+		maybeCompact();
+	return true;
+}
+
+bool LogPrefsStore::getAll(std::map<std::string, std::string>& r_prefs)
+{
+	if (!m_map)
+		return false;
+
+	for (const auto& slot : m_index)
+		r_prefs[slot.first].assign((const char*) m_map + slot.second.valueOffset, slot.second.valueLen);
+	return true;
+}
+
+bool LogPrefsStore::getRange(const std::string& prefix, std::map<std::string, std::string>& r_prefs)
+{
+	if (!m_map)
+		return false;
+
+	for (auto key = m_orderedKeys.lower_bound(&prefix);
+	     key != m_orderedKeys.end() && (*key)->compare(0, prefix.size(), prefix) == 0; ++key) {
+		const Slot& slot = m_index.find(**key)->second;
+		r_prefs[**key].assign((const char*) m_map + slot.valueOffset, slot.valueLen);
+	}
+	return true;
+}
+
+bool LogPrefsStore::begin()
+{
+	if (!m_map || m_inBatch)
+		return false;
+
+	m_inBatch = true;
+	m_batchStart = m_tail;
+	m_pendingTrim = 0;
+	m_batchUndo.clear();
+	return true;
+}
+
+bool LogPrefsStore::commit()
+{
+	if (!m_inBatch)
+		return false;
+
+	if (m_tail != m_batchStart) {
+		if (appendRecord(RecordCommit, std::string(), std::string(), std::string(), 0, 0) == std::string::npos
+			|| !sync(m_batchStart, m_tail))
+			return false;
+	}
+
+	m_inBatch = false;
+	m_batchUndo.clear();
+
+	if (m_pendingTrim) {
+		uint64_t seq = m_pendingTrim;
+		m_pendingTrim = 0;
+		trimJournal(seq);
+	}
+
+	maybeCompact();
+	return true;
+}
+
+void LogPrefsStore::rollback()
+{
+	if (!m_inBatch)
+		return;
+
+	undoBatch();
+	memset(m_map + m_batchStart, 0, m_tail - m_batchStart);
+	(void) sync(m_batchStart, m_tail);
+	m_tail = m_batchStart;
+	m_inBatch = false;
+	m_pendingTrim = 0;
+}
+
+bool LogPrefsStore::openJournal(uint64_t& r_lastSeq)
+{
+	r_lastSeq = m_maxSeq;
+	return m_map != nullptr;
+}
+
+bool LogPrefsStore::appendJournal(const PrefsJournalEntry& entry)
+{
+	size_t offset = appendRecord(RecordJournal, entry.key, std::string(), entry.origin,
+	                             entry.seq, entry.timestamp);
+	if (offset == std::string::npos) {
+		qWarning("Failed to journal change of key %s", entry.key.c_str());
+		return false;
+	}
+
+	applyJournal(entry, recordSize(entry.key, std::string(), entry.origin));
+	return true;
+}
+
+void LogPrefsStore::trimJournal(uint64_t seq)
+{
+	//kept out of batches so that a dropped batch never has to bring entries back
+	if (m_inBatch) {
+		m_pendingTrim = std::max(m_pendingTrim, seq);
+		return;
+	}
+
+	if (m_journal.empty() || m_journal.front().entry.seq > seq)
+		return;
+
+	if (appendRecord(RecordTrimJournal, std::string(), std::string(), std::string(), seq, 0) != std::string::npos)
+		applyTrim(seq);
+}
+
+bool LogPrefsStore::readJournal(uint64_t seq, std::list<PrefsJournalEntry>& r_entries,
+                                uint64_t& r_firstSeq)
+{
+	r_firstSeq = m_journal.empty() ? 0 : m_journal.front().entry.seq;
+	for (const JournalSlot& slot : m_journal) {
+		if (slot.entry.seq > seq)
+			r_entries.push_back(slot.entry);
+	}
+	return true;
+}
+
+void LogPrefsStore::memoryStats(int& r_cacheUsed, int& r_schemaUsed, int& r_stmtUsed) const
+{
+	//the values themselves live in the page cache, this is the index
+	size_t used = m_index.bucket_count() * sizeof(void*);
+	for (const auto& slot : m_index)
+		used += sizeof(slot) + slot.first.capacity() + 2 * sizeof(void*);
+	//ordered key set, a red-black tree node per key
+	used += m_orderedKeys.size() * (sizeof(void*) * 4 + sizeof(int));
+	for (const JournalSlot& slot : m_journal)
+		used += sizeof(slot) + slot.entry.key.capacity() + slot.entry.origin.capacity();
+
+	r_cacheUsed = used;
+	r_schemaUsed = 0;
+	r_stmtUsed = 0;
+}
+
+void LogPrefsStore::releaseMemory()
+{
+	//everything is synced outside of a batch, the pages are read back on demand
+	if (m_map && !m_inBatch)
+		(void) madvise(m_map, m_mapSize, MADV_DONTNEED);
+}
+
+void LogPrefsStore::maybeCompact()
+{
+	if (m_tail > s_compactMinBytes && m_tail - s_fileHeaderSize - m_liveBytes > m_liveBytes)
+		(void) compact();
+}
+
+//writes the live records to a new file and swaps it in
+bool LogPrefsStore::compact()
+{
+	size_t before = m_tail;
+	std::vector<unsigned char> buffer(s_fileHeaderSize + m_liveBytes);
+
+	uint32_t version = s_logVersion;
+	memcpy(buffer.data(), s_logMagic, sizeof(s_logMagic));
+	memcpy(buffer.data() + sizeof(s_logMagic), &version, sizeof(version));
+
+	size_t offset = s_fileHeaderSize;
+	for (const auto& slot : m_index) {
+		RecordHeader header;
+		memcpy(&header, m_map + slot.second.offset, sizeof(header));
+		const char* body = (const char*) m_map + slot.second.offset + sizeof(header);
+		std::string origin(body + header.keyLen + header.valueLen,
+		                   header.length - header.keyLen - header.valueLen);
+		offset += formatRecord(buffer.data() + offset, RecordPut, 0, slot.first,
+		                       std::string(body + header.keyLen, header.valueLen),
+		                       origin, header.seq, 0);
+	}
+	for (const JournalSlot& slot : m_journal) {
+		offset += formatRecord(buffer.data() + offset, RecordJournal, 0, slot.entry.key,
+		                       std::string(), slot.entry.origin, slot.entry.seq, slot.entry.timestamp);
+	}
+
+	std::string compactPath = m_path + ".compact";
+	int fd = ::open(compactPath.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		qWarning("Failed to create %s: %s", compactPath.c_str(), strerror(errno));
+		return false;
+	}
+
+	//mapped before the rename, a failure up to there leaves the old log as it was
+	size_t fileSize = std::max(s_growStep, (offset + offset / 2 + s_growStep - 1) / s_growStep * s_growStep);
+	void* map = MAP_FAILED;
+	if (write(fd, buffer.data(), offset) == (ssize_t) offset
+		&& ftruncate(fd, fileSize) == 0
+		&& fsync(fd) == 0)
+		map = mmap(nullptr, fileSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED || rename(compactPath.c_str(), m_path.c_str()) != 0) {
+		qWarning("Failed to compact prefs log %s: %s", m_path.c_str(), strerror(errno));
+		if (map != MAP_FAILED)
+			munmap(map, fileSize);
+		::close(fd);
+		unlink(compactPath.c_str());
+		return false;
+	}
+
+	gchar* dirPath = g_path_get_dirname(m_path.c_str());
+	int dirFd = ::open(dirPath, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	g_free(dirPath);
+	if (dirFd >= 0) {
+		(void) fsync(dirFd);
+		::close(dirFd);
+	}
+
+	//the old mapping still shows the unlinked file, switch to the new one
+	unmapFile();
+	::close(m_fd);
+	m_fd = fd;
+	m_map = static_cast<unsigned char*>(map);
+	m_mapSize = fileSize;
+
+	//the records are the ones just written, rebuilding the index can't fail
+	m_orderedKeys.clear();
+	m_index.clear();
+	m_journal.clear();
+	m_liveBytes = 0;
+	m_maxSeq = 0;
+	bool damaged = false;
+	(void) load(damaged);
+
+	PmLogInfo(sysServiceLogContext(), "PREFSDB_LOG_COMPACTED", 2,
+	          PMLOGKFV("BEFORE", "%zu", before),
+	          PMLOGKFV("AFTER", "%zu", m_tail),
+	          "Preferences log compacted");
+	return true;
+}
@@ -16,7 +16,8 @@
 
 #include "Logging.h"
 
-#include <QFileInfo>
+#include <cstdarg>
+#include <cstring>
 
 PmLogContext& sysServiceLogContext()
 {
@@ -40,41 +41,104 @@ void setLogLevel(const std::string& loglstr)
 		PmLogSetContextLevel(sysServiceLogContext(), kPmLogLevel_Info);
 }
 
-void logInfo(const char* file, int line, const char* func, const char *fmt, ...)
+// Same shape as QFileInfo(file).baseName() + "#line", but into a caller buffer
+static void formatMeta(char* meta, size_t size, const char* file, int line)
+{
+	const char* base = file ? logFileBaseName(file, file) : "";
+	int baseLen = static_cast<int>(strcspn(base, "."));
+
+	snprintf(meta, size, "%.*s#%d", baseLen, base, line);
+}
+
+static void emitLog(PmLogLevel level, const char* meta, const char* func, const char* data)
+{
+	if (!func)
+		func = "";
+
+	switch (level) {
+		case kPmLogLevel_Debug:
+			PmLogDebug(sysServiceLogContext(), "%s %s: %s", meta, func, data);
+			break;
+		case kPmLogLevel_Info:
+			PmLogInfo(sysServiceLogContext(), meta, 1, PMLOGKS("FUNC", func), "%s", data);
+			break;
+		case kPmLogLevel_Warning:
+			PmLogWarning(sysServiceLogContext(), meta, 1, PMLOGKS("FUNC", func), "%s", data);
+			break;
+		case kPmLogLevel_Error:
+			PmLogError(sysServiceLogContext(), meta, 1, PMLOGKS("FUNC", func), "%s", data);
+			break;
+		default:
+			PmLogCritical(sysServiceLogContext(), meta, 1, PMLOGKS("FUNC", func), "%s", data);
+			break;
+	}
+}
+
+static void vlogFormatted(PmLogLevel level, const char* file, int line, const char* func,
+                          const char* fmt, va_list args)
+{
+	char meta[64];
+	char data[1024];
+
+	formatMeta(meta, sizeof(meta), file, line);
+	// longer messages are truncated rather than spilled to the heap
+	vsnprintf(data, sizeof(data), fmt, args);
+
+	emitLog(level, meta, func, data);
+}
+
+void logFormatted(PmLogLevel level, const char* file, int line, const char* func, const char *fmt, ...)
 {
 	va_list args;
 	va_start(args, fmt);
+	vlogFormatted(level, file, line, func, fmt, args);
+	va_end(args);
+}
 
-	QString meta = QString("%1#%2").arg(QFileInfo(file).baseName()).arg(line);
-	QString data = QString().vsprintf(fmt, args);
+void logInfo(const char* file, int line, const char* func, const char *fmt, ...)
+{
+	if (!PmLogIsEnabled(sysServiceLogContext(), kPmLogLevel_Info))
+		return;
 
+	va_list args;
+	va_start(args, fmt);
+	vlogFormatted(kPmLogLevel_Info, file, line, func, fmt, args);
 	va_end(args);
-
-	PmLogInfo(sysServiceLogContext(), meta.toLatin1().data(), 1, PMLOGKS("FUNC", func), "%s", data.toUtf8().data());
 }
 
 void outputQtMessages(QtMsgType type, const QMessageLogContext &context, const QString &msg)
 {
-	QString meta = QString("%1#%2").arg(QFileInfo(context.file).baseName()).arg(context.line);
+	PmLogLevel level;
 
 	switch (type) {
 		case QtDebugMsg:
-#ifndef NO_LOGGING
-			PmLogDebug(sysServiceLogContext(), meta.toLatin1().data(), 1, PMLOGKS("FUNC", context.function),
-					   "%s", msg.toUtf8().data());
+#ifdef NO_LOGGING
+			return;
 #endif
+			level = kPmLogLevel_Debug;
 			break;
 		case QtWarningMsg:
-			PmLogWarning(sysServiceLogContext(), meta.toLatin1().data(), 1, PMLOGKS("FUNC", context.function),
-						 "%s", msg.toUtf8().data());
+			level = kPmLogLevel_Warning;
 			break;
 		case QtCriticalMsg:
-			PmLogError(sysServiceLogContext(), meta.toLatin1().data(), 1, PMLOGKS("FUNC", context.function),
-					   "%s", msg.toUtf8().data());
+			level = kPmLogLevel_Error;
 			break;
 		case QtFatalMsg:
-			PmLogCritical(sysServiceLogContext(), meta.toLatin1().data(), 1, PMLOGKS("FUNC", context.function),
-						  "%s", msg.toUtf8().data());
-			abort();
+			level = kPmLogLevel_Critical;
+			break;
+		default:
+			level = kPmLogLevel_Info;
+			break;
+	}
+
+	// don't touch the message until we know it will be written
+	if (PmLogIsEnabled(sysServiceLogContext(), level))
+	{
+		char meta[64];
+		formatMeta(meta, sizeof(meta), context.file, context.line);
+		emitLog(level, meta, context.function, msg.toUtf8().constData());
 	}
+
+	if (type == QtFatalMsg)
+		abort();
 }
@@ -0,0 +1,327 @@
+// Copyright (c) 2010-2018 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#include "LoopWatchdog.h"
+
+#include <algorithm>
+
+#include <pbnjson.hpp>
+#include <luna-service2/lunaservice.h>
+#include <luna-service2++/error.hpp>
+
+#include "JSONUtils.h"
+#include "Logging.h"
+#include "Mainloop.h"
+#include "RequestTrace.h"
+#include "Settings.h"
+
+using namespace pbnjson;
+
+// upper bounds of the lag histogram buckets, the last bucket takes the rest
+static const gint64 s_bucketLimitsMs[] = { 1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 2000, 5000 };
+
+LoopWatchdog::Loop::Loop()
+	: context(nullptr)
+	, stallMsgId(nullptr)
+	, stallEndedMsgId(nullptr)
+	, heartbeat(nullptr)
+	, posted(0)
+	, stallReported(false)
+	, stalls(0)
+	, lastStallAt(0)
+	, lastStallLag(0)
+	, samples(0)
+	, lagSum(0)
+	, lagMax(0)
+{
+	std::fill(buckets, buckets + s_bucketCount, 0);
+}
+
+LoopWatchdog::LoopWatchdog()
+	: m_interval(Settings::instance()->m_loopWatchdogInterval)
+	, m_threshold(Settings::instance()->m_loopStallThreshold)
+	, m_thread(nullptr)
+	, m_stop(false)
+{
+	static_assert(sizeof(s_bucketLimitsMs) / sizeof(s_bucketLimitsMs[0]) + 1 == s_bucketCount,
+	              "one bucket per limit and one for the rest");
+
+	g_mutex_init(&m_mutex);
+	g_cond_init(&m_cond);
+
+	for (int id = 0; id < LoopCount; ++id)
+		m_beats[id] = Beat { this, LoopId(id) };
+
+	Loop& main = m_loops[LoopMain];
+	main.context = g_mainloop ? g_main_loop_get_context(g_mainloop.get()) : g_main_context_default();
+	main.stallMsgId = "MAINLOOP_STALL";
+	main.stallEndedMsgId = "MAINLOOP_STALL_ENDED";
+	g_main_context_ref(main.context);
+}
+
+LoopWatchdog::~LoopWatchdog()
+{
+	if (m_thread) {
+		g_mutex_lock(&m_mutex);
+		m_stop = true;
+		g_cond_signal(&m_cond);
+		g_mutex_unlock(&m_mutex);
+		g_thread_join(m_thread);
+	}
+
+	for (Loop& loop : m_loops) {
+		if (loop.heartbeat) {
+			g_source_destroy(loop.heartbeat);
+			g_source_unref(loop.heartbeat);
+		}
+		if (loop.context)
+			g_main_context_unref(loop.context);
+	}
+
+	g_cond_clear(&m_cond);
+	g_mutex_clear(&m_mutex);
+}
+
+void LoopWatchdog::watchTimeLoop(GMainContext* context)
+{
+	if (m_thread || !context)
+		return;
+
+	Loop& time = m_loops[LoopTime];
+	time.context = g_main_context_ref(context);
+	time.stallMsgId = "TIMELOOP_STALL";
+	time.stallEndedMsgId = "TIMELOOP_STALL_ENDED";
+}
+
+void LoopWatchdog::start()
+{
+	if (m_interval == 0 || m_thread)
+		return;
+
+	m_thread = g_thread_new("loop-watchdog", &LoopWatchdog::threadFunc, this);
+}
+
+//static
+gpointer LoopWatchdog::threadFunc(gpointer data)
+{
+	LoopWatchdog* watchdog = static_cast<LoopWatchdog*>(data);
+
+	g_mutex_lock(&watchdog->m_mutex);
+	while (!watchdog->m_stop) {
+		gint64 now = g_get_monotonic_time();
+		for (int id = 0; id < LoopCount; ++id) {
+			if (!watchdog->m_loops[id].context)
+				continue;
+			if (watchdog->m_loops[id].heartbeat)
+				watchdog->checkStall(LoopId(id), now);
+			else
+				watchdog->post(LoopId(id), now);
+		}
+
+		gint64 wakeup = now + watchdog->m_interval * G_TIME_SPAN_MILLISECOND;
+		while (!watchdog->m_stop && g_cond_wait_until(&watchdog->m_cond, &watchdog->m_mutex, wakeup))
+			;
+	}
+	g_mutex_unlock(&watchdog->m_mutex);
+
+	return nullptr;
+}
+
+// watchdog thread, locked
+void LoopWatchdog::post(LoopId id, gint64 now)
+{
+	Loop& loop = m_loops[id];
+	loop.heartbeat = g_idle_source_new();
+	// same priority as bus messages, so the heartbeat queues behind them
+	g_source_set_priority(loop.heartbeat, G_PRIORITY_DEFAULT);
+	g_source_set_callback(loop.heartbeat, &LoopWatchdog::cbHeartbeat, &m_beats[id], nullptr);
+	loop.posted = now;
+	loop.stallReported = false;
+	g_source_attach(loop.heartbeat, loop.context);
+}
+
+// watchdog thread, locked
+void LoopWatchdog::checkStall(LoopId id, gint64 now)
+{
+	Loop& loop = m_loops[id];
+	gint64 lag = now - loop.posted;
+	if (loop.stallReported || lag < gint64(m_threshold) * G_TIME_SPAN_MILLISECOND)
+		return;
+
+	std::string method;
+	gint64 since = now;
+	bool busy = RequestTrace::inFlight(method, since, id == LoopTime);
+
+	loop.stallReported = true;
+	loop.stallMethod = busy ? method : std::string();
+	++loop.stalls;
+	loop.lastStallAt = now;
+	loop.lastStallLag = lag;
+	loop.lastStallMethod = loop.stallMethod;
+
+	PmLogWarning(sysServiceLogContext(), loop.stallMsgId, 3,
+	             PMLOGKFV("LAG_MS", "%lld", static_cast<long long>(lag / 1000)),
+	             PMLOGKS("METHOD", busy ? method.c_str() : "none"),
+	             PMLOGKFV("METHOD_MS", "%lld", static_cast<long long>((now - since) / 1000)),
+	             id == LoopTime ? "Time loop stalled" : "Main loop stalled");
+}
+
+//static
+gboolean LoopWatchdog::cbHeartbeat(gpointer data)
+{
+	Beat* beat = static_cast<Beat*>(data);
+	LoopWatchdog* watchdog = beat->watchdog;
+	Loop& loop = watchdog->m_loops[beat->loop];
+	gint64 now = g_get_monotonic_time();
+
+	g_mutex_lock(&watchdog->m_mutex);
+	gint64 lag = now - loop.posted;
+	bool stalled = loop.stallReported;
+	std::string method = loop.stallMethod;
+	if (stalled)
+		loop.lastStallLag = lag;
+	g_source_unref(loop.heartbeat);
+	loop.heartbeat = nullptr;
+	addSample(loop, lag);
+	g_mutex_unlock(&watchdog->m_mutex);
+
+	if (stalled) {
+		PmLogWarning(sysServiceLogContext(), loop.stallEndedMsgId, 2,
+		             PMLOGKFV("LAG_MS", "%lld", static_cast<long long>(lag / 1000)),
+		             PMLOGKS("METHOD", method.empty() ? "none" : method.c_str()),
+		             beat->loop == LoopTime ? "Time loop running again" : "Main loop running again");
+	}
+
+	return G_SOURCE_REMOVE;
+}
+
+// locked
+void LoopWatchdog::addSample(Loop& loop, gint64 lag)
+{
+	unsigned int bucket = 0;
+	while (bucket < s_bucketCount - 1 && lag >= s_bucketLimitsMs[bucket] * G_TIME_SPAN_MILLISECOND)
+		++bucket;
+
+	++loop.buckets[bucket];
+	++loop.samples;
+	loop.lagSum += lag;
+	loop.lagMax = std::max(loop.lagMax, lag);
+}
+
+// locked
+JValue LoopWatchdog::loopReport(const Loop& loop) const
+{
+	JValue histogram = pbnjson::Array();
+	for (unsigned int i = 0; i < s_bucketCount; ++i) {
+		JValue bucket = JObject {{"count", static_cast<int64_t>(loop.buckets[i])}};
+		if (i < s_bucketCount - 1)
+			bucket.put("upToMs", static_cast<int64_t>(s_bucketLimitsMs[i]));
+		histogram.append(bucket);
+	}
+
+	JValue report = JObject {
+		{"samples", static_cast<int64_t>(loop.samples)},
+		{"meanLagMs", loop.samples ? loop.lagSum / 1000.0 / loop.samples : 0.0},
+		{"maxLagMs", loop.lagMax / 1000.0},
+		{"histogram", histogram},
+		{"stalls", static_cast<int64_t>(loop.stalls)}
+	};
+	if (loop.stalls) {
+		report.put("lastStall", JObject {
+			{"method", loop.lastStallMethod},
+			{"lagMs", loop.lastStallLag / 1000.0},
+			{"secondsAgo", static_cast<int64_t>((g_get_monotonic_time() - loop.lastStallAt) / G_USEC_PER_SEC)}
+		});
+	}
+	return report;
+}
+
+/*!
+\page com_palm_diagnostics
+\n
+\section diagnostics_get_loop_lag getLoopLag
+
+\e Private. Available only at the private bus.
+
+com.webos.service.systemservice/diagnostics/getLoopLag
+
+Reports how long requests wait for the main loop. A watchdog thread posts a
+heartbeat to the main loop every \c loopWatchdogInterval ms (sysservice.conf)
+at the priority of bus messages and measures how long it waits to be run.
+Heartbeats waiting longer than \c loopStallThreshold ms are logged as stalls
+(MAINLOOP_STALL) together with the method the loop was running. With
+\c timeThread the loop of the time thread, which dispatches all bus traffic
+then, is watched the same way (TIMELOOP_STALL).
+
+\subsection diagnostics_get_loop_lag_syntax Syntax:
+\code
+{
+}
+\endcode
+
+\subsection diagnostics_get_loop_lag_returns Returns:
+\code
+{
+	"returnValue": true,
+	"enabled": boolean,
+	"intervalMs": int,
+	"stallThresholdMs": int,
+	"samples": int,
+	"meanLagMs": double,
+	"maxLagMs": double,
+	"histogram": [ { "upToMs": int, "count": int }, ..., { "count": int } ],
+	"stalls": int,
+	"lastStall": { "method": string, "lagMs": double, "secondsAgo": int },
+	"timeLoop": { "samples": int, "meanLagMs": double, ..., "lastStall": object }
+}
+\endcode
+
+\param enabled False if the watchdog is turned off (loopWatchdogInterval=0).
+\param histogram Heartbeat lag counts; a bucket takes the lags below its \c upToMs and at or above the one before; the last bucket takes the rest.
+\param stalls Number of stalls since startup.
+\param lastStall The latest stall, if there was one. \c method is empty if the loop wasn't running a bus method.
+\param timeLoop Only with \c timeThread. The same samples, histogram and stalls for the time loop.
+
+\subsection diagnostics_get_loop_lag_examples Examples:
+\code
+luna-send -n 1 -f luna://com.webos.service.systemservice/diagnostics/getLoopLag '{}'
+\endcode
+*/
+bool LoopWatchdog::cbGetLoopLag(LSHandle* lsHandle, LSMessage *message, void *user_data)
+{
+	EMPTY_SCHEMA_RETURN(lsHandle, message);
+
+	LoopWatchdog* watchdog = LoopWatchdog::instance();
+
+	g_mutex_lock(&watchdog->m_mutex);
+	JValue reply = watchdog->loopReport(watchdog->m_loops[LoopMain]);
+	if (watchdog->m_loops[LoopTime].context)
+		reply.put("timeLoop", watchdog->loopReport(watchdog->m_loops[LoopTime]));
+	g_mutex_unlock(&watchdog->m_mutex);
+
+	reply.put("returnValue", true);
+	reply.put("enabled", watchdog->m_thread != nullptr);
+	reply.put("intervalMs", static_cast<int64_t>(watchdog->m_interval));
+	reply.put("stallThresholdMs", static_cast<int64_t>(watchdog->m_threshold));
+
+	LS::Error error;
+	if (!LSMessageReply(lsHandle, message, reply.stringify().c_str(), error))
+	{
+		qWarning() << error.what();
+	}
+
+	return true;
+}
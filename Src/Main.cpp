@@ -30,6 +30,10 @@
 #include "TimeZoneService.h"
 #include "OsInfoService.h"
 #include "DeviceInfoService.h"
+#include "MemoryDiagnostics.h"
+#include "RequestTrace.h"
+#include "LoopWatchdog.h"
+#include "TimeThread.h"
 
 #include "BackupManager.h"
 #include "EraseHandler.h"
@@ -39,6 +43,7 @@
 #include "Utils.h"
 #include "Settings.h"
 #include "JSONUtils.h"
+#include "AsyncTask.h"
 
 static gboolean s_useSysLog = false;
 
@@ -55,24 +60,7 @@ namespace {
 		// which TimePrefsHandler manages system time synchronization
 		(void) clockHandler.setServiceHandle(serviceHandle);
 
-		clockHandler.manualOverride(TimePrefsHandler::instance()->isManualTimeUsed());
-
-		// setup properties bindings
-		TimePrefsHandler::instance()->systemTimeChanged.connect(&clockHandler, &ClockHandler::adjust);
-		TimePrefsHandler::instance()->isManualTimeChanged.connect(&clockHandler, &ClockHandler::manualOverride);
-		TimePrefsHandler::instance()->deprecatedClockChange.connectVoid(&clockHandler, &ClockHandler::update);
-		TimePrefsHandler::instance()->compensateSuspendedTimeToClocks.connect(&clockHandler, &ClockHandler::compensateSuspendedTimeToClocks);
-		clockHandler.clockChanged.connect(TimePrefsHandler::instance(), &TimePrefsHandler::clockChanged);
-		clockHandler.notAvailableSourceHandled.connect(TimePrefsHandler::instance(), &TimePrefsHandler::handleNotAvailableSource);
-
-		// setup time sources for clock handler
-		int basePriority = 1;
-		const TimePrefsHandler::TimeSources &sources = TimePrefsHandler::instance()->timeSources();
-		for (size_t i = 0; i < sources.size(); ++i)
-		{
-			int priority = sources.size()-1 - i + basePriority;
-			clockHandler.setup(sources[i], priority);
-		}
+		clockHandler.attachTimePrefs(TimePrefsHandler::instance());
 	}
 } // anonymous namespace
 
@@ -211,6 +199,12 @@ int main(int argc, char ** argv)
 
 	init_signals();
 
+	// worker pool for blocking requests, completions come back to g_mainloop
+	AsyncTaskPool* async_pool = AsyncTaskPool::instance();
+
+	// request recording, if configured; sees every category registered from here on
+	RequestTrace* request_trace = RequestTrace::instance();
+
 	SystemRestore::createSpecialDirectories();
 
 	// Initialize the Preferences database
@@ -232,7 +226,18 @@ int main(int argc, char ** argv)
 		return 1;
 	}
 
-	if (!LSGmainAttach(serviceHandle, g_mainloop.get(), error))
+	// time and clock queries are answered from a thread of their own, which
+	// then dispatches the whole handle and forwards the rest to the main loop
+	TimeThread* time_thread = TimeThread::instance();
+	if (settings->m_timeThread)
+	{
+		if (!time_thread->attach(serviceHandle, error))
+		{
+			qCritical() << "Failed to attach service handle to the time thread: " << error.what();
+			return 1;
+		}
+	}
+	else if (!LSGmainAttach(serviceHandle, g_mainloop.get(), error))
 	{
 		qCritical() << "Failed to attach service handle to main loop: " << error.what();
 		return 1;
@@ -278,10 +283,35 @@ int main(int argc, char ** argv)
 	//init the deviceinfo service;
 	DeviceInfoService *device_info_srv = DeviceInfoService::instance();
 	device_info_srv->setServiceHandle(serviceHandle);
+
+	//private memory diagnostics
+	MemoryDiagnostics *memory_diagnostics = MemoryDiagnostics::instance();
+	memory_diagnostics->setServiceHandle(serviceHandle);
+
+	// media partition copies queued by the startup check
+	system_restore->runDeferredRestores();
+
+	// watch the main loop, and the time loop that dispatches the bus with it, for stalls from here on
+	LoopWatchdog* loop_watchdog = LoopWatchdog::instance();
+	if (settings->m_timeThread)
+		loop_watchdog->watchTimeLoop(time_thread->context());
+	loop_watchdog->start();
+
+	// everything is registered, start taking requests
+	if (settings->m_timeThread)
+		time_thread->start();
 	
 	// Run the main loop
 	g_main_loop_run(g_mainloop.get());
 
+	// before the state its served methods read goes away; the watchdog
+	// still has a heartbeat on its loop until it is deleted itself
+	time_thread->stop();
+	delete loop_watchdog;
+	delete time_thread;
+	delete async_pool;
+	delete request_trace;
+	delete memory_diagnostics;
 	delete device_info_srv;
 	delete os_info_srv;
 	delete time_zone_srv;
@@ -0,0 +1,290 @@
+// Copyright (c) 2010-2018 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#include "MemoryDiagnostics.h"
+
+#include <malloc.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <sqlite3.h>
+#include <luna-service2++/error.hpp>
+
+#include "ImageModule.h"
+#include "JSONUtils.h"
+#include "Logging.h"
+#include "LoopWatchdog.h"
+#include "PrefsDb.h"
+#include "PrefsFactory.h"
+#include "RequestTrace.h"
+#include "TimeThread.h"
+
+using namespace pbnjson;
+
+static LSMethod s_diagnostics_methods[]  = {
+	{ "getMemoryInfo", MemoryDiagnostics::cbGetMemoryInfo },
+	{ "trimMemory", MemoryDiagnostics::cbTrimMemory },
+	{ "setRequestTrace", RequestTrace::cbSetRequestTrace },
+	{ "getLoopLag", LoopWatchdog::cbGetLoopLag },
+	{ 0, 0 },
+};
+
+/*! \page com_palm_diagnostics Service API com.webos.service.systemservice/diagnostics/
+ *
+ *  Private methods:
+ *   - \ref diagnostics_get_memory_info
+ *   - \ref diagnostics_trim_memory
+ *   - \ref diagnostics_set_request_trace
+ *   - \ref diagnostics_get_loop_lag
+ */
+
+// VmRSS/VmHWM of this process in kB, -1 if unavailable
+static void readProcessMemory(int64_t& rss, int64_t& hwm)
+{
+	rss = hwm = -1;
+
+	FILE* status = fopen("/proc/self/status", "r");
+	if (!status)
+		return;
+
+	char line[128];
+	while (fgets(line, sizeof(line), status)) {
+		long long value;
+		if (sscanf(line, "VmRSS: %lld kB", &value) == 1)
+			rss = value;
+		else if (sscanf(line, "VmHWM: %lld kB", &value) == 1)
+			hwm = value;
+	}
+	fclose(status);
+}
+
+static JValue allocatorReport()
+{
+	// mallinfo() wraps around at 2 GB, use mallinfo2() where glibc has it
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+	struct mallinfo2 info = mallinfo2();
+#else
+	struct mallinfo info = mallinfo();
+#endif
+
+	return JObject {
+		{"arena", static_cast<int64_t>(info.arena)},
+		{"mmapped", static_cast<int64_t>(info.hblkhd)},
+		{"inUse", static_cast<int64_t>(info.uordblks)},
+		{"free", static_cast<int64_t>(info.fordblks)},
+		{"releasable", static_cast<int64_t>(info.keepcost)}
+	};
+}
+
+static JValue sqliteReport()
+{
+	sqlite3_int64 used = 0, usedPeak = 0;
+	sqlite3_int64 overflow = 0, overflowPeak = 0;
+	(void) sqlite3_status64(SQLITE_STATUS_MEMORY_USED, &used, &usedPeak, 0);
+	(void) sqlite3_status64(SQLITE_STATUS_PAGECACHE_OVERFLOW, &overflow, &overflowPeak, 0);
+
+	PrefsDb::MemoryStats db = PrefsDb::instance()->memoryStats();
+
+	return JObject {
+		{"memoryUsed", static_cast<int64_t>(used)},
+		{"memoryUsedPeak", static_cast<int64_t>(usedPeak)},
+		{"pageCacheOverflow", static_cast<int64_t>(overflow)},
+		{"prefsDb", JObject {
+			{"engine", db.engine},
+			{"cacheUsed", db.cacheUsed},
+			{"schemaUsed", db.schemaUsed},
+			{"stmtUsed", db.stmtUsed},
+			{"writeBehindKeys", static_cast<int64_t>(db.writeBehindKeys)}
+		}}
+	};
+}
+
+void MemoryDiagnostics::setServiceHandle(LSHandle* serviceHandle)
+{
+	LS::Error error;
+	if (!LSRegisterCategory(serviceHandle, "/diagnostics", s_diagnostics_methods, nullptr, nullptr, error.get()))
+	{
+		qCritical() << "Failed in registering diagnostics handler methods:" << error.what();
+	}
+}
+
+JValue MemoryDiagnostics::memoryReport() const
+{
+	int64_t rss, hwm;
+	readProcessMemory(rss, hwm);
+
+	JObject caches;
+	for (const auto& handler : PrefsFactory::instance()->handlersMemoryUsed())
+		caches.put(handler.first, static_cast<int64_t>(handler.second));
+
+	ImageModule* images = ImageModule::instance();
+	TimeThread* timeThread = TimeThread::instance();
+
+	return JObject {
+		{"process", JObject {{"rssKb", rss}, {"rssPeakKb", hwm}}},
+		{"allocator", allocatorReport()},
+		{"sqlite", sqliteReport()},
+		{"caches", caches},
+		{"images", JObject {
+			{"moduleLoaded", images->isLoaded()},
+			{"moduleLoads", static_cast<int64_t>(images->loadCount())},
+			{"peakBufferBytes", static_cast<int64_t>(images->peakBufferBytes())}
+		}},
+		{"timeThread", JObject {
+			{"running", timeThread->isRunning()},
+			{"servedMethods", static_cast<int64_t>(timeThread->servedCount())},
+			{"pendingBarriers", static_cast<int64_t>(timeThread->pendingBarriers())},
+			{"relays", static_cast<int64_t>(TimeThread::relayCount())}
+		}}
+	};
+}
+
+bool MemoryDiagnostics::trim()
+{
+	ImageModule::instance()->trim();
+	PrefsFactory::instance()->releaseHandlerCaches();
+	PrefsDb::instance()->releaseMemory();
+
+	return malloc_trim(0) != 0;
+}
+
+/*!
+\page com_palm_diagnostics
+\n
+\section diagnostics_get_memory_info getMemoryInfo
+
+\e Private. Available only at the private bus.
+
+com.webos.service.systemservice/diagnostics/getMemoryInfo
+
+Reports the memory use of the service. Sizes are in bytes unless the name
+says otherwise; cache sizes are estimates.
+
+\subsection diagnostics_get_memory_info_syntax Syntax:
+\code
+{
+}
+\endcode
+
+\subsection diagnostics_get_memory_info_returns Returns:
+\code
+{
+	"returnValue": true,
+	"process": { "rssKb": int, "rssPeakKb": int },
+	"allocator": { "arena": int, "mmapped": int, "inUse": int, "free": int, "releasable": int },
+	"sqlite": {
+		"memoryUsed": int, "memoryUsedPeak": int, "pageCacheOverflow": int,
+		"prefsDb": { "engine": string, "cacheUsed": int, "schemaUsed": int, "stmtUsed": int, "writeBehindKeys": int }
+	},
+	"caches": { string: int },
+	"images": { "moduleLoaded": boolean, "moduleLoads": int, "peakBufferBytes": int },
+	"timeThread": { "running": boolean, "servedMethods": int, "pendingBarriers": int, "relays": int }
+}
+\endcode
+
+\param process Resident set size of the process and its peak, from /proc/self/status.
+\param allocator glibc heap statistics (mallinfo2).
+\param sqlite SQLite heap use and the page cache, schema and statement memory of the preferences db connection.
+With the log storage engine (prefsStorage=log) cacheUsed is the size of its index instead.
+\param caches Caches and tables of each preference handler, keyed by the first key the handler owns.
+\param images Whether the image module is loaded, how often it was loaded and the peak pixel memory of a single image operation.
+\param timeThread Whether the time thread (timeThread in sysservice.conf) runs, the methods it serves itself, forwarded requests the served ones are waiting for, and the callback relays it has created (they live until exit).
+
+\subsection diagnostics_get_memory_info_examples Examples:
+\code
+luna-send -n 1 -f luna://com.webos.service.systemservice/diagnostics/getMemoryInfo '{}'
+\endcode
+*/
+bool MemoryDiagnostics::cbGetMemoryInfo(LSHandle* lsHandle, LSMessage *message, void *user_data)
+{
+	EMPTY_SCHEMA_RETURN(lsHandle, message);
+
+	JValue reply = MemoryDiagnostics::instance()->memoryReport();
+	reply.put("returnValue", true);
+
+	LS::Error error;
+	if (!LSMessageReply(lsHandle, message, reply.stringify().c_str(), error))
+	{
+		qWarning() << error.what();
+	}
+
+	return true;
+}
+
+/*!
+\page com_palm_diagnostics
+\n
+\section diagnostics_trim_memory trimMemory
+
+\e Private. Available only at the private bus.
+
+com.webos.service.systemservice/diagnostics/trimMemory
+
+Unloads the image module if no request is using it, drops the cached
+preference value lists that can be rebuilt on demand, releases the unused
+SQLite page cache and returns free heap to the system with malloc_trim.
+
+\subsection diagnostics_trim_memory_syntax Syntax:
+\code
+{
+}
+\endcode
+
+\subsection diagnostics_trim_memory_returns Returns:
+\code
+{
+	"returnValue": true,
+	"trimmed": boolean,
+	"rssBeforeKb": int,
+	...
+}
+\endcode
+
+\param trimmed True if malloc_trim gave memory back to the system.
+\param rssBeforeKb Resident set size before trimming.
+
+The remaining fields are the same as for \ref diagnostics_get_memory_info, taken after trimming.
+
+\subsection diagnostics_trim_memory_examples Examples:
+\code
+luna-send -n 1 -f luna://com.webos.service.systemservice/diagnostics/trimMemory '{}'
+\endcode
+*/
+bool MemoryDiagnostics::cbTrimMemory(LSHandle* lsHandle, LSMessage *message, void *user_data)
+{
+	EMPTY_SCHEMA_RETURN(lsHandle, message);
+
+	int64_t rssBefore, hwm;
+	readProcessMemory(rssBefore, hwm);
+
+	bool trimmed = MemoryDiagnostics::instance()->trim();
+	PmLogInfo(sysServiceLogContext(), "MEMORY_TRIMMED", 1,
+	          PMLOGKFV("RSS_BEFORE_KB", "%lld", static_cast<long long>(rssBefore)),
+	          "Caches released on request");
+
+	JValue reply = MemoryDiagnostics::instance()->memoryReport();
+	reply.put("returnValue", true);
+	reply.put("trimmed", trimmed);
+	reply.put("rssBeforeKb", rssBefore);
+
+	LS::Error error;
+	if (!LSMessageReply(lsHandle, message, reply.stringify().c_str(), error))
+	{
+		qWarning() << error.what();
+	}
+
+	return true;
+}
@@ -0,0 +1,35 @@
+// Copyright (c) 2010-2018 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+/*
+ * Stand-in for PlatformLuna.cpp, for programs that run the core library
+ * without a bus. Messages handed to the core belong to the caller, which
+ * keeps them alive until every task referencing them has completed.
+ */
+
+#include "Platform.h"
+
+namespace Platform {
+
+void messageRef(LSMessage*)
+{
+}
+
+void messageUnref(LSMessage*)
+{
+}
+
+}
@@ -21,11 +21,14 @@
 #include <string.h>
 #include <strings.h>
 #include <unistd.h>
+#include <vector>
 
 #include "Logging.h"
+#include "LogPrefsStore.h"
 #include "PrefsDb.h"
+#include "Settings.h"
+#include "SqlitePrefsStore.h"
 #include "Utils.h"
-#include "SystemRestore.h"
 
 using namespace pbnjson;
 
@@ -64,6 +67,20 @@ const char* PrefsDb::s_volumeIconFileAndPathDest = MEDIAPARTITIONPATH ".VolumeIc
 const char* PrefsDb::s_sysDefaultWallpaperKey = ".prefsdb.setting.default.wallpaper";
 const char* PrefsDb::s_sysDefaultRingtoneKey = ".prefsdb.setting.default.ringtone";
 
+const char* PrefsDb::s_schemaVersion = "2.0";
+
+const unsigned int PrefsDb::s_journalSize = 512;
+const unsigned int PrefsDb::s_writeBehindDelay = 2;	//seconds
+
+//"systemprefs.db" -> "systemprefs.log"
+static std::string logFilename(const std::string& dbFilename)
+{
+	std::string path = dbFilename;
+	if (g_str_has_suffix(path.c_str(), ".db"))
+		path.resize(path.size() - 3);
+	return path + ".log";
+}
+
 PrefsDb* PrefsDb::createStandalone(const std::string& dbFilename,bool deleteExisting)
 {
 	if (deleteExisting)
@@ -72,7 +89,7 @@ PrefsDb* PrefsDb::createStandalone(const std::string& dbFilename,bool deleteExis
 	}
 
 	PrefsDb * pDb = new PrefsDb(dbFilename);
-	if (pDb->m_prefsDb)
+	if (pDb->m_store)
 		return pDb;
 
 	//else, creation failed...delete the faulty pDb and return 0
@@ -81,26 +98,36 @@ PrefsDb* PrefsDb::createStandalone(const std::string& dbFilename,bool deleteExis
 }
 
 PrefsDb::PrefsDb()
-: m_prefsDb(0)
+: m_store()
 , m_standalone(false)
 , m_dbFilename(s_prefsDbPath)
 , m_deleteOnDestroy(false)
+, m_journalOpen(false)
+, m_lastSeq(0)
+, m_flushTimer(0)
 {
 	openPrefsDb();
 }
 
 PrefsDb::PrefsDb(const std::string& standaloneDbFilename)
-: m_prefsDb(0)
+: m_store()
 , m_standalone(true)
 , m_dbFilename(standaloneDbFilename)
 , m_deleteOnDestroy(false)
+, m_journalOpen(false)
+, m_lastSeq(0)
+, m_flushTimer(0)
 {
 	openPrefsDb();
 }
 
 PrefsDb::~PrefsDb()
 {
+	//closePrefsDb() writes whatever is still pending
 	closePrefsDb();
+	//a retry after a failed flush can't outlive us
+	if (m_flushTimer)
+		g_source_remove(m_flushTimer);
 	if (m_deleteOnDestroy)
 	{
 		//on purpose that it doesn't respect deleteOnDestroy for the singleton copy
@@ -108,142 +135,261 @@ PrefsDb::~PrefsDb()
 	}
 }
 
-bool PrefsDb::setPref(const std::string& key, const std::string& value)
+bool PrefsDb::setPref(const std::string& key, const std::string& value, const std::string& origin)
 {
-	if (!m_prefsDb)
+	if (!m_store)
 		return false;
 
-	if (key.empty())
-		return false;
+	auto writeBehind = m_writeBehind.find(key);
+	if (writeBehind != m_writeBehind.end()) {
+		WriteBehindEntry& entry = writeBehind->second;
+		if (entry.present && entry.value == value)
+			return true;
 
-	char *queryStr = sqlite3_mprintf("INSERT INTO Preferences "
-									  "VALUES (%Q, %Q)",
-									  key.c_str(), value.c_str());
-
-	if (!queryStr)
-		return false;
+		entry.value = value;
+		entry.origin = origin;
+		entry.present = true;
+		entry.dirty = true;
+		if (!m_flushTimer)
+			m_flushTimer = g_timeout_add_seconds(s_writeBehindDelay, (GSourceFunc) &PrefsDb::cbFlushPrefs, this);
+		return true;
+	}
 
-	int ret = sqlite3_exec(m_prefsDb, queryStr, NULL, NULL, NULL);
+	return writePref(key, value, origin);
+}
 
-	if (ret) {
-		qWarning("Failed to execute query for key %s", key.c_str());
+bool PrefsDb::writePref(const std::string& key, const std::string& value, const std::string& origin)
+{
+	if (key.empty())
+		return false;
 
-		sqlite3_free(queryStr);
+	//modified is the journal sequence the write is about to get
+	if (!m_store->put(key, value, m_journalOpen ? m_lastSeq + 1 : 0, origin)) {
+		qWarning("Failed to write key %s", key.c_str());
 		return false;
 	}
 
-	sqlite3_free(queryStr);
+	SSLOG_DEBUG("set ( [%s] , [---, length %zu] )", key.c_str(), value.size());
 
-	qDebug("set ( [%s] , [---, length %zu] )", key.c_str(), value.size());
+	journal(key, origin);
 	return true;
 }
 
-std::string PrefsDb::getPref(const std::string& key)
+void PrefsDb::journal(const std::string& key, const std::string& origin)
 {
-	sqlite3_stmt* statement = 0;
-	const char* tail = 0;
-	std::string result = "";
+	if (!m_journalOpen)
+		return;
 
-	if (!m_prefsDb || key.empty())
-		return result;
+	JournalEntry entry;
+	entry.seq = m_lastSeq + 1;
+	entry.key = key;
+	entry.timestamp = time(NULL);
+	entry.origin = origin;
+	if (!m_store->appendJournal(entry))
+		return;
 
-	char *queryStr = sqlite3_mprintf("SELECT value FROM Preferences WHERE key=%Q",key.c_str());
+	m_lastSeq = entry.seq;
 
-	if (!queryStr)
-		goto Done;
+	//trim once in a while rather than on every write
+	if (m_lastSeq % 64 == 0 && m_lastSeq > s_journalSize)
+		m_store->trimJournal(m_lastSeq - s_journalSize);
+}
 
-	if (sqlite3_prepare(m_prefsDb, queryStr, -1, &statement, &tail)) {
-		qWarning("Failed to prepare sql statement: %s", queryStr);
-		goto Done;
-	}
+bool PrefsDb::changesSince(uint64_t seq, std::map<std::string, JournalEntry>& r_changes)
+{
+	if (!m_journalOpen || seq > m_lastSeq)
+		return false;
 
-	if (sqlite3_step(statement) == SQLITE_ROW) {
-		const unsigned char* res = sqlite3_column_text(statement, 0);
-		if (res)
-			result = (const char*) res;
-	}
+	if (seq == m_lastSeq)
+		return true;
 
-Done:
+	std::list<JournalEntry> entries;
+	uint64_t firstSeq = 0;
 
-	if (statement)
-		sqlite3_finalize(statement);
+	//the journal has to hold the change right after seq, or some are missing
+	if (!m_store->readJournal(seq, entries, firstSeq) || firstSeq == 0 || firstSeq > seq + 1)
+		return false;
 
-	if (queryStr)
-		sqlite3_free(queryStr);
+	//later entries overwrite earlier ones, leaving the latest change per key
+	for (const JournalEntry& entry : entries)
+		r_changes[entry.key] = entry;
 
-	return result;
+	return true;
 }
 
-bool PrefsDb::getPref(const std::string& key,std::string& r_val)
+void PrefsDb::setWriteBehind(const std::string& key)
 {
-	sqlite3_stmt* statement = 0;
-	const char* tail = 0;
-	bool result = false;
-
-	if (!m_prefsDb || key.empty())
-		return result;
+	if (key.empty() || m_writeBehind.count(key))
+		return;
 
-	char *queryStr = sqlite3_mprintf("SELECT value FROM Preferences WHERE key=%Q",key.c_str());
+	WriteBehindEntry& entry = m_writeBehind[key];
+	entry.present = readPref(key, entry.value);
+}
 
-	if (!queryStr)
-		goto Done;
+void PrefsDb::loadWriteBehind()
+{
+	for (auto& writeBehind : m_writeBehind) {
+		WriteBehindEntry& entry = writeBehind.second;
+		if (entry.dirty)
+			continue;	//memory is ahead of the db
+		entry.value.clear();
+		entry.present = readPref(writeBehind.first, entry.value);
+	}
+}
 
-	if (sqlite3_prepare(m_prefsDb, queryStr, -1, &statement, &tail)) {
-		qWarning("Failed to prepare sql statement: %s", queryStr);
-		goto Done;
+void PrefsDb::flushPrefs()
+{
+	if (m_flushTimer) {
+		g_source_remove(m_flushTimer);
+		m_flushTimer = 0;
 	}
 
-	if (sqlite3_step(statement) == SQLITE_ROW) {
-		const unsigned char* res = sqlite3_column_text(statement, 0);
-		if (res)
-		{
-			r_val = (const char*) res;
-			result = true;
+	if (!m_store)
+		return;
+
+	bool pending = false;
+	for (const auto& writeBehind : m_writeBehind)
+		pending = pending || writeBehind.second.dirty;
+	if (!pending)
+		return;
+
+	//all or nothing, so a crash or a failed write can't leave half of the time
+	//state behind; only if no transaction could be started are keys written one by one
+	uint64_t lastSeq = m_lastSeq;
+	bool transaction = m_store->begin();
+	bool ok = true;
+	std::vector<WriteBehindEntry*> written;
+	for (auto& writeBehind : m_writeBehind) {
+		WriteBehindEntry& entry = writeBehind.second;
+		if (!entry.dirty)
+			continue;
+		if (!writePref(writeBehind.first, entry.value, entry.origin)) {
+			ok = false;
+			if (transaction)
+				break;
+			continue;
+		}
+		entry.dirty = false;
+		written.push_back(&entry);
+	}
+	if (transaction) {
+		ok = ok && m_store->commit();
+		if (!ok) {
+			m_store->rollback();
+			m_lastSeq = lastSeq;
+			//only what this flush wrote is pending again
+			for (WriteBehindEntry* entry : written)
+				entry->dirty = true;
 		}
 	}
+	if (!ok) {
+		qWarning() << "Failed to flush write-behind preferences, retrying later";
+		m_flushTimer = g_timeout_add_seconds(s_writeBehindDelay, (GSourceFunc) &PrefsDb::cbFlushPrefs, this);
+	}
+}
 
-	Done:
+PrefsDb::MemoryStats PrefsDb::memoryStats() const
+{
+	MemoryStats stats = { 0, 0, 0, m_writeBehind.size(), m_store ? m_store->name() : "" };
+	if (m_store)
+		m_store->memoryStats(stats.cacheUsed, stats.schemaUsed, stats.stmtUsed);
+	return stats;
+}
+
+void PrefsDb::releaseMemory()
+{
+	if (m_store)
+		m_store->releaseMemory();
+}
 
-	if (statement)
-		sqlite3_finalize(statement);
-	if (queryStr)
-		sqlite3_free(queryStr);
+int PrefsDb::cbFlushPrefs(void* data)
+{
+	PrefsDb* self = static_cast<PrefsDb*>(data);
+	self->m_flushTimer = 0;
+	self->flushPrefs();
+	return G_SOURCE_REMOVE;
+}
 
+std::string PrefsDb::getPref(const std::string& key)
+{
+	std::string result;
+	(void) getPref(key, result);
 	return result;
 }
 
+bool PrefsDb::getPref(const std::string& key,std::string& r_val)
+{
+	auto writeBehind = m_writeBehind.find(key);
+	if (writeBehind != m_writeBehind.end()) {
+		if (writeBehind->second.present)
+			r_val = writeBehind->second.value;
+		return writeBehind->second.present;
+	}
+
+	return readPref(key, r_val);
+}
+
+bool PrefsDb::readPref(const std::string& key,std::string& r_val)
+{
+	if (!m_store || key.empty())
+		return false;
+
+	return m_store->get(key, r_val);
+}
+
 std::map<std::string,std::string> PrefsDb::getAllPrefs()
 {
-	sqlite3_stmt* statement = 0;
-	const char* tail = 0;
-	int ret = 0;
-	std::string query;
 	std::map<std::string, std::string> result;
 
-	if (!m_prefsDb)
+	if (!m_store)
 		return result;
 
-	query = "SELECT * FROM Preferences;";
+	if (!m_store->getAll(result))
+		qWarning() << "Failed to read all preferences";
 
-	ret = sqlite3_prepare(m_prefsDb, query.c_str(), -1, &statement, &tail);
-	if (ret) {
-		qWarning() << "Failed to prepare sql statement";
-		goto Done;
+	//the db may lag behind for write-behind keys
+	for (const auto& writeBehind : m_writeBehind) {
+		if (writeBehind.second.present)
+			result[writeBehind.first] = writeBehind.second.value;
+		else
+			result.erase(writeBehind.first);
 	}
 
-	while ((ret = sqlite3_step(statement)) == SQLITE_ROW) {
-		const char* key = (const char*) sqlite3_column_text(statement, 0);
-		const char* val = (const char*) sqlite3_column_text(statement, 1);
-		if (!key || !val)
-			continue;
+	return result;
+}
+
+std::map<std::string, std::string> PrefsDb::getPrefsMatching(const std::string& pattern)
+{
+	std::map<std::string, std::string> result;
 
-		result[key] = val;
+	if (!m_store)
+		return result;
+
+	size_t wildcard = pattern.find_first_of("*?");
+	std::string prefix = pattern.substr(0, wildcard);
+	if (!m_store->getRange(prefix, result))
+		qWarning() << "Failed to read preferences starting with" << prefix.c_str();
+
+	//the db may lag behind for write-behind keys
+	for (auto writeBehind = m_writeBehind.lower_bound(prefix);
+	     writeBehind != m_writeBehind.end() && writeBehind->first.compare(0, prefix.size(), prefix) == 0;
+	     ++writeBehind) {
+		if (writeBehind->second.present)
+			result[writeBehind->first] = writeBehind->second.value;
+		else
+			result.erase(writeBehind->first);
 	}
 
-	Done:
+	//a plain "prefix*" is all of the range, anything else still has to match
+	if (wildcard != std::string::npos && wildcard == pattern.size() - 1 && pattern[wildcard] == '*')
+		return result;
 
-	if (statement)
-		sqlite3_finalize(statement);
+	for (auto it = result.begin(); it != result.end();) {
+		if (g_pattern_match_simple(pattern.c_str(), it->first.c_str()))
+			++it;
+		else
+			it = result.erase(it);
+	}
 
 	return result;
 }
@@ -257,25 +403,37 @@ int PrefsDb::merge(PrefsDb * p_sourceDb,bool overwriteSameKeys)
 
 int PrefsDb::merge(const std::string& sourceDbFilename,bool overwriteSameKeys)
 {
+	if (!m_store)
+		return 0;
+
 	if (overwriteSameKeys)
 	{
-		//can use the ATTACH method
-		std::string attachCmd = std::string("ATTACH '")+sourceDbFilename+std::string("' AS backupDb;");
-		bool sqlOk = runSqlCommand(attachCmd.c_str());
-		if (!sqlOk)
+		uint64_t lastSeq = m_lastSeq;
+		bool transaction = m_store->begin();
+		//restored values are journaled, clients following the journal get them as changes
+		std::list<std::string> mergedKeys;
+		bool merged = importPrefs(sourceDbFilename, "restore", &mergedKeys);
+		if (transaction) {
+			merged = merged && m_store->commit();
+			if (!merged) {
+				m_store->rollback();
+				m_lastSeq = lastSeq;	//the journal entries went with it
+			}
+		}
+
+		if (!merged)
 		{
-			qWarning() << "Failed to run ATTACH cmd to attach [" << sourceDbFilename.c_str() << "] to this db";
+			qWarning() << "Failed to merge [" << sourceDbFilename.c_str() << "] into this db";
 			return 0;
 		}
-		std::string mergeCmd = std::string("INSERT INTO main.Preferences SELECT * FROM backupDb.Preferences;");
-		sqlOk = runSqlCommand(mergeCmd.c_str());
-		if (!sqlOk)
-		{
-			qWarning() << "Failed to run INSERT command to merge [" << sourceDbFilename.c_str() << "] into this db";
-		}
-		else
-		{
-			qDebug("successfully merged [%s] into this db", sourceDbFilename.c_str());
+		qDebug("successfully merged [%s] into this db", sourceDbFilename.c_str());
+
+		//pending write-behind values of restored keys are stale now, closing
+		//mustn't write them over the restored ones; the reopen reloads them
+		for (const std::string& key : mergedKeys) {
+			auto writeBehind = m_writeBehind.find(key);
+			if (writeBehind != m_writeBehind.end())
+				writeBehind->second.dirty = false;
 		}
 
 		closePrefsDb();
@@ -291,13 +449,38 @@ int PrefsDb::merge(const std::string& sourceDbFilename,bool overwriteSameKeys)
 
 }
 
+bool PrefsDb::importPrefs(const std::string& sqliteDbFilename, const char* origin,
+                          std::list<std::string>* r_keys)
+{
+	if (!g_file_test(sqliteDbFilename.c_str(), G_FILE_TEST_EXISTS))
+		return false;
+
+	//backups are sqlite dbs whatever the main db is stored in
+	SqlitePrefsStore source;
+	std::map<std::string, std::string> prefs;
+	if (source.open(sqliteDbFilename) != PrefsStore::OpenExisting || !source.getAll(prefs))
+		return false;
+	source.close();
+
+	//keep our own databaseVersion, the source may be on an older schema
+	prefs.erase("databaseVersion");
+
+	bool ok = true;
+	for (const auto& pref : prefs) {
+		ok = putDefault(pref.first, pref.second, origin) && ok;
+		if (r_keys)
+			r_keys->push_back(pref.first);
+	}
+	return ok;
+}
+
 int PrefsDb::copyKeys(PrefsDb * p_sourceDb,const std::list<std::string>& keys,bool overwriteSameKeys)
 {
 	if (!p_sourceDb || (p_sourceDb == this))
 		return 0;
 	if (keys.empty())
 		return 0;
-	if (p_sourceDb->m_prefsDb == 0)
+	if (!p_sourceDb->m_store)
 		return 0;
 
 	qDebug("source DB file: [%s] , target DB file: [%s] , overwriteSameKeys = %s",
@@ -321,108 +504,33 @@ int PrefsDb::copyKeys(PrefsDb * p_sourceDb,const std::list<std::string>& keys,bo
 	return n;
 }
 
-sqlite3_stmt* PrefsDb::runSqlQuery(const std::string& queryStr)
-{
-	sqlite3_stmt* statement = 0;
-	int ret = 0;
-	const char* tail = 0;
-
-	if (!m_prefsDb)
-		return 0;
-
-	if (queryStr.empty())
-		return 0;
-
-	ret = sqlite3_prepare(m_prefsDb, queryStr.c_str(), -1, &statement, &tail);
-	if (ret != SQLITE_OK) {
-		qWarning("Failed to prepare sql statement");
-		if (statement)
-		{
-			sqlite3_finalize(statement);
-		}
-		return 0;
-	}
-
-	return statement;
-}
-
-bool PrefsDb::runSqlCommand(const std::string& cmdStr)
-{
-	bool rc = false;
-	int ret = 0;
-	char * pErrMsg = 0;
-
-	char * queryStr = sqlite3_mprintf("%s",cmdStr.c_str());
-	if (!queryStr)
-		return false;
-
-	ret = sqlite3_exec(m_prefsDb, queryStr, NULL, NULL, &pErrMsg);
-	if (ret) {
-		qWarning() << "Failed to execute cmd [" << queryStr << "] - extended error: [" << (pErrMsg ? pErrMsg : "<none>") << "]";
-		rc = false;
-	}
-	else
-		rc = true;
-
-	if (queryStr)
-		sqlite3_free(queryStr);
-	if (pErrMsg)
-		sqlite3_free(pErrMsg);
-	return rc;
-}
-
-//TODO: STILL UNSAFE IF THE KEY HAS SINGLE QUOTES IN IT! (SEE getPref() FOR EXAMPLE OF HOW TO FIX)
 std::map<std::string, std::string> PrefsDb::getPrefs(const std::list<std::string>& keys)
 {
-	sqlite3_stmt* statement = 0;
-	const char* tail = 0;
-	int ret = 0;
-	std::string query;
 	std::map<std::string, std::string> result;
-	std::list<std::string>::const_iterator it;
 
-	if (!m_prefsDb)
+	if (!m_store)
 		return result;
 
-	if (keys.empty())
-		goto Done;
-
-	query = "SELECT * FROM Preferences WHERE key='";
-	query += keys.front() + "'";
-
-	it = keys.begin();
-	++it;
-
-	for (; it != keys.end(); ++it)
-		query += " OR key='" + (*it) + "'";
-	query += ";";
-
-	ret = sqlite3_prepare(m_prefsDb, query.c_str(), -1, &statement, &tail);
-	if (ret) {
-		qWarning() << "Failed to prepare sql statement";
-		goto Done;
-	}
-
-	while ((ret = sqlite3_step(statement)) == SQLITE_ROW) {
-		const char* key = (const char*) sqlite3_column_text(statement, 0);
-		const char* val = (const char*) sqlite3_column_text(statement, 1);
-		if (!key || !val)
+	for (const auto& key : keys) {
+		auto writeBehind = m_writeBehind.find(key);
+		if (writeBehind != m_writeBehind.end()) {
+			//the db may lag behind for write-behind keys
+			if (writeBehind->second.present)
+				result[key] = writeBehind->second.value;
 			continue;
+		}
 
-		result[key] = val;
+		std::string value;
+		if (m_store->get(key, value))
+			result[key] = value;
 	}
 
-Done:
-
-	if (statement)
-		sqlite3_finalize(statement);
-
 	return result;
 }
 
 void PrefsDb::openPrefsDb()
 {
-	if (m_prefsDb)
+	if (m_store)
 	{
 		//already open
 		return;
@@ -432,162 +540,96 @@ void PrefsDb::openPrefsDb()
 	g_mkdir_with_parents(prefsDirPath, 0755);
 	g_free(prefsDirPath);
 
-	int ret = sqlite3_open(m_dbFilename.c_str(), &m_prefsDb);
-	if (ret) {
-		qWarning() << "Failed to open preferences db [" << m_dbFilename.c_str() << "]";
-		return;
-	}
-
-	if (!checkTableConsistency()) {
-
-		qWarning() << "Failed to create Preferences table";
-		sqlite3_close(m_prefsDb);
-		m_prefsDb = 0;
-		return;
-	}
-
-	ret = sqlite3_exec(m_prefsDb,
-					   "CREATE TABLE IF NOT EXISTS Preferences "
-					   "(key   TEXT NOT NULL ON CONFLICT FAIL UNIQUE ON CONFLICT REPLACE, "
-					   " value TEXT);", NULL, NULL, NULL);
-	if (ret) {
-		qWarning() << "Failed to create Preferences table";
-		sqlite3_close(m_prefsDb);
-		m_prefsDb = 0;
-		return;
-	}
-}
+	//standalone dbs are backups, they stay sqlite so any build can restore them
+	bool useLog = !m_standalone && Settings::instance()->m_prefsStorage == "log";
+	std::string path = useLog ? logFilename(m_dbFilename) : m_dbFilename;
+	if (useLog)
+		m_store.reset(new LogPrefsStore);
+	else
+		m_store.reset(new SqlitePrefsStore);
 
-void PrefsDb::closePrefsDb()
-{
-	if (!m_prefsDb)
+	PrefsStore::OpenResult opened = m_store->open(path);
+	if (opened == PrefsStore::OpenFailed) {
+		qWarning() << "Failed to open preferences db [" << path.c_str() << "]";
+		m_store.reset();
 		return;
-
-	(void) sqlite3_close(m_prefsDb);
-	m_prefsDb = 0;
-}
-
-bool PrefsDb::checkTableConsistency()
-{
-	if (!m_prefsDb)
-		return false;
-
-	int ret;
-	std::string query;
-	sqlite3_stmt* statement = 0;
-	const char* tail = 0;
-
-	if (!integrityCheckDb())
-	{
-		qCritical("integrity check failed on prefs db and it cannot be recreated");
-		return false;
-	}
-
-	query = "SELECT value FROM Preferences WHERE key='databaseVersion'";
-	ret = sqlite3_prepare(m_prefsDb, query.c_str(), -1, &statement, &tail);
-	if (ret) {
-		qWarning("Failed to prepare sql statement: %s (%s)",
-					  query.c_str(), sqlite3_errmsg(m_prefsDb));
-		sqlite3_finalize(statement);
-		goto Recreate;
-	}
-
-	ret = sqlite3_step(statement);
-	sqlite3_finalize(statement);
-	if (ret != SQLITE_ROW) {
-		// Database not consistent. recreate
-		goto Recreate;
 	}
 
 	if (!m_standalone)
 	{
-		// check to see if all the defaults from the s_defaultPrefsFile at least exist and if not, add them
-		synchronizeDefaults();
-		synchronizePlatformDefaults();
+		//before the defaults, so that the values they change get journaled
+		openJournal();
+		uint64_t lastSeq = m_lastSeq;
+
+		//one transaction for all defaults instead of one per key
+		bool transaction = m_store->begin();
+
+		//a new log starts out with the prefs of the sqlite db it replaces
+		if (opened == PrefsStore::OpenCreated && useLog && importPrefs(m_dbFilename, "import")) {
+			PmLogInfo(sysServiceLogContext(), "PREFSDB_IMPORTED", 1,
+			          PMLOGKS("FROM", m_dbFilename.c_str()),
+			          "Preferences imported into the log store");
+			opened = PrefsStore::OpenExisting;
+		}
 
-		//check the same with the "customer care" file
-		synchronizeCustomerCareInfo();
+		if (opened == PrefsStore::OpenCreated)
+		{
+			loadDefaultPrefs();
+			loadDefaultPlatformPrefs();
+		}
+		else
+		{
+			// check to see if all the defaults from the s_defaultPrefsFile at least exist and if not, add them
+			synchronizeDefaults();
+			synchronizePlatformDefaults();
 
+			//check the same with the "customer care" file
+			synchronizeCustomerCareInfo();
+		}
 		updateWithCustomizationPrefOverrides();
-	}
-	//Everything is now ok.
-	return true;
-
-Recreate:
-
-	(void) sqlite3_exec(m_prefsDb, "DROP TABLE Preferences", NULL, NULL, NULL);
-	ret = sqlite3_exec(m_prefsDb,
-					   "CREATE TABLE Preferences "
-					   "(key   TEXT NOT NULL ON CONFLICT FAIL UNIQUE ON CONFLICT REPLACE, "
-					   " value TEXT);", NULL, NULL, NULL);
-	if (ret) {
-		qWarning() << "Failed to create Preferences table";
-		return false;
-	}
 
-	ret = sqlite3_exec(m_prefsDb, "INSERT INTO Preferences VALUES ('databaseVersion', '1.0')",
-					   NULL, NULL, NULL);
-	if (ret) {
-		qWarning() << "Failed to create Preferences table";
-		return false;
+		if (transaction && !m_store->commit()) {
+			m_store->rollback();
+			m_lastSeq = lastSeq;
+		}
 	}
 
-
-	if (!m_standalone)
-	{
-		loadDefaultPrefs();
-		loadDefaultPlatformPrefs();
-		updateWithCustomizationPrefOverrides();
-	}
-	return true;
+	loadWriteBehind();
 }
 
-bool PrefsDb::integrityCheckDb()
+void PrefsDb::openJournal()
 {
-	if (!m_prefsDb)
-		return false;
-
-	sqlite3_stmt* statement = 0;
-	const char* tail = 0;
-	int ret = 0;
-	bool integrityOk = false;
-
-	ret = sqlite3_prepare(m_prefsDb, "PRAGMA integrity_check", -1, &statement, &tail);
-	if (ret) {
-		qCritical() << "Failed to prepare sql statement for integrity_check";
-		goto CorruptDb;
-	}
-
-	ret = sqlite3_step(statement);
-	if (ret == SQLITE_ROW) {
-		const unsigned char* result = sqlite3_column_text(statement, 0);
-		if (result && strcasecmp((const char*) result, "ok") == 0)
-			integrityOk = true;
+	//continues the sequence where the last run left it
+	if (!m_store->openJournal(m_lastSeq)) {
+		qWarning() << "Failed to open the preferences journal, changes won't be journaled";
+		return;
 	}
 
-	sqlite3_finalize(statement);
-
-	if (!integrityOk)
-		goto CorruptDb;
-
-	qDebug("Integrity check for database passed");
-
-	return true;
-
-CorruptDb:
+	m_journalOpen = true;
+}
 
-	qCritical() << "integrity check failed. recreating database";
+void PrefsDb::closePrefsDb()
+{
+	if (!m_store)
+		return;
 
-	sqlite3_close(m_prefsDb);
-	unlink(m_dbFilename.c_str());
+	flushPrefs();
 
-	ret = sqlite3_open_v2 (m_dbFilename.c_str(), &m_prefsDb, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, NULL);
-	if (ret) {
-		qCritical() << "Failed to re-open prefs db at [" << m_dbFilename.c_str() << "]";
-		return false;
-	}
+	m_store->close();
+	m_store.reset();
+	m_journalOpen = false;
+}
 
-	return true;
+bool PrefsDb::putDefault(const std::string& key, const std::string& value, const char* origin)
+{
+	if (!m_journalOpen)
+		return m_store->put(key, value, 0, std::string());
+
+	//only values that actually change get a sequence, defaults are put again on every start
+	std::string current;
+	if (m_store->get(key, current) && current == value)
+		return true;
+	return writePref(key, value, origin);
 }
 
 void PrefsDb::synchronizeDefaults() {
@@ -614,12 +656,8 @@ void PrefsDb::synchronizeDefaults() {
 		//allow special keys to be overriden
 		if ((cv.length() == 0) || ((strncmp(key.c_str(),".sysservice",11) == 0))) {
 
-			Utils::gstring queryStr = g_strdup_printf("INSERT INTO Preferences "
-													  "VALUES ('%s', '%s')",
-													  key.c_str(), p_cDbv.c_str());
-
-			if (sqlite3_exec(m_prefsDb, queryStr.get(), NULL, NULL, NULL)) {
-				qWarning() << "Failed to execute query:" << queryStr.get();
+			if (!putDefault(key, p_cDbv)) {
+				qWarning() << "Failed to store default value of" << key;
 			}
 		}
 	}
@@ -652,12 +690,8 @@ void PrefsDb::synchronizePlatformDefaults() {
 
 		if (cv.length() == 0) {
 
-			Utils::gstring queryStr = g_strdup_printf("INSERT INTO Preferences "
-													  "VALUES ('%s', '%s')",
-													  key.c_str(), p_cDbv.c_str());
-
-			if (sqlite3_exec(m_prefsDb, queryStr.get(), NULL, NULL, NULL)) {
-				qWarning() << "Failed to execute query:" << queryStr.get();
+			if (!putDefault(key, p_cDbv)) {
+				qWarning() << "Failed to store default value of" << key;
 			}
 		}
 	}
@@ -689,12 +723,8 @@ void PrefsDb::synchronizeCustomerCareInfo() {
 		std::string cv = getPref(key);
 
 		if (cv.length() == 0) {
-			Utils::gstring queryStr = g_strdup_printf("INSERT INTO Preferences "
-											  "VALUES ('%s', '%s')",
-											  key.c_str(), p_cDbv.c_str());
-
-			if (sqlite3_exec(m_prefsDb, queryStr.get(), NULL, NULL, NULL)) {
-				qWarning() << "Failed to execute query:" << queryStr.get();
+			if (!putDefault(key, p_cDbv)) {
+				qWarning() << "Failed to store default value of" << key;
 			}
 		}
 		else if (cv != p_cDbv) {
@@ -724,13 +754,8 @@ void PrefsDb::updateWithCustomizationPrefOverrides() {
 		if (!pref.second.isString())
 			continue; //TODO: really should delete this key if it is in the database
 
-		Utils::gstring queryStr = g_strdup_printf("INSERT INTO Preferences "
-										  "VALUES ('%s', '%s')",
-										  pref.first.asString().c_str(),
-										  pref.second.asString().c_str());
-
-		if (sqlite3_exec(m_prefsDb, queryStr.get(), NULL, NULL, NULL)) {
-			qWarning() << "Failed to execute query:" << queryStr.get();
+		if (!putDefault(pref.first.asString(), pref.second.asString())) {
+			qWarning() << "Failed to store default value of" << pref.first.asString();
 		}
 	}
 }
@@ -741,8 +766,6 @@ static const char* s_DBNEWTOKEN[] = {".prefsdb.setting.dbReset","\"1\""};
 
 void PrefsDb::loadDefaultPrefs() {
 
-	Utils::gstring queryStr { nullptr };
-
 	JValue root = JDomParser::fromFile(s_defaultPrefsFile);
 	if (!root.isObject()) {
 		qWarning() << "Failed to load json from the default prefs file: "
@@ -759,13 +782,8 @@ void PrefsDb::loadDefaultPrefs() {
 
 		for (const JValue::KeyValue pref: prefs.children()) {
 
-			queryStr = g_strdup_printf("INSERT INTO Preferences "
-									   "VALUES ('%s', '%s')",
-									   pref.first.asString().c_str(),
-									   pref.second.asString().c_str());
-
-			if (sqlite3_exec(m_prefsDb, queryStr.get(), NULL, NULL, NULL)) {
-				qWarning() << "Failed to execute query:" << queryStr.get();
+			if (!putDefault(pref.first.asString(), pref.second.asString())) {
+				qWarning() << "Failed to store default value of" << pref.first.asString();
 			}
 		}
 	}
@@ -773,12 +791,8 @@ void PrefsDb::loadDefaultPrefs() {
 Stage1a:
 	// ----------------- Load in the db tokens that let the system service know what restore stage the system is in (after reformats, etc)
 
-	queryStr = g_strdup_printf("INSERT INTO Preferences "
-							   "VALUES ('%s', '%s')",
-							   s_DBNEWTOKEN[0],s_DBNEWTOKEN[1]);
-
-	if (sqlite3_exec(m_prefsDb, queryStr.get(), NULL, NULL, NULL)) {
-		qWarning() << "Failed to execute query:" << queryStr.get();
+	if (!putDefault(s_DBNEWTOKEN[0], s_DBNEWTOKEN[1])) {
+		qWarning() << "Failed to store default value of" << s_DBNEWTOKEN[0];
 	}
 
 	//customer care number also...this is in a separate file
@@ -793,13 +807,8 @@ Stage1a:
 
 		if (!pref.second.isString()) continue;
 
-		queryStr = g_strdup_printf("INSERT INTO Preferences "
-								   "VALUES ('%s', '%s')",
-								   pref.first.asString().c_str(),
-								   pref.second.asString().c_str());
-
-		if (sqlite3_exec(m_prefsDb, queryStr.get(), NULL, NULL, NULL)) {
-			qWarning() << "Failed to execute query:" << queryStr.get();
+		if (!putDefault(pref.first.asString(), pref.second.asString())) {
+			qWarning() << "Failed to store default value of" << pref.first.asString();
 			continue;
 		}
 
@@ -807,28 +816,18 @@ Stage1a:
 	}
 
 Stage3:
-	queryStr = g_strdup_printf("INSERT INTO Preferences "
-							   "VALUES ('%s', '%s')",
-							   s_DEFAULT_uaProf[0],s_DEFAULT_uaProf[1]);
-
-	int ret = sqlite3_exec(m_prefsDb, queryStr.get(), NULL, NULL, NULL);
-	if (ret) {
-		qWarning() << "[Stage 3] Failed to execute query:" << queryStr.get();
+	if (!putDefault(s_DEFAULT_uaProf[0], s_DEFAULT_uaProf[1])) {
+		qWarning() << "[Stage 3] Failed to store default value of" << s_DEFAULT_uaProf[0];
 	}
 
-	queryStr = g_strdup_printf("INSERT INTO Preferences "
-							   "VALUES ('%s', '%s')",
-							   s_DEFAULT_uaString[0],s_DEFAULT_uaString[1]);
-
-	ret = sqlite3_exec(m_prefsDb, queryStr.get(), NULL, NULL, NULL);
-	if (ret) {
-		qWarning() << "[Stage 3] Failed to execute query:" << queryStr.get();
+	if (!putDefault(s_DEFAULT_uaString[0], s_DEFAULT_uaString[1])) {
+		qWarning() << "[Stage 3] Failed to store default value of" << s_DEFAULT_uaString[0];
 	}
 
 	//back up the defaults for certain prefs
 	backupDefaultPrefs();
 	//refresh system restore
-	SystemRestore::instance()->refreshDefaultSettings();
+	defaultsReloaded.fire();
 
 }
 
@@ -850,13 +849,8 @@ void PrefsDb::loadDefaultPlatformPrefs() {
 
 		for (const JValue::KeyValue pref: prefs.children()) {
 
-			Utils::gstring queryStr = g_strdup_printf("INSERT INTO Preferences "
-											  "VALUES ('%s', '%s')",
-											  pref.first.asString().c_str(),
-											  pref.second.asString().c_str());
-
-			if (sqlite3_exec(m_prefsDb, queryStr.get(), NULL, NULL, NULL)) {
-				qWarning() << "Failed to execute query:" << queryStr.get();
+			if (!putDefault(pref.first.asString(), pref.second.asString())) {
+				qWarning() << "Failed to store default value of" << pref.first.asString();
 			}
 		}
 	} while (false);
@@ -864,7 +858,7 @@ void PrefsDb::loadDefaultPlatformPrefs() {
 	//back up the defaults for certain prefs
 	backupDefaultPrefs();
 	//refresh system restore
-	SystemRestore::instance()->refreshDefaultSettings();
+	defaultsReloaded.fire();
 }
 
 void PrefsDb::backupDefaultPrefs()
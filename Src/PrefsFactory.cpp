@@ -18,7 +18,9 @@
 
 #include <glib.h>
 
+#include <cstdint>
 #include <memory>
+#include <set>
 #include <luna-service2++/error.hpp>
 
 #include "ErrorException.h"
@@ -30,6 +32,7 @@
 #include "WallpaperPrefsHandler.h"
 #include "BuildInfoHandler.h"
 #include "RingtonePrefsHandler.h"
+#include "TimeThread.h"
 
 #include "UrlRep.h"
 #include "JSONUtils.h"
@@ -38,6 +41,22 @@ using namespace pbnjson;
 
 static const char* s_logChannel = "PrefsFactory";
 
+const char* PrefsFactory::s_keyPatternPrefix = "keyPattern:";
+const char* PrefsFactory::s_seqPrefix = "withSeq:";
+
+//json_object with "seq" added as its first member
+static std::string addSeq(const std::string& json_object, uint64_t seq)
+{
+	size_t brace = json_object.find('{');
+	if (brace == std::string::npos)
+		return json_object;
+
+	size_t next = json_object.find_first_not_of(" \t\n", brace + 1);
+	bool empty = next != std::string::npos && json_object[next] == '}';
+	return json_object.substr(0, brace + 1) + "\"seq\":" + std::to_string(seq) + (empty ? "" : ",")
+	       + json_object.substr(brace + 1);
+}
+
 static bool cbSetPreferences(LSHandle* lsHandle, LSMessage* message,
 							 void* user_data);
 static bool cbGetPreferences(LSHandle* lsHandle, LSMessage* message,
@@ -61,12 +80,93 @@ static LSMethod s_methods[] = {
 	{ 0, 0 }
 };
 
+/*
+ * Key to handler dispatch. The handled keys are fixed at build time, so they
+ * are laid out as a perfect hash table: s_keySlots maps a seeded FNV-1a hash
+ * of the key to its entry in s_handledKeys, and the seed is searched by the
+ * compiler until no two keys share a slot. A lookup is one hash and one
+ * string compare.
+ *
+ * Every key of a handler's keys() has to be listed here; registerPrefHandler
+ * complains at startup about the ones that aren't.
+ */
+struct HandledKey {
+	const char* name;
+	PrefsFactory::HandlerId handler;
+};
+
+static constexpr HandledKey s_handledKeys[] = {
+	{ "locale",             PrefsFactory::HandlerLocale },
+	{ "region",             PrefsFactory::HandlerLocale },
+	{ "useNetworkTime",     PrefsFactory::HandlerTime },
+	{ "useNetworkTimeZone", PrefsFactory::HandlerTime },
+	{ "timeZone",           PrefsFactory::HandlerTime },
+	{ "timeFormat",         PrefsFactory::HandlerTime },
+	{ "timeChangeLaunch",   PrefsFactory::HandlerTime },
+	{ "timeDriftPeriodHr",  PrefsFactory::HandlerTime },
+	{ "nitzValidity",       PrefsFactory::HandlerTime },
+	{ "wallpaper",          PrefsFactory::HandlerWallpaper },
+	{ "screenSize.width",   PrefsFactory::HandlerWallpaper },
+	{ "screenSize.height",  PrefsFactory::HandlerWallpaper },
+	{ "ringtone",           PrefsFactory::HandlerRingtone },
+};
+
+static constexpr unsigned s_handledKeyCount = sizeof(s_handledKeys) / sizeof(s_handledKeys[0]);
+static constexpr uint32_t s_keySlotCount = 64;		//power of two, a few times the key count
+
+static constexpr uint32_t keyHash(const char* key, uint32_t hash)
+{
+	return *key ? keyHash(key + 1, (hash ^ (unsigned char) *key) * 16777619u) : hash;
+}
+
+static constexpr uint32_t keySlot(unsigned i, uint32_t seed)
+{
+	return keyHash(s_handledKeys[i].name, seed) & (s_keySlotCount - 1);
+}
+
+//does any of the keys from i on land in slot
+static constexpr bool slotTaken(uint32_t slot, unsigned i, uint32_t seed)
+{
+	return i < s_handledKeyCount && (keySlot(i, seed) == slot || slotTaken(slot, i + 1, seed));
+}
+
+static constexpr bool collisionFree(unsigned i, uint32_t seed)
+{
+	return i >= s_handledKeyCount || (!slotTaken(keySlot(i, seed), i + 1, seed) && collisionFree(i + 1, seed));
+}
+
+static constexpr uint32_t findSeed(uint32_t seed, unsigned tries)
+{
+	return (collisionFree(0, seed) || tries == 0) ? seed : findSeed(seed + 1, tries - 1);
+}
+
+static constexpr uint32_t s_keySeed = findSeed(2166136261u, 200);
+static_assert(collisionFree(0, s_keySeed), "no collision free seed for s_handledKeys, raise s_keySlotCount");
+
+//entry of s_handledKeys in slot, -1 if it is empty
+static constexpr int keyForSlot(uint32_t slot, unsigned i = 0)
+{
+	return i >= s_handledKeyCount ? -1 : keySlot(i, s_keySeed) == slot ? (int) i : keyForSlot(slot, i + 1);
+}
+
+#define KEY_SLOTS_8(s) keyForSlot(s), keyForSlot(s + 1), keyForSlot(s + 2), keyForSlot(s + 3), \
+                       keyForSlot(s + 4), keyForSlot(s + 5), keyForSlot(s + 6), keyForSlot(s + 7)
+static constexpr int8_t s_keySlots[s_keySlotCount] = {
+	KEY_SLOTS_8(0),  KEY_SLOTS_8(8),  KEY_SLOTS_8(16), KEY_SLOTS_8(24),
+	KEY_SLOTS_8(32), KEY_SLOTS_8(40), KEY_SLOTS_8(48), KEY_SLOTS_8(56)
+};
+#undef KEY_SLOTS_8
+
 PrefsFactory::PrefsFactory()
 	: m_serviceHandle(nullptr)
 {
 	PrefsDb::instance();
 }
 
+PrefsFactory::~PrefsFactory()
+{
+}
+
 void PrefsFactory::setServiceHandle(LSHandle* serviceHandle)
 {
 	m_serviceHandle = serviceHandle;
@@ -78,30 +178,36 @@ void PrefsFactory::setServiceHandle(LSHandle* serviceHandle)
 		return;
 	}
 
+	// time preferences set this way show up in getSystemTime
+	TimeThread::instance()->orderAfter("/", "setPreferences");
+
 	// Now we can create all the prefs handlers
-	registerPrefHandler(std::make_shared<LocalePrefsHandler>(serviceHandle));
-	registerPrefHandler(std::make_shared<TimePrefsHandler>(serviceHandle));
-	registerPrefHandler(std::make_shared<WallpaperPrefsHandler>(serviceHandle));
-	registerPrefHandler(std::make_shared<BuildInfoHandler>(serviceHandle));
-	registerPrefHandler(std::make_shared<RingtonePrefsHandler>(serviceHandle));
+	registerPrefHandler(HandlerLocale, new LocalePrefsHandler(serviceHandle));
+	registerPrefHandler(HandlerTime, new TimePrefsHandler(serviceHandle));
+	registerPrefHandler(HandlerWallpaper, new WallpaperPrefsHandler(serviceHandle));
+	registerPrefHandler(HandlerBuildInfo, new BuildInfoHandler(serviceHandle));
+	registerPrefHandler(HandlerRingtone, new RingtonePrefsHandler(serviceHandle));
 }
 
-std::shared_ptr<PrefsHandler> PrefsFactory::getPrefsHandler(const std::string& key) const
+PrefsHandler* PrefsFactory::getPrefsHandler(const std::string& key) const
 {
-	auto it = m_handlersMaps.find(key);
-	if (it == m_handlersMaps.end())
+	int index = s_keySlots[keyHash(key.c_str(), s_keySeed) & (s_keySlotCount - 1)];
+	if (index < 0 || key != s_handledKeys[index].name)
 		return nullptr;
 
-	return (*it).second;
+	return m_handlers[s_handledKeys[index].handler].get();
 }
 
-void PrefsFactory::registerPrefHandler(const PrefsHandlerPtr& handler)
+void PrefsFactory::registerPrefHandler(HandlerId id, PrefsHandler* handler)
 {
 	assert(handler);
+	m_handlers[id].reset(handler);
 
 	std::list<std::string> keys = handler->keys();
-	for (const auto& key : keys)
-		m_handlersMaps[key] = handler;
+	for (const auto& key : keys) {
+		if (getPrefsHandler(key) != handler)
+			qCritical() << "key" << key.c_str() << "is not in the handled keys table, it won't reach its handler";
+	}
 }
 
 void PrefsFactory::postPrefChange(const std::string& keyStr,const std::string& valueStr)
@@ -132,7 +238,8 @@ void PrefsFactory::postPrefChange(const std::string& keyStr,const std::string& v
 		LSErrorFree(&lserror);
 	}
 
-
+	(void) postWithSeq(std::string(s_seqPrefix) + keyStr, reply);
+	postPrefChangeToKeyPatterns(keyStr, reply);
 }
 
 void PrefsFactory::postPrefChangeValueIsCompleteString(const std::string& keyStr,const std::string& json_string)
@@ -169,6 +276,77 @@ void PrefsFactory::postPrefChangeValueIsCompleteString(const std::string& keyStr
 		LSErrorFree(&lserror);
 	}
 
+	(void) postWithSeq(std::string(s_seqPrefix) + keyStr, reply);
+}
+
+bool PrefsFactory::postWithSeq(const std::string& subscriptionKey, const std::string& json_string)
+{
+	LSSubscriptionIter* iter = NULL;
+	LS::Error error;
+	if (!LSSubscriptionAcquire(m_serviceHandle, subscriptionKey.c_str(), &iter, error))
+		return false;
+
+	//the seq is only known after the change, and only needed with subscribers
+	bool subscribed = false;
+	std::string reply;
+	while (LSSubscriptionHasNext(iter)) {
+		if (!subscribed) {
+			reply = addSeq(json_string, PrefsDb::instance()->lastSeq());
+			subscribed = true;
+		}
+		LSMessage* message = LSSubscriptionNext(iter);
+		LS::Error replyError;
+		if (!LSMessageReply(m_serviceHandle, message, reply.c_str(), replyError))
+			qWarning() << "Failed to notify" << subscriptionKey.c_str() << ":" << replyError.what();
+	}
+	LSSubscriptionRelease(iter);
+	return subscribed;
+}
+
+bool PrefsFactory::addKeyPatternSubscription(LSHandle* lsHandle, const std::string& pattern, LSMessage* message,
+                                             bool withSeq)
+{
+	LS::Error error;
+	std::string subscriptionKey = std::string(withSeq ? s_seqPrefix : "") + s_keyPatternPrefix + pattern;
+	if (!LSSubscriptionAdd(lsHandle, subscriptionKey.c_str(), message, error)) {
+		qWarning() << "Failed to subscribe to key pattern" << pattern.c_str() << ":" << error.what();
+		return false;
+	}
+
+	m_keyPatterns.insert(pattern);
+	return true;
+}
+
+void PrefsFactory::postPrefChangeToKeyPatterns(const std::string& key, const std::string& json_string)
+{
+	for (auto pattern = m_keyPatterns.begin(); pattern != m_keyPatterns.end();) {
+		if (!g_pattern_match_simple(pattern->c_str(), key.c_str())) {
+			++pattern;
+			continue;
+		}
+
+		std::string subscriptionKey = std::string(s_keyPatternPrefix) + *pattern;
+		LSSubscriptionIter* iter = NULL;
+		LS::Error error;
+		bool subscribed = false;
+		if (LSSubscriptionAcquire(m_serviceHandle, subscriptionKey.c_str(), &iter, error)) {
+			while (LSSubscriptionHasNext(iter)) {
+				subscribed = true;
+				LSMessage* message = LSSubscriptionNext(iter);
+				LS::Error replyError;
+				if (!LSMessageReply(m_serviceHandle, message, json_string.c_str(), replyError))
+					qWarning() << "Failed to notify key pattern" << pattern->c_str() << ":" << replyError.what();
+			}
+			LSSubscriptionRelease(iter);
+		}
+		subscribed = postWithSeq(s_seqPrefix + subscriptionKey, json_string) || subscribed;
+
+		//the last subscriber has gone away
+		if (subscribed)
+			++pattern;
+		else
+			pattern = m_keyPatterns.erase(pattern);
+	}
 }
 
 void PrefsFactory::refreshAllKeys()
@@ -200,9 +378,9 @@ void PrefsFactory::runConsistencyChecksOnAllHandlers()
 {
 	//go through all the handlers
 
-	for (PrefsHandlerMap::iterator it = m_handlersMaps.begin();it != m_handlersMaps.end();++it) {
-		std::string key = it->first;
-		auto handler = it->second;
+	for (const HandledKey& handledKey : s_handledKeys) {
+		std::string key = handledKey.name;
+		PrefsHandler* handler = m_handlers[handledKey.handler].get();
 		if (handler) {
 			//run the verifier on this key to make sure the pref is correct
 			if (handler->isPrefConsistent() == false) {
@@ -216,6 +394,29 @@ void PrefsFactory::runConsistencyChecksOnAllHandlers()
 	}
 }
 
+std::map<std::string, size_t> PrefsFactory::handlersMemoryUsed() const
+{
+	std::map<std::string, size_t> used;
+
+	for (const auto& handler : m_handlers) {
+		if (!handler)
+			continue;
+		std::list<std::string> keys = handler->keys();
+		if (!keys.empty())
+			used[keys.front()] = handler->memoryUsed();
+	}
+
+	return used;
+}
+
+void PrefsFactory::releaseHandlerCaches()
+{
+	for (const auto& handler : m_handlers) {
+		if (handler)
+			handler->releaseCaches();
+	}
+}
+
 /*!
 \page com_palm_systemservice
 \n
@@ -298,8 +499,8 @@ static bool cbSetPreferences(LSHandle* lsHandle, LSMessage* message,
 			if (handler) {
 				PMLOG_TRACE("found handler for %s", key.c_str());
 				if (handler->validate(key, pref.second, callerId)) {
-					qDebug("handler validated value for key [%s]",key.c_str());
-					savedPref = PrefsDb::instance()->setPref(key, value);
+					SSLOG_DEBUG("handler validated value for key [%s]",key.c_str());
+					savedPref = PrefsDb::instance()->setPref(key, value, callerId);
 				}
 				else {
 					qWarning() << "handler DID NOT validate value for key:" << key.c_str();
@@ -309,9 +510,9 @@ static bool cbSetPreferences(LSHandle* lsHandle, LSMessage* message,
 				qWarning() << "setPref did NOT find handler for:" << key.c_str();
 
 				//filter out
-				savedPref = PrefsDb::instance()->setPref(key, value);
+				savedPref = PrefsDb::instance()->setPref(key, value, callerId);
 			}
-			qDebug("setPref saved? %s",(savedPref ? "true" : "false"));
+			SSLOG_DEBUG("setPref saved? %s",(savedPref ? "true" : "false"));
 
 			if (savedPref) {
 				++savecount;
@@ -319,7 +520,9 @@ static bool cbSetPreferences(LSHandle* lsHandle, LSMessage* message,
 				// successfully set the preference. post a notification about it
 				JObject json {{key, pref.second}};
 
-				PrefsFactory::instance()->postPrefChangeValueIsCompleteString(key, json.stringify());
+				std::string notification = json.stringify();
+				PrefsFactory::instance()->postPrefChangeValueIsCompleteString(key, notification);
+				PrefsFactory::instance()->postPrefChangeToKeyPatterns(key, notification);
 
 				// Inform the handler about the change
 				if (handler)
@@ -406,33 +609,49 @@ static bool quotesRequired(const std::string& value)
 
 com.webos.service.systemservice/getPreferences
 
-Retrieves the values for keys specified in a passed array. If subscribe is set to true, then getPreferences sends an update if the key values change.
+Retrieves the values for keys specified in a passed array, or for all keys starting with keyPrefix. If subscribe is set to true, then getPreferences sends an update if the key values change.
 
 \subsection com_palm_systemservice_get_preferences_syntax Syntax:
 \code
 {
 	"subscribe" : boolean,
-	"keys"      : string array
+	"keys"      : string array,
+	"keyPrefix" : string,
+	"sinceSeq"  : integer,
+	"withSeq"   : boolean
 }
 \endcode
 
-\param subscribe If true, getPreferences sends an update whenever the value of one of the keys changes.
-\param keys An array of key names. Required.
+\param subscribe If true, getPreferences sends an update whenever the value of one of the keys changes. For keyPrefix and patterns this includes keys that are set for the first time.
+\param keys An array of key names. A name containing '*' (any run of characters) or '?' (any one character) is a pattern and returns every key it matches. Required unless keyPrefix is given.
+\param keyPrefix Same as the pattern "<keyPrefix>*": every key starting with keyPrefix. Required unless keys is given.
+\param sinceSeq Optional. A "seq" from an earlier reply or update; only keys changed after it are returned. Implies withSeq.
+\param withSeq Optional. If true, the reply and every subscription update carry "seq". Without it (or sinceSeq) neither does.
 
 \subsection com_palm_systemservice_get_preferences_returns Returns:
 \code
 {
    "[no name]"   : object,
+   "seq"         : integer,
+   "fullResync"  : boolean,
+   "changes"     : object array,
    "returnValue" : boolean
 }
 \endcode
 
 \param "[no name]" Key-value pairs containing the values for the requested preferences. If the requested preferences key or keys do not exist, the object is empty.
+\param seq Only with withSeq or sinceSeq. Sequence number of the latest preference change, also in each subscription update. Pass the last one seen as sinceSeq to resync later; for keys written behind (nitzValidity, lastSystemTimeSource) that may return the last change again.
+\param fullResync Only with sinceSeq. True if the change journal doesn't reach back to sinceSeq anymore; all requested keys are returned then.
+\param changes Only with sinceSeq. For each returned key that changed: "key", "seq", "timestamp" (seconds since epoch) and "origin" (app id that made the change if known, "restore" for values restored from a backup, "default" for defaults and customization overrides).
 \param returnValue Indicates if the call was succesful.
 
 \subsection com_palm_systemservice_get_preferences_examples Examples:
 \code
 luna-send -n 1 -f luna://com.webos.service.systemservice/getPreferences '{"subscribe": false, "keys":["wallpaper", "ringtone"]}'
+luna-send -n 1 -f luna://com.webos.service.systemservice/getPreferences '{"keys":["wallpaper", "ringtone"], "sinceSeq": 42}'
+luna-send -i -f luna://com.webos.service.systemservice/getPreferences '{"subscribe": true, "keys":["timeZone"], "withSeq": true}'
+luna-send -i -f luna://com.webos.service.systemservice/getPreferences '{"subscribe": true, "keyPrefix": "timeZone"}'
+luna-send -n 1 -f luna://com.webos.service.systemservice/getPreferences '{"keys":["ringtone", "wallpaper*"]}'
 \endcode
 
 Example response for a succesful call:
@@ -462,10 +681,12 @@ Example response for a failed call:
 */
 static bool cbGetPreferences(LSHandle* lsHandle, LSMessage* message, void*)
 {
-	// {"subscribe": boolean, "keys": array of strings}
-	LSMessageJsonParser parser(message, STRICT_SCHEMA(PROPS_2(PROPERTY(subscribe, boolean),
-															  R"("keys":{"type": "array", "minItems": 1, "items": {"type":"string"}})")
-													  REQUIRED_1(keys)));
+	// {"subscribe": boolean, "keys": array of strings, "keyPrefix": string, "sinceSeq": integer, "withSeq": boolean}
+	LSMessageJsonParser parser(message, STRICT_SCHEMA(PROPS_5(PROPERTY(subscribe, boolean),
+															  R"("keys":{"type": "array", "minItems": 1, "items": {"type":"string"}})",
+															  R"("keyPrefix":{"type": "string", "minLength": 1})",
+															  R"("sinceSeq":{"type": "integer", "minimum": 0})",
+															  PROPERTY(withSeq, boolean))));
 
 	if (!parser.parse(__FUNCTION__, lsHandle, EValidateAndErrorAlways))
 		return true;
@@ -474,10 +695,26 @@ static bool cbGetPreferences(LSHandle* lsHandle, LSMessage* message, void*)
 
 	bool subscription = false;
 
-	JValue label = root["keys"];
+	if (!root.hasKey("keys") && !root.hasKey("keyPrefix")) {
+		JObject reply {{"returnValue", false},
+		               {"subscribed", false},
+		               {"errorCode", "no keys specified"}};
+		LS::Error error;
+		(void) LSMessageReply(lsHandle, message, reply.stringify().c_str(), error);
+		return true;
+	}
+
+	// plain keys, and globs / the prefix which are answered from a range of the key order
 	std::list<std::string> keyList;
+	std::list<std::string> patternList;
+	JValue label = root["keys"];
 	for (const JValue &key: label.items()) {
 		std::string key_str = key.asString();
+		if (PrefsDb::isKeyPattern(key_str)) {
+			patternList.push_back(key_str);
+			continue;
+		}
+
 		auto handler = PrefsFactory::instance()->getPrefsHandler(key_str);
 		if (handler) {
 			//run the verifier on this key to make sure the pref is correct
@@ -489,17 +726,52 @@ static bool cbGetPreferences(LSHandle* lsHandle, LSMessage* message, void*)
 		}
 		keyList.push_back(key_str);
 	}
-
-	std::map<std::string, std::string> resultMap = PrefsDb::instance()->getPrefs(keyList);
+	if (root.hasKey("keyPrefix"))
+		patternList.push_back(root["keyPrefix"].asString() + "*");
+
+	// on a resync only keys changed since the caller's last seq are needed
+	bool resync = root.hasKey("sinceSeq");
+	// seq fields only for callers that ask for them, they'd look like preference keys to others
+	bool withSeq = resync || (root.hasKey("withSeq") && root["withSeq"].asBool());
+	bool fullResync = false;
+	std::map<std::string, PrefsDb::JournalEntry> changes;
+	std::list<std::string> fetchList;
+	if (resync)
+		fullResync = !PrefsDb::instance()->changesSince(root["sinceSeq"].asNumber<int64_t>(), changes);
+
+	std::map<std::string, std::string> resultMap;
+	if (!resync || fullResync) {
+		if (!keyList.empty())
+			resultMap = PrefsDb::instance()->getPrefs(keyList);
+		for (const auto& pattern : patternList) {
+			std::map<std::string, std::string> matches = PrefsDb::instance()->getPrefsMatching(pattern);
+			resultMap.insert(matches.begin(), matches.end());
+		}
+	}
+	else {
+		std::set<std::string> requested(keyList.begin(), keyList.end());
+		for (const auto& change : changes) {
+			bool wanted = requested.count(change.first) > 0;
+			for (auto pattern = patternList.begin(); !wanted && pattern != patternList.end(); ++pattern)
+				wanted = g_pattern_match_simple(pattern->c_str(), change.first.c_str());
+			if (wanted)
+				fetchList.push_back(change.first);
+		}
+		if (!fetchList.empty())
+			resultMap = PrefsDb::instance()->getPrefs(fetchList);
+	}
 
 	if (LSMessageIsSubscription(message)) {
 
 		LS::Error tmp_error;
+		std::string prefix = withSeq ? PrefsFactory::s_seqPrefix : "";
 		for (std::list<std::string>::const_iterator it = keyList.begin();
 			 it != keyList.end(); ++it) {
-			(void) LSSubscriptionAdd(lsHandle, (*it).c_str(),
+			(void) LSSubscriptionAdd(lsHandle, (prefix + *it).c_str(),
 									 message, tmp_error);
 		}
+		for (const auto& pattern : patternList)
+			(void) PrefsFactory::instance()->addKeyPatternSubscription(lsHandle, pattern, message, withSeq);
 		subscription = true;
 	}
 	else
@@ -511,7 +783,7 @@ static bool cbGetPreferences(LSHandle* lsHandle, LSMessage* message, void*)
 		 it != resultMap.end(); ++it) {
 		JValue value = JDomParser::fromString((*it).second);
 		if (value.isValid()) {
-			qDebug("resultMap: [%s] -> [---, length %zu]",(*it).first.c_str(),(*it).second.size());
+			SSLOG_DEBUG("resultMap: [%s] -> [---, length %zu]",(*it).first.c_str(),(*it).second.size());
 			reply.put((*it).first, value);
 		}
 		else {
@@ -536,6 +808,25 @@ static bool cbGetPreferences(LSHandle* lsHandle, LSMessage* message, void*)
 	}
 
 	if (errorCode.empty()) {
+		if (withSeq)
+			reply.put("seq", static_cast<int64_t>(PrefsDb::instance()->lastSeq()));
+		if (resync) {
+			JArray changesArray;
+			for (const auto& key : fetchList) {
+				auto change = changes.find(key);
+				if (change == changes.end())
+					continue;
+
+				JObject changeObj {{"key", key},
+				                   {"seq", static_cast<int64_t>(change->second.seq)},
+				                   {"timestamp", change->second.timestamp}};
+				if (!change->second.origin.empty())
+					changeObj.put("origin", change->second.origin);
+				changesArray.append(changeObj);
+			}
+			reply.put("fullResync", fullResync);
+			reply.put("changes", changesArray);
+		}
 		reply.put("subscribed", subscription);
 		reply.put("returnValue", true);
 	}
@@ -567,11 +858,17 @@ Retrieve the list of valid values for the specified key. If the key is of a type
 \subsection com_palm_systemservice_get_preference_values_syntax Syntax:
 \code
 {
-	"key": string
+	"key": string,
+	"offset": integer,
+	"limit": integer,
+	"fields": string array
 }
 \endcode
 
 \param key Key name.
+\param offset Optional. Index of the first value to return. Defaults to 0.
+\param limit Optional. Maximum number of values to return. 0 or absent means all of them.
+\param fields Optional. For values that are objects, the names of the properties to return.
 
 \subsection com_palm_systemservice_get_preference_value_returns Returns:
 \code
@@ -582,11 +879,14 @@ Retrieve the list of valid values for the specified key. If the key is of a type
 \endcode
 
 \param "[no name]" The key and the valid values.
+\param total Total number of values for the key. Only returned if offset, limit or fields was given.
+\param offset Index of the first returned value. Only returned if offset, limit or fields was given.
 \param returnValue Indicates if the call was succesful.
 
 \subsection com_palm_systemservice_get_preference_value_examples Examples:
 \code
 luna-send -n 1 -f luna://com.webos.service.systemservice/getPreferenceValues '{"key": "wallpaper" }'
+luna-send -n 1 -f luna://com.webos.service.systemservice/getPreferenceValues '{"key": "timeZone", "offset": 20, "limit": 10, "fields": ["ZoneID", "City"]}'
 \endcode
 
 Example responses for succesful calls:
@@ -621,8 +921,11 @@ Example response for a failed call:
 */
 static bool cbGetPreferenceValues(LSHandle* lsHandle, LSMessage* message, void* user_data)
 {
-	// {"key": string}
-	LSMessageJsonParser parser(message, RELAXED_SCHEMA(PROPS_1(PROPERTY(key, string))
+	// {"key": string, "offset": integer, "limit": integer, "fields": array of strings}
+	LSMessageJsonParser parser(message, RELAXED_SCHEMA(PROPS_4(PROPERTY(key, string),
+															   R"("offset":{"type": "integer", "minimum": 0})",
+															   R"("limit":{"type": "integer", "minimum": 0})",
+															   R"("fields":{"type": "array", "items": {"type":"string"}})")
 													  REQUIRED_1(key)));
 
 	if (!parser.parse(__FUNCTION__, lsHandle, EValidateAndErrorAlways))
@@ -639,12 +942,36 @@ static bool cbGetPreferenceValues(LSHandle* lsHandle, LSMessage* message, void*
 			throw ErrorException(PrefsFactory::ErrorPrefDoesntExist, "Can't find handler for key: "+ key);
 		}
 
+		PrefsValuesWindow window;
+		if (!root.hasKey("offset") && !root.hasKey("limit") && !root.hasKey("fields"))
+		{
+			const std::string* prebuilt = handler->valuesReplyForKey(key);
+			if (prebuilt)
+			{
+				LS::Error error;
+				if (!LSMessageReply(lsHandle, message, prebuilt->c_str(), error))
+				{
+					qWarning() << error.what();
+				}
+				return true;
+			}
+		}
+
+		if (root.hasKey("offset"))
+			window.offset = root["offset"].asNumber<int64_t>();
+		if (root.hasKey("limit"))
+			window.limit = root["limit"].asNumber<int64_t>();
+		if (root["fields"].isArray()) {
+			for (const JValue &field : root["fields"].items())
+				window.fields.push_back(field.asString());
+		}
+
 		if ("timeZone" == key) {
 			std::string countryCode = root["countryCode"].asString();
 			std::string locale = root["locale"].asString();
-			reply = std::static_pointer_cast<TimePrefsHandler>(handler)->timeZoneListAsJson(countryCode, locale);
+			reply = static_cast<TimePrefsHandler*>(handler)->timeZoneListAsJson(countryCode, locale, window);
 		} else {
-			reply = handler->valuesForKey(key);
+			reply = handler->windowedValuesForKey(key, window);
 		}
 
 		if (!reply.isValid())
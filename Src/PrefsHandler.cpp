@@ -0,0 +1,66 @@
+// Copyright (c) 2010-2018 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#include "PrefsHandler.h"
+
+using namespace pbnjson;
+
+JValue PrefsValuesWindow::project(const JValue &entry) const
+{
+	JValue source = entry;
+	if (fields.empty() || !source.isObject())
+		return source;
+
+	JValue projected = pbnjson::Object();
+	for (const std::string& field : fields)
+	{
+		if (source.hasKey(field))
+			projected.put(field, source[field]);
+	}
+	return projected;
+}
+
+JValue PrefsValuesWindow::apply(const std::string& key, const JValue &values) const
+{
+	JValue source = values;
+	if (!source.isObject())
+		return source;
+
+	JValue list = source[key];
+	if (!list.isArray())
+		return source;
+
+	// build a new object: values may share its DOM with a cached document
+	JValue result = pbnjson::Object();
+	for (const JValue::KeyValue item : source.children())
+	{
+		if (item.first.asString() != key)
+			result.put(item.first, item.second);
+	}
+
+	JValue window = pbnjson::Array();
+	int total = list.arraySize();
+	for (int i = 0; i < total && !isPast(i); ++i)
+	{
+		if (contains(i))
+			window.append(project(list[i]));
+	}
+
+	result.put(key, window);
+	result.put("total", total);
+	result.put("offset", static_cast<int64_t>(offset));
+	return result;
+}
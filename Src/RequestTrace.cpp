@@ -0,0 +1,718 @@
+// Copyright (c) 2010-2018 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#include "RequestTrace.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <memory>
+
+#include <pbnjson.hpp>
+#include <luna-service2/lunaservice.h>
+#include <luna-service2++/error.hpp>
+
+#include "AsyncTask.h"
+#include "JSONUtils.h"
+#include "Logging.h"
+#include "Mainloop.h"
+#include "Settings.h"
+#include "TimeThread.h"
+
+using namespace pbnjson;
+
+static const unsigned int s_flushInterval = 5;                    //seconds
+static const gint64 s_replyWait = 30 * G_USEC_PER_SEC;            //before an entry is written without reply
+static const long s_maxFileSize = 32 * 1024 * 1024;
+
+// payload fields naming preference keys or time zones are kept by redact()
+static const char* s_keptFields[] = { "key", "keys", "tz", "timeZone", 0 };
+
+// set while recording, the LS2 wrappers are cheap without it; also read by the time thread
+static std::atomic<RequestTrace*> s_recorder(nullptr);
+
+// request a method served on the time thread is handling and when it was replied to
+static thread_local LSMessage* s_servedMessage = nullptr;
+static thread_local gint64 s_servedReplied = -1;
+
+// when the current main-loop iteration came back from poll()
+static gint64 s_iterationStart = 0;
+
+// method being dispatched, read by the watchdog thread
+namespace {
+
+// the method a loop is running, read by the loop watchdog
+struct InFlight
+{
+	std::atomic<const char*> category;
+	std::atomic<const char*> method;
+	std::atomic<gint64> since;
+};
+
+InFlight s_mainInFlight = { {nullptr}, {nullptr}, {0} };
+InFlight s_timeInFlight = { {nullptr}, {nullptr}, {0} };
+
+// publishes the method for the length of its handler, handlers may run nested main loops
+class DispatchScope
+{
+public:
+	DispatchScope(InFlight& inFlight, const char* category, const char* method, gint64 now)
+		: m_inFlight(inFlight)
+		, m_category(inFlight.category.load(std::memory_order_relaxed))
+		, m_method(inFlight.method.load(std::memory_order_relaxed))
+		, m_since(inFlight.since.load(std::memory_order_relaxed))
+	{
+		publish(category, method, now);
+	}
+
+	~DispatchScope()
+	{
+		publish(m_category, m_method, m_since);
+	}
+
+private:
+	void publish(const char* category, const char* method, gint64 since)
+	{
+		m_inFlight.method.store(nullptr, std::memory_order_release);
+		m_inFlight.since.store(since, std::memory_order_relaxed);
+		m_inFlight.category.store(category, std::memory_order_relaxed);
+		m_inFlight.method.store(method, std::memory_order_release);
+	}
+
+	InFlight& m_inFlight;
+	const char* m_category;
+	const char* m_method;
+	gint64 m_since;
+};
+
+}
+
+struct RequestTrace::Category
+{
+	std::string name;
+	const LSMethod* methods;
+	std::vector<LSMethod> traced;
+	std::vector<int> routes;	//TimeThread::Route per method, -1 until first called on the time thread
+	void* data;
+};
+
+static std::map<std::pair<LSHandle*, std::string>, RequestTrace::Category*> s_categories;
+
+extern "C" {
+
+bool __real_LSRegisterCategory(LSHandle* sh, const char* category, LSMethod* methods,
+                               LSSignal* signals, LSProperty* properties, LSError* lserror);
+bool __real_LSCategorySetData(LSHandle* sh, const char* category, void* userData, LSError* lserror);
+bool __real_LSMessageReply(LSHandle* sh, LSMessage* message, const char* replyPayload, LSError* lserror);
+bool __real_LSMessageRespond(LSMessage* message, const char* replyPayload, LSError* lserror);
+
+/*
+ * The service links with --wrap for these, every category gets the
+ * trampoline as its method functions and its own Category as user data
+ */
+bool __wrap_LSRegisterCategory(LSHandle* sh, const char* category, LSMethod* methods,
+                               LSSignal* signals, LSProperty* properties, LSError* lserror)
+{
+	if (!methods)
+		return __real_LSRegisterCategory(sh, category, methods, signals, properties, lserror);
+
+	std::unique_ptr<RequestTrace::Category> traced(new RequestTrace::Category);
+	traced->name = category;
+	traced->methods = methods;
+	traced->data = nullptr;
+
+	const LSMethod* method = methods;
+	for (; method->name; ++method) {
+		LSMethod entry = *method;
+		entry.function = &RequestTrace::cbTraced;
+		traced->traced.push_back(entry);
+	}
+	traced->traced.push_back(*method);
+	traced->routes.assign(traced->traced.size(), -1);
+
+	if (!__real_LSRegisterCategory(sh, category, traced->traced.data(), signals, properties, lserror))
+		return false;
+	if (!__real_LSCategorySetData(sh, category, traced.get(), lserror))
+		return false;
+
+	s_categories[std::make_pair(sh, std::string(category))] = traced.release();
+	return true;
+}
+
+bool __wrap_LSCategorySetData(LSHandle* sh, const char* category, void* userData, LSError* lserror)
+{
+	auto it = s_categories.find(std::make_pair(sh, std::string(category)));
+	if (it == s_categories.end())
+		return __real_LSCategorySetData(sh, category, userData, lserror);
+
+	it->second->data = userData;
+	return true;
+}
+
+bool __wrap_LSMessageReply(LSHandle* sh, LSMessage* message, const char* replyPayload, LSError* lserror)
+{
+	RequestTrace::noteReply(message);
+	return __real_LSMessageReply(sh, message, replyPayload, lserror);
+}
+
+bool __wrap_LSMessageRespond(LSMessage* message, const char* replyPayload, LSError* lserror)
+{
+	RequestTrace::noteReply(message);
+	return __real_LSMessageRespond(message, replyPayload, lserror);
+}
+
+}
+
+static gboolean probePrepare(GSource*, gint* timeout)
+{
+	*timeout = -1;
+	return FALSE;
+}
+
+static gboolean probeCheck(GSource*)
+{
+	s_iterationStart = g_get_monotonic_time();
+	return FALSE;
+}
+
+static gboolean probeDispatch(GSource*, GSourceFunc, gpointer)
+{
+	return G_SOURCE_CONTINUE;
+}
+
+static GSourceFuncs s_probeFuncs = { probePrepare, probeCheck, probeDispatch, nullptr, nullptr, nullptr };
+
+RequestTrace::RequestTrace()
+	: m_enabled(false)
+	, m_payloads(false)
+	, m_file(Settings::instance()->m_requestTraceFile)
+	, m_ring(std::max(16u, Settings::instance()->m_requestTraceEntries))
+	, m_first(0)
+	, m_next(0)
+	, m_dropped(0)
+	, m_start(0)
+	, m_truncate(false)
+	, m_writing(false)
+	, m_flushAll(false)
+	, m_flushTimer(0)
+	, m_loopProbe(nullptr)
+	, m_currentMessage(nullptr)
+	, m_currentSeq(0)
+{
+	if (Settings::instance()->m_requestTrace)
+		setEnabled(true, Settings::instance()->m_requestTracePayloads);
+}
+
+RequestTrace::~RequestTrace()
+{
+	if (s_recorder == this)
+		s_recorder = nullptr;
+	if (m_flushTimer)
+		g_source_remove(m_flushTimer);
+	detachLoopProbe();
+
+	// the worker pool is gone by now
+	if (m_enabled)
+		writeFile(m_file, takeEntries(true), m_truncate, m_start);
+}
+
+void RequestTrace::setEnabled(bool enabled, bool payloads)
+{
+	m_payloads = payloads;
+	if (enabled == m_enabled)
+		return;
+
+	m_enabled = enabled;
+	if (enabled) {
+		m_first = m_next;
+		m_dropped = 0;
+		m_start = g_get_monotonic_time();
+		m_truncate = true;
+		attachLoopProbe();
+		m_flushTimer = g_timeout_add_seconds(s_flushInterval, &RequestTrace::cbFlush, this);
+		s_recorder = this;
+
+		PmLogInfo(sysServiceLogContext(), "REQUEST_TRACE_STARTED", 2,
+		          PMLOGKS("FILE", m_file.c_str()),
+		          PMLOGKS("PAYLOADS", payloads ? "redacted" : "no"), "Recording requests");
+	}
+	else {
+		s_recorder = nullptr;
+		g_source_remove(m_flushTimer);
+		m_flushTimer = 0;
+		detachLoopProbe();
+		flush(true);
+
+		PmLogInfo(sysServiceLogContext(), "REQUEST_TRACE_STOPPED", 1,
+		          PMLOGKFV("REQUESTS", "%llu", static_cast<unsigned long long>(m_next)), "Request recording stopped");
+	}
+}
+
+RequestTrace::Entry* RequestTrace::find(uint64_t seq)
+{
+	if (seq < m_first || seq >= m_next)
+		return nullptr;
+	return &slot(seq);
+}
+
+RequestTrace::Entry& RequestTrace::record(const Category* category, const char* method, LSMessage* message, gint64 now)
+{
+	// ring full: the oldest entry that wasn't written out yet is lost
+	if (m_next - m_first == m_ring.size()) {
+		forget(slot(m_first));
+		++m_first;
+		++m_dropped;
+	}
+
+	Entry& entry = slot(m_next);
+	entry.seq = m_next++;
+	entry.category = category->name.c_str();
+	entry.method = method;
+	entry.message = message;
+	entry.dispatched = now;
+	entry.queued = s_iterationStart && now > s_iterationStart ? now - s_iterationStart : 0;
+	entry.handled = 0;
+	entry.replied = -1;
+	entry.awaiting = false;
+
+	const char* sender = LSMessageGetApplicationID(message);
+	if (!sender)
+		sender = LSMessageGetSenderServiceName(message);
+	if (!sender)
+		sender = LSMessageGetSender(message);
+	g_strlcpy(entry.sender, sender ? sender : "", sizeof(entry.sender));
+
+	const char* payload = LSMessageGetPayload(message);
+	entry.payloadSize = payload ? strlen(payload) : 0;
+	if (m_payloads && payload)
+		entry.payload = redact(payload);
+	else
+		entry.payload.clear();
+
+	return entry;
+}
+
+void RequestTrace::forget(Entry& entry)
+{
+	if (!entry.awaiting)
+		return;
+	entry.awaiting = false;
+
+	// the message may be gone and its address taken by a newer request
+	auto it = m_awaiting.find(entry.message);
+	if (it != m_awaiting.end() && it->second == entry.seq)
+		m_awaiting.erase(it);
+}
+
+//static
+bool RequestTrace::cbTraced(LSHandle* sh, LSMessage* message, void* categoryData)
+{
+	Category* category = static_cast<Category*>(categoryData);
+
+	const char* name = LSMessageGetMethod(message);
+	const LSMethod* method = category->methods;
+	while (method->name && strcmp(method->name, name) != 0)
+		++method;
+	if (!method->name)
+		return false;
+
+	if (TimeThread::isCurrent())
+		return route(sh, message, category, method);
+	return dispatch(sh, message, category, method);
+}
+
+// time thread: serve the method right here or pass it on to the main loop
+bool RequestTrace::route(LSHandle* sh, LSMessage* message, Category* category, const LSMethod* method)
+{
+	TimeThread* timeThread = TimeThread::instance();
+
+	int& methodRoute = category->routes[method - category->methods];
+	if (methodRoute < 0)
+		methodRoute = timeThread->route(category->name, method->name);
+
+	if (methodRoute == TimeThread::RouteServe && timeThread->mayServe() && !LSMessageIsSubscription(message)) {
+		gint64 dispatched = g_get_monotonic_time();
+		s_servedMessage = message;
+		s_servedReplied = -1;
+
+		bool result;
+		{
+			DispatchScope scope(s_timeInFlight, category->name.c_str(), method->name, dispatched);
+			result = method->function(sh, message, category->data);
+		}
+
+		s_servedMessage = nullptr;
+		if (s_recorder.load(std::memory_order_relaxed)) {
+			gint64 handled = g_get_monotonic_time() - dispatched;
+			gint64 replied = s_servedReplied < 0 ? -1 : s_servedReplied - dispatched;
+			LSMessageRef(message);
+			timeThread->forward(false, [category, method, message, dispatched, handled, replied]() {
+				RequestTrace* trace = s_recorder;
+				if (trace) {
+					Entry& entry = trace->record(category, method->name, message, dispatched);
+					entry.queued = 0;
+					entry.handled = handled;
+					entry.replied = replied;
+				}
+				LSMessageUnref(message);
+			});
+		}
+		return result;
+	}
+
+	LSMessageRef(message);
+	timeThread->forward(methodRoute == TimeThread::RouteBarrier, [sh, message, category, method]() {
+		(void) dispatch(sh, message, category, method);
+		LSMessageUnref(message);
+	});
+	return true;
+}
+
+// main loop
+bool RequestTrace::dispatch(LSHandle* sh, LSMessage* message, Category* category, const LSMethod* method)
+{
+	gint64 dispatched = g_get_monotonic_time();
+	DispatchScope scope(s_mainInFlight, category->name.c_str(), method->name, dispatched);
+
+	RequestTrace* trace = s_recorder;
+	if (!trace)
+		return method->function(sh, message, category->data);
+
+	uint64_t seq = trace->record(category, method->name, message, dispatched).seq;
+
+	// handlers may run nested main loops
+	LSMessage* outerMessage = trace->m_currentMessage;
+	uint64_t outerSeq = trace->m_currentSeq;
+	trace->m_currentMessage = message;
+	trace->m_currentSeq = seq;
+
+	bool result = method->function(sh, message, category->data);
+
+	trace->m_currentMessage = outerMessage;
+	trace->m_currentSeq = outerSeq;
+
+	// unless the handler stopped the trace (and wrote the entry out)
+	Entry* entry = s_recorder == trace ? trace->find(seq) : nullptr;
+	if (entry) {
+		entry->handled = g_get_monotonic_time() - dispatched;
+		if (entry->replied < 0) {
+			entry->awaiting = true;
+			trace->m_awaiting[message] = seq;
+		}
+	}
+	return result;
+}
+
+//static
+void RequestTrace::noteReply(LSMessage* message)
+{
+	if (TimeThread::isCurrent()) {
+		if (message == s_servedMessage && s_servedReplied < 0)
+			s_servedReplied = g_get_monotonic_time();
+		return;
+	}
+
+	RequestTrace* trace = s_recorder;
+	if (trace)
+		trace->replied(message);
+}
+
+void RequestTrace::replied(LSMessage* message)
+{
+	uint64_t seq;
+	if (message == m_currentMessage) {
+		seq = m_currentSeq;
+	}
+	else {
+		auto it = m_awaiting.find(message);
+		if (it == m_awaiting.end())
+			return;
+		seq = it->second;
+		m_awaiting.erase(it);
+	}
+
+	Entry* entry = find(seq);
+	if (!entry || entry->replied >= 0)
+		return;
+
+	entry->replied = g_get_monotonic_time() - entry->dispatched;
+	entry->awaiting = false;
+}
+
+std::vector<RequestTrace::Entry> RequestTrace::takeEntries(bool all)
+{
+	gint64 now = g_get_monotonic_time();
+	std::vector<Entry> entries;
+
+	for (; m_first < m_next; ++m_first) {
+		Entry& entry = slot(m_first);
+		if (entry.awaiting) {
+			// keep the order of the file, wait a bit for slow replies
+			if (!all && now - entry.dispatched < s_replyWait)
+				break;
+			forget(entry);
+		}
+		entries.push_back(std::move(entry));
+		entry.payload.clear();
+	}
+
+	if (m_dropped) {
+		PmLogWarning(sysServiceLogContext(), "REQUEST_TRACE_DROPPED", 1,
+		             PMLOGKFV("ENTRIES", "%llu", static_cast<unsigned long long>(m_dropped)),
+		             "Request trace ring overflowed, consider more requestTraceEntries");
+		m_dropped = 0;
+	}
+
+	return entries;
+}
+
+void RequestTrace::flush(bool all)
+{
+	// one write at a time, keeps the file in order
+	if (m_writing) {
+		m_flushAll = m_flushAll || all;
+		return;
+	}
+
+	std::shared_ptr<std::vector<Entry>> entries = std::make_shared<std::vector<Entry>>(takeEntries(all));
+	if (entries->empty() && !m_truncate)
+		return;
+
+	std::string path = m_file;
+	bool truncate = m_truncate;
+	gint64 start = m_start;
+	m_truncate = false;
+
+	m_writing = true;
+	bool queued = AsyncTaskPool::instance()->run(
+		[entries, path, truncate, start]() { writeFile(path, *entries, truncate, start); },
+		[this]() {
+			m_writing = false;
+			if (m_flushAll) {
+				m_flushAll = false;
+				flush(true);
+			}
+		});
+	if (!queued) {
+		writeFile(path, *entries, truncate, start);
+		m_writing = false;
+	}
+}
+
+//static
+void RequestTrace::writeFile(const std::string& path, const std::vector<Entry>& entries,
+                             bool truncate, gint64 start)
+{
+	FILE* file = fopen(path.c_str(), truncate ? "w" : "a");
+	if (!file) {
+		qWarning("Cannot write request trace %s: %s", path.c_str(), strerror(errno));
+		return;
+	}
+
+	fseek(file, 0, SEEK_END);
+	if (ftell(file) > s_maxFileSize) {
+		qWarning("Request trace %s is full, %zu entries dropped", path.c_str(), entries.size());
+		fclose(file);
+		return;
+	}
+
+	for (const Entry& entry : entries) {
+		JValue line = JObject {
+			{"method", methodPath(entry.category, entry.method)},
+			{"sender", std::string(entry.sender)},
+			{"at", (entry.dispatched - start) / 1000.0},
+			{"payloadSize", static_cast<int64_t>(entry.payloadSize)},
+			{"queuedUs", static_cast<int64_t>(entry.queued)},
+			{"handlerUs", static_cast<int64_t>(entry.handled)},
+			{"replyUs", static_cast<int64_t>(entry.replied)}
+		};
+		if (!entry.payload.empty())
+			line.put("payload", JDomParser::fromString(entry.payload));
+
+		fputs(line.stringify().c_str(), file);
+		fputc('\n', file);
+	}
+
+	fclose(file);
+}
+
+void RequestTrace::attachLoopProbe()
+{
+	if (m_loopProbe)
+		return;
+
+	GMainContext* context = g_mainloop ? g_main_loop_get_context(g_mainloop.get()) : g_main_context_default();
+	m_loopProbe = g_source_new(&s_probeFuncs, sizeof(GSource));
+	// checked before any other source of an iteration
+	g_source_set_priority(m_loopProbe, G_PRIORITY_HIGH);
+	g_source_attach(m_loopProbe, context);
+}
+
+void RequestTrace::detachLoopProbe()
+{
+	if (!m_loopProbe)
+		return;
+
+	g_source_destroy(m_loopProbe);
+	g_source_unref(m_loopProbe);
+	m_loopProbe = nullptr;
+	s_iterationStart = 0;
+}
+
+//static
+bool RequestTrace::inFlight(std::string& r_method, gint64& r_since, bool timeThread)
+{
+	InFlight& inFlight = timeThread ? s_timeInFlight : s_mainInFlight;
+	const char* method = inFlight.method.load(std::memory_order_acquire);
+	if (!method)
+		return false;
+
+	r_since = inFlight.since.load(std::memory_order_relaxed);
+	r_method = methodPath(inFlight.category.load(std::memory_order_relaxed), method);
+	return true;
+}
+
+//static
+std::string RequestTrace::methodPath(const char* category, const char* method)
+{
+	std::string path = category ? category : "";
+	if (path != "/")
+		path += "/";
+	return path + method;
+}
+
+//static
+gboolean RequestTrace::cbFlush(gpointer data)
+{
+	static_cast<RequestTrace*>(data)->flush(false);
+	return G_SOURCE_CONTINUE;
+}
+
+static JValue redactValue(const JValue& value, bool keep)
+{
+	if (value.isObject()) {
+		JValue result = pbnjson::Object();
+		for (const JValue::KeyValue child : value.children()) {
+			std::string key = child.first.asString();
+			bool keepChild = keep;
+			for (const char** kept = s_keptFields; !keepChild && *kept; ++kept)
+				keepChild = key == *kept;
+			result.put(key, redactValue(child.second, keepChild));
+		}
+		return result;
+	}
+	if (value.isArray()) {
+		JValue result = pbnjson::Array();
+		for (const JValue item : value.items())
+			result.append(redactValue(item, keep));
+		return result;
+	}
+	if (value.isString() && !keep)
+		return std::string(value.asString().size(), 'x');
+	return value;
+}
+
+//static
+std::string RequestTrace::redact(const char* payload)
+{
+	JValue root = JDomParser::fromString(payload);
+	if (root.isNull())
+		return std::string();
+	return redactValue(root, false).stringify();
+}
+
+/*!
+\page com_palm_diagnostics
+\n
+\section diagnostics_set_request_trace setRequestTrace
+
+\e Private. Available only at the private bus.
+
+com.webos.service.systemservice/diagnostics/setRequestTrace
+
+Starts or stops recording the requests the service handles. Each request is
+appended as one JSON line to the trace file: method, sender, payload size,
+dispatch time and how long it waited in the main loop, ran in its handler and
+took until the first reply. Starting truncates the file. The file can be
+replayed with sysservice-loadreplay.
+
+Recording can also be turned on at startup with \c requestTrace in the
+[Debug] section of sysservice.conf.
+
+\subsection diagnostics_set_request_trace_syntax Syntax:
+\code
+{
+	"enabled": boolean,
+	"payloads": boolean
+}
+\endcode
+
+\param enabled Start (true) or stop (false) recording.
+\param payloads Also record the payloads, redacted: string values other than preference keys and time zones are replaced by x's. Defaults to false.
+
+\subsection diagnostics_set_request_trace_returns Returns:
+\code
+{
+	"returnValue": true,
+	"enabled": boolean,
+	"payloads": boolean,
+	"file": string,
+	"entries": int
+}
+\endcode
+
+\param file Trace file the requests are written to.
+\param entries Size of the in-memory ring; requests beyond that between two writes are dropped.
+
+\subsection diagnostics_set_request_trace_examples Examples:
+\code
+luna-send -n 1 -f luna://com.webos.service.systemservice/diagnostics/setRequestTrace '{"enabled": true}'
+\endcode
+*/
+bool RequestTrace::cbSetRequestTrace(LSHandle* lsHandle, LSMessage *message, void *user_data)
+{
+	// {"enabled": boolean, "payloads": boolean}
+	LSMessageJsonParser parser(message, STRICT_SCHEMA(PROPS_2(PROPERTY(enabled, boolean),
+	                                                          PROPERTY(payloads, boolean))
+	                                                  REQUIRED_1(enabled)));
+
+	if (!parser.parse(__FUNCTION__, lsHandle, Settings::instance()->schemaValidationOption))
+		return true;
+
+	JValue request = parser.get();
+	RequestTrace* trace = RequestTrace::instance();
+	trace->setEnabled(request["enabled"].asBool(),
+	                  request["payloads"].isBoolean() && request["payloads"].asBool());
+
+	JValue reply = JObject {
+		{"returnValue", true},
+		{"enabled", trace->isEnabled()},
+		{"payloads", trace->capturesPayloads()},
+		{"file", trace->m_file},
+		{"entries", static_cast<int64_t>(trace->m_ring.size())}
+	};
+
+	LS::Error error;
+	if (!LSMessageReply(lsHandle, message, reply.stringify().c_str(), error))
+	{
+		qWarning() << error.what();
+	}
+
+	return true;
+}
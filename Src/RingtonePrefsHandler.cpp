@@ -16,8 +16,17 @@
 
 #include "RingtonePrefsHandler.h"
 
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <map>
+#include <memory>
+#include <mutex>
+
 #include <luna-service2++/error.hpp>
 
+#include "AsyncTask.h"
 #include "SystemRestore.h"
 #include "Utils.h"
 #include "UrlRep.h"
@@ -29,6 +38,135 @@ using namespace pbnjson;
 
 static const char* s_logChannel = "RingtonePrefsHandler";
 
+namespace {
+
+// State of one addRingtone request. Filled in on a worker thread, read by
+// the completion on the main loop.
+struct RingtoneImport
+{
+	RingtoneImport() : success(false), deduplicated(false), lastPercent(-1) {}
+
+	std::string source;
+	std::string target;
+	bool success;
+	bool deduplicated;
+	std::string errorText;
+	int lastPercent;
+};
+
+// Content hashes of files in the ringtones dir. An entry is only trusted
+// while size and mtime of the file still match. Worker threads only.
+struct RingtoneDigest
+{
+	off_t size;
+	time_t mtime;
+	std::string digest;
+};
+
+std::mutex s_digestsMutex;
+std::map<std::string, RingtoneDigest> s_digests;
+
+bool cachedChecksum(const std::string& path, const struct stat& st, std::string& r_digest)
+{
+	{
+		std::lock_guard<std::mutex> lock(s_digestsMutex);
+		auto it = s_digests.find(path);
+		if (it != s_digests.end() && it->second.size == st.st_size && it->second.mtime == st.st_mtime)
+		{
+			r_digest = it->second.digest;
+			return true;
+		}
+	}
+
+	if (!Utils::fileChecksum(path.c_str(), r_digest))
+		return false;
+
+	std::lock_guard<std::mutex> lock(s_digestsMutex);
+	s_digests[path] = RingtoneDigest { st.st_size, st.st_mtime, r_digest };
+	return true;
+}
+
+// Returns a file in dir with the same content as source, or an empty string.
+// Candidates are narrowed down by size first so the source is only hashed
+// if there is something to compare it with.
+std::string findDuplicate(const std::string& dir, const std::string& source, const struct stat& sourceStat)
+{
+	std::list<std::pair<std::string, struct stat>> candidates;
+
+	DIR* d = opendir(dir.c_str());
+	if (!d)
+		return std::string();
+
+	while (struct dirent* entry = readdir(d))
+	{
+		if (entry->d_name[0] == '.')
+			continue;
+
+		std::string path = dir + entry->d_name;
+		struct stat st;
+		if (stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode) && st.st_size == sourceStat.st_size)
+			candidates.push_back(std::make_pair(path, st));
+	}
+	closedir(d);
+
+	if (candidates.empty())
+		return std::string();
+
+	std::string sourceDigest;
+	if (!cachedChecksum(source, sourceStat, sourceDigest))
+		return std::string();
+
+	for (const auto& candidate : candidates)
+	{
+		std::string digest;
+		if (cachedChecksum(candidate.first, candidate.second, digest) && digest == sourceDigest)
+			return candidate.first;
+	}
+
+	return std::string();
+}
+
+// Worker thread part of addRingtone
+void importRingtone(RingtoneImport& import, const std::string& dir, const Utils::CopyProgress& progress)
+{
+	struct stat sourceStat;
+	if (stat(import.source.c_str(), &sourceStat) != 0)
+	{
+		import.errorText = "source file doesn't exist";
+		return;
+	}
+
+	std::string duplicate = findDuplicate(dir, import.source, sourceStat);
+	if (duplicate == import.target)
+	{
+		// exactly this ringtone is already there
+		import.success = import.deduplicated = true;
+		return;
+	}
+
+	if (!duplicate.empty())
+	{
+		// same content under another name, share its blocks
+		std::string link = import.target + ".link" + std::to_string(Utils::getRNG_UInt());
+		if (::link(duplicate.c_str(), link.c_str()) == 0 && rename(link.c_str(), import.target.c_str()) == 0)
+		{
+			import.success = import.deduplicated = true;
+			return;
+		}
+		(void) unlink(link.c_str());
+	}
+
+	if (Utils::fileCopy(import.source.c_str(), import.target.c_str(), progress) == -1)
+	{
+		import.errorText = "Unable to add ringtone.";
+		return;
+	}
+
+	import.success = true;
+}
+
+} // anonymous namespace
+
 static bool cbAddRingtone(LSHandle* lsHandle, LSMessage *message,
 							void *user_data);
 
@@ -131,22 +269,36 @@ Add a ringtone.
 \subsection systemservice_ringtone_add_ringtone_syntax Syntax:
 \code
 {
-	"filePath": string
+	"filePath": string,
+	"subscribe": boolean
 }
 \endcode
 
 \param filePath Absolute path to the ringtone file. Required.
+\param subscribe If true, progress replies are sent while the file is copied.
 
 \subsection systemservice_ringtone_add_ringtone_returns Returns:
 \code
 {
 	"returnValue": boolean,
-	"errorText": string
+	"fullPath": string,
+	"deduplicated": boolean,
+	"errorText": string,
+	"status": string,
+	"bytesCopied": int,
+	"totalBytes": int,
+	"subscribed": boolean
 }
 \endcode
 
 \param returnValue Indicates if the call was succesful.
+\param fullPath Path of the added ringtone.
+\param deduplicated True if a file with the same content was already in the ringtones folder, the ringtone then shares it instead of being copied.
 \param errorText Description of the error if call was not succesful.
+\param status Only for subscriptions. "copying" for progress replies, "done" for the final one.
+\param bytesCopied Only in progress replies. Bytes copied so far.
+\param totalBytes Only in progress replies. Size of the file.
+\param subscribed Only for subscriptions. False in the final reply.
 
 \subsection systemservice_ringtone_add_ringtone_examples Examples:
 \code
@@ -156,7 +308,9 @@ luna-send -n 1 -f luna://com.webos.service.systemservice/ringtone/addRingtone '{
 Example response for a succesful call:
 \code
 {
-	"returnValue": true
+	"returnValue": true,
+	"fullPath": "/media/internal/ringtones/ringtone.mp3",
+	"deduplicated": false
 }
 \endcode
 
@@ -170,22 +324,20 @@ Example response for a failed call:
 */
 static bool cbAddRingtone(LSHandle* lsHandle, LSMessage *message, void *)
 {
-	// {"filePath": string}
-	LSMessageJsonParser parser(message, STRICT_SCHEMA(PROPS_1(PROPERTY(filePath, string))
+	// {"filePath": string, "subscribe": boolean}
+	LSMessageJsonParser parser(message, STRICT_SCHEMA(PROPS_2(PROPERTY(filePath, string),
+															  PROPERTY(subscribe, boolean))
 													  REQUIRED_1(filePath)));
 
 	if (!parser.parse(__FUNCTION__, lsHandle, Settings::instance()->schemaValidationOption))
 		return true;
 
-	bool success = false;
-
-	int rc = 0;
-
 	std::string errorText;
-	std::string targetFileAndPath;
 	std::string pathPart ="";
 	std::string filePart ="";
-	
+	std::string ringtonesDir = std::string(PrefsDb::s_mediaPartitionPath)+std::string(PrefsDb::s_mediaPartitionRingtonesDir)+std::string("/");
+	auto import = std::make_shared<RingtoneImport>();
+
 	UrlRep urlRep;
 
 	do {
@@ -221,25 +373,73 @@ static bool cbAddRingtone(LSHandle* lsHandle, LSMessage *message, void *)
 			break;
 		}
 
-		targetFileAndPath = std::string(PrefsDb::s_mediaPartitionPath)+std::string(PrefsDb::s_mediaPartitionRingtonesDir)+std::string("/")+filePart;
-		rc = Utils::fileCopy(srcFileName.c_str(),targetFileAndPath.c_str());
-
-		if (rc == -1) {
-			errorText = std::string("Unable to add ringtone.");
-			break;
-		}
-
-		success = true;
+		import->source = srcFileName;
+		import->target = ringtonesDir+filePart;
 	} while (false);
 
-	JObject response {{"returnValue", success}};
+	if (!errorText.empty()) {
+		JObject response {{"returnValue", false}, {"errorText", errorText}};
 
-	if (!success) {
-		response.put("errorText", errorText);
+		LS::Error error;
+		(void) LSMessageReply(lsHandle, message, response.stringify().c_str(), error);
+		return true;
 	}
 
-	LS::Error error;
-	(void) LSMessageReply(lsHandle, message, response.stringify().c_str(), error);
+	// the copy (and the dedup hashing) runs on a worker thread; subscribers
+	// get progress replies while it runs and the result when it's done
+	AsyncTaskPool* pool = AsyncTaskPool::instance();
+	bool subscribed = LSMessageIsSubscription(message);
+	auto finished = std::make_shared<bool>(false);
+
+	Utils::CopyProgress progress;
+	if (subscribed) {
+		progress = [=](uint64_t copied, uint64_t total) {
+			int percent = total ? static_cast<int>(copied * 100 / total) : 100;
+			if (percent < import->lastPercent + 10 && percent != 100)
+				return;
+			import->lastPercent = percent;
+
+			LSMessageRef(message);
+			pool->post([=]() {
+				if (!*finished) {
+					JObject response {{"returnValue", true},
+					                  {"subscribed", true},
+					                  {"status", "copying"},
+					                  {"bytesCopied", static_cast<int64_t>(copied)},
+					                  {"totalBytes", static_cast<int64_t>(total)}};
+
+					LS::Error error;
+					(void) LSMessageReply(lsHandle, message, response.stringify().c_str(), error);
+				}
+				LSMessageUnref(message);
+			});
+		};
+	}
+
+	pool->offload(message,
+		[import, ringtonesDir, progress]() {
+			importRingtone(*import, ringtonesDir, progress);
+		},
+		[=]() {
+			*finished = true;
+
+			JObject response {{"returnValue", import->success}};
+			if (import->success) {
+				response.put("fullPath", import->target);
+				response.put("deduplicated", import->deduplicated);
+			}
+			else {
+				response.put("errorText", import->errorText);
+				qWarning() << import->errorText.c_str();
+			}
+			if (subscribed) {
+				response.put("status", "done");
+				response.put("subscribed", false);
+			}
+
+			LS::Error error;
+			(void) LSMessageReply(lsHandle, message, response.stringify().c_str(), error);
+		});
 
 	return true;
 }
@@ -30,11 +30,23 @@ Settings::Settings()
 	, m_saveLastBackedUpTempDb(false)
 	, m_saveLastRestoredTempDb(false)
 	, m_logLevel()
+	, m_requestTrace(false)
+	, m_requestTracePayloads(false)
+	, m_requestTraceFile("/tmp/sysservice-requests.jsonl")
+	, m_requestTraceEntries(4096)
 	, m_useComPalmImage2(false)
 	, m_image2svcAvailable(false)
 	, m_comPalmImage2BinaryFile("/usr/bin/acuteimaging")
 	, switchTimezoneOnManualTime(false)
         , useLocalizedTZ(false)
+	, m_asyncWorkerThreads(2)
+	, m_timeChangeSettleWindow(300)
+	, m_timeChangeMaxDelay(1000)
+	, m_imageModuleIdleUnload(300)
+	, m_loopWatchdogInterval(100)
+	, m_loopStallThreshold(500)
+	, m_prefsStorage("sqlite")
+	, m_timeThread(false)
 {
 	(void)load(kSettingsFile);
 	(void)load(kSettingsFilePlatform);
@@ -67,6 +79,25 @@ Settings::Settings()
 	else g_error_free(_error); \
 }
 
+#define KEY_INTEGER(cat,name,var) \
+{\
+	int _v;\
+	GError* _error = 0;\
+	_v=g_key_file_get_integer(keyfile,cat,name,&_error);\
+	if( !_error ) { var=_v; }\
+	else g_error_free(_error); \
+}
+
+// negative values are ignored, they would wrap around to huge counts and delays
+#define KEY_UINT(cat,name,var) \
+{\
+	int _v;\
+	GError* _error = 0;\
+	_v=g_key_file_get_integer(keyfile,cat,name,&_error);\
+	if( !_error ) { if( _v >= 0 ) var=(unsigned int)_v; }\
+	else g_error_free(_error); \
+}
+
 #define KEY_DOUBLE(cat,name,var) \
 {\
 	double _v;\
@@ -99,12 +130,24 @@ bool Settings::load(const char* settingsFile)
 	KEY_BOOLEAN("Debug","saveLastBackedUpTempDb",m_saveLastBackedUpTempDb);
 	KEY_BOOLEAN("Debug","saveLastRestoredTempDb",m_saveLastRestoredTempDb);
 	KEY_STRING("Debug","logLevel",m_logLevel);
+	KEY_BOOLEAN("Debug","requestTrace",m_requestTrace);
+	KEY_BOOLEAN("Debug","requestTracePayloads",m_requestTracePayloads);
+	KEY_STRING("Debug","requestTraceFile",m_requestTraceFile);
+	KEY_UINT("Debug","requestTraceEntries",m_requestTraceEntries);
 
 	KEY_BOOLEAN("ImageService","useComPalmImage2",m_useComPalmImage2);
 	KEY_STRING("ImageService","comPalmImage2Binary",m_comPalmImage2BinaryFile);
 
 	KEY_SCHEMA_ERR_OPTION("General", "schemaValidationOption", schemaValidationOption);
 	KEY_BOOLEAN("General", "switchTimezoneOnManualTime", switchTimezoneOnManualTime);
+	KEY_UINT("General", "asyncWorkerThreads", m_asyncWorkerThreads);
+	KEY_UINT("General", "timeChangeSettleWindow", m_timeChangeSettleWindow);
+	KEY_UINT("General", "timeChangeMaxDelay", m_timeChangeMaxDelay);
+	KEY_UINT("General", "imageModuleIdleUnload", m_imageModuleIdleUnload);
+	KEY_UINT("General", "loopWatchdogInterval", m_loopWatchdogInterval);
+	KEY_UINT("General", "loopStallThreshold", m_loopStallThreshold);
+	KEY_STRING("General", "prefsStorage", m_prefsStorage);
+	KEY_BOOLEAN("General", "timeThread", m_timeThread);
 
 	g_key_file_free( keyfile );
 	return true;
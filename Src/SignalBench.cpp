@@ -0,0 +1,258 @@
+// Copyright (c) 2010-2018 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+/*
+ * sysservice-signalbench: times connect and fire of the Signal in
+ * SignalSlot.h against the implementation it replaced, for the signatures
+ * the service fires (time_t / time_t, string, time_t / string, int,
+ * time_t, time_t) and 1 to 8 receivers.
+ *
+ *   $ ./sysservice-signalbench [fires per signal]
+ *
+ * The old implementation is kept below in namespace legacy. It is the
+ * previous header with its per-arity specializations folded into variadic
+ * templates; the layout that matters for the comparison is unchanged: one
+ * heap allocated slot per connection, called through a virtual function,
+ * kept in a std::set, and a std::set of senders per receiver.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <chrono>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "SignalSlot.h"
+
+namespace legacy {
+
+class Trackable;
+
+class Sender
+{
+public:
+
+	virtual void disconnectTrackable(Trackable* recv) = 0;
+};
+
+class Trackable {
+public:
+
+	virtual ~Trackable() {
+		for (std::set<Sender*>::iterator it = m_senders.begin();
+			 it != m_senders.end(); ++it) {
+			(*it)->disconnectTrackable(this);
+		}
+	}
+
+	void connected(Sender* sender) {
+		m_senders.insert(sender);
+	}
+
+	void disconnected(Sender* sender) {
+		m_senders.erase(sender);
+	}
+
+private:
+
+	std::set<Sender*> m_senders;
+};
+
+template <class... Args>
+class SlotBase
+{
+public:
+
+	virtual void fire(Args... args) = 0;
+	virtual ~SlotBase() {}
+
+	Trackable* receiver() const { return m_receiver; }
+
+protected:
+
+	Trackable* m_receiver;
+};
+
+template <class Receiver, class... Args>
+class Slot : public SlotBase<Args...>
+{
+public:
+
+	typedef void (Receiver::*Function)(Args...);
+
+	Slot(Receiver* rec, Function func) : m_function(func) {
+		this->m_receiver = rec;
+	}
+
+	void fire(Args... args) {
+		(static_cast<Receiver*>(this->m_receiver)->*m_function)(args...);
+	}
+
+private:
+
+	Function m_function;
+};
+
+template <class... Args>
+class Signal : public Sender
+{
+public:
+
+	virtual ~Signal() {
+		for (typename SlotSet::const_iterator it = m_slots.begin(); it != m_slots.end(); ++it) {
+			(*it)->receiver()->disconnected(this);
+			delete (*it);
+		}
+	}
+
+	template <class Receiver>
+	void connect(Receiver* rec, void (Receiver::*func)(Args...)) {
+		m_slots.insert(new Slot<Receiver, Args...>(rec, func));
+		rec->connected(this);
+	}
+
+	void disconnect(Trackable* recv) {
+		typename SlotSet::iterator it = m_slots.begin();
+		while (it != m_slots.end()) {
+			if ((*it)->receiver() == recv) {
+				delete (*it);
+				m_slots.erase(it++);
+				continue;
+			}
+			++it;
+		}
+	}
+
+	virtual void disconnectTrackable(Trackable* recv) {
+		disconnect(recv);
+	}
+
+	void fire(Args... args) {
+		typename SlotSet::iterator it = m_slots.begin();
+		while (it != m_slots.end()) {
+			(*it++)->fire(args...);
+		}
+	}
+
+private:
+
+	typedef std::set<SlotBase<Args...>*> SlotSet;
+	SlotSet m_slots;
+};
+
+}
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+// what the slots write to, so the calls can't be optimized away
+volatile long s_sink = 0;
+
+template <class Base>
+class Receiver : public Base
+{
+public:
+
+	void onTime(time_t t) { s_sink += t; }
+	void onZone(time_t t, std::string zone, time_t offset) { s_sink += t + offset + zone.size(); }
+	void onChange(std::string key, int source, time_t before, time_t after) {
+		s_sink += key.size() + source + after - before;
+	}
+};
+
+struct Result
+{
+	double fireNs;
+	double connectNs;
+};
+
+template <class Base, template <class...> class Sig>
+Result run(size_t receivers, size_t fires)
+{
+	typedef Receiver<Base> Rec;
+
+	const std::string zone("Europe/Berlin");
+	const std::string key("timeZone");
+	Result result;
+
+	// connect and teardown, repeated so that the clock resolution doesn't matter
+	const size_t rounds = 20000;
+	Clock::time_point start = Clock::now();
+	for (size_t round = 0; round < rounds; ++round) {
+		std::vector<Rec> recs(receivers);
+		Sig<time_t> sig1;
+		Sig<time_t, std::string, time_t> sig3;
+		Sig<std::string, int, time_t, time_t> sig4;
+		for (Rec& rec : recs) {
+			sig1.connect(&rec, &Rec::onTime);
+			sig3.connect(&rec, &Rec::onZone);
+			sig4.connect(&rec, &Rec::onChange);
+		}
+	}
+	result.connectNs = std::chrono::duration<double, std::nano>(Clock::now() - start).count()
+	                   / (rounds * receivers * 3);
+
+	std::vector<Rec> recs(receivers);
+	Sig<time_t> sig1;
+	Sig<time_t, std::string, time_t> sig3;
+	Sig<std::string, int, time_t, time_t> sig4;
+	for (Rec& rec : recs) {
+		sig1.connect(&rec, &Rec::onTime);
+		sig3.connect(&rec, &Rec::onZone);
+		sig4.connect(&rec, &Rec::onChange);
+	}
+
+	start = Clock::now();
+	for (size_t i = 0; i < fires; ++i) {
+		sig1.fire(i);
+		sig3.fire(i, zone, 3600);
+		sig4.fire(key, 1, i, i + 1);
+	}
+	result.fireNs = std::chrono::duration<double, std::nano>(Clock::now() - start).count()
+	                / (fires * 3);
+
+	return result;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+	size_t fires = 5000000;
+	if (argc > 1)
+		fires = strtoul(argv[1], nullptr, 10);
+	if (!fires) {
+		fprintf(stderr, "usage: %s [fires per signal]\n", argv[0]);
+		return 1;
+	}
+
+	printf("%zu fires per signal, times per fire and per connect\n\n", fires);
+	printf("receivers  old ns/fire  new ns/fire  old connect  new connect\n");
+
+	const size_t counts[] = { 1, 2, 4, 8 };
+	for (size_t receivers : counts) {
+		Result old = run<legacy::Trackable, legacy::Signal>(receivers, fires);
+		Result now = run<Trackable, Signal>(receivers, fires);
+		printf("%9zu  %11.1f  %11.1f  %8.0f ns  %8.0f ns\n",
+		       receivers, old.fireNs, now.fireNs, old.connectNs, now.connectNs);
+	}
+
+	return 0;
+}
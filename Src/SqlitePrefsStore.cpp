@@ -0,0 +1,518 @@
+// Copyright (c) 2010-2018 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#include "SqlitePrefsStore.h"
+
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include "Logging.h"
+#include "PrefsDb.h"
+
+SqlitePrefsStore::SqlitePrefsStore()
+	: m_db(0)
+	, m_getStatement(0)
+	, m_putStatement(0)
+	, m_legacySchema(false)
+{
+}
+
+SqlitePrefsStore::~SqlitePrefsStore()
+{
+	close();
+}
+
+PrefsStore::OpenResult SqlitePrefsStore::open(const std::string& path)
+{
+	if (m_db)
+		return OpenExisting;
+
+	m_path = path;
+	m_legacySchema = false;
+	int ret = sqlite3_open(m_path.c_str(), &m_db);
+	if (ret) {
+		qWarning() << "Failed to open preferences db [" << m_path.c_str() << "]";
+		close();
+		return OpenFailed;
+	}
+
+	OpenResult result = checkTableConsistency();
+	if (result == OpenFailed || createPrefsTable("Preferences", true)) {
+		qWarning() << "Failed to create Preferences table";
+		close();
+		return OpenFailed;
+	}
+
+	//a 1.0 table has no modified/origin columns
+	const char* putQuery = m_legacySchema
+						   ? "INSERT INTO Preferences (key, value) VALUES (?, ?)"
+						   : "INSERT INTO Preferences (key, value, modified, origin) VALUES (?, ?, ?, ?)";
+	if (sqlite3_prepare_v2(m_db, "SELECT value FROM Preferences WHERE key=?",
+						   -1, &m_getStatement, 0)
+		|| sqlite3_prepare_v2(m_db, putQuery, -1, &m_putStatement, 0)) {
+		qWarning("Failed to prepare preferences statements (%s)", sqlite3_errmsg(m_db));
+		close();
+		return OpenFailed;
+	}
+
+	return result;
+}
+
+void SqlitePrefsStore::close()
+{
+	sqlite3_finalize(m_getStatement);
+	sqlite3_finalize(m_putStatement);
+	m_getStatement = m_putStatement = 0;
+
+	if (m_db)
+		(void) sqlite3_close(m_db);
+	m_db = 0;
+}
+
+bool SqlitePrefsStore::get(const std::string& key, std::string& r_value)
+{
+	if (!m_getStatement)
+		return false;
+
+	bool result = false;
+	sqlite3_bind_text(m_getStatement, 1, key.data(), key.size(), SQLITE_STATIC);
+	if (sqlite3_step(m_getStatement) == SQLITE_ROW) {
+		const unsigned char* res = sqlite3_column_text(m_getStatement, 0);
+		if (res) {
+			r_value = (const char*) res;
+			result = true;
+		}
+	}
+	sqlite3_reset(m_getStatement);
+	sqlite3_clear_bindings(m_getStatement);
+	return result;
+}
+
+bool SqlitePrefsStore::put(const std::string& key, const std::string& value,
+                           uint64_t modified, const std::string& origin)
+{
+	if (!m_putStatement)
+		return false;
+
+	sqlite3_bind_text(m_putStatement, 1, key.data(), key.size(), SQLITE_STATIC);
+	sqlite3_bind_text(m_putStatement, 2, value.data(), value.size(), SQLITE_STATIC);
+	if (!m_legacySchema) {
+		sqlite3_bind_int64(m_putStatement, 3, (sqlite3_int64) modified);
+		if (origin.empty())
+			sqlite3_bind_null(m_putStatement, 4);
+		else
+			sqlite3_bind_text(m_putStatement, 4, origin.data(), origin.size(), SQLITE_STATIC);
+	}
+
+	int ret = sqlite3_step(m_putStatement);
+	sqlite3_reset(m_putStatement);
+	sqlite3_clear_bindings(m_putStatement);
+	if (ret != SQLITE_DONE) {
+		qWarning("Failed to write key %s (%s)", key.c_str(), sqlite3_errmsg(m_db));
+		return false;
+	}
+	return true;
+}
+
+bool SqlitePrefsStore::getAll(std::map<std::string, std::string>& r_prefs)
+{
+	sqlite3_stmt* statement = 0;
+	if (!m_db || sqlite3_prepare(m_db, "SELECT key, value FROM Preferences;", -1, &statement, 0)) {
+		qWarning() << "Failed to prepare sql statement";
+		sqlite3_finalize(statement);
+		return false;
+	}
+
+	while (sqlite3_step(statement) == SQLITE_ROW) {
+		const char* key = (const char*) sqlite3_column_text(statement, 0);
+		const char* val = (const char*) sqlite3_column_text(statement, 1);
+		if (!key || !val)
+			continue;
+
+		r_prefs[key] = val;
+	}
+
+	sqlite3_finalize(statement);
+	return true;
+}
+
+bool SqlitePrefsStore::getRange(const std::string& prefix, std::map<std::string, std::string>& r_prefs)
+{
+	// keys compare bytewise (BINARY collation), so the keys with the prefix are
+	// [prefix, prefix with its last byte below 0xff incremented) and the
+	// primary key of the WITHOUT ROWID table is walked over just that range
+	std::string upper = prefix;
+	while (!upper.empty() && (unsigned char) upper.back() == 0xff)
+		upper.pop_back();
+	if (!upper.empty())
+		upper.back() = (char) ((unsigned char) upper.back() + 1);
+
+	const char* sql = upper.empty() ? "SELECT key, value FROM Preferences WHERE key >= ?1;"
+	                                : "SELECT key, value FROM Preferences WHERE key >= ?1 AND key < ?2;";
+	sqlite3_stmt* statement = 0;
+	if (!m_db || sqlite3_prepare_v2(m_db, sql, -1, &statement, 0)) {
+		qWarning() << "Failed to prepare sql statement";
+		sqlite3_finalize(statement);
+		return false;
+	}
+
+	sqlite3_bind_text(statement, 1, prefix.data(), prefix.size(), SQLITE_STATIC);
+	if (!upper.empty())
+		sqlite3_bind_text(statement, 2, upper.data(), upper.size(), SQLITE_STATIC);
+
+	while (sqlite3_step(statement) == SQLITE_ROW) {
+		const char* key = (const char*) sqlite3_column_text(statement, 0);
+		const char* val = (const char*) sqlite3_column_text(statement, 1);
+		if (!key || !val)
+			continue;
+
+		r_prefs[key] = val;
+	}
+
+	sqlite3_finalize(statement);
+	return true;
+}
+
+bool SqlitePrefsStore::begin()
+{
+	return runSqlCommand("BEGIN TRANSACTION");
+}
+
+bool SqlitePrefsStore::commit()
+{
+	return runSqlCommand("COMMIT TRANSACTION");
+}
+
+void SqlitePrefsStore::rollback()
+{
+	(void) runSqlCommand("ROLLBACK TRANSACTION");
+}
+
+bool SqlitePrefsStore::openJournal(uint64_t& r_lastSeq)
+{
+	int ret = sqlite3_exec(m_db,
+					   "CREATE TABLE IF NOT EXISTS PrefsJournal "
+					   "(seq    INTEGER PRIMARY KEY, "
+					   " key    TEXT NOT NULL, "
+					   " time   INTEGER, "
+					   " origin TEXT);", NULL, NULL, NULL);
+	if (ret)
+		return false;
+
+	//continue the sequence where the last run left it
+	sqlite3_stmt* statement = 0;
+	const char* tail = 0;
+	r_lastSeq = 0;
+	ret = sqlite3_prepare(m_db, "SELECT MAX(seq) FROM PrefsJournal", -1, &statement, &tail);
+	if (!ret && sqlite3_step(statement) == SQLITE_ROW)
+		r_lastSeq = sqlite3_column_int64(statement, 0);
+	sqlite3_finalize(statement);
+
+	return true;
+}
+
+bool SqlitePrefsStore::appendJournal(const PrefsJournalEntry& entry)
+{
+	char* queryStr = sqlite3_mprintf("INSERT INTO PrefsJournal VALUES (%lld, %Q, %lld, %Q)",
+									 (sqlite3_int64) entry.seq, entry.key.c_str(),
+									 (sqlite3_int64) entry.timestamp, entry.origin.c_str());
+	if (!queryStr)
+		return false;
+
+	int ret = sqlite3_exec(m_db, queryStr, NULL, NULL, NULL);
+	sqlite3_free(queryStr);
+	if (ret) {
+		qWarning("Failed to journal change of key %s (%s)", entry.key.c_str(), sqlite3_errmsg(m_db));
+		return false;
+	}
+	return true;
+}
+
+void SqlitePrefsStore::trimJournal(uint64_t seq)
+{
+	char* queryStr = sqlite3_mprintf("DELETE FROM PrefsJournal WHERE seq <= %lld", (sqlite3_int64) seq);
+	if (queryStr) {
+		(void) sqlite3_exec(m_db, queryStr, NULL, NULL, NULL);
+		sqlite3_free(queryStr);
+	}
+}
+
+bool SqlitePrefsStore::readJournal(uint64_t seq, std::list<PrefsJournalEntry>& r_entries,
+                                   uint64_t& r_firstSeq)
+{
+	sqlite3_stmt* statement = 0;
+	const char* tail = 0;
+
+	r_firstSeq = 0;
+	int ret = sqlite3_prepare(m_db, "SELECT MIN(seq) FROM PrefsJournal", -1, &statement, &tail);
+	if (!ret && sqlite3_step(statement) == SQLITE_ROW
+		&& sqlite3_column_type(statement, 0) != SQLITE_NULL)
+		r_firstSeq = sqlite3_column_int64(statement, 0);
+	sqlite3_finalize(statement);
+
+	char* queryStr = sqlite3_mprintf("SELECT seq, key, time, origin FROM PrefsJournal "
+									 "WHERE seq > %lld ORDER BY seq", (sqlite3_int64) seq);
+	if (!queryStr)
+		return false;
+
+	ret = sqlite3_prepare(m_db, queryStr, -1, &statement, &tail);
+	sqlite3_free(queryStr);
+	if (ret) {
+		qWarning("Failed to prepare journal query (%s)", sqlite3_errmsg(m_db));
+		sqlite3_finalize(statement);
+		return false;
+	}
+
+	while (sqlite3_step(statement) == SQLITE_ROW) {
+		const char* key = (const char*) sqlite3_column_text(statement, 1);
+		const char* origin = (const char*) sqlite3_column_text(statement, 3);
+		if (!key)
+			continue;
+
+		PrefsJournalEntry entry;
+		entry.seq = sqlite3_column_int64(statement, 0);
+		entry.key = key;
+		entry.timestamp = sqlite3_column_int64(statement, 2);
+		entry.origin = origin ? origin : "";
+		r_entries.push_back(entry);
+	}
+
+	sqlite3_finalize(statement);
+	return true;
+}
+
+void SqlitePrefsStore::memoryStats(int& r_cacheUsed, int& r_schemaUsed, int& r_stmtUsed) const
+{
+	r_cacheUsed = r_schemaUsed = r_stmtUsed = 0;
+	if (!m_db)
+		return;
+
+	int highwater;
+	(void) sqlite3_db_status(m_db, SQLITE_DBSTATUS_CACHE_USED, &r_cacheUsed, &highwater, 0);
+	(void) sqlite3_db_status(m_db, SQLITE_DBSTATUS_SCHEMA_USED, &r_schemaUsed, &highwater, 0);
+	(void) sqlite3_db_status(m_db, SQLITE_DBSTATUS_STMT_USED, &r_stmtUsed, &highwater, 0);
+}
+
+void SqlitePrefsStore::releaseMemory()
+{
+	if (m_db)
+		(void) sqlite3_db_release_memory(m_db);
+}
+
+PrefsStore::OpenResult SqlitePrefsStore::checkTableConsistency()
+{
+	int ret;
+	std::string query;
+	std::string version;
+	sqlite3_stmt* statement = 0;
+	const char* tail = 0;
+
+	if (!integrityCheckDb())
+	{
+		qCritical("integrity check failed on prefs db and it cannot be recreated");
+		return OpenFailed;
+	}
+
+	query = "SELECT value FROM Preferences WHERE key='databaseVersion'";
+	ret = sqlite3_prepare(m_db, query.c_str(), -1, &statement, &tail);
+	if (ret) {
+		qWarning("Failed to prepare sql statement: %s (%s)",
+					  query.c_str(), sqlite3_errmsg(m_db));
+		sqlite3_finalize(statement);
+		goto Recreate;
+	}
+
+	ret = sqlite3_step(statement);
+	if (ret == SQLITE_ROW) {
+		const char* res = (const char*) sqlite3_column_text(statement, 0);
+		version = res ? res : "";
+	}
+	sqlite3_finalize(statement);
+	if (ret != SQLITE_ROW) {
+		// Database not consistent. recreate
+		goto Recreate;
+	}
+
+	if (!migrateSchema(version)) {
+		//the failed step was rolled back: keep the prefs in the old table and
+		//try again on the next start, recreating would throw them all away
+		qCritical("Failed to migrate prefs db from schema %s, using it as it is", version.c_str());
+		ret = sqlite3_prepare_v2(m_db, "SELECT modified, origin FROM Preferences LIMIT 0", -1, &statement, 0);
+		sqlite3_finalize(statement);
+		m_legacySchema = (ret != SQLITE_OK);
+	}
+
+	//Everything is now ok.
+	return OpenExisting;
+
+	//only reached without a (readable) databaseVersion
+Recreate:
+
+	(void) sqlite3_exec(m_db, "DROP TABLE Preferences", NULL, NULL, NULL);
+	ret = createPrefsTable("Preferences", false);
+	if (ret) {
+		qWarning() << "Failed to create Preferences table";
+		return OpenFailed;
+	}
+
+	query = std::string("INSERT INTO Preferences (key, value) VALUES ('databaseVersion', '")
+			+ PrefsDb::s_schemaVersion + "')";
+	ret = sqlite3_exec(m_db, query.c_str(), NULL, NULL, NULL);
+	if (ret) {
+		qWarning() << "Failed to create Preferences table";
+		return OpenFailed;
+	}
+
+	return OpenCreated;
+}
+
+int SqlitePrefsStore::createPrefsTable(const char* name, bool ifNotExists)
+{
+	//WITHOUT ROWID: lookups go straight to the key b-tree, no separate index
+	char* queryStr = sqlite3_mprintf("CREATE TABLE %s%s "
+									 "(key      TEXT NOT NULL ON CONFLICT FAIL PRIMARY KEY ON CONFLICT REPLACE, "
+									 " value    TEXT, "
+									 " modified INTEGER NOT NULL DEFAULT 0, "
+									 " origin   TEXT) WITHOUT ROWID;",
+									 ifNotExists ? "IF NOT EXISTS " : "", name);
+	if (!queryStr)
+		return SQLITE_NOMEM;
+
+	int ret = sqlite3_exec(m_db, queryStr, NULL, NULL, NULL);
+	sqlite3_free(queryStr);
+	return ret;
+}
+
+//each step moves the db from one schema version to the next, in order
+const SqlitePrefsStore::SchemaMigration SqlitePrefsStore::s_schemaMigrations[] = {
+	{ "1.0", "2.0", &SqlitePrefsStore::migrateToWithoutRowid },
+};
+
+bool SqlitePrefsStore::migrateSchema(std::string version)
+{
+	while (version != PrefsDb::s_schemaVersion) {
+		const SchemaMigration* step = nullptr;
+		for (const SchemaMigration& migration : s_schemaMigrations) {
+			if (version == migration.fromVersion)
+				step = &migration;
+		}
+		if (!step) {
+			//probably written by a newer service; the key/value columns still work
+			qWarning("No migration from prefs db schema %s, using it as it is", version.c_str());
+			return true;
+		}
+
+		//a failed step leaves the old schema untouched
+		if (!runSqlCommand("BEGIN TRANSACTION"))
+			return false;
+
+		std::string setVersion = std::string("UPDATE Preferences SET value='") + step->toVersion
+								 + "' WHERE key='databaseVersion'";
+		if (!(this->*step->migrate)() || !runSqlCommand(setVersion)
+			|| !runSqlCommand("COMMIT TRANSACTION")) {
+			(void) runSqlCommand("ROLLBACK TRANSACTION");
+			return false;
+		}
+
+		PmLogInfo(sysServiceLogContext(), "PREFSDB_MIGRATED", 2,
+		          PMLOGKS("FROM", step->fromVersion),
+		          PMLOGKS("TO", step->toVersion),
+		          "Preferences db schema migrated");
+		version = step->toVersion;
+	}
+
+	return true;
+}
+
+bool SqlitePrefsStore::migrateToWithoutRowid()
+{
+	(void) runSqlCommand("DROP TABLE IF EXISTS PreferencesNext");
+	if (createPrefsTable("PreferencesNext", false)) {
+		qWarning("Failed to create PreferencesNext table (%s)", sqlite3_errmsg(m_db));
+		return false;
+	}
+
+	//rows from before the migration predate the journal, so they have modified 0
+	return runSqlCommand("INSERT INTO PreferencesNext (key, value) "
+						 "SELECT key, value FROM Preferences WHERE key IS NOT NULL")
+		&& runSqlCommand("DROP TABLE Preferences")
+		&& runSqlCommand("ALTER TABLE PreferencesNext RENAME TO Preferences");
+}
+
+bool SqlitePrefsStore::integrityCheckDb()
+{
+	if (!m_db)
+		return false;
+
+	sqlite3_stmt* statement = 0;
+	const char* tail = 0;
+	int ret = 0;
+	bool integrityOk = false;
+
+	ret = sqlite3_prepare(m_db, "PRAGMA integrity_check", -1, &statement, &tail);
+	if (ret) {
+		qCritical() << "Failed to prepare sql statement for integrity_check";
+		goto CorruptDb;
+	}
+
+	ret = sqlite3_step(statement);
+	if (ret == SQLITE_ROW) {
+		const unsigned char* result = sqlite3_column_text(statement, 0);
+		if (result && strcasecmp((const char*) result, "ok") == 0)
+			integrityOk = true;
+	}
+
+	sqlite3_finalize(statement);
+
+	if (!integrityOk)
+		goto CorruptDb;
+
+	qDebug("Integrity check for database passed");
+
+	return true;
+
+CorruptDb:
+
+	qCritical() << "integrity check failed. recreating database";
+
+	sqlite3_close(m_db);
+	unlink(m_path.c_str());
+
+	ret = sqlite3_open_v2 (m_path.c_str(), &m_db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, NULL);
+	if (ret) {
+		qCritical() << "Failed to re-open prefs db at [" << m_path.c_str() << "]";
+		return false;
+	}
+
+	return true;
+}
+
+bool SqlitePrefsStore::runSqlCommand(const std::string& cmdStr)
+{
+	char * pErrMsg = 0;
+
+	if (!m_db)
+		return false;
+
+	int ret = sqlite3_exec(m_db, cmdStr.c_str(), NULL, NULL, &pErrMsg);
+	if (ret)
+		qWarning() << "Failed to execute cmd [" << cmdStr.c_str() << "] - extended error: [" << (pErrMsg ? pErrMsg : "<none>") << "]";
+
+	if (pErrMsg)
+		sqlite3_free(pErrMsg);
+	return ret == SQLITE_OK;
+}
@@ -17,6 +17,9 @@
 #include "SystemRestore.h"
 
 #include <cassert>
+#include <memory>
+
+#include <sys/stat.h>
 
 #include <glib.h>
 
@@ -24,18 +27,73 @@
 #include <luna-service2/lunaservice.h>
 
 #include <QDebug>
-#include <QtGui/QImageReader>
 
+#include "AsyncTask.h"
 #include "Utils.h"
 #include "Logging.h"
 #include "PrefsDb.h"
 #include "JSONUtils.h"
 #include "PrefsFactory.h"
+#include "ImageModule.h"
 
 using namespace pbnjson;
 
-SystemRestore::SystemRestore() : m_msmState(Phone)
+static const char* s_checkCacheFile = "consistencyCheckCache.json";
+
+namespace {
+
+// pulls the file name out of a wallpaper/ringtone setting
+std::string settingFileAndPath(const std::string& rawPref, const char* field, const char* what)
 {
+	if (rawPref.length() == 0)
+		return std::string();
+
+	JValue root = JDomParser::fromString(rawPref);
+	if (!root.isObject()) {
+		qWarning() << "Failed to parse" << what << "string into json: '" << rawPref.c_str() << "'";
+		return std::string();
+	}
+
+	JValue label = root[field];
+	if (!label.isString()) {
+		qWarning() << "Failed to parse" << what << "details";
+		return std::string();
+	}
+
+	return label.asString();
+}
+
+// one check of startupConsistencyCheck(), run on its own thread
+struct StartupCheck
+{
+	const char* name;
+	std::string fileAndPath;
+	bool (*check)(const std::string& fileAndPath);
+	struct stat st;
+	bool result;
+	GThread* thread;
+};
+
+gpointer runStartupCheck(gpointer data)
+{
+	StartupCheck* check = static_cast<StartupCheck*>(data);
+	check->result = check->check(check->fileAndPath);
+	return nullptr;
+}
+
+} // anonymous namespace
+
+SystemRestore::SystemRestore()
+	: m_msmState(Phone)
+	, m_checkCacheDirty(false)
+	, m_deferMediaCopies(false)
+	, m_tokenPending(false)
+{
+	loadCheckCache();
+
+	// the db reloads its defaults when it has to recreate the table
+	PrefsDb::instance()->defaultsReloaded.connect(this, &SystemRestore::refreshDefaultSettings);
+
 	do {
 		//load the defaults file
 		JValue root = JDomParser::fromFile(PrefsDb::s_defaultPrefsFile);
@@ -107,43 +165,6 @@ SystemRestore::SystemRestore() : m_msmState(Phone)
 	}
 }
 
-/* COMMENT: No gio-2.0 on device! blah...look for slow, alternate function below this one...
-//static
-int SystemRestore::fileCopy(const char * srcFileAndPath,const char * dstFileAndPath)
-{
-	if ((srcFileAndPath == NULL) || (dstFileAndPath == NULL))
-		return -1;
-	GFile * src = g_file_new_for_path(srcFileAndPath);
-	GFile * dst = g_file_new_for_path(dstFileAndPath);
-
-	GError * err=NULL;
-	gboolean rc = g_file_copy(
-			src,
-			dst,
-			G_FILE_COPY_OVERWRITE,
-			NULL,
-			NULL,
-			NULL,
-			&err
-	);
-	
-	g_object_unref(src);
-	g_object_unref(dst);
-	
-	if (rc == false) {
-		qWarning("file copy error %d: [%s]",err->code,err->message);
-		g_error_free(err);
-		return -1;
-	}
-	
-	//make sure there is no error struct created, and if so free it
-	if (err)
-		g_error_free(err);
-	
-	return 1;
-}
-*/
-
 int SystemRestore::restoreDefaultRingtoneToMediaPartition() 
 {
 	//check the file specified by defaultRingtoneFileAndPath
@@ -162,13 +183,7 @@ int SystemRestore::restoreDefaultRingtoneToMediaPartition()
 		return -1;
 	}
 	std::string targetFileAndPath = std::string(PrefsDb::s_mediaPartitionPath)+std::string(PrefsDb::s_mediaPartitionRingtonesDir)+std::string("/")+filePart;
-	int rc = Utils::fileCopy(defaultRingtoneFileAndPath.c_str(),targetFileAndPath.c_str());
-	if (rc == -1)
-	{
-		qWarning() << "filecopy" << defaultRingtoneFileAndPath.c_str() << "->" << targetFileAndPath.c_str() << "failed";
-		return -1;
-	}
-	return 1;
+	return mediaPartitionCopy(defaultRingtoneFileAndPath, targetFileAndPath);
 }
 int SystemRestore::restoreDefaultWallpaperToMediaPartition()
 {
@@ -190,16 +205,73 @@ int SystemRestore::restoreDefaultWallpaperToMediaPartition()
 	}
 		
 	std::string targetFileAndPath = std::string(PrefsDb::s_mediaPartitionPath)+std::string(PrefsDb::s_mediaPartitionWallpapersDir)+std::string("/")+filePart;
-	int rc = Utils::fileCopy(defaultWallpaperFileAndPath.c_str(),targetFileAndPath.c_str());
-	if (rc == -1)
+	return mediaPartitionCopy(defaultWallpaperFileAndPath, targetFileAndPath);
+}
+
+int SystemRestore::mediaPartitionCopy(const std::string& source, const std::string& target)
+{
+	if (m_deferMediaCopies) {
+		//still starting up; runDeferredRestores() does the copy
+		m_deferredCopies.push_back(std::make_pair(source, target));
+		return 1;
+	}
+
+	if (Utils::fileCopy(source.c_str(), target.c_str()) == -1)
 	{
-		qWarning() << "filecopy" << defaultWallpaperFileAndPath.c_str() << "->" << targetFileAndPath.c_str() << "failed";
+		qWarning() << "filecopy" << source.c_str() << "->" << target.c_str() << "failed";
 		return -1;
 	}
-
 	return 1;
 }
 
+void SystemRestore::runDeferredRestores()
+{
+	m_deferMediaCopies = false;
+
+	if (m_deferredCopies.empty()) {
+		if (m_tokenPending)
+			writeSystemToken();
+		m_tokenPending = false;
+		return;
+	}
+
+	typedef std::vector<std::pair<std::string, std::string> > CopyList;
+	auto copies = std::make_shared<CopyList>();
+	copies->swap(m_deferredCopies);
+	auto failed = std::make_shared<bool>(false);
+	bool writeToken = m_tokenPending;
+	m_tokenPending = false;
+
+	AsyncTaskPool::instance()->offload(nullptr,
+		[copies, failed]() {
+			for (const auto& copy : *copies) {
+				if (Utils::fileCopy(copy.first.c_str(), copy.second.c_str()) == -1) {
+					qWarning() << "filecopy" << copy.first.c_str() << "->" << copy.second.c_str() << "failed";
+					*failed = true;
+				}
+			}
+		},
+		[failed, writeToken]() {
+			if (!writeToken)
+				return;
+
+			if (*failed)
+				qWarning() << "system token WAS NOT written because restoring the media partition failed!";
+			else
+				writeSystemToken();
+		});
+}
+
+void SystemRestore::writeSystemToken()
+{
+	FILE * fp = fopen(PrefsDb::s_systemTokenFileAndPath,"w");
+	if (fp != NULL) {
+		fprintf(fp,"%lu",time(NULL));		//doesn't matter what I put in here, but timestamp seems sane
+		fflush(fp);
+		fclose(fp);
+	}
+}
+
 int SystemRestore::restoreDefaultRingtoneSetting()
 {
 	//parse json in the defaultRingtoneString
@@ -279,86 +351,137 @@ int SystemRestore::restoreDefaultWallpaperSetting()
 
 bool SystemRestore::isRingtoneSettingConsistent() 
 {
-	std::string ringToneRawPref = PrefsDb::instance()->getPref("ringtone");
-	std::string ringToneFileAndPath;
-	
-	bool rc=false;
+	std::string ringToneFileAndPath = settingFileAndPath(PrefsDb::instance()->getPref("ringtone"), "fullPath", "ringtone");
+	if (ringToneFileAndPath.empty())
+		return false;
 
-	do {
-		if (ringToneRawPref.length() == 0)
-			break;
+	return isFileConsistent("ringtone", ringToneFileAndPath, &SystemRestore::isRingtoneFileConsistent);
+}
 
-		//parse the setting
-		JValue root = JDomParser::fromString(ringToneRawPref);
-		if (!root.isObject()) {
-			qWarning() << "Failed to parse ringtone raw string into json: '" << ringToneRawPref.c_str() << "'";
-			break;
-		}
 
-		JValue label = root["fullPath"];
-		if (!label.isString()) {
-			qWarning() << "Failed to parse ringtone details";
-			break;
-		}
+bool SystemRestore::isWallpaperSettingConsistent()
+{
+	std::string wallpaperFileAndPath = settingFileAndPath(PrefsDb::instance()->getPref("wallpaper"), "wallpaperFile", "wallpaper");
+	if (wallpaperFileAndPath.empty())
+		return false;
+
+	return isFileConsistent("wallpaper", wallpaperFileAndPath, &SystemRestore::isWallpaperFileConsistent);
+}
 
-		ringToneFileAndPath = label.asString();
+bool SystemRestore::isFileConsistent(const char* name, const std::string& fileAndPath, FileCheck check)
+{
+	struct stat st;
+	if (::stat(fileAndPath.c_str(), &st) == 0 && lookupCheckCache(name, fileAndPath, st.st_size, st.st_mtime))
+		return true;
 
-		qDebug("checking [%s]...",ringToneFileAndPath.c_str());
-		//check to see if file exists
-		if (Utils::doesExistOnFilesystem(ringToneFileAndPath.c_str())) {
-			if (Utils::filesizeOnFilesystem(ringToneFileAndPath.c_str()) > 0)			//TODO: a better check for corruption; see wallpaper consist. checking
-				rc = true;
-			else
-				qWarning() << "file size is 0; corrupt file";
-		}
-		else {
-			qWarning() << "Sound file is not on filesystem";
-		}
-	} while (false);
+	if (!check(fileAndPath))
+		return false;
 
-	return rc;
+	if (::stat(fileAndPath.c_str(), &st) == 0) {
+		storeCheckCache(name, fileAndPath, st.st_size, st.st_mtime);
+		saveCheckCache();
+	}
+	return true;
 }
 
+//static
+bool SystemRestore::isRingtoneFileConsistent(const std::string& fileAndPath)
+{
+	qDebug("checking [%s]...",fileAndPath.c_str());
+	//check to see if file exists
+	if (!Utils::doesExistOnFilesystem(fileAndPath.c_str())) {
+		qWarning() << "Sound file is not on filesystem";
+		return false;
+	}
 
-bool SystemRestore::isWallpaperSettingConsistent()
+	if (Utils::filesizeOnFilesystem(fileAndPath.c_str()) <= 0) {			//TODO: a better check for corruption; see wallpaper consist. checking
+		qWarning() << "file size is 0; corrupt file";
+		return false;
+	}
+
+	return true;
+}
+
+//static
+bool SystemRestore::isWallpaperFileConsistent(const std::string& fileAndPath)
 {
-	std::string wallpaperRawPref = PrefsDb::instance()->getPref("wallpaper");
-	std::string wallpaperFileAndPath;
-	
-	bool rc=false;
+	qDebug("checking [%s]...",fileAndPath.c_str());
+	//check to see if file exists and still looks like an image; this runs on the
+	//startup check thread, so it must not touch the image module
+	if (ImageModule::sniffFormat(fileAndPath))
+		return true;
 
-	do {
-		if (wallpaperRawPref.length() == 0)
-			break;
+	qWarning() << "not a readable image:" << fileAndPath.c_str();
+	return false;
+}
 
-		//parse the setting
-		JValue root = JDomParser::fromString(wallpaperRawPref);
-		if (!root.isObject()) {
-			qWarning() << "Failed to parse wallpaper string into json: '" << wallpaperRawPref.c_str() << "'";
-			break;
-		}
+bool SystemRestore::lookupCheckCache(const char* name, const std::string& fileAndPath, off_t size, time_t mtime) const
+{
+	auto it = m_checkCache.find(name);
+	return it != m_checkCache.end()
+		&& it->second.fileAndPath == fileAndPath
+		&& it->second.size == size
+		&& it->second.mtime == mtime;
+}
 
-		JValue label = root["wallpaperFile"];
-		if (!label.isString()) {
-			qWarning() << "Failed to parse wallpaper details";
-			break;
-		}
+void SystemRestore::storeCheckCache(const char* name, const std::string& fileAndPath, off_t size, time_t mtime)
+{
+	CheckCacheEntry& entry = m_checkCache[name];
+	entry.fileAndPath = fileAndPath;
+	entry.size = size;
+	entry.mtime = mtime;
+	m_checkCacheDirty = true;
+}
 
-		wallpaperFileAndPath = label.asString();
+void SystemRestore::loadCheckCache()
+{
+	std::string cacheFile = std::string(PrefsDb::s_prefsPath) + "/" + s_checkCacheFile;
+	if (!Utils::doesExistOnFilesystem(cacheFile.c_str()))
+		return;
 
-		qDebug("checking [%s]...",wallpaperFileAndPath.c_str());
-		//check to see if file exists
+	JValue root = JDomParser::fromFile(cacheFile.c_str());
+	if (!root.isObject()) {
+		qWarning() << "Failed to load consistency check cache:" << cacheFile.c_str();
+		return;
+	}
 
-		{
-			QImageReader reader(QString::fromStdString(wallpaperFileAndPath));
-			if (reader.canRead())
-				rc = true;
-			else
-				qWarning() <<reader.errorString()<<reader.fileName();
-		}
-	} while (false);
+	for (const JValue::KeyValue check: root.children()) {
+		JValue file = check.second["fileAndPath"];
+		JValue size = check.second["size"];
+		JValue mtime = check.second["mtime"];
+		if (!file.isString() || !size.isNumber() || !mtime.isNumber())
+			continue;
+
+		CheckCacheEntry& entry = m_checkCache[check.first.asString()];
+		entry.fileAndPath = file.asString();
+		entry.size = size.asNumber<int64_t>();
+		entry.mtime = mtime.asNumber<int64_t>();
+	}
+}
 
-	return rc;
+void SystemRestore::saveCheckCache()
+{
+	if (!m_checkCacheDirty)
+		return;
+
+	JObject root;
+	for (const auto& check : m_checkCache) {
+		root.put(check.first, JObject {{"fileAndPath", check.second.fileAndPath},
+		                               {"size", static_cast<int64_t>(check.second.size)},
+		                               {"mtime", static_cast<int64_t>(check.second.mtime)}});
+	}
+
+	std::string cacheFile = std::string(PrefsDb::s_prefsPath) + "/" + s_checkCacheFile;
+	std::string data = root.stringify();
+	GError* error = nullptr;
+	if (!g_file_set_contents(cacheFile.c_str(), data.c_str(), data.size(), &error)) {
+		qWarning() << "Failed to write consistency check cache:" << (error ? error->message : "");
+		if (error)
+			g_error_free(error);
+		return;
+	}
+
+	m_checkCacheDirty = false;
 }
 
 void SystemRestore::refreshDefaultSettings()
@@ -459,23 +582,24 @@ int SystemRestore::startupConsistencyCheck()
 	PMLOG_TRACE("%s:started",__FUNCTION__);
 	// -- run startup tests to determine the state of the device
 
+	SystemRestore* restore = SystemRestore::instance();
+
+	//copies to the media partition are left for runDeferredRestores() so they
+	//don't hold up service registration
+	restore->m_deferMediaCopies = true;
+
 	if (Utils::doesExistOnFilesystem(PrefsDb::s_systemTokenFileAndPath) == false) {
 		//the media partition has been reformatted or damaged
 		qWarning() << "running - system token missing; media was erased/damaged";
 		//run restore
 
 		int rc=0;		//avoid having tons of if's ...so don't mess with the return values of the restore__ functions
-		rc += SystemRestore::instance()->restoreDefaultRingtoneSetting();
-		rc += SystemRestore::instance()->restoreDefaultWallpaperSetting();
+		rc += restore->restoreDefaultRingtoneSetting();
+		rc += restore->restoreDefaultWallpaperSetting();
 
-		//create token if all these succeeded
+		//create token if all these succeeded (and the copies do too)
 		if (rc == 2) {
-			FILE * fp = fopen(PrefsDb::s_systemTokenFileAndPath,"w");
-			if (fp != NULL) {
-				fprintf(fp,"%lu",time(NULL));		//doesn't matter what I put in here, but timestamp seems sane
-				fflush(fp);
-				fclose(fp);
-			}
+			restore->m_tokenPending = true;
 		}
 		else {
 			qWarning() << "running - system token missing and WAS NOT written because one of the restore functions failed!";
@@ -484,14 +608,56 @@ int SystemRestore::startupConsistencyCheck()
 	else {
 		
 		PMLOG_TRACE("running - checking wallpaper and ringtone consistency");
+
+		//the checks are independent of each other; those the cache can't
+		//answer get a thread each
+		StartupCheck checks[] = {
+			{ "wallpaper",
+			  settingFileAndPath(PrefsDb::instance()->getPref("wallpaper"), "wallpaperFile", "wallpaper"),
+			  &SystemRestore::isWallpaperFileConsistent },
+			{ "ringtone",
+			  settingFileAndPath(PrefsDb::instance()->getPref("ringtone"), "fullPath", "ringtone"),
+			  &SystemRestore::isRingtoneFileConsistent },
+		};
+
+		for (StartupCheck& check : checks) {
+			check.result = false;
+			check.thread = nullptr;
+
+			if (check.fileAndPath.empty() || ::stat(check.fileAndPath.c_str(), &check.st) != 0)
+				continue;
+
+			if (restore->lookupCheckCache(check.name, check.fileAndPath, check.st.st_size, check.st.st_mtime)) {
+				check.result = true;
+				continue;
+			}
+
+			check.thread = g_thread_try_new(check.name, runStartupCheck, &check, nullptr);
+			if (!check.thread) {
+				runStartupCheck(&check);
+				if (check.result)
+					restore->storeCheckCache(check.name, check.fileAndPath, check.st.st_size, check.st.st_mtime);
+			}
+		}
+
+		for (StartupCheck& check : checks) {
+			if (!check.thread)
+				continue;
+
+			g_thread_join(check.thread);
+			if (check.result)
+				restore->storeCheckCache(check.name, check.fileAndPath, check.st.st_size, check.st.st_mtime);
+		}
+		restore->saveCheckCache();
+
 		//check consistency of wallpaper setting
-		if (!SystemRestore::instance()->isWallpaperSettingConsistent()) {
+		if (!checks[0].result) {
 			//run restore on wallpaper
-			SystemRestore::instance()->restoreDefaultWallpaperSetting();
+			restore->restoreDefaultWallpaperSetting();
 		}
 		//check consistency of ringtone setting
-		if (!SystemRestore::instance()->isRingtoneSettingConsistent()) {
-			SystemRestore::instance()->restoreDefaultRingtoneSetting();
+		if (!checks[1].result) {
+			restore->restoreDefaultRingtoneSetting();
 		}
 	}
 
@@ -499,7 +665,7 @@ int SystemRestore::startupConsistencyCheck()
 	if (Utils::filesizeOnFilesystem(PrefsDb::s_volumeIconFileAndPathDest) == 0) {
 		PMLOG_TRACE("running - restoring volume icon file");
 		//restore it
-		Utils::fileCopy(PrefsDb::s_volumeIconFileAndPathSrc,PrefsDb::s_volumeIconFileAndPathDest);
+		restore->mediaPartitionCopy(PrefsDb::s_volumeIconFileAndPathSrc,PrefsDb::s_volumeIconFileAndPathDest);
 	}
 
 //	//attrib it all for good measure
@@ -28,6 +28,8 @@
 #include <errno.h>
 #include <memory.h>
 #include <set>
+#include <algorithm>
+#include <unordered_map>
 #include <sys/sysinfo.h>
 
 #if defined(HAVE_LUNA_PREFS)
@@ -47,6 +49,7 @@
 #include "Utils.h"
 #include "JSONUtils.h"
 #include "TimeZoneService.h"
+#include "TimeThread.h"
 
 using namespace pbnjson;
 
@@ -56,6 +59,7 @@ static const char*        s_zoneInfoFolder = "/usr/share/zoneinfo/";
 static const int          s_sysTimeNotificationThreshold = 3000; // 5 mins
 static const char*        s_logChannel = "TimePrefsHandler";
 static const char*        s_factoryTimeSource = "factory";
+static const guint        s_timeChangeLaunchInterval = 200; // ms between two launches
 static std::string        s_localeStr = "en-US";
 static const std::string  s_file = "cppstrings.json";
 static const std::string  s_resources_path = "/usr/share/localization/luna-sysservice";
@@ -84,7 +88,6 @@ namespace {
 	const int lowestTimeSourcePriority = INT_MIN; // mark for overriding
 } // anonymous namespace
 
-JValue TimePrefsHandler::s_timeZonesJson {};
 TimePrefsHandler * TimePrefsHandler::s_inst = NULL;
 
 extern char *strptime (__const char *__restrict __s,
@@ -178,18 +181,21 @@ tz_exists(const char* tz_name) {
 struct TimeZoneInfo
 {
 	bool operator==(const struct TimeZoneInfo& c) const {
-		return (name == c.name) && (city== c.city);
-	}
-	std::string name;
-	std::string city;
-	std::string description;
-	std::string country;
-	std::string countryCode;
-	std::string jsonStringValue;
-	int   	dstSupported;
-	int   	offsetToUTC;
-	bool 	preferred;					//if set to true, then pick this TZ is searching by offset vs any others
-	int		howManyZonesForCountry;		//how many offsets (incl. this one) does this country (based on countryCode) span? e.g. USA = 9
+		return (strcmp(name, c.name) == 0) && (strcmp(city, c.city) == 0);
+	}
+	// the strings are never owned by the zone; they point either into the
+	// string pool of TimeZoneTable or to literals
+	const char*	name = "";
+	const char*	city = "";
+	const char*	description = "";
+	const char*	country = "";
+	const char*	countryCode = "";
+	int16_t	offsetToUTC = 0;
+	int8_t	dstSupported = 0;
+	bool 	preferred = false;				//if set to true, then pick this TZ is searching by offset vs any others
+	bool	isDefault = false;				//marked as "default" in the timezone file
+	uint8_t	howManyZonesForCountry = 0;		//how many offsets (incl. this one) does this country (based on countryCode) span? e.g. USA = 9
+	uint16_t	mcc = 0;					//set for mccInfo entries only
 };
 
 namespace {
@@ -197,16 +203,7 @@ namespace {
 	{
 		TimeZoneInfo tz;
 		tz.name = "Etc/GMT-0";
-		tz.countryCode = "";
-		tz.jsonStringValue =  "{"
-			"\"Country\":\"\",\"CountryCode\":\"\","
-			"\"ZoneID\":\"Etc/GMT-0\",\"City\":\"\","
-			"\"Description\":\"GMT\",\"offsetFromUTC\": 0,"
-			"\"supportsDST\":0"
-			"}";
-		tz.dstSupported = 0;
-		tz.offsetToUTC = 0;
-		tz.preferred = false;
+		tz.description = "GMT";
 		return tz;
 	}
 } // anonymous namespace
@@ -216,105 +213,87 @@ const TimeZoneInfo TimePrefsHandler::s_failsafeDefaultZone = buildFailsafeDefaul
 struct TZJsonHelper
 {
 public:
-	static bool extract(const JValue& root, TimeZoneInfo* timeZoneInfo)
+	// zone as reported to clients, labels are localized if a bundle is given
+	static JValue pack(const TimeZoneInfo& timeZoneInfo, ResBundle* resBundle = nullptr)
 	{
-		if (!root.isObject()) {
-			return false;
-		}
-
-		reset(timeZoneInfo);
+		JValue timeZoneObj = pbnjson::Object();
 
-		JValue label = root["Description"];
-		if (label.isString()) {
-			timeZoneInfo->description = label.asString();
+		if (*timeZoneInfo.description) {
+			timeZoneObj.put("Description", localized(timeZoneInfo.description, resBundle));
 		}
 
-		label = root["City"];
-		if (label.isString()) {
-			timeZoneInfo->city = label.asString();
+		if (*timeZoneInfo.city) {
+			timeZoneObj.put("City", localized(timeZoneInfo.city, resBundle));
 		}
 
-		label = root["Country"];
-		if (label.isString()) {
-			timeZoneInfo->country = label.asString();
+		if (*timeZoneInfo.country) {
+			timeZoneObj.put("Country", localized(timeZoneInfo.country, resBundle));
 		}
 
-		label = root["supportDST"];
-		if (label.isNumber()) {
-			timeZoneInfo->dstSupported = label.asNumber<int>();
-		}
+		timeZoneObj.put("supportDST", static_cast<int>(timeZoneInfo.dstSupported));
+		timeZoneObj.put("offsetFromUTC", static_cast<int>(timeZoneInfo.offsetToUTC));
 
-		label = root["offsetFromUTC"];
-		if (label.isNumber()) {
-			timeZoneInfo->offsetToUTC = label.asNumber<int>();
+		if (*timeZoneInfo.name) {
+			timeZoneObj.put("ZoneID", std::string(timeZoneInfo.name));
 		}
 
-		label = root["ZoneID"];
-		if (label.isString()) {
-			timeZoneInfo->name = label.asString();
+		if (*timeZoneInfo.countryCode) {
+			timeZoneObj.put("CountryCode", std::string(timeZoneInfo.countryCode));
 		}
 
-		label = root["CountryCode"];
-		if (label.isString()) {
-			timeZoneInfo->countryCode = label.asString();
-		}
-
-		label = root["preferred"];
-		if (label.isBoolean()) {
-			timeZoneInfo->preferred = label.asBool();
+		if (timeZoneInfo.preferred)
+		{
+			timeZoneObj.put("preferred", true);
 		}
 
-		return true;
+		return timeZoneObj;
 	}
 
-	static JValue pack(const TimeZoneInfo* timeZoneInfo)
+	// zone in the layout of the timezone file; this is also the form kept
+	// in the "timeZone" preference
+	static JValue entry(const TimeZoneInfo& timeZoneInfo)
 	{
 		JValue timeZoneObj = pbnjson::Object();
 
-		if(!timeZoneInfo->description.empty()) {
-			timeZoneObj.put("Description", timeZoneInfo->description);
-		}
-
-		if(!timeZoneInfo->city.empty()) {
-			timeZoneObj.put("City", timeZoneInfo->city);
-		}
+		timeZoneObj.put("Country", std::string(timeZoneInfo.country));
+		timeZoneObj.put("CountryCode", std::string(timeZoneInfo.countryCode));
+		timeZoneObj.put("ZoneID", std::string(timeZoneInfo.name));
+		timeZoneObj.put("City", std::string(timeZoneInfo.city));
+		timeZoneObj.put("Description", std::string(timeZoneInfo.description));
 
-		if(!timeZoneInfo->country.empty()) {
-			timeZoneObj.put("Country", timeZoneInfo->country);
+		if (strcmp(timeZoneInfo.name, MANUAL_TZ_NAME) == 0) {
+			timeZoneObj.put("offsetFromUTC", "NA");
+			timeZoneObj.put("supportsDST", "NA");
+			return timeZoneObj;
 		}
 
-		timeZoneObj.put("supportDST", timeZoneInfo->dstSupported);
-		timeZoneObj.put("offsetFromUTC", timeZoneInfo->offsetToUTC);
+		timeZoneObj.put("offsetFromUTC", static_cast<int>(timeZoneInfo.offsetToUTC));
+		timeZoneObj.put("supportsDST", static_cast<int>(timeZoneInfo.dstSupported));
 
-		if (!timeZoneInfo->name.empty()) {
-			timeZoneObj.put("ZoneID", timeZoneInfo->name);
+		if (timeZoneInfo.preferred) {
+			timeZoneObj.put("preferred", true);
 		}
 
-		if (!timeZoneInfo->countryCode.empty()) {
-			timeZoneObj.put("CountryCode", timeZoneInfo->countryCode);
+		if (timeZoneInfo.isDefault) {
+			timeZoneObj.put("default", true);
 		}
 
-		if (timeZoneInfo->preferred)
-		{
-			timeZoneObj.put("preferred", timeZoneInfo->preferred);
+		if (timeZoneInfo.mcc) {
+			timeZoneObj.put("mcc", static_cast<int>(timeZoneInfo.mcc));
 		}
 
 		return timeZoneObj;
 	}
 
+	static std::string entryString(const TimeZoneInfo& timeZoneInfo)
+	{
+		return entry(timeZoneInfo).stringify();
+	}
+
 private:
-	static void reset(TimeZoneInfo* timeZoneInfo)
+	static std::string localized(const char* label, ResBundle* resBundle)
 	{
-		timeZoneInfo->name = "";
-		timeZoneInfo->city = "";
-		timeZoneInfo->description = "";
-		timeZoneInfo->country = "";
-		timeZoneInfo->countryCode = "";
-		timeZoneInfo->jsonStringValue = "";
-		timeZoneInfo->dstSupported = 0;
-		timeZoneInfo->offsetToUTC = 0;
-		timeZoneInfo->preferred = false;
-		timeZoneInfo->howManyZonesForCountry = 0;
+		return resBundle ? resBundle->getLocString(label) : std::string(label);
 	}
 };
 
@@ -328,12 +307,129 @@ struct PreferredZones
 	/* PreferredZones& operator=(const PreferredZones& c) = default; */
 
 	int 		   offset;
-	TimeZoneInfo * dstPref;
-	TimeZoneInfo * nonDstPref;
-	TimeZoneInfo * dstFallback;
-	TimeZoneInfo * nonDstFallback;
+	const TimeZoneInfo * dstPref;
+	const TimeZoneInfo * nonDstPref;
+	const TimeZoneInfo * dstFallback;
+	const TimeZoneInfo * nonDstFallback;
 };
 
+/**
+ * Read-only, compact copy of the timezone file.
+ *
+ * The "timeZone", "syszones" and "mccInfo" arrays are kept as sections of one
+ * contiguous row array. Every distinct string of the file is stored once in a
+ * shared pool that the rows point into, and the lookup indexes are sorted
+ * vectors. The table is filled once in init() and the parsed file is released
+ * right after; JSON is produced from the rows on demand.
+ */
+class TimeZoneTable
+{
+public:
+	struct Section
+	{
+		const TimeZoneInfo* first;
+		const TimeZoneInfo* last;
+
+		const TimeZoneInfo* begin() const { return first; }
+		const TimeZoneInfo* end() const { return last; }
+		size_t size() const { return last - first; }
+	};
+
+	TimeZoneTable() : m_sysBegin(0), m_mccBegin(0), m_loaded(false) {}
+
+	bool load(const JValue& root);
+	bool isValid() const { return m_loaded; }
+
+	Section zones() const { return section(0, m_sysBegin); }
+	Section sysZones() const { return section(m_sysBegin, m_mccBegin); }
+	Section mccZones() const { return section(m_mccBegin, m_rows.size()); }
+
+	bool isSysZone(const TimeZoneInfo* zone) const
+	{
+		return sysZones().first <= zone && zone < sysZones().last;
+	}
+
+	// timeZone and syszones entries with the given ZoneID, in file order
+	std::vector<const TimeZoneInfo*> zonesNamed(const std::string& name) const;
+	bool hasZoneNamed(const std::string& name) const;
+
+	// timeZone entries with the given offset, in file order
+	std::vector<const TimeZoneInfo*> zonesWithOffset(int offset) const;
+
+	const TimeZoneInfo* preferredZone(int offset, bool dst) const;
+	const TimeZoneInfo* mccZone(int mcc) const;
+	const TimeZoneInfo* defaultZone() const;
+
+	size_t poolSize() const { return m_strings.size(); }
+
+	// bytes held by the pool, the rows and the indexes
+	size_t memoryUsed() const
+	{
+		return m_strings.capacity()
+			+ m_rows.capacity() * sizeof(TimeZoneInfo)
+			+ (m_byName.capacity() + m_byOffset.capacity()) * sizeof(uint32_t)
+			+ m_preferred.capacity() * sizeof(PreferredZone)
+			+ m_byMcc.capacity() * sizeof(m_byMcc[0]);
+	}
+
+	JValue toJson() const;
+
+private:
+	typedef std::vector<uint32_t> Index;
+	typedef std::unordered_map<std::string, uint32_t> StringIds;
+
+	struct PreferredZone
+	{
+		int offset;
+		const TimeZoneInfo* dst;
+		const TimeZoneInfo* noDst;
+	};
+
+	// pool offsets of a row's strings until the pool stops growing
+	struct RowStrings
+	{
+		uint32_t name, city, description, country, countryCode;
+	};
+
+	struct ByName
+	{
+		const std::vector<TimeZoneInfo>& rows;
+		bool operator()(uint32_t row, const std::string& name) const { return strcmp(rows[row].name, name.c_str()) < 0; }
+		bool operator()(const std::string& name, uint32_t row) const { return strcmp(name.c_str(), rows[row].name) < 0; }
+	};
+
+	struct ByOffset
+	{
+		const std::vector<TimeZoneInfo>& rows;
+		bool operator()(uint32_t row, int offset) const { return rows[row].offsetToUTC < offset; }
+		bool operator()(int offset, uint32_t row) const { return offset < rows[row].offsetToUTC; }
+	};
+
+	Section section(size_t first, size_t last) const
+	{
+		Section s = { m_rows.data() + first, m_rows.data() + last };
+		return s;
+	}
+
+	uint32_t intern(const JValue& label, StringIds& ids);
+	void addRow(const JValue& entry, StringIds& ids, std::vector<RowStrings>& strings);
+	void buildIndexes();
+
+	std::string m_strings;
+	std::vector<TimeZoneInfo> m_rows;
+	size_t m_sysBegin;
+	size_t m_mccBegin;
+
+	Index m_byName;
+	Index m_byOffset;
+	std::vector<PreferredZone> m_preferred;
+	std::vector<std::pair<int, const TimeZoneInfo*> > m_byMcc;
+
+	bool m_loaded;
+};
+
+static TimeZoneTable s_zoneTable;
+
 NitzParameters::NitzParameters()
 : _offset(-1000)
 	, _dst(0)
@@ -516,6 +612,11 @@ TimePrefsHandler::TimePrefsHandler(LSHandle* serviceHandle)
 	, m_gsource_tzTrans(nullptr)
 	, m_gsource_tzTrans_id(0)
 	, m_nextTzTrans(-1)
+	, m_timeChangeSettleId(0)
+	, m_timeChangeFirstPending(0)
+	, m_timeChangePostBroadcast(false)
+	, m_launchDispatchId(0)
+	, m_lastLaunchDispatch(0)
 	, m_micomAvailable(true)
 	, m_altFactorySrcPriority(0)
 	, m_altFactorySrcLastUpdate(0)
@@ -525,6 +626,7 @@ TimePrefsHandler::TimePrefsHandler(LSHandle* serviceHandle)
 	if (!s_inst)
 		s_inst=this;
 
+	g_mutex_init(&m_timeStateMutex);
 	init();
 }
 
@@ -532,6 +634,11 @@ TimePrefsHandler::~TimePrefsHandler()
 {
 	NetworkConnectionListener::instance()->shutdown();
 
+	if (m_timeChangeSettleId)
+		g_source_remove(m_timeChangeSettleId);
+	if (m_launchDispatchId)
+		g_source_remove(m_launchDispatchId);
+
 	delete m_p_lastNitzParameter;
         m_p_lastNitzParameter = nullptr;
 	delete m_pManualTimeZone;
@@ -539,20 +646,7 @@ TimePrefsHandler::~TimePrefsHandler()
 	delete m_pDefaultTimeZone;
         m_pDefaultTimeZone = nullptr;
 
-	TimeZoneInfoList::iterator it = m_zoneList.begin();
-	for (; it != m_zoneList.end();++it)
-	{
-		delete *it;
-                *it = nullptr;
-	}
-        m_zoneList.clear();
-	it = m_syszoneList.begin();
-	for (; it != m_syszoneList.end();++it)
-	{
-		delete *it;
-                *it = nullptr;
-	}
-        m_syszoneList.clear();
+	g_mutex_clear(&m_timeStateMutex);
 }
 
 std::list<std::string> TimePrefsHandler::keys() const
@@ -581,33 +675,27 @@ void TimePrefsHandler::updateTimeZoneInfo()
 {
 	if((m_p_lastNitzParameter != NULL) && (true == m_p_lastNitzParameter->_tzvalid)) {
 		const TimeZoneInfo* nitzTz = timeZone_ZoneFromOffset(m_p_lastNitzParameter->_offset, m_p_lastNitzParameter->_dst, m_p_lastNitzParameter->_mcc);
-		bool valid_tz = isValidTimeZoneName(nitzTz->name);
+		bool valid_tz = nitzTz && isValidTimeZoneName(nitzTz->name);
 		if(valid_tz)
 		{
-			JValue root = JDomParser::fromString(nitzTz->jsonStringValue);
-			TimeZoneInfo tzInfo;
-			if (TZJsonHelper::extract(root, &tzInfo)) {
-                                if(Settings::instance()->useLocalizedTZ) {
-				        std::unique_ptr<ResBundle> resBundle = std::unique_ptr<ResBundle>(new ResBundle(s_localeStr, s_file, s_resources_path));
-				        tzInfo.city = resBundle->getLocString(tzInfo.city);
-				        tzInfo.description = resBundle->getLocString(tzInfo.description);
-				        tzInfo.country = resBundle->getLocString(tzInfo.country);
-                                }
-
-				JValue tzInfoJValue = pbnjson::Object();
-				tzInfoJValue.put("timeZone", TZJsonHelper::pack(&tzInfo));
-
-				std::string reply = tzInfoJValue.stringify();
-
-				LSError error;
-				LSErrorInit(&error);
-				if (!(LSCall(getServiceHandle(),"luna://com.webos.service.systemservice/setPreferences", reply.c_str(), nullptr, this, nullptr, &error)))
-				{
-					LSErrorFree(&error);
-				}
-				else {
-					PmLogDebug(sysServiceLogContext(), "set Network TimeZone successfull");
-				}
+			std::unique_ptr<ResBundle> resBundle;
+			if(Settings::instance()->useLocalizedTZ) {
+				resBundle.reset(new ResBundle(s_localeStr, s_file, s_resources_path));
+			}
+
+			JValue tzInfoJValue = pbnjson::Object();
+			tzInfoJValue.put("timeZone", TZJsonHelper::pack(*nitzTz, resBundle.get()));
+
+			std::string reply = tzInfoJValue.stringify();
+
+			LSError error;
+			LSErrorInit(&error);
+			if (!(LSCall(getServiceHandle(),"luna://com.webos.service.systemservice/setPreferences", reply.c_str(), nullptr, this, nullptr, &error)))
+			{
+				LSErrorFree(&error);
+			}
+			else {
+				PmLogDebug(sysServiceLogContext(), "set Network TimeZone successfull");
 			}
 		}
 	}
@@ -635,7 +723,7 @@ void TimePrefsHandler::switchTimeZone(bool b_recover)
 	{
 		PrefsDb::instance()->setPref("lastTimeZone",
 				m_cpCurrentTimeZone->name);
-		qDebug("set TimeZone to [%s]",m_cpCurrentTimeZone->name.c_str());
+		qDebug("set TimeZone to [%s]",m_cpCurrentTimeZone->name);
 
 		TimeZoneService::instance()->createTimeZoneFromEasData(getServiceHandle());
 
@@ -656,6 +744,20 @@ void TimePrefsHandler::valueChanged(const std::string& key, const JValue &value)
 	bool bval;
 	std::string strval;
 
+	if (key == "timeChangeLaunch") {
+		// reached from refreshAllKeys() after a db restore and from
+		// cbSetPreferences (which validateFor_timeChangeLaunch currently
+		// refuses); cbSetTimeChangeLaunch updates the list itself
+		setTimeChangeLaunchList(value);
+		return;
+	}
+
+	if (key == "nitzValidity") {
+		// restored db
+		publishTimeState();
+		return;
+	}
+
 	if (key == "useNetworkTime") {
 		if (value.isBoolean()) {
 			bval = value.asBool();
@@ -726,7 +828,7 @@ void TimePrefsHandler::valueChanged(const std::string& key, const JValue &value)
 			}
 
 			if (m_cpCurrentTimeZone) {
-				qDebug("%s: successfully mapped to zone [%s]", __func__, m_cpCurrentTimeZone->name.c_str());
+				qDebug("%s: successfully mapped to zone [%s]", __func__, m_cpCurrentTimeZone->name);
 				setTimeZone(m_cpCurrentTimeZone);
 			}
 			else {
@@ -752,11 +854,8 @@ void TimePrefsHandler::valueChanged(const std::string& key, const JValue &value)
 			transitionNITZValidState((this->getLastNITZValidity() == TimePrefsHandler::NITZ_Valid),true);
 
 			// TODO: consider moving to systemSetTimeZone
-			postSystemTimeChange();
-			postBroadcastEffectiveTimeChange();
-			//launch any apps that wanted to be launched when the time/zone changed
-			launchAppsOnTimeChange();
-			tzTransTimer();
+			//post the change and launch any apps that wanted to be launched when the time/zone changed
+			scheduleTimeChangeEffects(true);
 		}
 		else {
 			qWarning("attempted change of timeZone but no value provided");
@@ -787,6 +886,16 @@ void TimePrefsHandler::valueChanged(const std::string& key, const JValue &value)
 			(this->isNITZTimeEnabled() ? "true" : "false"),(this->isNITZTZEnabled() ? "true" : "false"));
 }
 
+size_t TimePrefsHandler::memoryUsed() const
+{
+	size_t used = s_zoneTable.memoryUsed();
+
+	for (const auto& launch : m_timeChangeLaunches)
+		used += sizeof(launch) + launch.first.capacity() + launch.second.capacity();
+
+	return used;
+}
+
 JValue TimePrefsHandler::valuesForKey(const std::string& key)
 {
 	JValue result;
@@ -837,124 +946,67 @@ bool TimePrefsHandler::cbLocaleHandler(LSHandle* sh, LSMessage* message, void* d
 
 JValue TimePrefsHandler::timeZoneListAsJson()
 {
-	return TimePrefsHandler::s_timeZonesJson; //"copy" it!
+	return s_zoneTable.toJson();
 }
 
-JValue TimePrefsHandler::timeZoneListAsJson(const std::string& countryCode, const std::string& locale)
+JValue TimePrefsHandler::timeZoneListAsJson(const std::string& countryCode, const std::string& locale,
+                                            const PrefsValuesWindow& window)
 {
-	do {
-		JValue timeZones = TimePrefsHandler::s_timeZonesJson["timeZone"];
-		if (!timeZones.isArray()) {
-			qWarning() << "Failed to parse timeZone details";
-			break;
-		}
+	if (!s_zoneTable.isValid()) {
+		qWarning() << "Failed to parse timeZone details";
+		return JValue();
+	}
 
-		JValue sysZones = TimePrefsHandler::s_timeZonesJson["syszones"];
-		if (!sysZones.isArray()) {
-			qWarning() << "Failed to parse syszones details";
-			break;
-		}
+	std::unique_ptr<ResBundle> resBundle;
+	if (Settings::instance()->useLocalizedTZ)
+	{
+		resBundle.reset(new ResBundle(locale.empty() ? s_localeStr : locale, s_file, s_resources_path));
+	}
 
-		JValue mmcInfoObj = TimePrefsHandler::s_timeZonesJson["mmcInfo"];
-		if (!mmcInfoObj.isObject()) {
-			qWarning() << "Failed to parse mmcInfo details";
-			break;
-		}
+	JValue timeZoneArray = pbnjson::Array();
+	size_t index = 0;
+	for (const TimeZoneInfo& zone: s_zoneTable.zones()) {
 
-		std::unique_ptr<ResBundle> resBundle(nullptr);
-		if (!locale.empty())
-		{
-			resBundle.reset(new ResBundle(locale, s_file, s_resources_path));
-		}
-		else
-		{
-			resBundle.reset(new ResBundle(s_localeStr, s_file, s_resources_path));
-		}
+		if (!countryCode.empty() && countryCode != zone.countryCode)
+			continue;
 
-		std::string locCountryCode("");
-		JValue label;
-		JValue timeZoneArray = pbnjson::Array();
-		TimeZoneInfo tzInfo;
-		for (const JValue key: timeZones.items()) {
-
-			label = key["CountryCode"];
-			if (!label.isString())	continue;
-			locCountryCode = label.asString();
-
-			if (countryCode.empty() || (countryCode == locCountryCode)) {
-				if (TZJsonHelper::extract(key, &tzInfo)) {
-                                                if(Settings::instance()->useLocalizedTZ) {
-						        tzInfo.description = resBundle->getLocString(tzInfo.description);
-						        tzInfo.city = resBundle->getLocString(tzInfo.city);
-						        tzInfo.country = resBundle->getLocString(tzInfo.country);
-                                                }
-						timeZoneArray.append(TZJsonHelper::pack(&tzInfo));
-				}
-			}
+		// only entries inside the window are localized and packed,
+		// the rest are just counted for "total"
+		if (window.contains(index++)) {
+			timeZoneArray.append(window.project(TZJsonHelper::pack(zone, resBundle.get())));
 		}
+	}
 
-		JValue timeZonesListObj = pbnjson::Object();
-		timeZonesListObj.put("timeZone", timeZoneArray);
-		if (countryCode.empty()) {
-			timeZonesListObj.put("syszones", sysZones);
-			timeZonesListObj.put("mmcInfo", mmcInfoObj);
-		}
+	JValue timeZonesListObj = pbnjson::Object();
+	timeZonesListObj.put("timeZone", timeZoneArray);
+	// system zones and mcc info aren't paged, send them with the first window only
+	if (countryCode.empty() && window.offset == 0) {
+		JValue sysZones = pbnjson::Array();
+		for (const TimeZoneInfo& zone: s_zoneTable.sysZones())
+			sysZones.append(TZJsonHelper::entry(zone));
+		timeZonesListObj.put("syszones", sysZones);
 
-		if (!timeZonesListObj.isNull()) {
-			return timeZonesListObj;
-		}
-	} while(false);
+		JValue mccInfo = pbnjson::Array();
+		for (const TimeZoneInfo& zone: s_zoneTable.mccZones())
+			mccInfo.append(TZJsonHelper::entry(zone));
+		timeZonesListObj.put("mccInfo", mccInfo);
+	}
+	if (!window.isFull()) {
+		timeZonesListObj.put("total", static_cast<int64_t>(index));
+		timeZonesListObj.put("offset", static_cast<int64_t>(window.offset));
+	}
 
-	return TimePrefsHandler::s_timeZonesJson;
+	return timeZonesListObj;
 }
 
 bool TimePrefsHandler::isValidTimeZoneName(const std::string& tzName)
 {
-	if (!TimePrefsHandler::s_timeZonesJson.isValid())
+	if (!s_zoneTable.isValid())
 		return false;
 
 	if(!tzName.compare(MANUAL_TZ_NAME)) return true;
 
-	JValue label = TimePrefsHandler::s_timeZonesJson["timeZone"];
-	if (!label.isArray()) {
-		return false;
-	}
-
-	for (const JValue& timezone: label.items()) {
-
-		if (!timezone.isObject()) continue;
-
-		//parse out the TZ name
-		JValue zone_id = timezone["ZoneID"];
-		if (!zone_id.isString()) {
-			continue;
-		}
-
-		if (tzName == zone_id.asString())
-			return true;
-	}
-
-	label = TimePrefsHandler::s_timeZonesJson["syszones"];
-	if (!label.isArray()) {
-		return false;
-	}
-
-	for (const JValue timezone: label.items()) {
-
-		if (!timezone.isObject()) continue;
-
-		//parse out the TZ name
-		JValue zone_id = timezone["ZoneID"];
-		if (!zone_id.isString()) {
-			continue;
-		}
-
-		if (tzName == zone_id.asString())
-			return true;
-	}
-
-	return false;
-
+	return s_zoneTable.hasZoneNamed(tzName);
 }
 
 static JValue valuesFor_useNetworkTime(TimePrefsHandler *)
@@ -1007,50 +1059,22 @@ static bool validateFor_timeZone(TimePrefsHandler * pTimePrefsHandler, const JVa
 }
 
 /*
- * Scans the json timezone array (built in init()) for "default" on an entry and returns that json object as
+ * Looks up the zone marked "default" in the timezone table and returns it in the timezone file layout as
  * a string
  */
 std::string TimePrefsHandler::getDefaultTZFromJson(TimeZoneInfo * r_pZoneInfo)
 {
-	if (!s_timeZonesJson.isValid())
+	const TimeZoneInfo * zone = s_zoneTable.defaultZone();
+	if (!zone || !*zone->name)
 	{
-		if (r_pZoneInfo)
-			*r_pZoneInfo = s_failsafeDefaultZone;
-		return s_failsafeDefaultZone.jsonStringValue;
-	}
-
-	JValue label = s_timeZonesJson["timeZone"];
-	if (!label.isArray()) {
-		qWarning() << "error on json object: it doesn't contain a timezones array";
-		if (r_pZoneInfo)
-			*r_pZoneInfo = s_failsafeDefaultZone;
-		return s_failsafeDefaultZone.jsonStringValue;
-	}
-
-	for (const JValue timezone: label.items()) {
-
-		//look for "default" boolean
-		if (!timezone["default"].isValid())
-			continue;
-
-		//found it - I actually don't care if it's true or false...its mere existence is enough to
-		//consider this a default.
-
-		if (r_pZoneInfo)
-		{
-			if (TimePrefsHandler::jsonUtil_ZoneFromJson(timezone, *r_pZoneInfo) == false)
-			{
-				*r_pZoneInfo = s_failsafeDefaultZone;
-				return (s_failsafeDefaultZone.jsonStringValue);
-			}
-			else
-				return (r_pZoneInfo->jsonStringValue);
-		}
+		if (s_zoneTable.isValid())
+			qWarning() << "timezone table doesn't contain a default zone";
+		zone = &s_failsafeDefaultZone;
 	}
 
 	if (r_pZoneInfo)
-		*r_pZoneInfo = s_failsafeDefaultZone;
-	return s_failsafeDefaultZone.jsonStringValue;
+		*r_pZoneInfo = *zone;
+	return TZJsonHelper::entryString(*zone);
 }
 
 //static
@@ -1090,6 +1114,8 @@ std::string TimePrefsHandler::transitionNITZValidState(bool nitzValid,bool userS
 
 	PrefsDb::instance()->setPref("nitzValidity",nextState);
 	qDebug("transitioning [%s] -> [%s]",currentState.c_str(),nextState.c_str());
+	if (s_inst)
+		s_inst->publishTimeState();
 
 	return currentState;
 }
@@ -1129,9 +1155,15 @@ void TimePrefsHandler::init()
 	LSError lsError;
 	LSErrorInit(&lsError);
 
+	//volatile time state; kept in memory and written behind so that the
+	//clock update paths don't wait for the db
+	PrefsDb::instance()->setWriteBehind("lastSystemTimeSource");
+	PrefsDb::instance()->setWriteBehind("nitzValidity");
+
 	//(these will also set defaults in the db if there was nothing stored yet (e.g. first use))
 	readCurrentNITZSettings();
 	readCurrentTimeSettings();
+	setTimeChangeLaunchList(JDomParser::fromString(PrefsDb::instance()->getPref("timeChangeLaunch")));
 
    //init the keylist
 	for (size_t i=0;i<sizeof(timePrefKeys)/sizeof(TimePrefKey);i++) {
@@ -1153,20 +1185,21 @@ void TimePrefsHandler::init()
 		return;
 	}
 
-	s_timeZonesJson = JDomParser::fromFile(s_tzFile);
-	if (s_timeZonesJson.isValid())
+	// read-only queries, answered from the time thread when it runs; the
+	// other /time methods change what they report and go first
+	TimeThread::instance()->serve("/time", "getSystemTime");
+	TimeThread::instance()->serve("/time", "getSystemTimezoneFile");
+	TimeThread::instance()->serve("/time", "getSystemUptime");
+	TimeThread::instance()->orderAfter("/time");
+
+	// the parsed file is only needed to fill the zone table, the DOM goes
+	// away at the end of this block
 	{
-		JValue ja = s_timeZonesJson["timeZone"];
-		if (ja.isArray()) {
-			qDebug("%zd timezones loaded from [%s]", ja.arraySize(), s_tzFile);
-		}
-		JValue jsa = s_timeZonesJson["syszones"];
-		if (jsa.isArray()) {
-			qDebug("%zd sys timezones loaded from [%s]", jsa.arraySize(), s_tzFile);
-		}
-	}
-	else {
-		qWarning("Can't parse timezones from the file: %s", s_tzFile);
+		JValue timeZonesJson = JDomParser::fromFile(s_tzFile);
+		if (timeZonesJson.isValid())
+			scanTimeZoneJson(timeZonesJson);
+		else
+			qWarning("Can't parse timezones from the file: %s", s_tzFile);
 	}
 
 	//load the default
@@ -1194,7 +1227,7 @@ void TimePrefsHandler::init()
 	std::string currentlySetTimeZoneJsonString= PrefsDb::instance()->getPref("timeZone");
 	if (currentlySetTimeZoneJsonString == "") {
                 if(nullptr != m_pDefaultTimeZone){
-                        currentlySetTimeZoneJsonString = m_pDefaultTimeZone->jsonStringValue;
+                        currentlySetTimeZoneJsonString = TZJsonHelper::entryString(*m_pDefaultTimeZone);
                 }
 		//set a default
 		PrefsDb::instance()->setPref("timeZone",currentlySetTimeZoneJsonString);
@@ -1205,12 +1238,10 @@ void TimePrefsHandler::init()
 	std::string currentlySetTimeZoneName = tzNameFromJsonString(currentlySetTimeZoneJsonString);
 	qDebug("timezone default set to [%s]",currentlySetTimeZoneName.c_str());
 
-	scanTimeZoneJson();
-
 	m_cpCurrentTimeZone = timeZone_ZoneFromName(currentlySetTimeZoneName);
 
 	if (m_cpCurrentTimeZone) {
-		qDebug("%s: successfully mapped to zone [%s]", __func__, m_cpCurrentTimeZone->name.c_str());
+		qDebug("%s: successfully mapped to zone [%s]", __func__, m_cpCurrentTimeZone->name);
 		setTimeZone(m_cpCurrentTimeZone);
 	}
 	else {
@@ -1388,8 +1419,8 @@ std::string TimePrefsHandler::tzNameFromJsonString(const std::string& TZJson)
 }
 
 /**
- * Scans s_timeZonesJson for ZoneID == tzName. Returns that json object as a string, or "" if none found
- *
+ * Looks up the zone table for ZoneID == tzName. Returns that zone in the timezone file layout as a string,
+ * or "" if none found
  *
  */
 
@@ -1398,40 +1429,16 @@ std::string TimePrefsHandler::getQualifiedTZIdFromName(const std::string& tzName
 	if (tzName.length() == 0)
 		return std::string();
 
-	JValue label = s_timeZonesJson["timeZone"];
-	if (!label.isArray()) {
-		qWarning() << "error on json object: it doesn't contain a timezones array";
+	if (!s_zoneTable.isValid()) {
+		qWarning() << "timezone table isn't loaded";
 		return std::string();
 	}
 
-	for (const JValue timezone: label.items()) {
-
-		JValue zone_id = timezone["ZoneID"];
-		if (!zone_id.isString())
-			continue;
-
-		if (tzName == zone_id.asString())
-			return timezone.asString();
-	}
-
-	//try the sys zones
-	label = s_timeZonesJson["syszones"];
-	if (!label.isArray()) {
-		qWarning() << "error on json object: it doesn't contain a syszones array";
+	std::vector<const TimeZoneInfo*> zones = s_zoneTable.zonesNamed(tzName);
+	if (zones.empty())
 		return std::string();
-	}
-
-	for (const JValue timezone: label.items()) {
 
-		JValue zone_id = timezone["ZoneID"];
-		if (!zone_id.isString())
-			continue;
-
-		if (tzName == zone_id.asString())
-			return timezone.asString();
-	}
-
-	return std::string();
+	return TZJsonHelper::entryString(*zones.front());
 }
 
 std::string TimePrefsHandler::getQualifiedTZIdFromJson(const std::string& jsonTz)
@@ -1458,239 +1465,309 @@ std::string TimePrefsHandler::getQualifiedTZIdFromJson(const std::string& jsonTz
 	return getQualifiedTZIdFromName(tzName);
 }
 
-//a replacement for the scanTimeZoneFile so that I only need to deal with 1 file...see init() for where the json obj is created
-void TimePrefsHandler::scanTimeZoneJson()
+uint32_t TimeZoneTable::intern(const JValue& label, StringIds& ids)
 {
-	std::map<int,PreferredZones> tmpPrefZoneMap;
-	std::map<int,PreferredZones>::iterator tmpPrefZoneMapIter;
-	std::map<std::string,std::set<int> > tmpCountryZoneCounterMap;
+	// offset 0 of the pool is the empty string
+	if (!label.isString())
+		return 0;
 
-	if (!s_timeZonesJson.isValid()) {
-		qWarning () << "no json loaded";
-		return;
-	}
+	std::string str = label.asString();
+	if (str.empty())
+		return 0;
+
+	StringIds::const_iterator it = ids.find(str);
+	if (it != ids.end())
+		return it->second;
+
+	uint32_t id = m_strings.size();
+	m_strings.append(str.c_str(), str.size() + 1);
+	ids.insert(std::make_pair(str, id));
+	return id;
+}
+
+void TimeZoneTable::addRow(const JValue& entry, StringIds& ids, std::vector<RowStrings>& strings)
+{
+	RowStrings refs;
+	refs.name = intern(entry["ZoneID"], ids);
+	refs.city = intern(entry["City"], ids);
+	refs.description = intern(entry["Description"], ids);
+	refs.country = intern(entry["Country"], ids);
+	refs.countryCode = intern(entry["CountryCode"], ids);
+	strings.push_back(refs);
 
-	JValue timezones = TimePrefsHandler::s_timeZonesJson["timeZone"];
+	TimeZoneInfo tz;
+
+	JValue label = entry["offsetFromUTC"];
+	if (label.isNumber())
+		tz.offsetToUTC = label.asNumber<int>();
+
+	// the file spells it "supportsDST", older files used "supportDST"
+	label = entry["supportsDST"];
+	if (!label.isNumber())
+		label = entry["supportDST"];
+	if (label.isNumber())
+		tz.dstSupported = label.asNumber<int>();
+
+	label = entry["preferred"];
+	if (label.isBoolean())
+		tz.preferred = label.asBool();
+
+	//its mere existence is enough to consider this a default
+	tz.isDefault = entry["default"].isValid();
+
+	label = entry["mcc"];
+	if (label.isNumber())
+		tz.mcc = label.asNumber<int>();
+
+	m_rows.push_back(tz);
+}
+
+bool TimeZoneTable::load(const JValue& root)
+{
+	JValue timezones = root["timeZone"];
 	if (!timezones.isArray()) {
 		qWarning() << "invalid json; missing timeZone array";
-		return;
+		return false;
+	}
+
+	JValue syszones = root["syszones"];
+	if (!syszones.isArray()) {
+		qWarning() << "invalid json; missing syszones array";
+		syszones = pbnjson::Array();
+	}
+
+	JValue mccInfo = root["mccInfo"];
+	if (!mccInfo.isArray()) {
+		qWarning() << "invalid json; missing mccInfo array";
+		mccInfo = pbnjson::Array();
+	}
+
+	StringIds ids;
+	std::vector<RowStrings> strings;
+	m_strings.assign(1, '\0');
+	m_rows.clear();
+	m_rows.reserve(timezones.arraySize() + syszones.arraySize() + mccInfo.arraySize());
+	strings.reserve(m_rows.capacity());
+
+	for (const JValue& timezone: timezones.items()) {
+		if (timezone.isObject())
+			addRow(timezone, ids, strings);
+	}
+	m_sysBegin = m_rows.size();
+
+	//the "syszones" are the default, generic, timezones that get set in case NITZ supplies "dstinvalid"
+	for (const JValue& timezone: syszones.items()) {
+		if (timezone.isObject() && timezone["ZoneID"].isString() && timezone["offsetFromUTC"].isNumber())
+			addRow(timezone, ids, strings);
 	}
+	m_mccBegin = m_rows.size();
 
-	TimeZoneInfo tzInfo;
-	// cannot work with const JValue because of stringify
-	for (JValue timezone: timezones.items()) {
-		TZJsonHelper::extract(timezone, &tzInfo);
+	//time zone info for known MCCs...used to correct problems in many networks' NITZ data
+	for (const JValue& timezone: mccInfo.items()) {
+		if (timezone.isObject() && timezone["offsetFromUTC"].isNumber() &&
+			timezone["supportsDST"].isNumber() && timezone["mcc"].isNumber())
+			addRow(timezone, ids, strings);
+	}
 
-		//update "counter map"
-		tmpCountryZoneCounterMap[tzInfo.countryCode].insert(tzInfo.offsetToUTC);
+	// the pool doesn't grow anymore, point the rows into it
+	m_strings.shrink_to_fit();
+	m_rows.shrink_to_fit();
+	const char* pool = m_strings.c_str();
+	for (size_t i = 0; i < m_rows.size(); ++i) {
+		m_rows[i].name = pool + strings[i].name;
+		m_rows[i].city = pool + strings[i].city;
+		m_rows[i].description = pool + strings[i].description;
+		m_rows[i].country = pool + strings[i].country;
+		m_rows[i].countryCode = pool + strings[i].countryCode;
+	}
 
-		TimeZoneInfo* tz = new TimeZoneInfo;
-		tz->offsetToUTC = tzInfo.offsetToUTC;
-		tz->preferred = tzInfo.preferred;
-		tz->dstSupported = tzInfo.dstSupported;
-		tz->name = tzInfo.name;
-		tz->city = tzInfo.city;
-		tz->countryCode = tzInfo.countryCode;
-		tz->jsonStringValue = timezone.stringify();
+	buildIndexes();
 
-		tmpPrefZoneMapIter = tmpPrefZoneMap.find(tz->offsetToUTC);
-		if (tmpPrefZoneMapIter == tmpPrefZoneMap.end()) {
+	m_loaded = true;
+	return true;
+}
+
+void TimeZoneTable::buildIndexes()
+{
+	std::map<const char*, std::set<int> > countryOffsets;	//keyed by pool pointer, strings are interned
+	std::map<int, PreferredZones> prefZoneMap;
+	std::map<int, const TimeZoneInfo*> mccMap;
+
+	m_byOffset.clear();
+	for (size_t i = 0; i < m_sysBegin; ++i) {
+		const TimeZoneInfo* tz = &m_rows[i];
+
+		countryOffsets[tz->countryCode].insert(tz->offsetToUTC);
+		m_byOffset.push_back(i);
+
+		std::map<int, PreferredZones>::iterator it = prefZoneMap.find(tz->offsetToUTC);
+		if (it == prefZoneMap.end()) {
 			PreferredZones pz;
-			pz.offset = tzInfo.offsetToUTC;
-			if ((tzInfo.preferred) && (tzInfo.dstSupported))
+			pz.offset = tz->offsetToUTC;
+			if ((tz->preferred) && (tz->dstSupported))
 				pz.dstPref = tz;
-			else if ((tzInfo.preferred) && (!tzInfo.dstSupported))
+			else if ((tz->preferred) && (!tz->dstSupported))
 				pz.nonDstPref = tz;
-			else if (tzInfo.dstSupported)
+			else if (tz->dstSupported)
 				pz.dstFallback = tz;
 			else
 				pz.nonDstFallback = tz;
 
-			tmpPrefZoneMap[tzInfo.offsetToUTC] = pz;
+			prefZoneMap[tz->offsetToUTC] = pz;
 		}
 		else {
-			if ((tzInfo.preferred) && (tzInfo.dstSupported))
-				(*tmpPrefZoneMapIter).second.dstPref = tz;
-			else if ((tzInfo.preferred) && (!tzInfo.dstSupported))
-				(*tmpPrefZoneMapIter).second.nonDstPref = tz;
-			else if ((tzInfo.dstSupported) && (((*tmpPrefZoneMapIter).second.dstFallback)==NULL))
-				(*tmpPrefZoneMapIter).second.dstFallback = tz;
-			else if ( (!tzInfo.dstSupported) && ((*tmpPrefZoneMapIter).second.nonDstFallback)==NULL)
-				(*tmpPrefZoneMapIter).second.nonDstFallback = tz;
+			if ((tz->preferred) && (tz->dstSupported))
+				it->second.dstPref = tz;
+			else if ((tz->preferred) && (!tz->dstSupported))
+				it->second.nonDstPref = tz;
+			else if ((tz->dstSupported) && (it->second.dstFallback == NULL))
+				it->second.dstFallback = tz;
+			else if ((!tz->dstSupported) && (it->second.nonDstFallback == NULL))
+				it->second.nonDstFallback = tz;
 		}
-
-		m_zoneList.push_back(tz);
-
-		m_offsetZoneMultiMap.insert(TimeZonePair(tzInfo.offsetToUTC, tz));
-
 	}
 
-	//go through the whole zone list and assign offset-per-country counter values
-	for (TimeZoneInfoList::iterator it = m_zoneList.begin(); it != m_zoneList.end();++it)
-	{
-		(*it)->howManyZonesForCountry = tmpCountryZoneCounterMap[(*it)->countryCode].size();
-	}
+	//assign offset-per-country counter values
+	for (size_t i = 0; i < m_sysBegin; ++i)
+		m_rows[i].howManyZonesForCountry = countryOffsets[m_rows[i].countryCode].size();
 
-	//go through the temp map and assign values to the final dst and non-dst maps
-	for (tmpPrefZoneMapIter = tmpPrefZoneMap.begin();tmpPrefZoneMapIter != tmpPrefZoneMap.end();++tmpPrefZoneMapIter) {
-		int off_key = (*tmpPrefZoneMapIter).second.offset;
-
-		//if there is only a dstPref, then use that for both dst and non-dst
-		if ( ((*tmpPrefZoneMapIter).second.dstPref) && ((*tmpPrefZoneMapIter).second.nonDstPref == NULL))
-		{
-			m_preferredTimeZoneMapDST[off_key] = (*tmpPrefZoneMapIter).second.dstPref;
-			m_preferredTimeZoneMapNoDST[off_key] = (*tmpPrefZoneMapIter).second.dstPref;
-			continue;
-		}
+	m_preferred.clear();
+	for (std::map<int, PreferredZones>::const_iterator it = prefZoneMap.begin(); it != prefZoneMap.end(); ++it) {
+		const PreferredZones& pz = it->second;
+		PreferredZone zone;
+		zone.offset = pz.offset;
 
-		if ((*tmpPrefZoneMapIter).second.dstPref)
-			m_preferredTimeZoneMapDST[off_key] = (*tmpPrefZoneMapIter).second.dstPref;
-		else if ((*tmpPrefZoneMapIter).second.dstFallback)
-			m_preferredTimeZoneMapDST[off_key] = (*tmpPrefZoneMapIter).second.dstFallback;
-		else if ((*tmpPrefZoneMapIter).second.nonDstPref)
-			m_preferredTimeZoneMapDST[off_key] = (*tmpPrefZoneMapIter).second.nonDstPref;
+		if (pz.dstPref)
+			zone.dst = pz.dstPref;
+		else if (pz.dstFallback)
+			zone.dst = pz.dstFallback;
+		else if (pz.nonDstPref)
+			zone.dst = pz.nonDstPref;
 		else
-			m_preferredTimeZoneMapDST[off_key] = (*tmpPrefZoneMapIter).second.nonDstFallback;
-
-		if ((*tmpPrefZoneMapIter).second.nonDstPref)
-			m_preferredTimeZoneMapNoDST[off_key] = (*tmpPrefZoneMapIter).second.nonDstPref;
-		else if ((*tmpPrefZoneMapIter).second.nonDstFallback)
-			m_preferredTimeZoneMapNoDST[off_key] = (*tmpPrefZoneMapIter).second.nonDstFallback;
-		else if ((*tmpPrefZoneMapIter).second.dstPref)
-			m_preferredTimeZoneMapNoDST[off_key] = (*tmpPrefZoneMapIter).second.dstPref;
-		else
-			m_preferredTimeZoneMapNoDST[off_key] = (*tmpPrefZoneMapIter).second.dstFallback;
-	}
+			zone.dst = pz.nonDstFallback;
 
-	qDebug("found %zu timezones",m_zoneList.size());
+		//if there is only a dstPref, then use that for both dst and non-dst
+		if (pz.nonDstPref)
+			zone.noDst = pz.nonDstPref;
+		else if (pz.dstPref)
+			zone.noDst = pz.dstPref;
+		else if (pz.nonDstFallback)
+			zone.noDst = pz.nonDstFallback;
+		else
+			zone.noDst = pz.dstFallback;
 
-	for (TimeZoneMapIterator it = m_preferredTimeZoneMapDST.begin();it != m_preferredTimeZoneMapDST.end();it++) {
-	PMLOG_TRACE("DST-MAP: preferred zone found: [%s] , offset = %d , dstSupport = %s",
-				it->second->name.c_str(),it->second->offsetToUTC,(it->second->dstSupported != 0 ? "TRUE" : "FALSE"));
-	}
-	for (TimeZoneMapIterator it = m_preferredTimeZoneMapNoDST.begin();it != m_preferredTimeZoneMapNoDST.end();it++) {
-	PMLOG_TRACE("NON-DST-MAP: preferred zone found: [%s] , offset = %d , dstSupport = %s",
-						it->second->name.c_str(),it->second->offsetToUTC,(it->second->dstSupported != 0 ? "TRUE" : "FALSE"));
+		m_preferred.push_back(zone);
 	}
+	m_preferred.shrink_to_fit();
 
-	//now grab the "syszones"...these are the default, generic, timezones that get set in case NITZ supplies "dstinvalid"
+	std::stable_sort(m_byOffset.begin(), m_byOffset.end(),
+		[this](uint32_t a, uint32_t b) { return m_rows[a].offsetToUTC < m_rows[b].offsetToUTC; });
+	m_byOffset.shrink_to_fit();
 
-	timezones = s_timeZonesJson["syszones"];
-	if (!timezones.isArray()) {
-		qWarning() << "invalid json; missing syszones array";
-		return;
-	}
-
-	for (JValue timezone: timezones.items()) {
+	m_byName.clear();
+	for (size_t i = 0; i < m_mccBegin; ++i)
+		m_byName.push_back(i);
+	std::stable_sort(m_byName.begin(), m_byName.end(),
+		[this](uint32_t a, uint32_t b) { return strcmp(m_rows[a].name, m_rows[b].name) < 0; });
+	m_byName.shrink_to_fit();
 
-		if (!timezone.isObject())
-			continue;
+	//later entries for the same MCC win
+	for (size_t i = m_mccBegin; i < m_rows.size(); ++i)
+		mccMap[m_rows[i].mcc] = &m_rows[i];
+	m_byMcc.assign(mccMap.begin(), mccMap.end());
+}
 
-		JValue label = timezone["ZoneID"];
-		if (!label.isString()) {
-			continue;
-		}
-		std::string name = label.asString();
+std::vector<const TimeZoneInfo*> TimeZoneTable::zonesNamed(const std::string& name) const
+{
+	std::vector<const TimeZoneInfo*> zones;
+	std::pair<Index::const_iterator, Index::const_iterator> range =
+		std::equal_range(m_byName.begin(), m_byName.end(), name, ByName{m_rows});
+	for (Index::const_iterator it = range.first; it != range.second; ++it)
+		zones.push_back(&m_rows[*it]);
+	return zones;
+}
 
-		label = timezone["offsetFromUTC"];
-		if (!label.isNumber()) {
-			continue;
-		}
-		int offset = label.asNumber<int>();
+bool TimeZoneTable::hasZoneNamed(const std::string& name) const
+{
+	return std::binary_search(m_byName.begin(), m_byName.end(), name, ByName{m_rows});
+}
 
-		TimeZoneInfo* tz = new TimeZoneInfo;
-		tz->offsetToUTC = offset;
-		tz->preferred = false;
-		tz->dstSupported = 0;
-		//setTZIName(tz,name.c_str());
-		tz->name = name;
-		tz->jsonStringValue = timezone.stringify();
+std::vector<const TimeZoneInfo*> TimeZoneTable::zonesWithOffset(int offset) const
+{
+	std::vector<const TimeZoneInfo*> zones;
+	std::pair<Index::const_iterator, Index::const_iterator> range =
+		std::equal_range(m_byOffset.begin(), m_byOffset.end(), offset, ByOffset{m_rows});
+	for (Index::const_iterator it = range.first; it != range.second; ++it)
+		zones.push_back(&m_rows[*it]);
+	return zones;
+}
 
-		m_syszoneList.push_back(tz);
-	}
+const TimeZoneInfo* TimeZoneTable::preferredZone(int offset, bool dst) const
+{
+	std::vector<PreferredZone>::const_iterator it = std::lower_bound(m_preferred.begin(), m_preferred.end(), offset,
+		[](const PreferredZone& zone, int off) { return zone.offset < off; });
+	if (it == m_preferred.end() || it->offset != offset)
+		return NULL;
+	return dst ? it->dst : it->noDst;
+}
 
-	//now grab the time zone info for known MCCs...
-	// This is used to correct problems in many networks' NITZ data
+const TimeZoneInfo* TimeZoneTable::mccZone(int mcc) const
+{
+	std::vector<std::pair<int, const TimeZoneInfo*> >::const_iterator it =
+		std::lower_bound(m_byMcc.begin(), m_byMcc.end(), mcc,
+			[](const std::pair<int, const TimeZoneInfo*>& entry, int code) { return entry.first < code; });
+	if (it == m_byMcc.end() || it->first != mcc)
+		return NULL;
+	return it->second;
+}
 
-	timezones = s_timeZonesJson["mccInfo"];
-	if (!timezones.isArray()) {
-		qWarning() << "invalid json; missing mccInfo array";
-		return;
+const TimeZoneInfo* TimeZoneTable::defaultZone() const
+{
+	for (const TimeZoneInfo& zone: zones()) {
+		if (zone.isDefault)
+			return &zone;
 	}
+	return NULL;
+}
 
-	for (JValue timezone: timezones.items()) {
-		if (!timezone.isObject())
-			continue;
+JValue TimeZoneTable::toJson() const
+{
+	if (!m_loaded)
+		return JValue();
 
-		std::string name;
-		JValue label = timezone["ZoneID"];
-		if (label.isString()) {
-			name = label.asString();
-		}
+	JValue timeZoneArray = pbnjson::Array();
+	for (const TimeZoneInfo& zone: zones())
+		timeZoneArray.append(TZJsonHelper::entry(zone));
 
-		std::string countryCode;
-		label = timezone["CountryCode"];
-		if (label.isString()) {
-			countryCode = label.asString();
-		}
+	JValue sysZoneArray = pbnjson::Array();
+	for (const TimeZoneInfo& zone: sysZones())
+		sysZoneArray.append(TZJsonHelper::entry(zone));
 
-		label = timezone["offsetFromUTC"];
-		if (!label.isNumber()) {
-			continue;
-		}
-		int offset = label.asNumber<int>();
+	JValue mccArray = pbnjson::Array();
+	for (const TimeZoneInfo& zone: mccZones())
+		mccArray.append(TZJsonHelper::entry(zone));
 
-		label = timezone["supportsDST"];
-		if (!label.isNumber()) {
-			continue;
-		}
-		int supportsDst = label.asNumber<int>();
-
-		label = timezone["mcc"];
-		if (!label.isNumber()) {
-			continue;
-		}
-		int mcc = label.asNumber<int>();
-
-		TimeZoneInfo* tz = new TimeZoneInfo;
-		tz->offsetToUTC = offset;
-		tz->preferred = false;
-		tz->dstSupported = supportsDst;
-		tz->countryCode = countryCode;
-		if (name.size()) {
-			//setTZIName(tz,name.c_str());
-			tz->name = name;
-			tz->jsonStringValue = timezone.stringify();
-		}
-		else {
-			tz->name = "";
-			tz->jsonStringValue = "";
-		}
-		m_mccZoneInfoMap[mcc] = tz;
+	return JObject {{"timeZone", timeZoneArray}, {"syszones", sysZoneArray}, {"mccInfo", mccArray}};
+}
 
-	}
+//a replacement for the scanTimeZoneFile so that I only need to deal with 1 file...see init() for where the json obj is created
+void TimePrefsHandler::scanTimeZoneJson(const JValue& timeZonesJson)
+{
+	if (!s_zoneTable.load(timeZonesJson))
+		return;
 
+	qDebug("found %zu timezones, %zu sys timezones, %zu mcc entries (%zu bytes of strings) in [%s]",
+		   s_zoneTable.zones().size(), s_zoneTable.sysZones().size(),
+		   s_zoneTable.mccZones().size(), s_zoneTable.poolSize(), s_tzFile);
 }
 
 void TimePrefsHandler::setManualTimeZoneInfo()
 {
         if( nullptr != m_pManualTimeZone )
         {
+                *m_pManualTimeZone = TimeZoneInfo();
                 m_pManualTimeZone->name = MANUAL_TZ_NAME;
-                m_pManualTimeZone->countryCode = "";
-
-                m_pManualTimeZone->jsonStringValue =  "{"
-                        "\"Country\":\"\",\"CountryCode\":\"\","
-                        "\"ZoneID\":\"";
-                m_pManualTimeZone->jsonStringValue += MANUAL_TZ_NAME;
-                m_pManualTimeZone->jsonStringValue += "\",\"City\":\"\","
-                        "\"Description\":\"Manual Time Zone\",\"offsetFromUTC\":\"NA\","
-                        "\"supportsDST\":\"NA\""
-                        "}";
-
-                m_pManualTimeZone->dstSupported = 0;
-                m_pManualTimeZone->offsetToUTC = 0;
-                m_pManualTimeZone->preferred = false;
+                m_pManualTimeZone->description = "Manual Time Zone";
         }
 
 }
@@ -1701,22 +1778,23 @@ void TimePrefsHandler::setTimeZone(const TimeZoneInfo * pZoneInfo)
 	{
 		//failsafe default!
 		pZoneInfo = &s_failsafeDefaultZone;
-		qWarning() << "passed in NULL for the zone. Failsafe activated! setting failsafe-default zone: [" << pZoneInfo->name.c_str() << "]";
+		qWarning() << "passed in NULL for the zone. Failsafe activated! setting failsafe-default zone: [" << pZoneInfo->name << "]";
 	}
 
-	std::string tzFileActual = s_zoneInfoFolder + pZoneInfo->name;
+	std::string tzFileActual = std::string(s_zoneInfoFolder) + pZoneInfo->name;
 	qWarning() << "Checking timezone data from " << tzFileActual.c_str() << "].";
 	if (access(tzFileActual.c_str(), F_OK))
 	{
-		qWarning() << "Missing timezone data for [" << pZoneInfo->name.c_str() << "]."
-			" Failsafe activated! setting failsafe-default zone: [" << s_failsafeDefaultZone.name.c_str() << "]";
+		qWarning() << "Missing timezone data for [" << pZoneInfo->name << "]."
+			" Failsafe activated! setting failsafe-default zone: [" << s_failsafeDefaultZone.name << "]";
 		pZoneInfo = &s_failsafeDefaultZone;
-		tzFileActual = s_zoneInfoFolder + pZoneInfo->name;
+		tzFileActual = std::string(s_zoneInfoFolder) + pZoneInfo->name;
 	}
 
 	m_cpCurrentTimeZone = pZoneInfo;
-	PrefsDb::instance()->setPref("timeZone",pZoneInfo->jsonStringValue);
+	PrefsDb::instance()->setPref("timeZone",TZJsonHelper::entryString(*pZoneInfo));
 	systemSetTimeZone(tzFileActual, *pZoneInfo);
+	publishTimeState();
 }
 
 void TimePrefsHandler::systemSetTimeZone(const std::string &tzFileActual, const TimeZoneInfo &zoneInfo)
@@ -1756,6 +1834,7 @@ bool TimePrefsHandler::systemSetTime(time_t deltaTime, const std::string &source
 			// remember last synchronized with time
 			m_systemTimeSourceTag = source;
 			PrefsDb::instance()->setPref("lastSystemTimeSource", m_systemTimeSourceTag);
+			publishTimeState();
 			// next time "micom" will come we'll use this clock tag instead
 		}
 
@@ -1770,10 +1849,7 @@ bool TimePrefsHandler::systemSetTime(time_t deltaTime, const std::string &source
 			m_micomTimeStamp += deltaTime;
 		}
 
-		postSystemTimeChange();
-		if (isSystemTimeBroadcastEffective()) postBroadcastEffectiveTimeChange();
-		launchAppsOnTimeChange();
-		tzTransTimer();
+		scheduleTimeChangeEffects(isSystemTimeBroadcastEffective());
 	}
 
 	// if we had valid NTP in our system-time we destroy it here
@@ -1811,51 +1887,6 @@ void TimePrefsHandler::updateSystemTime()
 }
 
 
-//static
-bool TimePrefsHandler::jsonUtil_ZoneFromJson(const JValue &json, TimeZoneInfo& r_zoneInfo)
-{
-	if (!json.isValid())
-		return false;
-
-	JValue label = json["ZoneID"];
-	if (!label.isString()) {
-		return false;
-	}
-	std::string name = label.asString();
-
-	label = json["offsetFromUTC"];
-	if (!label.isNumber()) {
-		return false;
-	}
-	int offset = label.asNumber<int>();
-
-	label = json["supportsDST"];
-	if (!label.isNumber()) {
-		return false;
-	}
-	int supportsDst = label.asNumber<int>();
-
-	bool pref = false;
-	label = json["preferred"];
-	if (label.isBoolean()) {
-		pref = label.asBool();
-	}
-
-	std::string countryCode;
-	label = json["countryCode"];
-	if (label.isString())
-		countryCode = label.asString();
-
-	r_zoneInfo.offsetToUTC = offset;
-	r_zoneInfo.preferred = pref;
-	r_zoneInfo.dstSupported = supportsDst;
-	r_zoneInfo.name = name;
-	r_zoneInfo.countryCode = countryCode;
-	r_zoneInfo.jsonStringValue = JValue(json).stringify(); // libpbnjson design flaw
-
-	return true;
-}
-
 void TimePrefsHandler::postSystemTimeChange()
 {
 	if (!m_cpCurrentTimeZone)
@@ -1899,8 +1930,11 @@ void TimePrefsHandler::attachSystemTime(JValue &json)
 		json.put("isDST", true);
 	}
 
-	if (currentTimeZone()) {
-		json.put("timezone", currentTimeZone()->name);
+	// may run on the time thread, everything but the clock comes from the published state
+	SystemTimeState state = systemTimeState();
+
+	if (!state.timeZone.empty()) {
+		json.put("timezone", state.timeZone);
 		//get current time zone abbreviation
 		char tzoneabbr_cstr[16];
 		strftime(tzoneabbr_cstr, 16,"%Z", &localTm);
@@ -1913,16 +1947,36 @@ void TimePrefsHandler::attachSystemTime(JValue &json)
 	}
 
 	json.put("timeZoneFile", s_tzFilePath);
-	json.put("systemTimeSource", getSystemTimeSource());
-
-	std::string nitzValidity = PrefsDb::instance()->getPref("nitzValidity");
+	json.put("systemTimeSource", state.systemTimeSource);
 
-	if (nitzValidity == NITZVALIDITY_STATE_NITZVALID)
+	if (state.nitzValidity == NITZVALIDITY_STATE_NITZVALID)
 		json.put("NITZValid", true);
-	else if (nitzValidity == NITZVALIDITY_STATE_NITZINVALIDUSERNOTSET)
+	else if (state.nitzValidity == NITZVALIDITY_STATE_NITZINVALIDUSERNOTSET)
 		json.put("NITZValid", false);
 }
 
+TimePrefsHandler::SystemTimeState TimePrefsHandler::systemTimeState() const
+{
+	g_mutex_lock(&m_timeStateMutex);
+	SystemTimeState state = m_timeState;
+	g_mutex_unlock(&m_timeStateMutex);
+	return state;
+}
+
+// main loop, after the zone, the time source or nitzValidity changed
+void TimePrefsHandler::publishTimeState()
+{
+	SystemTimeState state;
+	if (m_cpCurrentTimeZone)
+		state.timeZone = m_cpCurrentTimeZone->name;
+	state.systemTimeSource = m_systemTimeSourceTag;
+	state.nitzValidity = PrefsDb::instance()->getPref("nitzValidity");
+
+	g_mutex_lock(&m_timeStateMutex);
+	std::swap(m_timeState, state);
+	g_mutex_unlock(&m_timeStateMutex);
+}
+
 
 void TimePrefsHandler::postNitzValidityStatus()
 {
@@ -1949,21 +2003,21 @@ void TimePrefsHandler::postNitzValidityStatus()
 
 void TimePrefsHandler::launchAppsOnTimeChange()
 {
-	//grab the pref and parse out the json
-	std::string rawCurrentPref = PrefsDb::instance()->getPref("timeChangeLaunch");
+	for (const auto& launch : m_timeChangeLaunches)
+		queueTimeChangeLaunch(launch.first, launch.second);
+}
 
-	JValue storedJson = JDomParser::fromString(rawCurrentPref);
-	if (!storedJson.isObject()) {
-		//nothing to do
+void TimePrefsHandler::setTimeChangeLaunchList(const JValue &stored)
+{
+	m_timeChangeLaunches.clear();
+
+	if (!stored.isObject())
 		return;
-	}
 
 	//get the launchList array object out of it
-	JValue storedJson_listArray = storedJson["launchList"];
-	if (!storedJson_listArray.isArray()) {
-		//nothing to do
+	JValue storedJson_listArray = stored["launchList"];
+	if (!storedJson_listArray.isArray())
 		return;
-	}
 
 	for (const JValue key: storedJson_listArray.items())
 	{
@@ -1971,22 +2025,71 @@ void TimePrefsHandler::launchAppsOnTimeChange()
 		if (!label.isString()) {
 			continue; //something really bad happened; something was stored in the list w/o an appId!
 		}
-		std::string appId = label.asString();
 
-		label = key["parameters"];
-		std::string launchStr;
-		if (label.isValid()) {
-			launchStr = "{ \"id\":\"" + appId + "\", \"params\":" + label.stringify().c_str() + " }";
-		} else {
-			launchStr = "{ \"id\":\"" + appId + "\", \"params\":{} }";
-		}
+		JValue params = key["parameters"];
+		JObject launch {{"id", label}, {"params", params.isValid() ? params : JObject()}};
+		m_timeChangeLaunches.push_back(std::make_pair(label.asString(), launch.stringify()));
+	}
+}
+
+void TimePrefsHandler::queueTimeChangeLaunch(const std::string &appId, const std::string &payload)
+{
+	// an app already waiting gets launched once, with the latest parameters
+	auto pending = m_pendingLaunches.find(appId);
+	if (pending != m_pendingLaunches.end()) {
+		pending->second = payload;
+		return;
+	}
+
+	m_pendingLaunches[appId] = payload;
+	m_launchQueue.push_back(appId);
 
+	if (m_launchDispatchId)
+		return;
+
+	gint64 sinceLast = (g_get_monotonic_time() - m_lastLaunchDispatch) / 1000;
+	if (m_lastLaunchDispatch == 0 || sinceLast >= s_timeChangeLaunchInterval) {
+		if (!dispatchTimeChangeLaunch())
+			return;
+		sinceLast = 0;
+	}
+
+	m_launchDispatchId = g_timeout_add(s_timeChangeLaunchInterval - sinceLast,
+									   &TimePrefsHandler::cbDispatchTimeChangeLaunch, this);
+}
+
+// launches the app at the head of the queue, returns false once the queue is empty
+bool TimePrefsHandler::dispatchTimeChangeLaunch()
+{
+	if (m_launchQueue.empty())
+		return false;
+
+	std::string appId = m_launchQueue.front();
+	m_launchQueue.pop_front();
+
+	auto pending = m_pendingLaunches.find(appId);
+	if (pending != m_pendingLaunches.end()) {
 		LS::Error error;
-		(void) LSCall(getServiceHandle(),
-					  "luna://com.webos.service.applicationManager/launch",
-					  launchStr.c_str(),
-					  NULL,NULL,NULL, error);
+		if (!LSCall(getServiceHandle(),
+					"luna://com.webos.service.applicationManager/launch",
+					pending->second.c_str(),
+					NULL,NULL,NULL, error))
+			qWarning() << "failed to launch" << appId.c_str() << "on time change:" << error.what();
+		m_pendingLaunches.erase(pending);
 	}
+
+	m_lastLaunchDispatch = g_get_monotonic_time();
+	return !m_launchQueue.empty();
+}
+
+gboolean TimePrefsHandler::cbDispatchTimeChangeLaunch(gpointer userData)
+{
+	TimePrefsHandler* inst = static_cast<TimePrefsHandler*>(userData);
+	inst->m_launchDispatchId = 0;
+	if (inst->dispatchTimeChangeLaunch())
+		inst->m_launchDispatchId = g_timeout_add(s_timeChangeLaunchInterval,
+												 &TimePrefsHandler::cbDispatchTimeChangeLaunch, inst);
+	return G_SOURCE_REMOVE;
 }
 
 std::string TimePrefsHandler::currentTimeZoneName() const
@@ -2080,22 +2183,19 @@ const TimeZoneInfo* TimePrefsHandler::timeZone_ZoneFromOffset(int offset,int dst
 	if (mcc != 0) {
 
 		const TimeZoneInfo* tzMcc = timeZone_ZoneFromMCC(mcc, 0);
-		if (tzMcc && !tzMcc->countryCode.empty()) {
-
-			qDebug("MCC code: %d, Offset: %d, DstValue: %d, TZ Entry: %s", mcc, offset, dstValue,
-					  tzMcc->jsonStringValue.c_str());
+		if (tzMcc && *tzMcc->countryCode) {
 
-			std::string countryCode = tzMcc->countryCode;
+			qDebug("MCC code: %d, Offset: %d, DstValue: %d, TZ Entry: %s (%s)", mcc, offset, dstValue,
+					  tzMcc->name, tzMcc->countryCode);
 
 			// All timezones wih matching offset
-			std::pair<TimeZoneMultiMapConstIterator, TimeZoneMultiMapConstIterator> iterPair
-				= m_offsetZoneMultiMap.equal_range(offset);
+			std::vector<const TimeZoneInfo*> offsetMatchingTzList = s_zoneTable.zonesWithOffset(offset);
 
 			// narrow down list to those matching the MCC code
-			TimeZoneInfoList mccMatchingTzList;
-			for (TimeZoneMultiMapConstIterator iter = iterPair.first; iter != iterPair.second; ++iter) {
-				if (iter->second->countryCode == countryCode) {
-					mccMatchingTzList.push_back(iter->second);
+			std::vector<const TimeZoneInfo*> mccMatchingTzList;
+			for (const TimeZoneInfo* z : offsetMatchingTzList) {
+				if (strcmp(z->countryCode, tzMcc->countryCode) == 0) {
+					mccMatchingTzList.push_back(z);
 				}
 			}
 
@@ -2104,98 +2204,65 @@ const TimeZoneInfo* TimePrefsHandler::timeZone_ZoneFromOffset(int offset,int dst
 //				if (dstValue == 1) {
 
 					// First iteration: preferred and DST enabled
-					for (TimeZoneInfoListConstIterator iter = mccMatchingTzList.begin();
-						 iter != mccMatchingTzList.end(); ++iter) {
-
-						TimeZoneInfo* z = (*iter);
+					for (const TimeZoneInfo* z : mccMatchingTzList) {
 //						if (z->preferred && z->dstSupported == 1) {
 						if (z->preferred && z->dstSupported == dstValue) {
-						PMLOG_TRACE("Found match in first iteration: %s", z->jsonStringValue.c_str());
+						PMLOG_TRACE("Found match in first iteration: %s", z->name);
 							return z;
 						}
 					}
 
 					// Second iteration: DST enabled
-					for (TimeZoneInfoListConstIterator iter = mccMatchingTzList.begin();
-						 iter != mccMatchingTzList.end(); ++iter) {
-
-						TimeZoneInfo* z = (*iter);
+					for (const TimeZoneInfo* z : mccMatchingTzList) {
 						if (z->dstSupported == 1) {
-						PMLOG_TRACE("Found match in second iteration: %s", z->jsonStringValue.c_str());
+						PMLOG_TRACE("Found match in second iteration: %s", z->name);
 							return z;
 						}
 					}
 //				}
 
 				// Third iteration: just preferred
-				for (TimeZoneInfoListConstIterator iter = mccMatchingTzList.begin();
-					 iter != mccMatchingTzList.end(); ++iter) {
-
-					TimeZoneInfo* z = (*iter);
+				for (const TimeZoneInfo* z : mccMatchingTzList) {
 					if (z->preferred) {
-					PMLOG_TRACE("Found match in third iteration: %s", z->jsonStringValue.c_str());
+					PMLOG_TRACE("Found match in third iteration: %s", z->name);
 						return z;
 					}
 				}
 
 				//  Fourth iteration: just matching DST
-				for (TimeZoneInfoListConstIterator iter = mccMatchingTzList.begin();
-					 iter != mccMatchingTzList.end(); ++iter) {
-
-					TimeZoneInfo* z = (*iter);
+				for (const TimeZoneInfo* z : mccMatchingTzList) {
 					if (z->dstSupported == dstValue) {
-					PMLOG_TRACE("Found match in fourth iteration: %s", z->jsonStringValue.c_str());
+					PMLOG_TRACE("Found match in fourth iteration: %s", z->name);
 						return z;
 					}
 				}
 
 				// Finally: just the first in the list
-				TimeZoneInfo* z = mccMatchingTzList.front();
-				if (z) {
-					qDebug("Found match in fifth iteration: %s", z->jsonStringValue.c_str());
-					return z;
-				}
+				const TimeZoneInfo* z = mccMatchingTzList.front();
+				qDebug("Found match in fifth iteration: %s", z->name);
+				return z;
 			}
 		}
 	}
 
-	TimeZoneInfo * z = NULL;
-	TimeZoneMapConstIterator it;
-	if (dstValue == 0) {
-		it = m_preferredTimeZoneMapNoDST.find(offset);
-		if (it != m_preferredTimeZoneMapNoDST.end())
-			z = it->second;
-	}
-	else {
-		it = m_preferredTimeZoneMapDST.find(offset);
-		if (it != m_preferredTimeZoneMapDST.end())
-			z = it->second;
-	}
-
-	return z;
+	return s_zoneTable.preferredZone(offset, dstValue != 0);
 }
 
 const TimeZoneInfo* TimePrefsHandler::timeZone_GenericZoneFromOffset(int offset) const
 {
 
 	//scan the sys zones list
-	for (TimeZoneInfoListConstIterator 	it = m_syszoneList.begin();
-									it != m_syszoneList.end();
-									it++)
+	for (const TimeZoneInfo& zc : s_zoneTable.sysZones())
 	{
-		TimeZoneInfo * zc = *it;
-		if (zc->offsetToUTC == offset)
-			return zc;
+		if (zc.offsetToUTC == offset)
+			return &zc;
 	}
 	return NULL;
 }
 
 const TimeZoneInfo* TimePrefsHandler::timeZone_ZoneFromMCC(int mcc,int mnc) const
 {
-	TimeZoneMapConstIterator it = m_mccZoneInfoMap.find(mcc);
-	if (it == m_mccZoneInfoMap.end())
-		return NULL;
-	return it->second;
+	return s_zoneTable.mccZone(mcc);
 }
 
 const TimeZoneInfo* TimePrefsHandler::timeZone_ZoneFromName(const std::string& name, const std::string& city) const
@@ -2203,37 +2270,39 @@ const TimeZoneInfo* TimePrefsHandler::timeZone_ZoneFromName(const std::string& n
 	if (name.empty())
 		return 0;
 
-	std::string cityString;
 	if(name.compare(MANUAL_TZ_NAME) == 0)
 	{
 		return m_pManualTimeZone;
 	}
-	for (TimeZoneInfoList::const_iterator it = m_zoneList.begin(); it != m_zoneList.end(); ++it)
-	{
-		TimeZoneInfo* z = (TimeZoneInfo*) (*it);
 
-		if (z->name == name)
+	std::vector<const TimeZoneInfo*> zones = s_zoneTable.zonesNamed(name);
+	if (zones.empty())
+		return 0;
+
+	std::string cityString;
+	convertString(city.c_str(), cityString);
+	qDebug("Received [city: [%s], After Translation city: [%s]", city.c_str(), cityString.c_str());
+
+	// zones from the timeZone list are preferred over the sys zones
+	const TimeZoneInfo* sysZone = 0;
+	for (const TimeZoneInfo* z : zones)
+	{
+		if (s_zoneTable.isSysZone(z))
 		{
-			qDebug("%s: successfully mapped to zone [%s]", __func__, name.c_str());
-			convertString(city.c_str(), cityString);
-			qDebug("Received [city: [%s], After Translation city: [%s]", city.c_str(), cityString.c_str());
-			if( city.empty() || z->city == cityString)
-			{
-				qDebug("Found city : %s", z->city.c_str());
-				return z;
-			}
+			if (!sysZone)
+				sysZone = z;
+			continue;
 		}
-	}
-
-	for (TimeZoneInfoList::const_iterator it = m_syszoneList.begin();
-	it != m_syszoneList.end(); ++it) {
-		TimeZoneInfo* z = (TimeZoneInfo*) (*it);
 
-		if (z->name == name)
+		qDebug("%s: successfully mapped to zone [%s]", __func__, name.c_str());
+		if( city.empty() || cityString == z->city)
+		{
+			qDebug("Found city : %s", z->city);
 			return z;
+		}
 	}
 
-	return 0;
+	return sysZone;
 }
 
 const TimeZoneInfo* TimePrefsHandler::timeZone_GetDefaultZoneFailsafe()
@@ -3133,10 +3202,7 @@ Done_timeoutFunc:
 		if (m_immNitzZoneValid)
 		{
 			// TODO: consider moving to systemSetTimeZone
-			postSystemTimeChange();
-			postBroadcastEffectiveTimeChange();
-			launchAppsOnTimeChange();
-			tzTransTimer();
+			scheduleTimeChangeEffects(true);
 		}
 	}
 
@@ -3207,6 +3273,71 @@ void TimePrefsHandler::tzTransTimer(time_t timeout)
 	return;
 }
 
+/*
+ * After boot micom, NITZ, NTP and broadcast time can all arrive within a few
+ * hundred ms. Each of them used to post the change, launch apps and reparse
+ * the TZif for the DST timer; now that happens once per settle window.
+ */
+void TimePrefsHandler::scheduleTimeChangeEffects(bool postBroadcastEffective)
+{
+	m_timeChangePostBroadcast = m_timeChangePostBroadcast || postBroadcastEffective;
+
+	guint window = Settings::instance()->m_timeChangeSettleWindow;
+	guint maxDelay = Settings::instance()->m_timeChangeMaxDelay;
+	if (window == 0)
+	{
+		flushTimeChangeEffects();
+		return;
+	}
+
+	gint64 now = g_get_monotonic_time();
+	if (m_timeChangeFirstPending == 0)
+		m_timeChangeFirstPending = now;
+
+	// restart the window, but don't push past max delay after the first change
+	gint64 elapsed = (now - m_timeChangeFirstPending) / 1000;
+	if (elapsed >= maxDelay)
+	{
+		if (m_timeChangeSettleId)
+			return;    // already due
+		window = 0;
+	}
+	else if (elapsed + window > maxDelay)
+	{
+		window = maxDelay - elapsed;
+	}
+
+	if (m_timeChangeSettleId)
+		g_source_remove(m_timeChangeSettleId);
+	m_timeChangeSettleId = g_timeout_add(window, &TimePrefsHandler::cbTimeChangeSettled, this);
+}
+
+void TimePrefsHandler::flushTimeChangeEffects()
+{
+	if (m_timeChangeSettleId)
+	{
+		g_source_remove(m_timeChangeSettleId);
+		m_timeChangeSettleId = 0;
+	}
+
+	bool postBroadcast = m_timeChangePostBroadcast;
+	m_timeChangePostBroadcast = false;
+	m_timeChangeFirstPending = 0;
+
+	postSystemTimeChange();
+	if (postBroadcast) postBroadcastEffectiveTimeChange();
+	launchAppsOnTimeChange();
+	tzTransTimer();
+}
+
+gboolean TimePrefsHandler::cbTimeChangeSettled(gpointer userData)
+{
+	TimePrefsHandler* inst = static_cast<TimePrefsHandler*>(userData);
+	inst->m_timeChangeSettleId = 0;
+	inst->flushTimeChangeEffects();
+	return G_SOURCE_REMOVE;
+}
+
 inline void TimePrefsHandler::tzTransTimerAnew(time_t timeout)
 {
 	/* Reset values to re-init timer in tzTransTimer.
@@ -3231,7 +3362,7 @@ gboolean TimePrefsHandler::tzTrans(gpointer userData)
 
 	if ( inst->m_cpCurrentTimeZone ) {
 		PmLogInfo(sysServiceLogContext(), "TIMEZONE_TRANSITION", 3,
-				PMLOGKFV("ZoneId", "\"%s\"", inst->m_cpCurrentTimeZone->name.c_str()),
+				PMLOGKFV("ZoneId", "\"%s\"", inst->m_cpCurrentTimeZone->name),
 				PMLOGKFV("Offset", "%d", inst->m_cpCurrentTimeZone->offsetToUTC),
 				PMLOGKFV("DST", "%s", inst->m_cpCurrentTimeZone->dstSupported ? "true" : "false"),
 				"TimeZone offset is changed");
@@ -3409,7 +3540,7 @@ int	 TimePrefsHandler::timeoutNitzHandlerOffsetValue(NitzParameters& nitz,int& f
 			//found one!  ...set it...but first, see if the "name" is set. If not, reselect based on the offset and dst (not all MCC table zones have names)
 			nitz._offset = tz->offsetToUTC;
 			nitz._dst = tz->dstSupported;
-			if (tz->name.empty())
+			if (!*tz->name)
 			{
 				tz = timeZone_ZoneFromOffset(nitz._offset,nitz._dst);
 				//check to see that this zone's country doesn't span multiple zones...if it does, then it can't be used,
@@ -4139,6 +4270,7 @@ Store:
 	//store the pref back, in string form
 	rawCurrentPref = storedJson.stringify();
 	PrefsDb::instance()->setPref("timeChangeLaunch",rawCurrentPref.c_str());
+	TimePrefsHandler::instance()->setTimeChangeLaunchList(storedJson);
 
 Done:
 	JObject jsonOutput {{"subscribed", false}};	//no subscriptions on this; make that explicit!
@@ -4502,7 +4634,7 @@ void TimePrefsHandler::source_periodic_destroy(gpointer userData)
 
 void TimePrefsHandler::updateTimeZoneEnv()
 {
-	const char* tzName = (m_cpCurrentTimeZone->name).c_str();
+	const char* tzName = m_cpCurrentTimeZone->name;
 
 	__qMessage("Setting Time Zone: %s, utc Offset: %d",
 			tzName, m_cpCurrentTimeZone->offsetToUTC);
@@ -4598,11 +4730,8 @@ std::list<std::string> TimePrefsHandler::getTimeZonesForOffset(int offset)
 	std::list<std::string> timeZones;
 
 	// All timezones wih matching offset
-	std::pair<TimeZoneMultiMapConstIterator, TimeZoneMultiMapConstIterator> iterPair
-		= m_offsetZoneMultiMap.equal_range(offset);
-
-	for (TimeZoneMultiMapConstIterator iter = iterPair.first; iter != iterPair.second; ++iter)
-		timeZones.push_back(iter->second->name);
+	for (const TimeZoneInfo* zone : s_zoneTable.zonesWithOffset(offset))
+		timeZones.push_back(zone->name);
 
 	return timeZones;
 }
@@ -4798,20 +4927,14 @@ void TimePrefsHandler::clockChanged(const std::string &clockTag, int priority, t
 
 JValue TimePrefsHandler::getTimeZoneByLocale(std::string& locale)
 {
-	JValue root = JDomParser::fromString(m_cpCurrentTimeZone->jsonStringValue);
+	if (!m_cpCurrentTimeZone)
+		return JValue();
 
-	TimeZoneInfo tzInfo;
-	if (TZJsonHelper::extract(root, &tzInfo)) {
-                if(Settings::instance()->useLocalizedTZ) {
-		        std::unique_ptr<ResBundle> resBundle = std::unique_ptr<ResBundle>(new ResBundle(locale, s_file, s_resources_path));
-		        tzInfo.description = resBundle->getLocString(tzInfo.description);
-		        tzInfo.city = resBundle->getLocString(tzInfo.city);
-		        tzInfo.country = resBundle->getLocString(tzInfo.country);
-                }
-		return TZJsonHelper::pack(&tzInfo);
+	std::unique_ptr<ResBundle> resBundle;
+	if(Settings::instance()->useLocalizedTZ) {
+		resBundle.reset(new ResBundle(locale, s_file, s_resources_path));
 	}
-
-	return JValue();
+	return TZJsonHelper::pack(*m_cpCurrentTimeZone, resBundle.get());
 }
 
 bool TimePrefsHandler::cbTimeZoneByLocale(LSHandle* lsHandle, LSMessage *message, void *user_data)
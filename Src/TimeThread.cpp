@@ -0,0 +1,258 @@
+// Copyright (c) 2010-2018 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#include "TimeThread.h"
+
+#include <map>
+
+#include <luna-service2/lunaservice.h>
+
+#include "AsyncTask.h"
+#include "Logging.h"
+
+// the handle dispatched from the time context, set by attach()
+static LSHandle* s_handle = nullptr;
+
+static thread_local bool s_onTimeThread = false;
+
+namespace {
+
+// callback and context of an LSCall or server status registration on s_handle
+struct Relay
+{
+	LSFilterFunc reply;
+	LSServerStatusFunc status;
+	void* ctx;
+};
+
+// one relay per callback and context, the callers pass static functions and
+// singletons so there are only a few dozen of them; they live as long as the process
+GMutex s_relayMutex;
+std::map<std::pair<LSFilterFunc, void*>, Relay*> s_replyRelays;
+std::map<std::pair<LSServerStatusFunc, void*>, Relay*> s_statusRelays;
+
+Relay* replyRelay(LSFilterFunc callback, void* ctx)
+{
+	g_mutex_lock(&s_relayMutex);
+	Relay*& relay = s_replyRelays[std::make_pair(callback, ctx)];
+	if (!relay)
+		relay = new Relay{ callback, nullptr, ctx };
+	Relay* result = relay;
+	g_mutex_unlock(&s_relayMutex);
+	return result;
+}
+
+Relay* statusRelay(LSServerStatusFunc callback, void* ctx)
+{
+	g_mutex_lock(&s_relayMutex);
+	Relay*& relay = s_statusRelays[std::make_pair(callback, ctx)];
+	if (!relay)
+		relay = new Relay{ nullptr, callback, ctx };
+	Relay* result = relay;
+	g_mutex_unlock(&s_relayMutex);
+	return result;
+}
+
+// replies and server status changes for s_handle arrive on the time thread
+bool cbRelayReply(LSHandle* sh, LSMessage* reply, void* ctx)
+{
+	Relay* relay = static_cast<Relay*>(ctx);
+	if (!s_onTimeThread)
+		return relay->reply(sh, reply, relay->ctx);
+
+	LSMessageRef(reply);
+	TimeThread::instance()->forward(false, [sh, reply, relay]() {
+		(void) relay->reply(sh, reply, relay->ctx);
+		LSMessageUnref(reply);
+	});
+	return true;
+}
+
+bool cbRelayServerStatus(LSHandle* sh, const char* serviceName, bool connected, void* ctx)
+{
+	Relay* relay = static_cast<Relay*>(ctx);
+	if (!s_onTimeThread)
+		return relay->status(sh, serviceName, connected, relay->ctx);
+
+	std::string name(serviceName ? serviceName : "");
+	TimeThread::instance()->forward(false, [sh, name, connected, relay]() {
+		(void) relay->status(sh, name.c_str(), connected, relay->ctx);
+	});
+	return true;
+}
+
+}
+
+extern "C" {
+
+bool __real_LSCall(LSHandle* sh, const char* uri, const char* payload, LSFilterFunc callback,
+                   void* ctx, LSMessageToken* token, LSError* lserror);
+bool __real_LSCallOneReply(LSHandle* sh, const char* uri, const char* payload, LSFilterFunc callback,
+                           void* ctx, LSMessageToken* token, LSError* lserror);
+bool __real_LSRegisterServerStatusEx(LSHandle* sh, const char* serviceName, LSServerStatusFunc func,
+                                     void* ctx, void** cookie, LSError* lserror);
+
+/*
+ * The service links with --wrap for these, callbacks of calls made on the
+ * handle the time thread dispatches get a relay that moves them to the main
+ * loop, where their code expects to run
+ */
+bool __wrap_LSCall(LSHandle* sh, const char* uri, const char* payload, LSFilterFunc callback,
+                   void* ctx, LSMessageToken* token, LSError* lserror)
+{
+	if (!callback || !s_handle || sh != s_handle)
+		return __real_LSCall(sh, uri, payload, callback, ctx, token, lserror);
+	return __real_LSCall(sh, uri, payload, &cbRelayReply, replyRelay(callback, ctx), token, lserror);
+}
+
+bool __wrap_LSCallOneReply(LSHandle* sh, const char* uri, const char* payload, LSFilterFunc callback,
+                           void* ctx, LSMessageToken* token, LSError* lserror)
+{
+	if (!callback || !s_handle || sh != s_handle)
+		return __real_LSCallOneReply(sh, uri, payload, callback, ctx, token, lserror);
+	return __real_LSCallOneReply(sh, uri, payload, &cbRelayReply, replyRelay(callback, ctx), token, lserror);
+}
+
+bool __wrap_LSRegisterServerStatusEx(LSHandle* sh, const char* serviceName, LSServerStatusFunc func,
+                                     void* ctx, void** cookie, LSError* lserror)
+{
+	if (!func || !s_handle || sh != s_handle)
+		return __real_LSRegisterServerStatusEx(sh, serviceName, func, ctx, cookie, lserror);
+	return __real_LSRegisterServerStatusEx(sh, serviceName, &cbRelayServerStatus,
+	                                       statusRelay(func, ctx), cookie, lserror);
+}
+
+}
+
+TimeThread::TimeThread()
+	: m_context(g_main_context_new())
+	, m_loop(g_main_loop_new(m_context, false))
+	, m_thread(nullptr)
+	, m_pendingBarriers(0)
+{
+}
+
+TimeThread::~TimeThread()
+{
+	stop();
+
+	g_main_loop_unref(m_loop);
+	g_main_context_unref(m_context);
+}
+
+bool TimeThread::attach(LSHandle* handle, LSError* lserror)
+{
+	if (!LSGmainContextAttach(handle, m_context, lserror))
+		return false;
+
+	s_handle = handle;
+	return true;
+}
+
+void TimeThread::start()
+{
+	if (m_thread)
+		return;
+
+	m_thread = g_thread_new("time-loop", &TimeThread::threadFunc, this);
+
+	PmLogInfo(sysServiceLogContext(), "TIME_THREAD_STARTED", 1,
+	          PMLOGKFV("SERVED", "%zu", m_served.size()), "Time queries served from their own thread");
+}
+
+void TimeThread::stop()
+{
+	if (!m_thread)
+		return;
+
+	// a quit before the loop runs would get lost, let the loop quit itself
+	g_main_context_invoke(m_context, &TimeThread::cbQuit, this);
+	g_thread_join(m_thread);
+	m_thread = nullptr;
+}
+
+//static
+size_t TimeThread::relayCount()
+{
+	g_mutex_lock(&s_relayMutex);
+	size_t count = s_replyRelays.size() + s_statusRelays.size();
+	g_mutex_unlock(&s_relayMutex);
+	return count;
+}
+
+//static
+bool TimeThread::isCurrent()
+{
+	return s_onTimeThread;
+}
+
+void TimeThread::serve(const char* category, const char* method)
+{
+	m_served.insert(std::make_pair(std::string(category), std::string(method)));
+}
+
+void TimeThread::orderAfter(const char* category, const char* method)
+{
+	m_barriers.insert(std::make_pair(std::string(category), std::string(method ? method : "")));
+}
+
+TimeThread::Route TimeThread::route(const std::string& category, const char* method) const
+{
+	std::pair<std::string, std::string> path(category, method);
+	if (m_served.count(path))
+		return RouteServe;
+	if (m_barriers.count(path))
+		return RouteBarrier;
+
+	path.second.clear();
+	return m_barriers.count(path) ? RouteBarrier : RouteForward;
+}
+
+void TimeThread::forward(bool barrier, std::function<void()> dispatch)
+{
+	if (!barrier) {
+		AsyncTaskPool::instance()->post(std::move(dispatch));
+		return;
+	}
+
+	m_pendingBarriers.fetch_add(1, std::memory_order_acq_rel);
+	std::function<void()> fn(std::move(dispatch));
+	AsyncTaskPool::instance()->post([this, fn]() {
+		fn();
+		m_pendingBarriers.fetch_sub(1, std::memory_order_acq_rel);
+	});
+}
+
+//static
+gpointer TimeThread::threadFunc(gpointer data)
+{
+	TimeThread* self = static_cast<TimeThread*>(data);
+	s_onTimeThread = true;
+
+	// sources the served methods add go to the time context
+	g_main_context_push_thread_default(self->m_context);
+	g_main_loop_run(self->m_loop);
+	g_main_context_pop_thread_default(self->m_context);
+
+	return nullptr;
+}
+
+//static
+gboolean TimeThread::cbQuit(gpointer data)
+{
+	g_main_loop_quit(static_cast<TimeThread*>(data)->m_loop);
+	return G_SOURCE_REMOVE;
+}
@@ -309,83 +309,18 @@ TimeZoneService::TimeZoneResultList TimeZoneService::getTimeZoneRuleOne(const Ti
 	for (IntList::const_iterator it = entry.years.begin();
 		 it != entry.years.end(); ++it) {
 
-		int year = (*it);
+		TzYearRule rule;
+		if (!tzRuleForYear(transitionList, *it, rule))
+			continue;
 
 		TimeZoneResult res;
 		res.tz = entry.tz;
-		res.year = year;
-		res.hasDstChange = false;
-		res.utcOffset = -1;
-		res.dstOffset = -1;
-		res.dstStart  = -1;
-		res.dstEnd    = -1;
-
-		// First do a scan to check if there are entries for this year
-		bool hasEntriesForYear = false;
-		for (TzTransitionList::const_iterator iter = transitionList.begin();
-			 iter != transitionList.end(); ++iter) {
-
-			const TzTransition& trans = (*iter);
-			if (trans.year == year && false == trans.isDst) {
-				hasEntriesForYear = true;
-				break;
-			}
-		}
-
-		if (hasEntriesForYear) {
-		
-			for (TzTransitionList::const_iterator iter = transitionList.begin();
-				 iter != transitionList.end(); ++iter) {
-
-				const TzTransition& trans = (*iter);
-				if (trans.year != year)
-					continue;
-
-				if (trans.isDst) {
-					res.hasDstChange = true;
-					res.dstOffset    = trans.utcOffset;
-					res.dstStart     = trans.time;
-				}
-				else {
-					res.utcOffset    = trans.utcOffset;
-					res.dstEnd       = trans.time;
-				}
-			}
-		}
-		else {
-			int64_t dstUtcOffset=-1;
-			// Pick the latest year which is < the specified year
-			for (TzTransitionList::const_reverse_iterator iter = transitionList.rbegin();
-				 iter != transitionList.rend(); ++iter) {
-
-				const TzTransition& trans = (*iter);
-				if (trans.year > year)
-					continue;
-
-				if (trans.isDst) {
-					// Keep the DST UTC offset for fail safe.
-					dstUtcOffset = trans.utcOffset;
-					continue;
-				}
-
-				res.hasDstChange = false;
-				res.dstOffset    = -1;
-				res.dstStart     = -1;
-				res.dstEnd       = -1;
-				res.utcOffset    = trans.utcOffset;
-
-				break;
-			}
-			// If not found except DST, then use it.
-			if (res.utcOffset == -1)
-				res.utcOffset = dstUtcOffset;
-		}
-
-		if (res.utcOffset == -1)
-			continue;
-					
-		if (res.dstStart == -1)
-			res.dstEnd = -1;
+		res.year = rule.year;
+		res.hasDstChange = rule.hasDstChange;
+		res.utcOffset = rule.utcOffset;
+		res.dstOffset = rule.dstOffset;
+		res.dstStart  = rule.dstStart;
+		res.dstEnd    = rule.dstEnd;
 
 		results.push_back(res);
 	}	
@@ -576,7 +511,7 @@ bool TimeZoneService::cbGetTimeZoneFromEasData(LSHandle* lsHandle, LSMessage *me
 			reply = createJsonReply(false, 0, "Failed to find timeZone preference");
 			goto Done;
 		}
-		TimePrefsHandler* tzHandler = static_cast<TimePrefsHandler*>(handler.get());
+		TimePrefsHandler* tzHandler = static_cast<TimePrefsHandler*>(handler);
 		TimeZoneService* tzService = TimeZoneService::instance();
 
 		std::list<std::string> timeZones = tzHandler->getTimeZonesForOffset(-easBias);
@@ -683,7 +618,7 @@ bool TimeZoneService::createTimeZoneFromEasData(LSHandle* lsHandle, UserTzData*
 	auto handler = PrefsFactory::instance()->getPrefsHandler("timeZone");
 	if (!handler)
 		return false;
-	TimePrefsHandler* tzHandler = static_cast<TimePrefsHandler*>(handler.get());
+	TimePrefsHandler* tzHandler = static_cast<TimePrefsHandler*>(handler);
 
 	if (false == a_userTz.easBiasValid)
 	{
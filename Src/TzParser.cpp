@@ -454,6 +454,85 @@ TzTransitionList parseTimeZone(const char* tzName)
 	return result;
 }
 
+bool tzRuleForYear(const TzTransitionList& transitionList, int year, TzYearRule& rule)
+{
+	rule.year = year;
+	rule.hasDstChange = false;
+	rule.utcOffset = -1;
+	rule.dstOffset = -1;
+	rule.dstStart  = -1;
+	rule.dstEnd    = -1;
+
+	// First do a scan to check if there are entries for this year
+	bool hasEntriesForYear = false;
+	for (TzTransitionList::const_iterator iter = transitionList.begin();
+		 iter != transitionList.end(); ++iter) {
+
+		const TzTransition& trans = (*iter);
+		if (trans.year == year && false == trans.isDst) {
+			hasEntriesForYear = true;
+			break;
+		}
+	}
+
+	if (hasEntriesForYear) {
+
+		for (TzTransitionList::const_iterator iter = transitionList.begin();
+			 iter != transitionList.end(); ++iter) {
+
+			const TzTransition& trans = (*iter);
+			if (trans.year != year)
+				continue;
+
+			if (trans.isDst) {
+				rule.hasDstChange = true;
+				rule.dstOffset    = trans.utcOffset;
+				rule.dstStart     = trans.time;
+			}
+			else {
+				rule.utcOffset    = trans.utcOffset;
+				rule.dstEnd       = trans.time;
+			}
+		}
+	}
+	else {
+		int64_t dstUtcOffset=-1;
+		// Pick the latest year which is < the specified year
+		for (TzTransitionList::const_reverse_iterator iter = transitionList.rbegin();
+			 iter != transitionList.rend(); ++iter) {
+
+			const TzTransition& trans = (*iter);
+			if (trans.year > year)
+				continue;
+
+			if (trans.isDst) {
+				// Keep the DST UTC offset for fail safe.
+				dstUtcOffset = trans.utcOffset;
+				continue;
+			}
+
+			rule.hasDstChange = false;
+			rule.dstOffset    = -1;
+			rule.dstStart     = -1;
+			rule.dstEnd       = -1;
+			rule.utcOffset    = trans.utcOffset;
+
+			break;
+		}
+		// If not found except DST, then use it.
+		if (rule.utcOffset == -1)
+			rule.utcOffset = dstUtcOffset;
+	}
+
+	if (rule.utcOffset == -1)
+		return false;
+
+	if (rule.dstStart == -1)
+		rule.dstEnd = -1;
+
+	return true;
+}
+
 /*
 int main(int argc, char** argv)
 {
@@ -44,13 +44,20 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/statfs.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#include <linux/fs.h>
 #include <stdarg.h>
 #include <unistd.h>
 #include "UrlRep.h"
 #include "Utils.h"
+#include "Logging.h"
 #include <cstdlib>
 #include <cstring>
 #include <algorithm>
@@ -280,48 +287,217 @@ bool doesExistOnFilesystem(const char * pathAndFile) {
 	
 }
 
+namespace {
+
+// Copies [offset, size) of in to out, advancing offset. Each method returns
+// false with errno set if it isn't usable for this pair of files (the next
+// one is tried from the current offset) and true once everything is copied.
+// With a progress callback the kernel copies are split into chunks so that
+// progress can be reported between them.
+
+const off_t s_progressChunk = 1024 * 1024;
+
+inline size_t chunkSize(off_t size, off_t offset, const CopyProgress& progress)
+{
+	off_t left = size - offset;
+	return (progress && left > s_progressChunk) ? s_progressChunk : left;
+}
+
+bool cloneFile(int in, int out, off_t size, off_t& offset)
+{
+#ifdef FICLONE
+	if (offset == 0 && ioctl(out, FICLONE, in) == 0)
+	{
+		offset = size;
+		return true;
+	}
+#else
+	errno = ENOTSUP;
+#endif
+	return false;
+}
+
+bool copyFileRange(int in, int out, off_t size, off_t& offset, const CopyProgress& progress)
+{
+#ifdef __NR_copy_file_range
+	while (offset < size)
+	{
+		loff_t inOffset = offset;
+		loff_t outOffset = offset;
+		ssize_t n = syscall(__NR_copy_file_range, in, &inOffset, out, &outOffset,
+		                    chunkSize(size, offset, progress), 0);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		offset += n;
+		if (progress)
+			progress(offset, size);
+	}
+	return true;
+#else
+	errno = ENOSYS;
+	return false;
+#endif
+}
+
+bool sendFile(int in, int out, off_t size, off_t& offset, const CopyProgress& progress)
+{
+	if (lseek(out, offset, SEEK_SET) < 0)
+		return false;
+
+	while (offset < size)
+	{
+		ssize_t n = sendfile(out, in, &offset, chunkSize(size, offset, progress));
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		if (progress)
+			progress(offset, size);
+	}
+	return true;
+}
+
+bool readWriteLoop(int in, int out, off_t size, off_t& offset, const CopyProgress& progress)
+{
+	static const size_t bufferSize = 128 * 1024;
+	std::unique_ptr<char[]> buffer(new char[bufferSize]);
+
+	// no size bound here: also handles files that can't be stat'ed for size
+	for (;;)
+	{
+		ssize_t r = pread(in, buffer.get(), bufferSize, offset);
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r < 0)
+			return false;
+		if (r == 0)
+			return true;
+
+		for (ssize_t done = 0; done < r; )
+		{
+			ssize_t w = pwrite(out, buffer.get() + done, r - done, offset + done);
+			if (w < 0 && errno == EINTR)
+				continue;
+			if (w <= 0)
+				return false;
+			done += w;
+		}
+		offset += r;
+		if (progress)
+			progress(offset, std::max(size, offset));
+	}
+}
+
+void syncParentDir(const std::string& fileAndPath)
+{
+	gchar* dir = g_path_get_dirname(fileAndPath.c_str());
+	int fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	g_free(dir);
+	if (fd < 0)
+		return;
+	(void) fsync(fd);
+	close(fd);
+}
+
+} // anonymous namespace
+
+/*
+ * Copies srcFileAndPath to dstFileAndPath, returns 1 on success and -1 on error.
+ *
+ * The data goes into a temp file next to the destination, which is fsync'ed
+ * and renamed over it, so readers (and a crash) see either the old or the
+ * complete new file. The copy itself tries a reflink (FICLONE), then
+ * copy_file_range, then sendfile and falls back to a plain read/write loop.
+ */
 int fileCopy(const char * srcFileAndPath,const char * dstFileAndPath)
+{
+	return fileCopy(srcFileAndPath, dstFileAndPath, CopyProgress());
+}
+
+int fileCopy(const char * srcFileAndPath,const char * dstFileAndPath,const CopyProgress& progress)
 {
 	if ((srcFileAndPath == NULL) || (dstFileAndPath == NULL))
 		return -1;
-	
-	FILE * infp = fopen(srcFileAndPath,"rb");
-	FILE * outfp = fopen(dstFileAndPath,"wb");
-	if ((infp == NULL) || (outfp == NULL)) {
-		if (infp)
-			fclose(infp);
-		if (outfp)
-			fclose(outfp);
+
+	int in = open(srcFileAndPath, O_RDONLY | O_CLOEXEC);
+	if (in < 0)
+		return -1;
+
+	struct stat st;
+	if (fstat(in, &st) < 0 || S_ISDIR(st.st_mode))
+	{
+		close(in);
 		return -1;
 	}
-	
-	char buffer[2048];
-	bool success=true;
-	while (!feof(infp)) {
-		size_t r = fread(buffer,1,2048,infp);
-		if ((r == 0) && (ferror(infp))) {
-			success=false;
-			break;
-		}
-		size_t w = fwrite(buffer,1,r,outfp);
-		if (w < r) {
-			success=false;
-			break;
-		}
+
+	std::string tempFile = std::string(dstFileAndPath) + ".XXXXXX";
+	int out = mkostemp(&tempFile[0], O_CLOEXEC);
+	if (out < 0)
+	{
+		close(in);
+		return -1;
 	}
-	
-	fflush(infp);
-	fflush(outfp);	//apparently our filesystem doesn't like to commit even on close
-	fclose(infp);
-	fclose(outfp);
-	if (!success) // incomplete copy
+	(void) fchmod(out, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+
+	off_t offset = 0;
+	bool success = cloneFile(in, out, st.st_size, offset)
+		|| copyFileRange(in, out, st.st_size, offset, progress)
+		|| sendFile(in, out, st.st_size, offset, progress);
+
+	// whatever is left, including anything the file grew by meanwhile
+	success = readWriteLoop(in, out, st.st_size, offset, progress) && (success || offset >= st.st_size);
+
+	//apparently our filesystem doesn't like to commit even on close
+	success = (ftruncate(out, offset) == 0) && (fsync(out) == 0) && success;
+	close(in);
+	success = (close(out) == 0) && success;
+
+	if (!success || rename(tempFile.c_str(), dstFileAndPath) < 0)
 	{
-		// XXX: (void) unlink(dstFileAndPath);
+		qWarning("copy of [%s] to [%s] failed: %s", srcFileAndPath, dstFileAndPath, strerror(errno));
+		(void) unlink(tempFile.c_str());
 		return -1;
 	}
+
+	syncParentDir(dstFileAndPath);
+	if (progress)
+		progress(offset, offset);
 	return 1;
 }
 
+bool fileChecksum(const char * pathAndFile,std::string& r_digest)
+{
+	if (pathAndFile == NULL)
+		return false;
+
+	int fd = open(pathAndFile, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+
+	static const size_t bufferSize = 128 * 1024;
+	std::unique_ptr<char[]> buffer(new char[bufferSize]);
+	std::unique_ptr<GChecksum, void(*)(GChecksum*)> checksum(g_checksum_new(G_CHECKSUM_SHA256), g_checksum_free);
+
+	ssize_t r;
+	while ((r = read(fd, buffer.get(), bufferSize)) != 0)
+	{
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r < 0)
+		{
+			close(fd);
+			return false;
+		}
+		g_checksum_update(checksum.get(), reinterpret_cast<const guchar*>(buffer.get()), r);
+	}
+	close(fd);
+
+	r_digest = g_checksum_get_string(checksum.get());
+	return true;
+}
+
 int filesizeOnFilesystem(const char * pathAndFile)
 {
 	if (pathAndFile == NULL)
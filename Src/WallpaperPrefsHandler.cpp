@@ -31,13 +31,9 @@
 #include <QtCore/QDebug>
 #include <QtCore/QString>
 #include <QtCore/QFile>
-#include <QtGui/QImage>
-#include <QtGui/QImageReader>
-#include <QtGui/QImageWriter>
-#include <QtGui/QPainter>
 #include <QtCore/QtGlobal>
 
-#include "ImageHelpers.h"
+#include "ImageModule.h"
 #include "JSONUtils.h"
 #include "WallpaperPrefsHandler.h"
 #include "ImageServices.h"
@@ -172,27 +168,35 @@ void WallpaperPrefsHandler::valueChanged(const std::string &, const JValue &valu
 }
 
 JValue WallpaperPrefsHandler::valuesForKey(const std::string& key)
+{
+    return windowedValuesForKey(key, PrefsValuesWindow());
+}
+
+JValue WallpaperPrefsHandler::windowedValuesForKey(const std::string& key, const PrefsValuesWindow& window)
 {
     //scan the wallpapers dir
-    std::list<std::string> wallpaperFilenames = scanForWallpapers();
+    const std::list<std::string>& wallpaperFilenames = scanForWallpapers();
     JArray arrayObj;
-    for (std::list<std::string>::iterator it = wallpaperFilenames.begin();it != wallpaperFilenames.end();++it) {
-        JObject element;
-
-        char * filename_cstr = const_cast<char*>((*it).c_str());
-        element.put("wallpaperName", filename_cstr);
-
-        std::string wpFile = s_wallpaperDir + std::string("/")+(*it);
-        std::string wpThumbFile = s_wallpaperThumbsDir + std::string("/")+(*it);
-        filename_cstr = const_cast<char*>(wpFile.c_str());
-        element.put("wallpaperFile", filename_cstr);
+    size_t index = 0;
+    for (std::list<std::string>::const_iterator it = wallpaperFilenames.begin();it != wallpaperFilenames.end();++it, ++index) {
+        if (window.isPast(index))
+            break;
+        if (!window.contains(index))
+            continue;
 
-        filename_cstr = const_cast<char*>(wpThumbFile.c_str());
-        element.put("wallpaperThumbFile", filename_cstr);
-        arrayObj.append(element);
+        JObject element;
+        element.put("wallpaperName", *it);
+        element.put("wallpaperFile", s_wallpaperDir + std::string("/")+(*it));
+        element.put("wallpaperThumbFile", s_wallpaperThumbsDir + std::string("/")+(*it));
+        arrayObj.append(window.project(element));
     }
 
-    return JObject {{"wallpaper", arrayObj}};
+    JObject result {{"wallpaper", arrayObj}};
+    if (!window.isFull()) {
+        result.put("total", static_cast<int64_t>(wallpaperFilenames.size()));
+        result.put("offset", static_cast<int64_t>(window.offset));
+    }
+    return result;
 }
 
 void WallpaperPrefsHandler::init()
@@ -408,12 +412,16 @@ bool WallpaperPrefsHandler::importWallpaper(std::string& ret_wallpaperName, cons
         double scale, std::string& errorText) {
     std::string pathAndFile = sourcePath + std::string("/")+sourceFile;
 
-    QImageReader reader(QString::fromStdString(pathAndFile));
-    if(!reader.canRead()) {
-        errorText = reader.errorString().toStdString();
+    ImageModule::Ref codec;
+    if (!codec) {
+        errorText = ImageModule::unavailableError();
         return false;
     }
 
+    ImageInfo info;
+    if (!codec->info(pathAndFile, info, errorText))
+        return false;
+
     //does it exist in the wallpaper dir?
     //(trim off the extension)
     std::string destPathAndFile = s_wallpaperDir + std::string("/")+sourceFile;
@@ -444,7 +452,7 @@ bool WallpaperPrefsHandler::importWallpaper(std::string& ret_wallpaperName, cons
     //(that function should be able to optimize things, such as copying the image directly without (re)compression
     if (qFuzzyCompare(scale, 1.0)
         && qFuzzyCompare(centerX,0.5) && qFuzzyCompare(centerY,0.5)
-        && reader.size().width() == SCREEN_WIDTH && reader.size().height() == SCREEN_HEIGHT)
+        && info.width == SCREEN_WIDTH && info.height == SCREEN_HEIGHT)
         toScreenSize = true;
 
     qDebug("importWallpaper(): parameters: scale = %lf , centerX = %lf , centerY = %lf , toScreenSize? = %s\n",
@@ -452,42 +460,15 @@ bool WallpaperPrefsHandler::importWallpaper(std::string& ret_wallpaperName, cons
     //create a resized version of the image to screen res in the wallpapers dir
 
     if (toScreenSize) {
-        if (resizeImage(pathAndFile, destPathAndFile, SCREEN_WIDTH, SCREEN_HEIGHT, reader.format().data()) != 0)
+        if (resizeImage(pathAndFile, destPathAndFile, SCREEN_WIDTH, SCREEN_HEIGHT, info.format.c_str()) != 0)
             return false;
     }
     else {
-        double prescale;
-        QImage image;
-        if(!readImageWithPrescale(reader, image, prescale)) {
-            errorText=reader.errorString().toStdString();
-            return false;
-        }
-        scale /= prescale;
-
-        if(scale != 1.0) {
-            image = image.scaled(image.width() * scale, image.height() * scale);
-            if (image.isNull()) {
-                errorText = std::strerror(errno);
-                qWarning("importWallpaper(): cannot scale %s %g times: %s\n",
-                         sourceFile.c_str(),
-                         scale,
-                         errorText.c_str()
-                        );
-                return false;
-            }
-        }
-
-        // now refocus as requested
-        qDebug("importWallpaper(): calling clipImageBufferToScreenSizeWithFocus...\n");
-        image = clipImageToScreenSizeWithFocus(image,
-                image.width() * centerX, image.height() * centerY);
-
-        // and write out the file
-        if (!image.save(QString::fromStdString(destPathAndFile), 0, 100)) {
-            errorText = std::strerror(errno);
-            qWarning("importWallpaper(): cannot save %s to %s: %s\n",
+        // scale, then refocus as requested and write out the file
+        if (!codec->scaleAndClip(pathAndFile, destPathAndFile, nullptr, scale, true,
+                                 centerX, centerY, SCREEN_WIDTH, SCREEN_HEIGHT, errorText)) {
+            qWarning("importWallpaper(): cannot import %s: %s\n",
                      sourceFile.c_str(),
-                     destPathAndFile.c_str(),
                      errorText.c_str()
                     );
             return false;
@@ -496,7 +477,7 @@ bool WallpaperPrefsHandler::importWallpaper(std::string& ret_wallpaperName, cons
     }
 
     //create a thumbnail version in the wallpaper thumbs dir
-    if (resizeImage(destPathAndFile, destThumbPathAndFile, THUMBS_WIDTH, THUMBS_HEIGHT, reader.format().data()) != 0) {
+    if (resizeImage(destPathAndFile, destThumbPathAndFile, THUMBS_WIDTH, THUMBS_HEIGHT, info.format.c_str()) != 0) {
         //delete the resized screen wallpaper
         unlink(destPathAndFile.c_str());
         errorText = std::string("couldn't create thumbnail");
@@ -518,13 +499,16 @@ bool WallpaperPrefsHandler::importWallpaper_lowMem(std::string& ret_wallpaperNam
         std::string& errorText) {
 
     std::string pathAndFile = sourcePath + std::string("/")+sourceFile;
-    QImageReader reader(QString::fromStdString(pathAndFile));
-    if(!reader.canRead()) {
-        qWarning()<<reader.supportedImageFormats();
-        errorText = reader.errorString().toStdString();
+    ImageModule::Ref codec;
+    if (!codec) {
+        errorText = ImageModule::unavailableError();
         return false;
     }
 
+    ImageInfo info;
+    if (!codec->info(pathAndFile, info, errorText))
+        return false;
+
     //does it exist in the wallpaper dir?
     //(trim off the extension)
     std::string destPathAndFile = s_wallpaperDir + std::string("/")+sourceFile;
@@ -553,8 +537,8 @@ bool WallpaperPrefsHandler::importWallpaper_lowMem(std::string& ret_wallpaperNam
     //TODO: WARN: strict comparison of float to 0 might fail
     if (qFuzzyCompare(scale, 0.0))
         scale = 1.0;
-    int srcWidth = reader.size().width();
-    int srcHeight = reader.size().height();
+    int srcWidth = info.width;
+    int srcHeight = info.height;
 
     if ((qFuzzyCompare(scale,1.0)) && (qFuzzyCompare(centerX,0.5)) && (qFuzzyCompare(centerY,0.5))
             && (srcWidth == SCREEN_WIDTH) && (srcHeight == SCREEN_HEIGHT))
@@ -607,14 +591,14 @@ bool WallpaperPrefsHandler::importWallpaper_lowMem(std::string& ret_wallpaperNam
             }
         }
 
-        result = ImageServices::instance()->ezResize(pathAndFile, destPathAndFile, reader.format().data(), desiredWidth, desiredHeight, errorText);
+        result = ImageServices::instance()->ezResize(pathAndFile, destPathAndFile, info.format.c_str(), desiredWidth, desiredHeight, errorText);
     } else {
         // Don't resize the image, SysMgr can handle this.
         result = (0 < Utils::fileCopy(pathAndFile.c_str(), destPathAndFile.c_str()));
     }
 
     //create a thumbnail version in the wallpaper thumbs dir
-    if (resizeImage(destPathAndFile, destThumbPathAndFile, THUMBS_WIDTH, THUMBS_HEIGHT, reader.format().data()) != 0) {
+    if (resizeImage(destPathAndFile, destThumbPathAndFile, THUMBS_WIDTH, THUMBS_HEIGHT, info.format.c_str()) != 0) {
         //delete the resized screen wallpaper
         unlink(destPathAndFile.c_str());
         errorText = std::string("couldn't create thumbnail");
@@ -635,16 +619,12 @@ bool WallpaperPrefsHandler::convertImage(const std::string& pathToSourceFile,
                                          double centerX, double centerY, double scale,
                                          std::string& r_errorText)
 {
-    QImageReader reader(QString::fromStdString(pathToSourceFile));
-    if(!reader.canRead()) {
-        r_errorText = reader.errorString().toStdString();
+    ImageModule::Ref codec;
+    if (!codec) {
+        r_errorText = ImageModule::unavailableError();
         return false;
     }
 
-    //fix scale factor just in case it's negative
-    if (scale < 0.0)
-        scale *= -1.0;
-
     //fix scale factor just in case it's negative
     if (scale < 0.0)
         scale *= -1.0;
@@ -656,42 +636,9 @@ bool WallpaperPrefsHandler::convertImage(const std::string& pathToSourceFile,
 
     qDebug("convertImage parameters: scale = %lf , centerX = %lf , centerY = %lf\n", scale,centerX,centerY);
 
-    // used to scale the file before it is actually read to memory
-    double prescale = 1.0;
-    QImage image;
-    if (!readImageWithPrescale(reader, image, prescale)) {
-        r_errorText = reader.errorString().toStdString();
-        return false;
-    }
-    //scale the image as requested...factor in whatever the prescale did
-    scale /= prescale;
-    qDebug("convertImage(): scale after prescale adjustment: %f, prescale: %f", scale, prescale);
-
-    if (scale != 1.0) {
-        qDebug("convertImage(): scaling image\n");
-        image = image.scaled(scale * image.width(), scale * image.height());
-        if (image.isNull()) {
-           r_errorText = std::strerror(errno);
-           qWarning("convertImage(): cannot scale %s %g times: %s\n",
-                    pathToSourceFile.c_str(),
-                    scale,
-                    r_errorText.c_str()
-                   );
-           return false;
-        }
-    }
-
-    if (!justConvert) {
-        //now refocus as requested
-        qDebug("convertImage(): Calling clipImageBufferToScreenSizeWithFocus...");
-        image = clipImageToScreenSizeWithFocus(image, image.width() * centerX, image.height() * centerY);
-
-        qDebug("convertImage(): clipImageBufferToScreenSizeWithFocus Ok\n");
-    }
-
-    //and write out the file
-    if (!image.save(QString::fromStdString(pathToDestFile), format, 100)) {
-        r_errorText = std::strerror(errno);
+    // unless just converting, refocus as requested after scaling
+    if (!codec->scaleAndClip(pathToSourceFile, pathToDestFile, format, scale, !justConvert,
+                             centerX, centerY, SCREEN_WIDTH, SCREEN_HEIGHT, r_errorText)) {
         qWarning("convertImage(): cannot convert %s to %s: %s\n",
                  pathToSourceFile.c_str(),
                  pathToDestFile.c_str(),
@@ -742,79 +689,6 @@ bool WallpaperPrefsHandler::deleteWallpaper(std::string wallpaperName) {
     return found;
 }
 
-/*
- *     Makes the image size == to screen size
- * In case the image is LARGER than screen size, it just cuts off the bigger pieces
- * In case the image is SMALLER than screen size, it mounts the picture in a black RGBA(0,0,0,255) border
- *
- *     'center' determines whether cut (LARGER) or mount (SMALLER) happens relative to the center of the image
- *         true = if cut, the cut is taken evenly along all sides (center-cut)
- *                 if mount, the image is mounted in the center
- *         false = if cut, anything >= SCREEN_WIDTH on the right edge is cut and anything >= SCREEN_HEIGHT on the bottom edge is cut
- *                 if mount, the image is mounted with (0,0) aligned, and anything in dest image (x,y) such that (x,y) >= (srcImgW,srcImgH)
- *                  is blackfilled
- *
- */
-QImage WallpaperPrefsHandler::clipImageToScreenSize(QImage& image, bool center)
-{
-    if (image.width() == SCREEN_WIDTH && image.height() == SCREEN_HEIGHT)
-        return image;
-    QImage result(SCREEN_WIDTH, SCREEN_HEIGHT, image.format());
-
-    result.fill(Qt::black);
-    int halfScreenW = SCREEN_WIDTH>>1;
-    int halfScreenH = SCREEN_HEIGHT>>1;
-
-    QPainter p(&result);
-    p.setRenderHint(QPainter::SmoothPixmapTransform);
-    if(center) {
-        p.translate(-image.width()/2, -image.height());
-        p.translate(halfScreenW, halfScreenH);
-    }
-    p.drawImage(QPoint(0,0), image);
-    p.end();
-    return result;
-}
-
-/*
- *     Makes the image size == to screen size, but the image center is now focus_x,focus_y
- *
- *     focus_x,focus_y determines the center point of the image. In other words, the final image has the src img's (focus_x,focus_y)
- *     at its center, and extends +/- SCREEN_WIDTH/2 horizontally and +/- SCREEN_HEIGHT/2 vertically
- *
- *     any region of the source image that is not within UL(focus_x-SCREEN_WIDTH/2,focus_y-SCREEN_HEIGHT/2)
- *                                                       LR(focus_x+SCREEN_WIDTH/2,focus_y+SCREEN_HEIGHT/2)
- *     ...is matted black
- */
-
-QImage WallpaperPrefsHandler::clipImageToScreenSizeWithFocus(QImage& image, int focus_x,int focus_y)
-{
-    if (focus_x < 0)
-        focus_x = 0;
-    if(focus_x > image.width())
-        focus_x = image.width();
-    if(focus_y < 0)
-        focus_y = 0;
-    if(focus_y >= image.height())
-        focus_y = image.height();
-
-    qDebug("clipImageToScreenSizeWithFocus(): srcImg is ( %d , %d ), focus is ( %d , %d )", image.width(),image.height() ,focus_x,focus_y);
-
-    QImage result(SCREEN_WIDTH, SCREEN_HEIGHT, image.format());
-
-    result.fill(Qt::black);
-    int halfScreenW = SCREEN_WIDTH>>1;
-    int halfScreenH = SCREEN_HEIGHT>>1;
-
-    QPainter p(&result);
-    p.setRenderHint(QPainter::SmoothPixmapTransform);
-    p.translate(-focus_x, -focus_y);
-    p.translate(halfScreenW, halfScreenH);
-    p.drawImage(QPoint(0,0), image);
-    p.end();
-    return result;
-}
-
 int WallpaperPrefsHandler::resizeImage(const std::string& sourceFile,
                                        const std::string& destFile,
                                        int destImgW, int destImgH,
@@ -823,30 +697,28 @@ int WallpaperPrefsHandler::resizeImage(const std::string& sourceFile,
     if ((destImgW <= 0) || (destImgH <= 0))
         return -1;
 
-    QImage image;
-    if(!image.load(QString::fromStdString(sourceFile)))
+    ImageModule::Ref codec;
+    if (!codec)
+        return -1;
+
+    std::string errorText;
+    ImageInfo info;
+    if (!codec->info(sourceFile, info, errorText))
         return -1;
 
-    if ((image.width() == destImgW) && (image.height() == destImgH)) {
+    if ((info.width == destImgW) && (info.height == destImgH)) {
         // already desired size - just copy
         int fcopyRc = Utils::fileCopy(sourceFile.c_str(),destFile.c_str());
         if (fcopyRc <= 0) {
             qDebug()<<"error copying to"<<QString::fromStdString(destFile);
             return EIO;
         }
+        return 0;
     }
-    QImage result(destImgW, destImgH, image.format());
-
-    QPainter p(&result);
-    p.setRenderHint(QPainter::SmoothPixmapTransform);
-    p.drawImage(QRect(0,0,destImgW, destImgH), image);
-    p.end();
 
-    QImageWriter w(QString::fromStdString(destFile), format);
-    w.setQuality(100);
-    qDebug()<<"saving with quality"<<w.quality()<<format;
-    if (!w.write(result)) {
-       qCritical()<<"writer:"<<w.errorString();
+    qDebug()<<"saving with quality 100"<<format;
+    if (!codec->resize(sourceFile, destFile, format, destImgW, destImgH, errorText)) {
+       qCritical()<<"writer:"<<errorText.c_str();
        return -1;
     }
     return 0;
@@ -948,11 +820,11 @@ const std::list<std::string>& WallpaperPrefsHandler::buildIndexFromExisting(int
                 continue;
             }
 
-            QImageReader reader(QString::fromStdString(path + entries[i]->d_name));
             // UNSUPPORTED FILE TYPE
             // not incrementing invalid count since there isn't a lot I can do about this wallpaper
             // even if I call scanForWallpapers()
-            if(!reader.canRead())
+            // (checked by signature, so building the index doesn't load the image module)
+            if (!ImageModule::sniffFormat(path + entries[i]->d_name))
                 continue;
 
             m_wallpapers.push_back(std::string(entries[i]->d_name));
@@ -984,6 +856,9 @@ const std::list<std::string>& WallpaperPrefsHandler::scanForWallpapers(bool rebu
     if (thumbpath[thumbpath.size() - 1] != '/')
         thumbpath += '/';
 
+    // held for the whole scan so thumbnails are made with a single module load
+    ImageModule::Ref codec;
+
     struct dirent **entries;
 
     int rc;
@@ -1051,18 +926,19 @@ const std::list<std::string>& WallpaperPrefsHandler::scanForWallpapers(bool rebu
             }
 
             std::string p = path + entries[i]->d_name;
-            QImageReader reader(QString::fromStdString(p));
-            if(!reader.canRead())
+            std::string errorText;
+            ImageInfo info;
+            if (!codec || !codec->info(p, info, errorText))
                 continue;
 
-            if (reader.format() == "png") {
-                rc = WallpaperPrefsHandler::resizeImage(p, thumbpath+(entries[i]->d_name), THUMBS_WIDTH, THUMBS_HEIGHT, reader.format());
+            if (info.format == "png") {
+                rc = WallpaperPrefsHandler::resizeImage(p, thumbpath+(entries[i]->d_name), THUMBS_WIDTH, THUMBS_HEIGHT, info.format.c_str());
                 if (rc == 0) {
                     //success...
                     m_wallpapers.push_back(std::string(entries[i]->d_name));
                 }
             }
-            else if (reader.format() == "jpg") {
+            else if (info.format == "jpg") {
                 // why do we not create thumbs for jpgs?
                 qWarning() << "Can\'t create thumbnails for JPGs" << entries[i]->d_name;
             }